@@ -0,0 +1,355 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/BlockCompression.cpp
+///
+/// summary:    Implements the BC1 (DXT1) encoder and the mip chain builder
+//////////////////////////////////////////////////////////////////////////
+
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace Lis
+{
+namespace
+{
+typedef int BlockPixels[16][3];
+typedef int Palette[4][3];
+
+//////////////////////////////////////////////////////////////////////////
+uint16_t PackRgb565(const float color[3])
+{
+    const int r = std::min(std::max(static_cast<int>(color[0] * (31.0f / 255.0f) + 0.5f), 0), 31);
+    const int g = std::min(std::max(static_cast<int>(color[1] * (63.0f / 255.0f) + 0.5f), 0), 63);
+    const int b = std::min(std::max(static_cast<int>(color[2] * (31.0f / 255.0f) + 0.5f), 0), 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void UnpackRgb565(uint16_t packed, int color[3])
+{
+    const int r = packed >> 11;
+    const int g = (packed >> 5) & 63;
+    const int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// The four-color palette, valid when c0 > c1
+//////////////////////////////////////////////////////////////////////////
+void BuildPalette(uint16_t c0, uint16_t c1, Palette palette)
+{
+    UnpackRgb565(c0, palette[0]);
+    UnpackRgb565(c1, palette[1]);
+    for (int i = 0; i < 3; ++i)
+    {
+        palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+        palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// The nearest palette entry of every pixel; returns the squared error
+//////////////////////////////////////////////////////////////////////////
+int ChooseIndices(const BlockPixels pixels, const Palette palette, uint32_t& indices)
+{
+    int error = 0;
+    indices = 0;
+    for (int p = 0; p < 16; ++p)
+    {
+        int best = 0;
+        int bestError = 0x7fffffff;
+        for (int i = 0; i < 4; ++i)
+        {
+            const int dr = pixels[p][0] - palette[i][0];
+            const int dg = pixels[p][1] - palette[i][1];
+            const int db = pixels[p][2] - palette[i][2];
+            const int distance = dr * dr + dg * dg + db * db;
+            if (distance < bestError)
+            {
+                bestError = distance;
+                best = i;
+            }
+        }
+        indices |= static_cast<uint32_t>(best) << (2 * p);
+        error += bestError;
+    }
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+struct EncodedBlock
+{
+    uint16_t c0;
+    uint16_t c1;
+    uint32_t indices;
+    int error;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Quantize the end points and pick the indices
+//////////////////////////////////////////////////////////////////////////
+EncodedBlock EncodeEndPoints(const BlockPixels pixels, const float high[3], const float low[3])
+{
+    EncodedBlock block;
+    block.c0 = PackRgb565(high);
+    block.c1 = PackRgb565(low);
+    if (block.c0 < block.c1)
+        std::swap(block.c0, block.c1);
+
+    Palette palette;
+    if (block.c0 == block.c1)
+    {
+        // Three-color mode with every pixel at c0: a flat block
+        UnpackRgb565(block.c0, palette[0]);
+        for (int i = 1; i < 4; ++i)
+            std::copy(palette[0], palette[0] + 3, palette[i]);
+    }
+    else
+    {
+        BuildPalette(block.c0, block.c1, palette);
+    }
+    block.error = ChooseIndices(pixels, palette, block.indices);
+    if (block.c0 == block.c1)
+        block.indices = 0;
+    return block;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The end points minimizing the squared error for the given indices:
+///   pixel = alpha * high + (1 - alpha) * low, alpha in {1, 0, 2/3, 1/3}.
+///   Returns false for a degenerate system, e.g. every index the same.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+bool FitEndPoints(const BlockPixels pixels, uint32_t indices, float high[3], float low[3])
+{
+    static const float Weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+    float aa = 0, ab = 0, bb = 0;
+    float ax[3] = { 0, 0, 0 };
+    float bx[3] = { 0, 0, 0 };
+    for (int p = 0; p < 16; ++p)
+    {
+        const float alpha = Weights[(indices >> (2 * p)) & 3];
+        const float beta = 1.0f - alpha;
+        aa += alpha * alpha;
+        ab += alpha * beta;
+        bb += beta * beta;
+        for (int i = 0; i < 3; ++i)
+        {
+            ax[i] += alpha * pixels[p][i];
+            bx[i] += beta * pixels[p][i];
+        }
+    }
+
+    const float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        high[i] = (ax[i] * bb - bx[i] * ab) / determinant;
+        low[i] = (bx[i] * aa - ax[i] * ab) / determinant;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void StoreBlock(const EncodedBlock& encoded, uint8_t* block)
+{
+    // Little-endian: c0, c1, then two bits per pixel, row by row
+    block[0] = static_cast<uint8_t>(encoded.c0);
+    block[1] = static_cast<uint8_t>(encoded.c0 >> 8);
+    block[2] = static_cast<uint8_t>(encoded.c1);
+    block[3] = static_cast<uint8_t>(encoded.c1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        block[4 + i] = static_cast<uint8_t>(encoded.indices >> (8 * i));
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+size_t Bc1Size(uint32_t width, uint32_t height)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void CompressBc1Block(const uint8_t* rgba, size_t stride, uint8_t* block)
+{
+    BlockPixels pixels;
+    float mean[3] = { 0, 0, 0 };
+    for (int p = 0; p < 16; ++p)
+    {
+        const uint8_t* pixel = rgba + (p / 4) * stride + (p % 4) * 4;
+        for (int i = 0; i < 3; ++i)
+        {
+            pixels[p][i] = pixel[i];
+            mean[i] += pixel[i];
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+        mean[i] /= 16.0f;
+
+    // The covariance matrix: rr, rg, rb, gg, gb, bb
+    float covariance[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int p = 0; p < 16; ++p)
+    {
+        const float r = pixels[p][0] - mean[0];
+        const float g = pixels[p][1] - mean[1];
+        const float b = pixels[p][2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // The principal axis by power iteration, starting from the widest channel
+    float axis[3] = { covariance[0], covariance[3], covariance[5] };
+    for (int iteration = 0; iteration < 4; ++iteration)
+    {
+        const float x = axis[0] * covariance[0] + axis[1] * covariance[1] + axis[2] * covariance[2];
+        const float y = axis[0] * covariance[1] + axis[1] * covariance[3] + axis[2] * covariance[4];
+        const float z = axis[0] * covariance[2] + axis[1] * covariance[4] + axis[2] * covariance[5];
+        const float scale = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+        if (scale <= 0.0f)
+            break;
+        axis[0] = x / scale;
+        axis[1] = y / scale;
+        axis[2] = z / scale;
+    }
+    const float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+    float high[3], low[3];
+    if (length < 1e-6f)
+    {
+        // A flat block
+        std::copy(mean, mean + 3, high);
+        std::copy(mean, mean + 3, low);
+    }
+    else
+    {
+        float minimum = 0, maximum = 0;
+        for (int p = 0; p < 16; ++p)
+        {
+            const float t = ((pixels[p][0] - mean[0]) * axis[0] + (pixels[p][1] - mean[1]) * axis[1]
+                + (pixels[p][2] - mean[2]) * axis[2]) / length;
+            minimum = std::min(minimum, t);
+            maximum = std::max(maximum, t);
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            high[i] = mean[i] + axis[i] / length * maximum;
+            low[i] = mean[i] + axis[i] / length * minimum;
+        }
+    }
+
+    EncodedBlock best = EncodeEndPoints(pixels, high, low);
+    if (best.error > 0 && best.c0 != best.c1 && FitEndPoints(pixels, best.indices, high, low))
+    {
+        const EncodedBlock refined = EncodeEndPoints(pixels, high, low);
+        if (refined.error < best.error)
+            best = refined;
+    }
+    StoreBlock(best, block);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void CompressBc1(const uint8_t* rgba, uint32_t width, uint32_t height, size_t stride, uint8_t* output,
+    ThreadPool& pool)
+{
+    const uint32_t blocksX = (width + 3) / 4;
+    const uint32_t blocksY = (height + 3) / 4;
+
+    pool.ParallelFor(0, blocksY, 4, [=](size_t first, size_t last) {
+        uint8_t edge[4 * 4 * 4];
+        for (size_t by = first; by < last; ++by)
+        {
+            uint8_t* block = output + by * blocksX * 8;
+            for (uint32_t bx = 0; bx < blocksX; ++bx, block += 8)
+            {
+                const uint32_t x = bx * 4;
+                const uint32_t y = static_cast<uint32_t>(by) * 4;
+                if (x + 4 <= width && y + 4 <= height)
+                {
+                    CompressBc1Block(rgba + y * stride + x * 4, stride, block);
+                    continue;
+                }
+
+                // Clamp to the last row and column of the image
+                for (uint32_t row = 0; row < 4; ++row)
+                {
+                    const uint8_t* line = rgba + std::min(y + row, height - 1) * stride;
+                    for (uint32_t column = 0; column < 4; ++column)
+                        std::memcpy(edge + row * 16 + column * 4, line + std::min(x + column, width - 1) * 4, 4);
+                }
+                CompressBc1Block(edge, 16, block);
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+void DownsampleRgba(const uint8_t* rgba, uint32_t width, uint32_t height, size_t stride,
+    std::vector<uint8_t>& output, ThreadPool& pool)
+{
+    const uint32_t outWidth = std::max(width / 2, 1u);
+    const uint32_t outHeight = std::max(height / 2, 1u);
+    output.resize(static_cast<size_t>(outWidth) * outHeight * 4);
+    uint8_t* target = output.data();
+
+    pool.ParallelFor(0, outHeight, 16, [=](size_t first, size_t last) {
+        for (size_t y = first; y < last; ++y)
+        {
+            const uint8_t* top = rgba + std::min<size_t>(y * 2, height - 1) * stride;
+            const uint8_t* bottom = rgba + std::min<size_t>(y * 2 + 1, height - 1) * stride;
+            uint8_t* line = target + y * outWidth * 4;
+            for (uint32_t x = 0; x < outWidth; ++x)
+            {
+                const size_t left = std::min(x * 2, width - 1) * 4;
+                const size_t right = std::min(x * 2 + 1, width - 1) * 4;
+                for (int i = 0; i < 4; ++i)
+                {
+                    line[x * 4 + i] = static_cast<uint8_t>(
+                        (top[left + i] + top[right + i] + bottom[left + i] + bottom[right + i] + 2) >> 2);
+                }
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<CompressedLevel> BuildBc1MipChain(const uint8_t* rgba, uint32_t width, uint32_t height, size_t stride,
+    ThreadPool& pool)
+{
+    std::vector<CompressedLevel> levels;
+    std::vector<uint8_t> current, next;
+    const uint8_t* source = rgba;
+
+    for (;;)
+    {
+        CompressedLevel level;
+        level.width = width;
+        level.height = height;
+        level.data.resize(Bc1Size(width, height));
+        CompressBc1(source, width, height, stride, level.data.data(), pool);
+        levels.push_back(std::move(level));
+
+        if (width == 1 && height == 1)
+            return levels;
+
+        DownsampleRgba(source, width, height, stride, next, pool);
+        current.swap(next);
+        source = current.data();
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        stride = static_cast<size_t>(width) * 4;
+    }
+}
+} // namespace Lis
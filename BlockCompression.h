@@ -0,0 +1,72 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/BlockCompression.h
+///
+/// summary:    Declares the BC1 (DXT1) encoder and the mip chain builder
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// Bumped whenever the encoder output changes: it is part of the cache
+/// keys, so the textures baked by an older encoder are rebuilt
+//////////////////////////////////////////////////////////////////////////
+const uint32_t Bc1EncoderVersion = 1;
+
+//////////////////////////////////////////////////////////////////////////
+/// Bytes of a BC1 image: 8 bytes per 4x4 block, partial blocks included
+//////////////////////////////////////////////////////////////////////////
+size_t Bc1Size(uint32_t width, uint32_t height);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Encode one 4x4 block of RGBA8 pixels, rows `stride` bytes apart.
+///   The end points follow the principal axis of the block colors and
+///   are refined once by least squares; alpha is ignored.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void CompressBc1Block(const uint8_t* rgba, size_t stride, uint8_t* block);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Encode an RGBA8 image into Bc1Size(width, height) bytes at
+///   `output`, block rows in parallel. The partial blocks at the right
+///   and bottom edges repeat the edge pixels.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void CompressBc1(const uint8_t* rgba, uint32_t width, uint32_t height, size_t stride, uint8_t* output,
+    ThreadPool& pool = ThreadPool::GetShared());
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Halve an RGBA8 image with a 2x2 box filter into a tightly packed
+///   max(width / 2, 1) x max(height / 2, 1) one; an odd last row or
+///   column is averaged with itself.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void DownsampleRgba(const uint8_t* rgba, uint32_t width, uint32_t height, size_t stride,
+    std::vector<uint8_t>& output, ThreadPool& pool = ThreadPool::GetShared());
+
+//////////////////////////////////////////////////////////////////////////
+struct CompressedLevel
+{
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The full BC1 mip chain of an RGBA8 image, down to 1x1
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+std::vector<CompressedLevel> BuildBc1MipChain(const uint8_t* rgba, uint32_t width, uint32_t height, size_t stride,
+    ThreadPool& pool = ThreadPool::GetShared());
+} // namespace Lis
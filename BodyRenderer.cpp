@@ -0,0 +1,179 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/BodyRenderer.cpp
+//
+// summary:	Implements the instanced drawing of the bodies of a planetary system
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "BodyRenderer.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QOpenGLTexture>
+#include <QtGui/QOpenGLVertexArrayObject>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+/// <summary>	The size of a layer: the bodies are small on the screen. </summary>
+const QSize LayerSize(1024, 512);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Recolor the imagery by its luminance, from the dark to the bright color. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QImage tint(const QImage& source, QColor dark, QColor bright)
+{
+    QImage image = source.copy();
+    for (int y = 0; y < image.height(); ++y)
+    {
+        uchar* texel = image.scanLine(y);
+        for (int x = 0; x < image.width(); ++x, texel += 4)
+        {
+            const float l = (0.299f * texel[0] + 0.587f * texel[1] + 0.114f * texel[2]) / 255.0f;
+            texel[0] = static_cast<uchar>(dark.red() + l * (bright.red() - dark.red()));
+            texel[1] = static_cast<uchar>(dark.green() + l * (bright.green() - dark.green()));
+            texel[2] = static_cast<uchar>(dark.blue() + l * (bright.blue() - dark.blue()));
+        }
+    }
+    return image;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The layers of the texture array, in the order of the Body::layer values. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<QImage> prepareLayers()
+{
+    LIS_TRACE_ZONE("BodyRenderer layers");
+    QImage earth(":/images/land_ocean_ice_2048.jpg");
+    if (earth.isNull())
+        throw std::runtime_error("failed to load the body imagery");
+
+    // The rows as uploadTexture() leaves them, top down
+    earth = earth.scaled(LayerSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+        .convertToFormat(QImage::Format_RGBA8888);
+    return { earth, tint(earth, QColor(60, 60, 64), QColor(220, 220, 215)),
+        tint(earth, QColor(90, 30, 10), QColor(240, 170, 110)), tint(earth, QColor(255, 150, 30), QColor(255, 250, 220)) };
+}
+} // namespace
+
+const int BodyRenderer::Layers;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+BodyRenderer::BodyRenderer()
+    : m_pendingLayers(ThreadPool::GetShared().Submit(&prepareLayers))
+    , m_instances(QOpenGLBuffer::VertexBuffer)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+BodyRenderer::~BodyRenderer()
+{
+    // The decoding may still hold the pool: let it finish rather than leave it behind
+    if (m_pendingLayers.valid())
+        m_pendingLayers.wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void BodyRenderer::initialize(const std::vector<ShaderFile>& shaders, QOpenGLBuffer& vertices, QOpenGLBuffer& indices)
+{
+    initializeOpenGLFunctions();
+
+    m_program = std::make_unique<QOpenGLShaderProgram>();
+    ProgramCache().build(*m_program, shaders);
+
+    // Rethrows the decoding errors
+    const std::vector<QImage> layers = m_pendingLayers.get();
+    m_layers = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2DArray);
+    m_layers->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    m_layers->setSize(LayerSize.width(), LayerSize.height());
+    m_layers->setLayers(Layers);
+    m_layers->setMipLevels(m_layers->maximumMipLevels());
+    m_layers->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+    if (!m_layers->isStorageAllocated())
+        throw std::runtime_error("failed to allocate the texture array of the bodies");
+    for (int layer = 0; layer < Layers; ++layer)
+        m_layers->setData(0, layer, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, layers[layer].constBits());
+    m_layers->generateMipMaps();
+    m_layers->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+    m_layers->setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::Repeat);
+    m_layers->setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::ClampToEdge);
+
+    // The layout of body-vertex.shader: the mesh at 0 and 1, the instances at 2 and 3
+    m_vao = std::make_unique<QOpenGLVertexArrayObject>();
+    m_vao->create();
+    m_vao->bind();
+
+    vertices.bind();
+    const GLsizei stride = static_cast<GLsizei>(sizeof(PackedVertex));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_SHORT, GL_TRUE, stride, reinterpret_cast<const void*>(offsetof(PackedVertex, normal)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(PackedVertex, texCoord)));
+
+    m_instances.create();
+    m_instances.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    m_instances.bind();
+    const GLsizei instanceStride = static_cast<GLsizei>(sizeof(BodyInstance));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, instanceStride, reinterpret_cast<const void*>(offsetof(BodyInstance, center)));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, instanceStride, reinterpret_cast<const void*>(offsetof(BodyInstance, cosSpin)));
+    glVertexAttribDivisor(3, 1);
+
+    indices.bind();
+    m_vao->release();
+    m_instances.release();
+    vertices.release();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool BodyRenderer::isInitialized() const
+{
+    return static_cast<bool>(m_vao);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void BodyRenderer::draw(const std::vector<BodyInstance>& bodies, const QMatrix4x4& viewProjection, const SphereMesh& mesh)
+{
+    m_drawCalls = 0;
+    if (bodies.empty() || mesh.IndexCount() == 0)
+        return;
+
+    // Orphan the storage the previous frames may still read, grow it geometrically
+    const int count = static_cast<int>(bodies.size());
+    m_instances.bind();
+    if (count > m_instanceCapacity)
+        m_instanceCapacity = std::max(count, m_instanceCapacity * 2);
+    m_instances.allocate(m_instanceCapacity * static_cast<int>(sizeof(BodyInstance)));
+    m_instances.write(0, bodies.data(), count * static_cast<int>(sizeof(BodyInstance)));
+    m_instances.release();
+
+    if (!m_program->bind())
+        throw std::runtime_error("failed to bind the body program to active GL context");
+    glActiveTexture(GL_TEXTURE0);
+    m_layers->bind();
+    m_program->setUniformValue("bodies", 0);
+    m_program->setUniformValue("viewProjection", viewProjection);
+
+    // Every layer is in the one array: a single draw for all the bodies
+    m_vao->bind();
+    glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(mesh.IndexCount()),
+        mesh.HasShortIndices() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, nullptr, count);
+    m_vao->release();
+    m_layers->release();
+    m_program->release();
+    m_drawCalls = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int BodyRenderer::drawCalls() const
+{
+    return m_drawCalls;
+}
+} // namespace Lis
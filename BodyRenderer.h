@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/BodyRenderer.h
+//
+// summary:	Declares the instanced drawing of the bodies of a planetary system
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "PlanetarySystem.h"
+#include "ProgramCache.h"
+#include "SphereMesh.h"
+
+#include <QtGui/QImage>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QOpenGLBuffer>
+#include <QtGui/QOpenGLExtraFunctions>
+
+#include <future>
+#include <memory>
+#include <vector>
+
+class QOpenGLShaderProgram;
+class QOpenGLTexture;
+class QOpenGLVertexArrayObject;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Draws any number of bodies sharing the sphere mesh with one instanced draw per
+/// 			texture array: the per-instance buffer holds the center, the radius, the spin
+/// 			and the layer of every visible body and is refilled each frame. The draw
+/// 			calls stay constant as the bodies grow in number; the cost is in the vertices
+/// 			of the bodies that pass the culling.
+///
+/// 			The layers are variants of the embedded imagery (an earth, a moon, a desert
+/// 			world and the star), decoded on the thread pool from the construction on.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class BodyRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    static const int Layers = 4;
+
+    BodyRenderer();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Must be destroyed with the context of initialize() current. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    ~BodyRenderer();
+
+    BodyRenderer(const BodyRenderer&) = delete;
+    BodyRenderer& operator=(const BodyRenderer&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Build the program and the texture array (waits for the layers) and
+    /// 			bind the mesh buffers, whatever mesh they hold later, to the vertex
+    /// 			array of the instances.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void initialize(const std::vector<ShaderFile>& shaders, QOpenGLBuffer& vertices, QOpenGLBuffer& indices);
+    bool isInitialized() const;
+
+    void draw(const std::vector<BodyInstance>& bodies, const QMatrix4x4& viewProjection, const SphereMesh& mesh);
+
+    /// <summary>	The draw calls of the last frame. </summary>
+    int drawCalls() const;
+
+private:
+    std::future<std::vector<QImage>> m_pendingLayers;
+    std::unique_ptr<QOpenGLShaderProgram> m_program;
+    std::unique_ptr<QOpenGLVertexArrayObject> m_vao;
+    std::unique_ptr<QOpenGLTexture> m_layers;
+    QOpenGLBuffer m_instances;
+    int m_instanceCapacity = 0;
+    int m_drawCalls = 0;
+};
+} // namespace Lis
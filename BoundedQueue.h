@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/BoundedQueue.h
+///
+/// summary:    Declares the bounded lock-free multi-producer queue
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Bounded multi-producer multi-consumer queue (D. Vyukov's algorithm).
+///   Every cell carries a sequence number telling whether it is ready for
+///   the next producer or the next consumer, so both sides need a single
+///   CAS on their own counter and never take a lock.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+template<class T>
+class BoundedQueue
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <param name="capacity"> The number of cells, must be a power of two </param>
+    //////////////////////////////////////////////////////////////////////////
+    explicit BoundedQueue(size_t capacity)
+        : m_cells(new Cell[capacity])
+        , m_mask(capacity - 1)
+        , m_enqueuePos(0)
+        , m_dequeuePos(0)
+    {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+            throw std::invalid_argument("queue capacity must be a power of two");
+
+        for (size_t i = 0; i < capacity; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Put the value into the queue. Returns false if the queue is full,
+    ///   the value is left untouched in that case.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    bool TryPush(T&& value)
+    {
+        Cell* cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Take the oldest value from the queue. Returns false if it is empty.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    bool TryPop(T& value)
+    {
+        Cell* cell;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->data);
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Approximate check, exact only when no other thread is working
+    //////////////////////////////////////////////////////////////////////////
+    bool Empty() const
+    {
+        return m_enqueuePos.load(std::memory_order_acquire) == m_dequeuePos.load(std::memory_order_acquire);
+    }
+
+    size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // Keep the producer and the consumer counters on separate cache lines.
+    // Padding is used instead of alignas: C++14 has no over-aligned new.
+    static const size_t CacheLineSize = 64;
+
+    std::unique_ptr<Cell[]> m_cells;
+    const size_t m_mask;
+    char m_padding0[CacheLineSize];
+    std::atomic<size_t> m_enqueuePos;
+    char m_padding1[CacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeuePos;
+};
+} // namespace Lis
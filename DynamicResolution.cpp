@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/DynamicResolution.cpp
+///
+/// summary:    Implements the control of the render resolution by the GPU
+///             time of the frames
+//////////////////////////////////////////////////////////////////////////
+
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+DynamicResolution::DynamicResolution(const DynamicResolutionParams& params)
+    : m_params(params)
+    , m_scale(params.maxScale)
+{
+    if (!(params.budgetMs > 0.0))
+        throw std::invalid_argument("the frame budget must be positive");
+    if (!(params.lowerBand > 0.0 && params.lowerBand < 1.0))
+        throw std::invalid_argument("the lower band must be within (0, 1) of the budget");
+    if (!(params.scaleStep > 0.0f && params.minScale > 0.0f && params.minScale <= params.maxScale))
+        throw std::invalid_argument("invalid resolution scales");
+    if (params.windowFrames == 0)
+        throw std::invalid_argument("a decision needs at least one frame");
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool DynamicResolution::AddFrame(double gpuMs)
+{
+    if (m_cooldown > 0)
+    {
+        --m_cooldown;
+        return false;
+    }
+
+    m_sum += gpuMs;
+    if (++m_frames < m_params.windowFrames)
+        return false;
+
+    m_averageMs = m_sum / m_frames;
+    m_sum = 0.0;
+    m_frames = 0;
+
+    // Within the band the scale stays
+    const double budget = m_params.budgetMs;
+    if (m_averageMs <= budget && m_averageMs >= budget * m_params.lowerBand)
+        return false;
+
+    // The scale of the pixels that would take the middle of the band
+    const double target = budget * (1.0 + m_params.lowerBand) * 0.5;
+    float scale = Quantize(static_cast<float>(m_scale * std::sqrt(target / std::max(m_averageMs, 1e-3))));
+    if (m_averageMs > budget)
+    {
+        scale = std::min(scale, m_scale - m_params.scaleStep);
+    }
+    else
+    {
+        // A cheap frame is no proof the next step fits: the costs that do not follow
+        // the pixels make the model optimistic, so it climbs slowly
+        scale = std::min(scale, m_scale + 2.0f * m_params.scaleStep);
+    }
+    scale = std::max(m_params.minScale, std::min(m_params.maxScale, scale));
+    if (std::fabs(scale - m_scale) < m_params.scaleStep * 0.5f)
+        return false;
+
+    m_scale = scale;
+    m_cooldown = m_params.cooldownFrames;
+    ++m_changes;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+float DynamicResolution::Quantize(float scale) const
+{
+    // Down to a step, with a margin for the rounding of the division
+    return std::floor(scale / m_params.scaleStep + 1e-3f) * m_params.scaleStep;
+}
+} // namespace Lis
@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/DynamicResolution.h
+///
+/// summary:    Declares the control of the render resolution by the GPU
+///             time of the frames
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+struct DynamicResolutionParams
+{
+    double budgetMs = 8.3;          ///< the GPU time of a frame to stay under
+    double lowerBand = 0.8;         ///< of the budget: the scale grows only below it
+    float minScale = 0.5f;          ///< of the output, each way
+    float maxScale = 1.0f;
+    float scaleStep = 0.05f;        ///< the scales are multiples of it
+    size_t windowFrames = 8;        ///< the frames averaged into a decision
+    size_t cooldownFrames = 8;      ///< ignored after a change, still at the old scale
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Picks the scale of the render resolution, each way, that keeps the
+///   GPU time of a frame within the budget. The cost is taken to follow
+///   the pixels, the square of the scale: a decision aims at the middle
+///   of the band between lowerBand and the budget. Within the band
+///   nothing changes, which is the hysteresis: the scale settles instead
+///   of going back and forth across the budget. The scale drops as far
+///   as needed at once, it grows by two steps at most.
+///
+///   The frames measured after a change were mostly rendered before it
+///   (the GPU times arrive frames late): they are skipped.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class DynamicResolution
+{
+public:
+    /// Throws std::invalid_argument if the params are inconsistent
+    explicit DynamicResolution(const DynamicResolutionParams& params = DynamicResolutionParams());
+
+    const DynamicResolutionParams& Params() const { return m_params; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Add the GPU time of a frame, ms, in the order of the frames.
+    /// </summary>
+    ///
+    /// <returns> true if the scale changed </returns>
+    //////////////////////////////////////////////////////////////////////////
+    bool AddFrame(double gpuMs);
+
+    /// The scale to render the next frame at; maxScale at first
+    float Scale() const { return m_scale; }
+
+    /// The times the scale changed
+    uint64_t Changes() const { return m_changes; }
+
+    /// The mean GPU time of the frames of the last decision, ms
+    double AverageMs() const { return m_averageMs; }
+
+private:
+    float Quantize(float scale) const;
+
+    DynamicResolutionParams m_params;
+    float m_scale;
+    double m_sum = 0.0;
+    size_t m_frames = 0;
+    size_t m_cooldown = 0;
+    double m_averageMs = 0.0;
+    uint64_t m_changes = 0;
+};
+} // namespace Lis
@@ -0,0 +1,356 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/FieldTexture.cpp
+//
+// summary:	Implements the texture of a field streamed to the GPU every frame
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "FieldTexture.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLTexture>
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace Lis
+{
+namespace
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct FormatInfo
+{
+    QOpenGLTexture::TextureFormat textureFormat;
+    QOpenGLTexture::PixelFormat pixelFormat;    ///< the values are the GL enums
+    QOpenGLTexture::PixelType pixelType;
+    int bytesPerTexel;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FormatInfo formatInfo(FieldFormat format)
+{
+    switch (format)
+    {
+    case FieldFormat::R8:
+        return FormatInfo{ QOpenGLTexture::R8_UNorm, QOpenGLTexture::Red, QOpenGLTexture::UInt8, 1 };
+    case FieldFormat::RGBA8:
+        return FormatInfo{ QOpenGLTexture::RGBA8_UNorm, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, 4 };
+    case FieldFormat::R16F:
+        return FormatInfo{ QOpenGLTexture::R16F, QOpenGLTexture::Red, QOpenGLTexture::Float16, 2 };
+    case FieldFormat::RG16F:
+        return FormatInfo{ QOpenGLTexture::RG16F, QOpenGLTexture::RG, QOpenGLTexture::Float16, 4 };
+    case FieldFormat::RGBA16F:
+        return FormatInfo{ QOpenGLTexture::RGBA16F, QOpenGLTexture::RGBA, QOpenGLTexture::Float16, 8 };
+    case FieldFormat::R32F:
+        return FormatInfo{ QOpenGLTexture::R32F, QOpenGLTexture::Red, QOpenGLTexture::Float32, 4 };
+    }
+    throw std::invalid_argument("unknown field texture format");
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FieldTexture::FieldTexture(const QSize& size, FieldFormat format, const FieldTextureSettings& settings)
+    : m_size(size)
+    , m_format(format)
+    , m_settings(settings)
+{
+    if (size.isEmpty() || settings.tileSize < 1 || settings.ringFrames < 2 || settings.maxTilesPerFrame < 0)
+        throw std::invalid_argument("invalid field texture settings");
+
+    m_tilesX = (size.width() + settings.tileSize - 1) / settings.tileSize;
+    m_tilesY = (size.height() + settings.tileSize - 1) / settings.tileSize;
+    const int tiles = m_tilesX * m_tilesY;
+    const int frameTiles = settings.maxTilesPerFrame > 0 ? std::min(settings.maxTilesPerFrame, tiles) : tiles;
+
+    // The edge tiles take a whole slot too: every slot has the same row pitch
+    m_tileBytes = static_cast<size_t>(settings.tileSize) * settings.tileSize * formatInfo(format).bytesPerTexel;
+    m_frameBytes = m_tileBytes * frameTiles;
+    m_dirty.assign(tiles, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FieldTexture::~FieldTexture()
+{
+    if (!m_ring)
+        return;
+
+    for (GLsync fence : m_fences)
+    {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    if (m_persistent)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_ring);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &m_ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FieldTexture::initialize()
+{
+    initializeOpenGLFunctions();
+    const FormatInfo format = formatInfo(m_format);
+
+    for (std::unique_ptr<QOpenGLTexture>& texture : m_textures)
+    {
+        texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+        texture->setFormat(format.textureFormat);
+        texture->setSize(m_size.width(), m_size.height());
+        texture->setMipLevels(1);
+        texture->allocateStorage(format.pixelFormat, format.pixelType);
+        if (!texture->isStorageAllocated())
+            throw std::runtime_error("failed to allocate a field texture");
+        texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+
+        // The fields wrap around the longitudes
+        texture->setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::Repeat);
+        texture->setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::ClampToEdge);
+    }
+
+    // Immutable storage can stay mapped while the GPU reads it
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    BufferStorage bufferStorage = nullptr;
+    if (context->isOpenGLES())
+    {
+        if (context->hasExtension(QByteArrayLiteral("GL_EXT_buffer_storage")))
+            bufferStorage = reinterpret_cast<BufferStorage>(context->getProcAddress("glBufferStorageEXT"));
+    }
+    else if (context->format().version() >= qMakePair(4, 4) || context->hasExtension(QByteArrayLiteral("GL_ARB_buffer_storage")))
+    {
+        bufferStorage = reinterpret_cast<BufferStorage>(context->getProcAddress("glBufferStorage"));
+    }
+
+    const GLsizeiptr ringBytes = static_cast<GLsizeiptr>(m_frameBytes * m_settings.ringFrames);
+    glGenBuffers(1, &m_ring);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_ring);
+    if (bufferStorage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, flags);
+        m_persistent = static_cast<uchar*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ringBytes, flags));
+        if (!m_persistent)
+        {
+            // The storage is immutable: start over with a plain buffer
+            Logger::GetInstance().Error() << "failed to map the field upload ring persistently";
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &m_ring);
+            glGenBuffers(1, &m_ring);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_ring);
+        }
+    }
+    if (!m_persistent)
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    m_fences.assign(m_settings.ringFrames, nullptr);
+    markAllDirty();
+
+    Logger::GetInstance().Info() << "field texture " << m_size.width() << "x" << m_size.height() << ", "
+        << m_tilesX * m_tilesY << " tiles of " << m_settings.tileSize << " px, " << m_settings.ringFrames
+        << " frames of " << m_frameBytes / 1024 << " KB in the " << (m_persistent ? "persistent" : "mapped")
+        << " upload ring";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FieldTexture::markDirty(const QRect& texels)
+{
+    const QRect area = texels & QRect(QPoint(0, 0), m_size);
+    if (area.isEmpty())
+        return;
+
+    const int tileSize = m_settings.tileSize;
+    for (int y = area.top() / tileSize; y <= area.bottom() / tileSize; ++y)
+        std::fill_n(m_dirty.begin() + y * m_tilesX + area.left() / tileSize, area.right() / tileSize - area.left() / tileSize + 1, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FieldTexture::markAllDirty()
+{
+    std::fill(m_dirty.begin(), m_dirty.end(), 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int FieldTexture::update(const TileWriter& writer)
+{
+    const int tiles = m_tilesX * m_tilesY;
+    const int ringFrames = m_settings.ringFrames;
+    const size_t slot = static_cast<size_t>(m_frame % ringFrames);
+
+    // The tiles of this frame; a full ring leaves the rest for later, the next
+    // frame starts after the last one taken so that no tile starves
+    std::vector<Upload> fresh;
+    std::vector<uint8_t> isFresh(tiles, 0);
+    const size_t capacity = m_frameBytes / m_tileBytes;
+    for (int i = 0; i < tiles && fresh.size() < capacity; ++i)
+    {
+        const int tile = (m_nextTile + i) % tiles;
+        if (!m_dirty[tile])
+            continue;
+        m_dirty[tile] = 0;
+        isFresh[tile] = 1;
+        fresh.push_back(Upload{ tile, slot * m_frameBytes + fresh.size() * m_tileBytes });
+    }
+    if (!fresh.empty())
+        m_nextTile = (fresh.back().tile + 1) % tiles;
+    if (fresh.empty() && m_previous.empty())
+        return 0;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_ring);
+    if (!fresh.empty())
+    {
+        // The part of the ring was last read ringFrames - 1 frames ago
+        waitForFrame(static_cast<int>(static_cast<int64_t>(m_frame) + 1 - ringFrames));
+
+        const size_t bytes = fresh.size() * m_tileBytes;
+        uchar* texels = m_persistent
+            ? m_persistent + slot * m_frameBytes
+            : static_cast<uchar*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, slot * m_frameBytes, bytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        if (!texels)
+            throw std::runtime_error("failed to map the field upload ring");
+
+        const int stride = m_settings.tileSize * formatInfo(m_format).bytesPerTexel;
+        try
+        {
+            ThreadPool::GetShared().ParallelFor(0, fresh.size(), 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i)
+                    writer(tileRect(fresh[i].tile), texels + i * m_tileBytes, stride);
+            });
+        }
+        catch (...)
+        {
+            if (!m_persistent)
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            throw;
+        }
+        if (!m_persistent)
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        m_uploadedBytes += bytes;
+    }
+
+    GLint rowLength = 0, alignment = 4;
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, m_settings.tileSize);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // The back copy misses the tiles of the previous frame; they are still in the ring
+    const int back = m_front ^ 1;
+    m_textures[back]->bind();
+    for (const Upload& upload : m_previous)
+    {
+        if (!isFresh[upload.tile])
+            copyTile(upload);
+    }
+    for (const Upload& upload : fresh)
+        copyTile(upload);
+    m_textures[back]->release();
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Covers this part of the ring and the previous one, read by the copies above
+    if (m_fences[slot])
+        glDeleteSync(m_fences[slot]);
+    m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    m_previous.swap(fresh);
+    m_front = back;
+    ++m_frame;
+    return static_cast<int>(m_previous.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FieldTexture::waitForFrame(int frame)
+{
+    if (frame < 0)
+        return;
+
+    GLsync& fence = m_fences[frame % m_settings.ringFrames];
+    if (!fence)
+        return;
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        ++m_stalls;
+        do
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while (result == GL_TIMEOUT_EXPIRED);
+    }
+    if (result == GL_WAIT_FAILED)
+        throw std::runtime_error("failed to wait for the field uploads");
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FieldTexture::copyTile(const Upload& upload)
+{
+    const FormatInfo format = formatInfo(m_format);
+    const QRect rect = tileRect(upload.tile);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(),
+        static_cast<GLenum>(format.pixelFormat), static_cast<GLenum>(format.pixelType),
+        reinterpret_cast<const void*>(upload.offset));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QRect FieldTexture::tileRect(int tile) const
+{
+    const int tileSize = m_settings.tileSize;
+    const int x = tile % m_tilesX * tileSize;
+    const int y = tile / m_tilesX * tileSize;
+    return QRect(x, y, std::min(tileSize, m_size.width() - x), std::min(tileSize, m_size.height() - y));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FieldTexture::bind(int unit)
+{
+    m_textures[m_front]->bind(unit);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QSize FieldTexture::size() const
+{
+    return m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool FieldTexture::isPersistent() const
+{
+    return m_persistent != nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 FieldTexture::gpuMemory() const
+{
+    const qint64 texture = qint64(m_size.width()) * m_size.height() * formatInfo(m_format).bytesPerTexel;
+    return 2 * texture + qint64(m_frameBytes) * m_settings.ringFrames;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 FieldTexture::uploadedBytes() const
+{
+    return m_uploadedBytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int FieldTexture::stalls() const
+{
+    return m_stalls;
+}
+} // namespace Lis
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/FieldTexture.h
+//
+// summary:	Declares the texture of a field streamed to the GPU every frame
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtGui/QOpenGLExtraFunctions>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class QOpenGLTexture;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+enum class FieldFormat
+{
+    R8,
+    RGBA8,
+    R16F,
+    RG16F,
+    RGBA16F,
+    R32F
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct FieldTextureSettings
+{
+    int tileSize = 128;         ///< texels per side of the unit of the dirty tracking
+    int ringFrames = 3;         ///< frames of uploads in flight, at least 2
+    int maxTilesPerFrame = 0;   ///< the capacity of a frame of the ring, 0 for the whole field
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	A field texture (temperature, cloud cover...) whose texels change every frame.
+/// 			The changed tiles are written straight into a ring of pixel unpack buffers,
+/// 			persistently mapped where GL 4.4 or ARB_buffer_storage allows, mapped
+/// 			unsynchronized per frame otherwise. A fence per frame tells when the GPU is
+/// 			done with a part of the ring, so the CPU never overwrites what is still
+/// 			being copied and never waits for the copies of the last frames.
+///
+/// 			The texture is doubled: the uploads of a frame go to the texture the
+/// 			previous frame did not draw with, so the driver never has to wait for
+/// 			that draw or rename the storage. The tiles of the previous frame are
+/// 			copied again from their part of the ring to bring the other copy up to date.
+///
+/// 			Per frame: markDirty() any number of times, then update() once, then bind().
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class FieldTexture : protected QOpenGLExtraFunctions
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Fills a tile at the texels, the rows stride bytes apart. Called on the
+    /// 			thread pool, for different tiles at once.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    typedef std::function<void(const QRect& tile, uchar* texels, int stride)> TileWriter;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	No OpenGL calls are made until initialize(). </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    FieldTexture(const QSize& size, FieldFormat format, const FieldTextureSettings& settings = FieldTextureSettings());
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Must be destroyed with the context of initialize() current. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    ~FieldTexture();
+
+    FieldTexture(const FieldTexture&) = delete;
+    FieldTexture& operator=(const FieldTexture&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Create the textures and the ring; the whole field is dirty. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void initialize();
+
+    void markDirty(const QRect& texels);
+    void markAllDirty();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Write the dirty tiles with the writer and upload them, as many as a
+    /// 			frame of the ring holds; the rest stays dirty for the next frames.
+    /// 			Waits only if the GPU is more than ringFrames - 1 frames behind.
+    /// </summary>
+    ///
+    /// <returns>	The number of tiles written. </returns>
+    ////////////////////////////////////////////////////////////////////////////////
+    int update(const TileWriter& writer);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Bind the copy updated last to the texture unit. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void bind(int unit);
+
+    QSize size() const;
+    bool isPersistent() const;
+    qint64 gpuMemory() const;
+
+    /// <summary>	Bytes written into the ring since the start. </summary>
+    qint64 uploadedBytes() const;
+
+    /// <summary>	The frames that had to wait for the GPU to release a part of the ring. </summary>
+    int stalls() const;
+
+private:
+    struct Upload
+    {
+        int tile;
+        size_t offset;          ///< in the ring buffer
+    };
+
+    typedef void (QOPENGLF_APIENTRYP BufferStorage)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+    QRect tileRect(int tile) const;
+    void waitForFrame(int frame);
+    void copyTile(const Upload& upload);
+
+    QSize m_size;
+    FieldFormat m_format;
+    FieldTextureSettings m_settings;
+    int m_tilesX;
+    int m_tilesY;
+    size_t m_tileBytes;
+    size_t m_frameBytes;
+
+    std::unique_ptr<QOpenGLTexture> m_textures[2];
+    int m_front = 0;
+
+    GLuint m_ring = 0;
+    uchar* m_persistent = nullptr;      ///< the whole ring, null if mapped per frame
+    std::vector<GLsync> m_fences;       ///< per frame of the ring
+    uint64_t m_frame = 0;
+
+    std::vector<uint8_t> m_dirty;       ///< per tile
+    int m_nextTile = 0;                 ///< where the search for the dirty tiles starts
+    std::vector<Upload> m_previous;     ///< the uploads of the previous frame
+
+    qint64 m_uploadedBytes = 0;
+    int m_stalls = 0;
+};
+} // namespace Lis
@@ -0,0 +1,244 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/FixedStepScheduler.h
+///
+/// summary:    Declares the fixed-timestep world update thread
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Logger.h"
+#include "Tracer.h"
+#include "TripleBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Updates the world at a fixed timestep on its own thread, decoupled
+///   from the display. Every completed tick is published through a
+///   TripleBuffer as the pair of the last two states, so the renderer
+///   picks up the newest pair without blocking and interpolates between
+///   them at any frame rate: 144 Hz frames of a 10 Hz world are smooth,
+///   10 Hz frames of a 144 Hz world skip the ticks they cannot show.
+///
+///   Tick k holds the world at k * step and is computed one step ahead
+///   of the wall clock, so the frame at any moment falls between the two
+///   states of the latest pair. If the steps take longer than the
+///   timestep, the world slows down instead of spiralling: the clock the
+///   frames are placed on drops the lost time.
+///
+///   The state is copied twice per tick; keep it to what the frames need.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+template<class State>
+class FixedStepScheduler
+{
+public:
+    typedef std::function<void(State& state, double step)> StepFunction;
+    typedef std::chrono::steady_clock Clock;
+
+    /// The last two states of the world
+    struct Frame
+    {
+        State previous;
+        State current;
+        uint64_t tick;      ///< of current; 0 before the first step
+        double time;        ///< of current, seconds of the world
+
+        //////////////////////////////////////////////////////////////////////////
+        /// The weight of current at the world time, 0 to 1
+        //////////////////////////////////////////////////////////////////////////
+        double Alpha(double worldTime, double step) const
+        {
+            return tick == 0 ? 1.0 : std::min(std::max((worldTime - time) / step + 1.0, 0.0), 1.0);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <param name="step"> The timestep, s </param>
+    /// <param name="initial"> The world at time 0 </param>
+    /// <param name="function"> Advances the state by the timestep, on the
+    ///   update thread </param>
+    //////////////////////////////////////////////////////////////////////////
+    FixedStepScheduler(double step, const State& initial, StepFunction function)
+        : m_step(step)
+        , m_function(std::move(function))
+        , m_state(initial)
+        , m_tick(0)
+        , m_frames(Frame{ initial, initial, 0, 0.0 })
+        , m_running(false)
+        , m_failed(false)
+        , m_epoch(0)
+        , m_lateTicks(0)
+    {
+        if (!(step > 0.0))
+            throw std::invalid_argument("the timestep must be positive");
+    }
+
+    ~FixedStepScheduler()
+    {
+        Stop();
+    }
+
+    FixedStepScheduler(const FixedStepScheduler&) = delete;
+    FixedStepScheduler& operator=(const FixedStepScheduler&) = delete;
+
+    /// Start the update thread; the world clock starts now
+    void Start()
+    {
+        if (m_thread.joinable())
+            throw std::logic_error("the scheduler is already running");
+
+        m_epoch.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        m_running = true;
+        m_thread = std::thread(&FixedStepScheduler::Run, this);
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_wakeUp.notify_one();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Step on the calling thread until the world reaches the time, for
+    ///   the reproducible frames of a headless run. Not to be mixed with
+    ///   Start().
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void AdvanceTo(double worldTime)
+    {
+        if (m_thread.joinable())
+            throw std::logic_error("the world is updated by its thread");
+
+        while (m_tick * m_step < worldTime)
+            StepAndPublish();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The newest pair of states; never waits. Rethrows the exception a
+    ///   step failed with, the thread stops on it. The reference is valid
+    ///   until the next call; reader side only.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    const Frame& Latest()
+    {
+        if (m_failed.load(std::memory_order_acquire))
+            std::rethrow_exception(m_error);
+
+        m_frames.Update();
+        return m_frames.ReadBuffer();
+    }
+
+    /// Whether a tick was published since the last Latest(); reader side
+    bool HasNewFrame() const { return m_frames.HasNew(); }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// The world time the frame shown now should be placed at, s, while
+    /// the thread is running
+    //////////////////////////////////////////////////////////////////////////
+    double WorldTime() const
+    {
+        const Clock::duration elapsed = Clock::now().time_since_epoch()
+            - Clock::duration(m_epoch.load(std::memory_order_relaxed));
+        return std::chrono::duration<double>(elapsed).count();
+    }
+
+    double Step() const { return m_step; }
+
+    /// The ticks that ran late enough to slow the world down
+    uint64_t LateTicks() const { return m_lateTicks.load(std::memory_order_relaxed); }
+
+private:
+    /// Too late by more than this many steps and the world slows down
+    static const int MaxLagSteps = 4;
+
+    void StepAndPublish()
+    {
+        LIS_TRACE_ZONE("FixedStepScheduler::Step");
+        Frame& frame = m_frames.WriteBuffer();
+        frame.previous = m_state;
+        m_function(m_state, m_step);
+        frame.current = m_state;
+        frame.tick = ++m_tick;
+        frame.time = m_tick * m_step;
+        m_frames.Publish();
+    }
+
+    void Run()
+    {
+        Tracer::GetInstance().SetThreadName("world");
+        const Clock::duration step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_step));
+        Clock::time_point due = Clock::now();
+        try
+        {
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wakeUp.wait_until(lock, due, [this] { return !m_running; });
+                    if (!m_running)
+                        return;
+                }
+
+                StepAndPublish();
+                due += step;
+
+                const Clock::time_point now = Clock::now();
+                if (now - due > MaxLagSteps * step)
+                {
+                    // Give up on the lost time: move the world clock with the schedule
+                    m_epoch.fetch_add((now - due).count(), std::memory_order_relaxed);
+                    m_lateTicks.fetch_add(1, std::memory_order_relaxed);
+                    LIS_LOG_DEBUG() << "world update late by " << std::chrono::duration<double, std::milli>(now - due).count()
+                        << " ms at tick " << m_tick;
+                    due = now;
+                }
+            }
+        }
+        catch (...)
+        {
+            Logger::GetInstance().Error() << "the world update stopped at tick " << m_tick;
+            m_error = std::current_exception();
+            m_failed.store(true, std::memory_order_release);
+        }
+    }
+
+    const double m_step;
+    const StepFunction m_function;
+
+    // The writer side: the update thread or AdvanceTo()
+    State m_state;
+    uint64_t m_tick;
+
+    TripleBuffer<Frame> m_frames;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    bool m_running;
+
+    std::exception_ptr m_error;
+    std::atomic<bool> m_failed;
+    std::atomic<Clock::rep> m_epoch;    ///< the start of the world clock, moved by the lost time
+    std::atomic<uint64_t> m_lateTicks;
+};
+} // namespace Lis
@@ -0,0 +1,351 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/FrameProfiler.cpp
+//
+// summary:	Implements the CPU and GPU timing of the frames and their passes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "FrameProfiler.h"
+#include "Logger.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLTimerQuery>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QSaveFile>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QJsonObject summaryToJson(const HistogramSummary& summary)
+{
+    QJsonObject json;
+    json["count"] = static_cast<double>(summary.count);
+    json["mean_ms"] = summary.mean;
+    json["min_ms"] = summary.min;
+    json["max_ms"] = summary.max;
+    json["p50_ms"] = summary.p50;
+    json["p90_ms"] = summary.p90;
+    json["p99_ms"] = summary.p99;
+
+    QJsonArray buckets;
+    for (uint32_t count : summary.buckets)
+        buckets.append(static_cast<double>(count));
+    json["histogram"] = buckets;
+    return json;
+}
+} // namespace
+
+const char* const FrameProfiler::FrameZone = "frame";
+const size_t FrameProfiler::FramesInFlight;
+const size_t FrameProfiler::NoRecord;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameProfiler::Zone::Zone(const char* name, size_t window)
+    : name(name)
+    , cpu(window)
+    , gpu(window)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameProfiler::FrameProfiler(size_t window)
+    : m_window(window)
+{
+    m_zones.emplace_back(FrameZone, window);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameProfiler::~FrameProfiler()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::setReport(double intervalSeconds, const QString& jsonPath)
+{
+    if (intervalSeconds < 0)
+        throw std::invalid_argument("the report interval must not be negative");
+
+    m_reportInterval = intervalSeconds;
+    m_reportPath = jsonPath;
+    m_lastReport = Clock::now();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::beginFrame()
+{
+    // The previous frame did not end if its render threw
+    endFrame();
+    if (!m_enabled)
+        return;
+
+    if (!m_initialized)
+    {
+        // QOpenGLTimerQuery needs GL 3.3 or ARB_timer_query; without them the frames are timed on the CPU only
+        QOpenGLContext* context = QOpenGLContext::currentContext();
+        m_gpuTimers = context && !context->isOpenGLES()
+            && (context->format().version() >= qMakePair(3, 3) || context->hasExtension("GL_ARB_timer_query"));
+        m_initialized = true;
+        Logger::GetInstance().Info() << "frame profiler: " << (m_gpuTimers ? "CPU and GPU timers" : "CPU timers only");
+    }
+
+    if (m_gpuTimers)
+    {
+        collect();
+        if (m_pending.size() >= FramesInFlight)
+        {
+            // Never wait: the GPU is too far behind for this frame to be worth its results
+            releaseFrame(m_pending.front());
+            m_pending.pop_front();
+            ++m_droppedFrames;
+        }
+        m_pending.emplace_back();
+    }
+    m_inFrame = true;
+    beginZone(FrameZone);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::endFrame()
+{
+    if (!m_inFrame)
+        return;
+
+    // A zone left open by an exception is closed with the frame
+    while (!m_open.empty())
+        endZone();
+    m_inFrame = false;
+
+    if (m_reportInterval > 0
+        && std::chrono::duration<double>(Clock::now() - m_lastReport).count() >= m_reportInterval)
+    {
+        report();
+        m_lastReport = Clock::now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::beginZone(const char* name, bool gpu)
+{
+    OpenZone zone{ findZone(name), Clock::now(), NoRecord };
+
+    // Outside a frame the zone has nowhere to keep its queries
+    if (gpu && m_gpuTimers && m_inFrame)
+    {
+        std::vector<Record>& records = m_pending.back();
+        Record record{ zone.zone, acquireQuery(), nullptr };
+        record.begin->recordTimestamp();
+        zone.record = records.size();
+        records.push_back(record);
+    }
+    m_open.push_back(zone);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::endZone()
+{
+    if (m_open.empty())
+        return;
+
+    const OpenZone zone = m_open.back();
+    m_open.pop_back();
+    m_zones[zone.zone].cpu.Add(std::chrono::duration<double, std::milli>(Clock::now() - zone.start).count());
+
+    if (zone.record != NoRecord)
+    {
+        Record& record = m_pending.back()[zone.record];
+        record.end = acquireQuery();
+        record.end->recordTimestamp();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<ZoneTimes> FrameProfiler::times() const
+{
+    std::vector<ZoneTimes> times;
+    for (const Zone& zone : m_zones)
+        times.push_back(ZoneTimes{ zone.name, zone.cpu.Summary(), zone.gpu.Summary() });
+    return times;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QJsonObject FrameProfiler::toJson() const
+{
+    QJsonArray limits;
+    for (size_t bucket = 0; bucket + 1 < HistogramSummary::BucketCount; ++bucket)
+        limits.append(HistogramSummary::BucketLimit(bucket));
+
+    QJsonArray zones;
+    for (const ZoneTimes& zone : times())
+    {
+        QJsonObject json;
+        json["name"] = QString::fromStdString(zone.name);
+        json["cpu"] = summaryToJson(zone.cpu);
+        if (zone.gpu.count > 0)
+            json["gpu"] = summaryToJson(zone.gpu);
+        zones.append(json);
+    }
+
+    QJsonObject json;
+    json["frames"] = static_cast<double>(m_zones.front().cpu.Total());
+    json["gpu_timers"] = m_gpuTimers;
+    json["dropped_frames"] = m_droppedFrames;
+    json["histogram_limits_ms"] = limits;
+    json["zones"] = zones;
+
+    QJsonObject counters;
+    for (const std::pair<const char*, double>& counter : m_counters)
+        counters[counter.first] = counter.second;
+    json["counters"] = counters;
+    return json;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::setGpuFrameListener(std::function<void(double)> listener)
+{
+    m_gpuFrameListener = std::move(listener);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::setCounter(const char* name, double value)
+{
+    for (std::pair<const char*, double>& counter : m_counters)
+    {
+        if (counter.first == name || std::strcmp(counter.first, name) == 0)
+        {
+            counter.second = value;
+            return;
+        }
+    }
+    m_counters.emplace_back(name, value);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool FrameProfiler::hasGpuTimers() const
+{
+    return m_gpuTimers;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int FrameProfiler::droppedFrames() const
+{
+    return m_droppedFrames;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::releaseQueries()
+{
+    m_open.clear();
+    m_inFrame = false;
+    m_pending.clear();
+    m_freeQueries.clear();
+    m_queries.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t FrameProfiler::findZone(const char* name)
+{
+    // A handful of zones: the pointers of the literals match first time in practice
+    for (size_t zone = 0; zone < m_zones.size(); ++zone)
+    {
+        if (m_zones[zone].name == name || std::strcmp(m_zones[zone].name, name) == 0)
+            return zone;
+    }
+    m_zones.emplace_back(name, m_window);
+    return m_zones.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QOpenGLTimerQuery* FrameProfiler::acquireQuery()
+{
+    if (m_freeQueries.empty())
+    {
+        std::unique_ptr<QOpenGLTimerQuery> query = std::make_unique<QOpenGLTimerQuery>();
+        if (!query->create())
+            throw std::runtime_error("failed to create a timer query");
+        m_freeQueries.push_back(query.get());
+        m_queries.push_back(std::move(query));
+    }
+
+    QOpenGLTimerQuery* query = m_freeQueries.back();
+    m_freeQueries.pop_back();
+    return query;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::releaseFrame(std::vector<Record>& records)
+{
+    // A query still pending is simply reused: the next timestamp replaces its result
+    for (const Record& record : records)
+    {
+        m_freeQueries.push_back(record.begin);
+        if (record.end)
+            m_freeQueries.push_back(record.end);
+    }
+    records.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::collect()
+{
+    while (!m_pending.empty())
+    {
+        std::vector<Record>& records = m_pending.front();
+
+        // The end of the frame zone is the last timestamp of the frame: once it is available, all are
+        if (!records.empty() && records.front().end && !records.front().end->isResultAvailable())
+            return;
+
+        for (const Record& record : records)
+        {
+            if (!record.end)
+                continue;
+            const GLuint64 begin = record.begin->waitForResult();
+            const GLuint64 end = record.end->waitForResult();
+            const double ms = end > begin ? (end - begin) / 1e6 : 0.0;
+            m_zones[record.zone].gpu.Add(ms);
+            if (record.zone == 0 && m_gpuFrameListener)
+                m_gpuFrameListener(ms);
+        }
+
+        releaseFrame(records);
+        m_pending.pop_front();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void FrameProfiler::report()
+{
+    if (!m_reportPath.isEmpty())
+    {
+        // Replaced atomically, so a viewer polling the file never reads half of it
+        QSaveFile file(m_reportPath);
+        const QByteArray json = QJsonDocument(toJson()).toJson();
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit())
+            Logger::GetInstance().Error() << "failed to write the profile to " << m_reportPath.toStdString();
+        return;
+    }
+
+    Logger& log = Logger::GetInstance();
+    for (const ZoneTimes& zone : times())
+    {
+        auto record = log.Info();
+        record << "profile " << zone.name << ": cpu p50 " << zone.cpu.p50 << " ms, p99 " << zone.cpu.p99
+            << " ms, max " << zone.cpu.max << " ms";
+        if (zone.gpu.count > 0)
+            record << "; gpu p50 " << zone.gpu.p50 << " ms, p99 " << zone.gpu.p99 << " ms, max " << zone.gpu.max << " ms";
+    }
+    for (const std::pair<const char*, double>& counter : m_counters)
+        log.Info() << "profile " << counter.first << ": " << counter.second;
+}
+} // namespace Lis
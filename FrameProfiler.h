@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/FrameProfiler.h
+//
+// summary:	Declares the CPU and GPU timing of the frames and their passes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "RollingHistogram.h"
+
+#include <QtCore/QJsonObject>
+#include <QtCore/QString>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class QOpenGLTimerQuery;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The recent timings of a zone, ms. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ZoneTimes
+{
+    std::string name;
+    HistogramSummary cpu;
+    HistogramSummary gpu;       ///< empty without the timer queries or for a CPU-only zone
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Measures every frame and the named zones (passes) within it, on the CPU with
+/// 			the steady clock and on the GPU with timestamp queries, and keeps the last
+/// 			samples of each in a rolling histogram.
+///
+/// 			The GPU timestamps are read several frames later, once the queries report
+/// 			their results available, so the profiler never waits for the GPU. The
+/// 			timestamps allow the zones to nest, which GL_TIME_ELAPSED queries do not.
+/// 			A frame whose results are still pending when FramesInFlight newer ones are
+/// 			recorded is dropped from the GPU statistics.
+///
+/// 			Disabled (the default), a zone costs a test of a flag. The profiler must
+/// 			be used and destroyed with the same context current.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class FrameProfiler
+{
+public:
+    /// <summary>	The name of the zone of the whole frame. </summary>
+    static const char* const FrameZone;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <param name="window">	The number of frames the statistics follow. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    explicit FrameProfiler(size_t window = 600);
+    ~FrameProfiler();
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return m_enabled; }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Report the statistics every interval: through the logger, or by
+    /// 			rewriting the JSON file if a path is given. 0 disables the reports.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setReport(double intervalSeconds, const QString& jsonPath = QString());
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Bracket a frame; the zones are recorded in between. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void beginFrame();
+    void endFrame();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Open a zone within the frame; zones nest and close in the reverse
+    /// 			order. The name must outlive the profiler, a string literal. Use
+    /// 			ProfileZone rather than these.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void beginZone(const char* name, bool gpu = true);
+    void endZone();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Called with the GPU time of every frame, ms, as its results arrive:
+    /// 			frames late, from beginFrame(). Not called without timer queries.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setGpuFrameListener(std::function<void(double)> listener);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Set a value that is not a time, e.g. the resolution scale; the last
+    /// 			value is reported with the zones. The name must outlive the
+    /// 			profiler, a string literal.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setCounter(const char* name, double value);
+
+    /// <summary>	The frame first, then the zones in the order they were first seen. </summary>
+    std::vector<ZoneTimes> times() const;
+    QJsonObject toJson() const;
+
+    /// <summary>	Whether the context has timer queries; set by the first enabled frame. </summary>
+    bool hasGpuTimers() const;
+
+    /// <summary>	The frames whose GPU results were not available in time. </summary>
+    int droppedFrames() const;
+
+    /// <summary>	Release the queries; the context of the frames must be current. </summary>
+    void releaseQueries();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /// <summary>	The frames recorded while the oldest results are awaited. </summary>
+    static const size_t FramesInFlight = 4;
+
+    struct Zone
+    {
+        Zone(const char* name, size_t window);
+
+        const char* name;
+        RollingHistogram cpu;
+        RollingHistogram gpu;
+    };
+
+    struct Record
+    {
+        size_t zone;
+        QOpenGLTimerQuery* begin;
+        QOpenGLTimerQuery* end;
+    };
+
+    struct OpenZone
+    {
+        size_t zone;
+        Clock::time_point start;
+        size_t record;          ///< in the current frame, or NoRecord for a CPU-only zone
+    };
+
+    static const size_t NoRecord = static_cast<size_t>(-1);
+
+    size_t findZone(const char* name);
+    QOpenGLTimerQuery* acquireQuery();
+    void releaseFrame(std::vector<Record>& records);
+    void collect();
+    void report();
+
+    bool m_enabled = false;
+    bool m_inFrame = false;
+    bool m_initialized = false;
+    bool m_gpuTimers = false;
+    size_t m_window;
+
+    std::vector<Zone> m_zones;
+    std::vector<OpenZone> m_open;
+
+    std::vector<std::unique_ptr<QOpenGLTimerQuery>> m_queries;  ///< all of them, owned
+    std::vector<QOpenGLTimerQuery*> m_freeQueries;
+    std::deque<std::vector<Record>> m_pending;                  ///< the frames awaiting results, oldest first
+    int m_droppedFrames = 0;
+    std::function<void(double)> m_gpuFrameListener;
+    std::vector<std::pair<const char*, double>> m_counters;
+
+    double m_reportInterval = 0;
+    QString m_reportPath;
+    Clock::time_point m_lastReport;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Times the enclosing scope as a zone of the current frame. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ProfileZone
+{
+public:
+    ProfileZone(FrameProfiler& profiler, const char* name, bool gpu = true)
+        : m_profiler(profiler.isEnabled() ? &profiler : nullptr)
+    {
+        if (m_profiler)
+            m_profiler->beginZone(name, gpu);
+    }
+
+    ~ProfileZone()
+    {
+        if (m_profiler)
+            m_profiler->endZone();
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    FrameProfiler* m_profiler;
+};
+} // namespace Lis
@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/FrameScheduler.cpp
+///
+/// summary:    Implements the decision of when a window renders a frame
+//////////////////////////////////////////////////////////////////////////
+
+#include "FrameScheduler.h"
+
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+FrameScheduler::Clock::duration Period(double hertz)
+{
+    return std::chrono::duration_cast<FrameScheduler::Clock::duration>(std::chrono::duration<double>(1.0 / hertz));
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+const char* FrameChangeName(int index)
+{
+    static const char* const Names[FRAME_CHANGE_COUNT] = { "input", "surface", "simulation", "streaming", "settling" };
+    return index >= 0 && index < FRAME_CHANGE_COUNT ? Names[index] : "unknown";
+}
+
+//////////////////////////////////////////////////////////////////////////
+FrameScheduler::FrameScheduler(const FrameSchedulerParams& params)
+    : m_refreshPeriod(Period(60.0))
+    , m_changes(0)
+{
+    SetParams(params);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void FrameScheduler::SetParams(const FrameSchedulerParams& params)
+{
+    if (!(params.maxFps >= 0.0) || !(params.inactiveFps >= 0.0))
+        throw std::invalid_argument("the frame rate caps must not be negative");
+    m_params = params;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void FrameScheduler::SetRefreshRate(double hertz)
+{
+    if (hertz > 0.0)
+        m_refreshPeriod = Period(hertz);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void FrameScheduler::SetActive(bool active)
+{
+    m_active = active;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void FrameScheduler::Invalidate(uint32_t changes)
+{
+    m_changes.fetch_or(changes, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool FrameScheduler::Due(Clock::time_point now, Clock::time_point& next)
+{
+    if (!m_started)
+    {
+        m_started = true;
+        m_start = now;
+        m_nextFrame = now;
+    }
+
+    if (m_params.onDemand && m_changes.load(std::memory_order_acquire) == 0)
+    {
+        // Nothing to show: look again at the next refresh
+        next = now + m_refreshPeriod;
+        return false;
+    }
+
+    // The swap waits for the vertical sync, so the frames start up to a refresh late:
+    // half a refresh early is on time, or a 30 Hz cap on 60 Hz would give 20 frames
+    if (now + m_refreshPeriod / 2 < m_nextFrame)
+    {
+        next = m_nextFrame;
+        return false;
+    }
+
+    // The cap follows its own schedule, restarted after an idle time
+    const Clock::duration interval = Interval();
+    if (m_nextFrame + interval < now)
+        m_nextFrame = now;
+    m_nextFrame += interval;
+
+    m_frameChanges = m_changes.exchange(0, std::memory_order_acq_rel);
+    ++m_stats.rendered;
+    for (int change = 0; change < FRAME_CHANGE_COUNT; ++change)
+    {
+        if (m_frameChanges & (1u << change))
+            ++m_stats.byChange[change];
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+FrameSchedulerStats FrameScheduler::Stats(Clock::time_point now) const
+{
+    FrameSchedulerStats stats = m_stats;
+    if (!m_started)
+        return stats;
+
+    stats.seconds = std::chrono::duration<double>(now - m_start).count();
+    const uint64_t refreshes = static_cast<uint64_t>((now - m_start) / m_refreshPeriod);
+    stats.skipped = refreshes > stats.rendered ? refreshes - stats.rendered : 0;
+    return stats;
+}
+
+//////////////////////////////////////////////////////////////////////////
+FrameScheduler::Clock::duration FrameScheduler::Interval() const
+{
+    const double fps = !m_active && m_params.inactiveFps > 0.0 ? m_params.inactiveFps : m_params.maxFps;
+    return fps > 0.0 ? Period(fps) : Clock::duration::zero();
+}
+} // namespace Lis
@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/FrameScheduler.h
+///
+/// summary:    Declares the decision of when a window renders a frame
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   What makes the next frame differ from the one on the screen
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+enum FrameChange
+{
+    FRAME_INPUT = 1 << 0,       ///< keys, the wheel, an explicit update
+    FRAME_SURFACE = 1 << 1,     ///< exposed, resized, the resolution scale
+    FRAME_SIMULATION = 1 << 2,  ///< a new state of the world published
+    FRAME_STREAMING = 1 << 3,   ///< tiles, patches or a mesh arrived
+    FRAME_SETTLING = 1 << 4,    ///< the frames a change takes to converge
+    FRAME_CHANGE_COUNT = 5
+};
+
+/// "input", "surface", "simulation", "streaming" or "settling"
+const char* FrameChangeName(int index);
+
+//////////////////////////////////////////////////////////////////////////
+struct FrameSchedulerParams
+{
+    bool onDemand = true;       ///< false: a frame every refresh, changed or not
+    double maxFps = 0.0;        ///< the cap of the frame rate, 0 for none
+    double inactiveFps = 0.0;   ///< the cap while the window is not active, 0 for maxFps
+};
+
+//////////////////////////////////////////////////////////////////////////
+struct FrameSchedulerStats
+{
+    uint64_t rendered = 0;
+    uint64_t skipped = 0;       ///< the refreshes that showed no new frame
+    uint64_t byChange[FRAME_CHANGE_COUNT] = {};     ///< the frames rendered for each change
+    double seconds = 0.0;       ///< since the first frame
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Renders only when something changed. Anything that changes the
+///   picture Invalidate()s, from any thread; the render thread asks Due()
+///   before a frame and waits otherwise, so a still window costs neither
+///   CPU nor GPU. The frames are capped by maxFps, by inactiveFps when
+///   the window is not active; a window that is not exposed (minimized,
+///   occluded) asks nothing and renders nothing.
+///
+///   Every refresh of the display that shows no new frame is a skipped
+///   one: rendered against skipped is the saving over a window redrawn
+///   at the refresh rate.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class FrameScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// Throws std::invalid_argument if a cap is negative
+    explicit FrameScheduler(const FrameSchedulerParams& params = FrameSchedulerParams());
+
+    /// Before the first Due()
+    void SetParams(const FrameSchedulerParams& params);
+    const FrameSchedulerParams& Params() const { return m_params; }
+
+    /// The refreshes the skipped frames are counted in, Hz
+    void SetRefreshRate(double hertz);
+
+    /// Whether the window has the focus, for inactiveFps
+    void SetActive(bool active);
+
+    /// Add the changes, FrameChange bits; any thread
+    void Invalidate(uint32_t changes);
+
+    /// Whether anything changed since the last frame
+    bool HasChanges() const { return m_changes.load(std::memory_order_acquire) != 0; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Whether to render a frame now: something changed, or the
+    ///   scheduling is continuous, and the cap allows it. If so the
+    ///   frame is counted and takes the changes, for FrameChanges().
+    ///   Otherwise next is when to ask again at the latest: the end of
+    ///   the cap if something changed, the next refresh if not.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    bool Due(Clock::time_point now, Clock::time_point& next);
+
+    /// The changes the last frame Due() allowed is rendered for
+    uint32_t FrameChanges() const { return m_frameChanges; }
+
+    FrameSchedulerStats Stats(Clock::time_point now) const;
+
+private:
+    Clock::duration Interval() const;
+
+    FrameSchedulerParams m_params;
+    Clock::duration m_refreshPeriod;
+    bool m_active = true;
+    std::atomic<uint32_t> m_changes;
+
+    uint32_t m_frameChanges = 0;
+    bool m_started = false;
+    Clock::time_point m_start;
+    Clock::time_point m_nextFrame;      ///< the earliest the cap allows
+    FrameSchedulerStats m_stats;
+};
+} // namespace Lis
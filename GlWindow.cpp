@@ -6,10 +6,27 @@
 
 #include "GlWindow.h"
 #include "Logger.h"
+#include "Tracer.h"
 
 #include <QtGui/QPainter>
+#include <QtGui/QScreen>
 #include <QtGui/QOpenGLContext>
+#include <QtGui/QOffscreenSurface>
+#include <QtGui/QOpenGLFramebufferObject>
+#include <QtGui/QKeyEvent>
+#include <QtGui/QPlatformSurfaceEvent>
+#include <QtGui/QResizeEvent>
+#include <QtGui/QMouseEvent>
+#include <QtGui/QWheelEvent>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <utility>
 
 namespace Lis
 {
@@ -17,12 +34,36 @@ namespace Lis
 GlWindow::GlWindow(QWindow* parent)
     : QWindow(parent)
     , m_animating(false)
-    , m_context(nullptr)
     , m_device(nullptr)
+    , m_threaded(false)
+    , m_stopped(false)
+    , m_threadRefreshRate(60.0)
+    , m_surfaceExposed(false)
+    , m_commands(1024)
+    , m_renderSleeping(false)
+    , m_headlessSamples(0)
 {
     setSurfaceType(QWindow::OpenGLSurface);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+GlWindow::~GlWindow()
+{
+    // Normally stopped by the derived window already, whose virtuals the thread calls
+    stopRendering();
+    if (!m_stopped && !isHeadless())
+        reportFrames();
+
+    // The framebuffer object and the timer queries must be released while the context is still alive
+    if (m_context)
+    {
+        m_context->makeCurrent(renderSurface());
+        m_profiler.releaseQueries();
+        m_fbo.reset();
+        m_context->doneCurrent();
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void GlWindow::render(QPainter* painter)
 {
@@ -37,6 +78,11 @@ void GlWindow::initialize()
     // with a valid current QOpenGLContext.
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::prepare()
+{
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void GlWindow::render()
 {
@@ -50,10 +96,38 @@ void GlWindow::render()
     render(&painter);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::keyPressed(int key, Qt::KeyboardModifiers modifiers)
+{
+    Q_UNUSED(key);
+    Q_UNUSED(modifiers);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::wheelTurned(const QPoint& angleDelta)
+{
+    Q_UNUSED(angleDelta);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::mouseClicked(const QPoint& position, Qt::MouseButton button)
+{
+    Q_UNUSED(position);
+    Q_UNUSED(button);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::checkChanges()
+{
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void GlWindow::renderLater()
 {
-    requestUpdate();
+    if (m_threaded)
+        post(RenderCommand());
+    else
+        requestUpdate();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -62,8 +136,27 @@ bool GlWindow::event(QEvent* event)
     switch (event->type())
     {
     case QEvent::UpdateRequest:
-        renderNow();
+        renderScheduled();
         return true;
+    case QEvent::WindowActivate:
+    case QEvent::WindowDeactivate:
+        if (m_threaded)
+        {
+            RenderCommand command;
+            command.type = RenderCommand::Activate;
+            command.flag = event->type() == QEvent::WindowActivate;
+            post(std::move(command));
+        }
+        else
+        {
+            m_scheduler.SetActive(event->type() == QEvent::WindowActivate);
+        }
+        return QWindow::event(event);
+    case QEvent::PlatformSurface:
+        // Closing the window destroys the surface the render thread may be swapping
+        if (static_cast<QPlatformSurfaceEvent*>(event)->surfaceEventType() == QPlatformSurfaceEvent::SurfaceAboutToBeDestroyed)
+            stopRendering();
+        return QWindow::event(event);
     default:
         return QWindow::event(event);
     }
@@ -74,31 +167,379 @@ void GlWindow::exposeEvent(QExposeEvent* event)
 {
     Q_UNUSED(event);
 
-    if (isExposed())
-        renderNow();
+    // The thread is started by the first exposure, once the window has a native surface, and
+    // again by the exposure of a new surface after the old one was destroyed
+    if (!m_threaded && (!m_context || m_stopped) && !isHeadless() && isExposed()
+        && QOpenGLContext::supportsThreadedOpenGL())
+    {
+        m_stopped = false;
+        startRendering();
+    }
+
+    if (m_threaded)
+    {
+        RenderCommand command;
+        command.type = RenderCommand::Expose;
+        command.flag = isExposed();
+        post(std::move(command));
+    }
+    else if (isExposed())
+    {
+        m_scheduler.Invalidate(FRAME_SURFACE);
+        renderScheduled();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::resizeEvent(QResizeEvent* event)
+{
+    if (m_threaded)
+    {
+        RenderCommand command;
+        command.type = RenderCommand::Resize;
+        command.size = event->size() * devicePixelRatio();
+        post(std::move(command));
+    }
+    else
+    {
+        m_scheduler.Invalidate(FRAME_SURFACE);
+    }
+    QWindow::resizeEvent(event);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::keyPressEvent(QKeyEvent* event)
+{
+    if (m_threaded)
+    {
+        RenderCommand command;
+        command.type = RenderCommand::KeyPress;
+        command.key = event->key();
+        command.modifiers = event->modifiers();
+        post(std::move(command));
+    }
+    else
+    {
+        keyPressed(event->key(), event->modifiers());
+        m_scheduler.Invalidate(FRAME_INPUT);
+        renderLater();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::wheelEvent(QWheelEvent* event)
+{
+    if (m_threaded)
+    {
+        RenderCommand command;
+        command.type = RenderCommand::Wheel;
+        command.delta = event->angleDelta();
+        post(std::move(command));
+    }
+    else
+    {
+        wheelTurned(event->angleDelta());
+        m_scheduler.Invalidate(FRAME_INPUT);
+        renderLater();
+    }
+    event->accept();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::mousePressEvent(QMouseEvent* event)
+{
+    const QPoint position = (QPointF(event->pos()) * devicePixelRatio()).toPoint();
+    if (m_threaded)
+    {
+        RenderCommand command;
+        command.type = RenderCommand::MousePress;
+        command.delta = position;
+        command.key = event->button();
+        post(std::move(command));
+    }
+    else
+    {
+        mouseClicked(position, event->button());
+        m_scheduler.Invalidate(FRAME_INPUT);
+        renderLater();
+    }
+    event->accept();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void GlWindow::renderNow()
 {
-    if (!isExposed())
+    if (m_stopped)
+        return;
+    if (m_threaded)
+    {
+        post(RenderCommand());
+        return;
+    }
+
+    // The bench measures every frame it asks for
+    if (isHeadless())
+    {
+        renderFrame();
+        return;
+    }
+    m_scheduler.Invalidate(FRAME_INPUT);
+    renderScheduled();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::renderScheduled()
+{
+    // Without a render thread: the frames are scheduled on the GUI thread, by update requests
+    if (m_stopped || m_threaded || isHeadless() || !isExposed())
+        return;
+
+    m_scheduler.SetRefreshRate(refreshRate());
+    if (m_animating)
+        checkChanges();
+    if (!m_animating && !m_scheduler.HasChanges())
+        return;
+
+    const FrameScheduler::Clock::time_point now = FrameScheduler::Clock::now();
+    FrameScheduler::Clock::time_point next = now;
+    if (m_scheduler.Due(now, next))
+    {
+        renderFrame();
+        if (!m_animating)
+            return;
+    }
+
+    // Animating, or a change the cap holds back, which no input may come to ask for again.
+    // The swap has waited for the vertical sync already: ask again right away unless capped.
+    if (next <= now)
+        renderLater();
+    else
+        QTimer::singleShot(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1,
+            this, SLOT(renderLater()));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::startRendering()
+{
+    m_threadRefreshRate = screen() ? screen()->refreshRate() : 60.0;
+    m_surfaceSize = size() * devicePixelRatio();
+    m_scheduler.SetRefreshRate(m_threadRefreshRate);
+    m_threaded = true;
+    if (!m_context)
+    {
+        m_renderThread = std::thread(&GlWindow::renderLoop, this);
+        return;
+    }
+
+    // A restart: the context a stop gave back can only be pushed to the render thread from this
+    // one, so the thread waits for it before it renders
+    std::promise<QThread*> started;
+    std::future<QThread*> renderThread = started.get_future();
+    std::promise<void> handedOver;
+    std::future<void> contextReady = handedOver.get_future();
+    m_renderThread = std::thread([this](std::promise<QThread*> threadStarted, std::future<void> contextMoved) {
+        threadStarted.set_value(QThread::currentThread());
+        contextMoved.wait();
+        renderLoop();
+    }, std::move(started), std::move(contextReady));
+    m_context->moveToThread(renderThread.get());
+    handedOver.set_value();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::stopRendering()
+{
+    if (!m_renderThread.joinable())
         return;
 
+    RenderCommand command;
+    command.type = RenderCommand::Stop;
+    post(std::move(command));
+    m_renderThread.join();
+
+    // The context is back on this thread, released; setCurrentContext() makes it current here
+    m_threaded = false;
+    m_stopped = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::post(RenderCommand command)
+{
+    // The queue only fills up if the render thread is stuck in a frame: wait for it
+    while (!m_commands.TryPush(std::move(command)))
+        std::this_thread::yield();
+
+    // The mutex only when the render thread is really asleep. The fence pairs with the one in
+    // renderLoop(): either the push is seen before the sleep or the sleep flag is seen here,
+    // which a release store and an acquire load do not order.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_renderSleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_wakeUp.notify_one();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool GlWindow::execute(const RenderCommand& command)
+{
+    switch (command.type)
+    {
+    case RenderCommand::Expose:
+        m_surfaceExposed = command.flag;
+        m_scheduler.Invalidate(FRAME_SURFACE);
+        break;
+    case RenderCommand::Resize:
+        m_surfaceSize = command.size;
+        m_scheduler.Invalidate(FRAME_SURFACE);
+        break;
+    case RenderCommand::Activate:
+        m_scheduler.SetActive(command.flag);
+        break;
+    case RenderCommand::Update:
+        m_scheduler.Invalidate(FRAME_INPUT);
+        break;
+    case RenderCommand::KeyPress:
+        keyPressed(command.key, command.modifiers);
+        m_scheduler.Invalidate(FRAME_INPUT);
+        break;
+    case RenderCommand::Wheel:
+        wheelTurned(command.delta);
+        m_scheduler.Invalidate(FRAME_INPUT);
+        break;
+    case RenderCommand::MousePress:
+        mouseClicked(command.delta, static_cast<Qt::MouseButton>(command.key));
+        m_scheduler.Invalidate(FRAME_INPUT);
+        break;
+    case RenderCommand::Stop:
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::renderLoop()
+{
+    Tracer::GetInstance().SetThreadName("render");
+
+    bool running = true;
+    bool failed = false;
+    while (running)
+    {
+        bool rendered = false;
+        bool hasWakeUp = false;
+        FrameScheduler::Clock::time_point wakeUp;
+        try
+        {
+            // Everything the GUI has sent applies to the next frame
+            RenderCommand command;
+            while (running && m_commands.TryPop(command))
+                running = execute(command);
+
+            // Hidden, nothing is rendered. The swap blocks for the vertical sync, which
+            // paces the frames due one after another.
+            if (running && !failed && m_surfaceExposed)
+            {
+                const bool animating = m_animating.load();
+                if (animating)
+                    checkChanges();
+                FrameScheduler::Clock::time_point next;
+                if (animating || m_scheduler.HasChanges())
+                {
+                    // Not due: animating or a change the cap holds back, wake up for it
+                    if (m_scheduler.Due(FrameScheduler::Clock::now(), next))
+                    {
+                        renderFrame();
+                        rendered = true;
+                    }
+                    else
+                    {
+                        hasWakeUp = true;
+                        wakeUp = next;
+                    }
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // Nothing catches on this thread: end the application as a failed frame on the GUI
+            // thread would, and render nothing more until stopped
+            Logger::GetInstance().Error() << "render thread: " << e.what();
+            QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+            failed = true;
+        }
+        if (!running || rendered)
+            continue;
+
+        // Nothing to draw: sleep until the GUI sends something or the next frame may be due.
+        // The fence pairs with the one in post(), so a command pushed after the check wakes
+        // the thread up.
+        std::unique_lock<std::mutex> lock(m_wakeLock);
+        m_renderSleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_commands.Empty())
+        {
+            if (hasWakeUp)
+                m_wakeUp.wait_until(lock, wakeUp);
+            else
+                m_wakeUp.wait(lock);
+        }
+        m_renderSleeping.store(false, std::memory_order_relaxed);
+    }
+    reportFrames();
+
+    // Give the context back released, for the GUI thread to destroy the GL objects with it
+    if (m_context)
+    {
+        m_context->doneCurrent();
+        m_context->moveToThread(thread());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::renderFrame()
+{
+    LIS_TRACE_ZONE("GlWindow::renderFrame");
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point startupStart;
+
     bool needsInitialize = false;
     if (!m_context)
     {
-        m_context = new QOpenGLContext(this);
+        startupStart = Clock::now();
+        prepare();
+        m_startupTimes.prepareMs = std::chrono::duration<double, std::milli>(Clock::now() - startupStart).count();
+
+        // Owned by the window rather than parented to it: the render thread creates it
+        m_context = std::make_unique<QOpenGLContext>();
         m_context->setFormat(requestedFormat());
-        m_context->create();
+        if (!m_context->create())
+            throw std::runtime_error("failed to create OpenGL context");
 
         needsInitialize = true;
     }
 
-    m_context->makeCurrent(this);
+    m_context->makeCurrent(renderSurface());
     if (needsInitialize)
     {
         initializeOpenGLFunctions();
+        if (isHeadless())
+        {
+            QOpenGLFramebufferObjectFormat fboFormat;
+            fboFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+            fboFormat.setSamples(m_headlessSamples);
+            m_fbo = std::make_unique<QOpenGLFramebufferObject>(m_headlessSize, fboFormat);
+            if (!m_fbo->isValid())
+                throw std::runtime_error("failed to create the offscreen framebuffer");
+            m_fbo->bind();
+        }
+        const Clock::time_point initializeStart = Clock::now();
+        m_startupTimes.contextMs = std::chrono::duration<double, std::milli>(initializeStart - startupStart).count()
+            - m_startupTimes.prepareMs;
+
         initialize();
+        m_startupTimes.initializeMs = std::chrono::duration<double, std::milli>(Clock::now() - initializeStart).count();
 
         const char* glVendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
         const char* glVersion = reinterpret_cast<const char*>(glGetString(GL_VERSION));
@@ -109,24 +550,171 @@ void GlWindow::renderNow()
         log.Info() << "GLGS version: " << glgsVersion;
     }
 
+    const Clock::time_point renderStart = Clock::now();
+    if (!isHeadless())
+        m_profiler.setCounter("skipped frames", static_cast<double>(m_scheduler.Stats(renderStart).skipped));
+    m_profiler.beginFrame();
+    if (isHeadless())
+    {
+        // There is no swap to throttle the frames, so wait for the GPU explicitly:
+        // otherwise the driver queues the work and the frame time means nothing
+        m_fbo->bind();
+        render();
+        {
+            ProfileZone zone(m_profiler, "finish", false);
+            glFinish();
+        }
+        m_profiler.endFrame();
+        if (needsInitialize)
+            finishStartup(startupStart, renderStart);
+        return;
+    }
+
     render();
+    m_profiler.endFrame();
 
-    m_context->swapBuffers(this);
-    if (m_animating)
-        renderLater();
+    {
+        // Blocks for the vertical sync: the time the frame waits rather than works, kept out of the frame
+        ProfileZone zone(m_profiler, "swap", false);
+        LIS_TRACE_ZONE("swapBuffers");
+        m_context->swapBuffers(this);
+    }
+    if (needsInitialize)
+        finishStartup(startupStart, renderStart);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::finishStartup(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point renderStart)
+{
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    m_startupTimes.firstFrameMs = std::chrono::duration<double, std::milli>(end - renderStart).count();
+    m_startupTimes.totalMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    Logger::GetInstance().Info() << "startup: prepare " << m_startupTimes.prepareMs << " ms, context "
+        << m_startupTimes.contextMs << " ms, initialize " << m_startupTimes.initializeMs << " ms, first frame "
+        << m_startupTimes.firstFrameMs << " ms, total " << m_startupTimes.totalMs << " ms";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::reportFrames()
+{
+    const FrameSchedulerStats stats = m_scheduler.Stats(FrameScheduler::Clock::now());
+    if (stats.rendered == 0)
+        return;
+
+    const uint64_t refreshes = stats.rendered + stats.skipped;
+    auto line = Logger::GetInstance().Info();
+    line << "frames: " << stats.rendered << " rendered, " << stats.skipped << " skipped of "
+        << refreshes << " refreshes in " << stats.seconds << " s (" << 100.0 * stats.skipped / refreshes << "% saved); for";
+    for (int change = 0; change < FRAME_CHANGE_COUNT; ++change)
+        line << " " << FrameChangeName(change) << " " << stats.byChange[change];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void GlWindow::setAnimating(bool animating)
 {
-    m_animating = animating;
-    if (m_animating)
+    m_animating.store(animating);
+    if (animating)
         renderLater();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void GlWindow::setCurrentContext()
 {
-    m_context->makeCurrent(this);
+    // The context does not exist if the window has never been rendered
+    if (m_context)
+        m_context->makeCurrent(renderSurface());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool GlWindow::isRenderThreaded() const
+{
+    return m_threaded;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void GlWindow::setHeadless(const QSize& size, int samples)
+{
+    if (m_context || m_threaded)
+        throw std::logic_error("headless mode must be set before the first frame is rendered");
+
+    m_headlessSize = size;
+    m_headlessSamples = samples;
+
+    m_offscreenSurface = std::make_unique<QOffscreenSurface>();
+    m_offscreenSurface->setFormat(requestedFormat());
+    m_offscreenSurface->create();
+    if (!m_offscreenSurface->isValid())
+        throw std::runtime_error("failed to create the offscreen surface");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool GlWindow::isHeadless() const
+{
+    return static_cast<bool>(m_offscreenSurface);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QSize GlWindow::framebufferSize() const
+{
+    if (isHeadless())
+        return m_headlessSize;
+    if (m_threaded)
+        return m_surfaceSize;
+    return size() * devicePixelRatio();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+GLuint GlWindow::outputFramebuffer() const
+{
+    if (m_fbo)
+        return m_fbo->handle();
+    return m_context ? m_context->defaultFramebufferObject() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+qreal GlWindow::refreshRate() const
+{
+    if (isHeadless())
+        return 60.0;
+    if (m_threaded)
+        return m_threadRefreshRate;
+    return screen() ? screen()->refreshRate() : 60.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QImage GlWindow::grabFramebuffer()
+{
+    if (!m_fbo)
+        return QImage();
+
+    m_context->makeCurrent(renderSurface());
+    return m_fbo->toImage();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const StartupTimes& GlWindow::startupTimes() const
+{
+    return m_startupTimes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameProfiler& GlWindow::profiler()
+{
+    return m_profiler;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameScheduler& GlWindow::frameScheduler()
+{
+    return m_scheduler;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QSurface* GlWindow::renderSurface()
+{
+    if (isHeadless())
+        return m_offscreenSurface.get();
+    return this;
 }
 }
@@ -6,32 +6,79 @@
 
 #pragma once
 
+#include "BoundedQueue.h"
+#include "FrameProfiler.h"
+#include "FrameScheduler.h"
+
 #include <QtGui/QWindow>
 #include <QtGui/QOpenGLFunctions>
 #include <QtGui/QOpenGLPaintDevice>
+#include <QtGui/QImage>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 class QPainter;
 class QOpenGLContext;
+class QOffscreenSurface;
+class QOpenGLFramebufferObject;
 
 namespace Lis
 {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Wall time of the startup stages, ms. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct StartupTimes
+{
+    double prepareMs = 0;       ///< prepare(): starting the work that needs no context
+    double contextMs = 0;       ///< the context and the offscreen framebuffer
+    double initializeMs = 0;    ///< initialize()
+    double firstFrameMs = 0;    ///< the first render(), presented
+    double totalMs = 0;         ///< from the first renderNow() to the first frame presented
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	A window drawn by OpenGL. On screen the context belongs to a render thread of
+/// 			its own, started by the first expose: it makes the context, calls prepare(),
+/// 			initialize() and render() and swaps the buffers, so neither a long frame nor
+/// 			the wait for the vertical sync holds the event loop. The GUI thread only
+/// 			queues what happens to the window - exposure, resize, input - for the render
+/// 			thread to take before its next frame. Without threaded OpenGL on the
+/// 			platform, and in headless mode, the frames are rendered on the GUI thread
+/// 			as before.
+///
+/// 			A derived window must call stopRendering() first in its destructor: the
+/// 			render thread calls its virtuals until then.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
 class GlWindow : public QWindow, protected QOpenGLFunctions
 {
     Q_OBJECT
 public:
     explicit GlWindow(QWindow* parent = 0);
-    virtual ~GlWindow() = default;
+    virtual ~GlWindow();
 
     virtual void render(QPainter* painter);
     virtual void render();
     virtual void initialize();
 
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Called once before the context is created: start the work that
+    /// 			needs no OpenGL (file reads, decoding) on worker threads, so it
+    /// 			overlaps the context creation and initialize().
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    virtual void prepare();
+
     ////////////////////////////////////////////////////////////////////////////////
     /// <summary>	Use setAnimating(true) for render() to be called
     /// 			at the vertical refresh rate, assuming vertical sync is enabled
-    /// 			in the underlying OpenGL drivers.
+    /// 			in the underlying OpenGL drivers, whenever checkChanges() finds
+    /// 			something changed.
     /// </summary>
     ///
     /// <remarks>	Andrey Sploshnov, 23.12.2017. </remarks>
@@ -40,19 +87,175 @@ public:
     ////////////////////////////////////////////////////////////////////////////////
     void setAnimating(bool animating);
 
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Make the context current on the calling thread. With a render thread
+    /// 			only valid after stopRendering(), which gives the context back.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
     void setCurrentContext();
 
+    /// <summary>	Whether the frames are rendered by a thread of their own. </summary>
+    bool isRenderThreaded() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Switch the window to the headless mode: the same initialize()/render()
+    /// 			path is driven into a framebuffer object on an offscreen surface,
+    /// 			so no display is required. Must be called before the first
+    /// 			renderNow(); the window should not be shown.
+    /// </summary>
+    ///
+    /// <param name="size">   	The size of the offscreen framebuffer in pixels. </param>
+    /// <param name="samples">	The number of MSAA samples of the framebuffer (0 - none). </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setHeadless(const QSize& size, int samples = 0);
+    bool isHeadless() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Get the size of the render target in pixels: the offscreen
+    /// 			framebuffer in headless mode, the scaled window size otherwise.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    QSize framebufferSize() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The framebuffer the frame is presented from: the offscreen one in
+    /// 			headless mode, the window's otherwise. Needs the context current.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    GLuint outputFramebuffer() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Get the refresh rate the animation is paced by. Headless mode uses
+    /// 			a fixed 60 Hz to keep the rendered frames reproducible. The render
+    /// 			thread reads the rate of the screen it started on.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    qreal refreshRate() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Read back the last rendered headless frame. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    QImage grabFramebuffer();
+
+    /// <summary>	The startup stages, zero until the first frame is presented. </summary>
+    const StartupTimes& startupTimes() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The timings of the frames, disabled by default. Every frame is a
+    /// 			zone of its own; render() adds the zones of its passes.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    FrameProfiler& profiler();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	When the frames are rendered. Its params are set before the window
+    /// 			is shown; Invalidate() from any thread.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    FrameScheduler& frameScheduler();
+
     public slots :
     void renderLater();
     void renderNow();
 
 protected:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The input of the window, called on the thread render() is called on:
+    /// 			the state they change belongs to the frames, not to the GUI. A click
+    /// 			is at a pixel of the framebuffer.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    virtual void keyPressed(int key, Qt::KeyboardModifiers modifiers);
+    virtual void wheelTurned(const QPoint& angleDelta);
+    virtual void mouseClicked(const QPoint& position, Qt::MouseButton button);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Called before every decision on a frame of an animating window, on
+    /// 			the thread of render(): invalidate the frame scheduler with what
+    /// 			changed since the last frame. The input and the window changes are
+    /// 			invalidated already.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    virtual void checkChanges();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Finish the frame in flight, stop the render thread and take the
+    /// 			context back to the GUI thread, released. Nothing is rendered after,
+    /// 			until the window is exposed again: also called before the native
+    /// 			surface is destroyed, e.g. on close or hide, and a new surface
+    /// 			restarts the thread. Does nothing without a render thread.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void stopRendering();
+
     bool event(QEvent* event) override;
     void exposeEvent(QExposeEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
+    void keyPressEvent(QKeyEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
 
 private:
-    bool m_animating;
-    QOpenGLContext* m_context;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	What the GUI thread tells the render thread. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    struct RenderCommand
+    {
+        enum Type
+        {
+            Expose,     ///< flag: whether the window is visible
+            Resize,     ///< size: of the framebuffer, pixels
+            Activate,   ///< flag: whether the window has the focus
+            Update,     ///< render a frame, e.g. to start animating
+            KeyPress,   ///< key, modifiers
+            Wheel,      ///< delta: the angle of the wheel, eighths of a degree
+            MousePress, ///< delta: the pixel of the framebuffer, key: the button
+            Stop
+        };
+
+        Type type = Update;
+        bool flag = false;
+        QSize size;
+        int key = 0;
+        Qt::KeyboardModifiers modifiers;
+        QPoint delta;
+    };
+
+    QSurface* renderSurface();
+    void renderScheduled();
+    void renderFrame();
+    void reportFrames();
+    void finishStartup(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point renderStart);
+
+    void startRendering();
+    void post(RenderCommand command);
+    bool execute(const RenderCommand& command);
+    void renderLoop();
+
+    std::atomic<bool> m_animating;
+    std::unique_ptr<QOpenGLContext> m_context;
     std::unique_ptr<QOpenGLPaintDevice> m_device;
+
+    // The render thread. m_threaded and m_stopped are set by the GUI thread
+    // only; the rest after the start belongs to the render thread.
+    bool m_threaded;
+    bool m_stopped;
+    qreal m_threadRefreshRate;
+    QSize m_surfaceSize;
+    bool m_surfaceExposed;
+    BoundedQueue<RenderCommand> m_commands;
+    std::atomic<bool> m_renderSleeping;
+    std::mutex m_wakeLock;
+    std::condition_variable m_wakeUp;
+    std::thread m_renderThread;
+
+    QSize m_headlessSize;
+    int m_headlessSamples;
+    std::unique_ptr<QOffscreenSurface> m_offscreenSurface;
+    std::unique_ptr<QOpenGLFramebufferObject> m_fbo;
+
+    StartupTimes m_startupTimes;
+    FrameProfiler m_profiler;
+    FrameScheduler m_scheduler;
 };
 } // namespace Lis
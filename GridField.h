@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/GridField.h
+///
+/// summary:    Declares the cache-aligned scalar field of a regular grid
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   One scalar per cell of a width x height grid, row by row. Every row
+///   starts on a cache line: the pitch is rounded up to 16 floats and
+///   the storage is over-allocated to align the first row, since C++14
+///   has no over-aligned new. Rows can be processed by different threads
+///   without false sharing and by aligned vector loads.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class GridField
+{
+public:
+    static const size_t Alignment = 64;
+    static const size_t FloatsPerLine = Alignment / sizeof(float);
+
+    GridField()
+        : m_width(0)
+        , m_height(0)
+        , m_pitch(0)
+        , m_offset(0)
+    {
+    }
+
+    GridField(uint32_t width, uint32_t height, float value = 0.0f)
+        : m_width(width)
+        , m_height(height)
+        , m_pitch((width + FloatsPerLine - 1) / FloatsPerLine * FloatsPerLine)
+        , m_storage(m_pitch * height + FloatsPerLine, value)
+    {
+        const size_t misalignment = reinterpret_cast<uintptr_t>(m_storage.data()) % Alignment;
+        m_offset = misalignment ? (Alignment - misalignment) / sizeof(float) : 0;
+    }
+
+    // A copy would lose the alignment; a move keeps the buffer
+    GridField(const GridField&) = delete;
+    GridField& operator=(const GridField&) = delete;
+    GridField(GridField&&) = default;
+    GridField& operator=(GridField&&) = default;
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+
+    /// Floats between the starts of two rows
+    size_t Pitch() const { return m_pitch; }
+
+    float* Row(uint32_t y) { return m_storage.data() + m_offset + y * m_pitch; }
+    const float* Row(uint32_t y) const { return m_storage.data() + m_offset + y * m_pitch; }
+
+    float& At(uint32_t x, uint32_t y) { return Row(y)[x]; }
+    float At(uint32_t x, uint32_t y) const { return Row(y)[x]; }
+
+    void Fill(float value) { std::fill(m_storage.begin(), m_storage.end(), value); }
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    size_t m_pitch;
+    std::vector<float> m_storage;
+    size_t m_offset;
+};
+} // namespace Lis
@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Hash.cpp
+///
+/// summary:    Implements the content hash used for the cache keys
+//////////////////////////////////////////////////////////////////////////
+
+#include "Hash.h"
+
+#include <cstring>
+
+namespace Lis
+{
+namespace
+{
+const uint64_t Multiplier = 0x9e3779b97f4a7c15ull;
+
+//////////////////////////////////////////////////////////////////////////
+/// The 64-bit finalizer of MurmurHash3: every input bit affects every
+/// output bit
+//////////////////////////////////////////////////////////////////////////
+uint64_t Mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = Mix(seed ^ (size * Multiplier));
+
+    // Four independent lanes keep the multipliers busy
+    uint64_t lanes[4] = { hash, hash ^ 1, hash ^ 2, hash ^ 3 };
+    while (size >= 32)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * Multiplier;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+        bytes += 32;
+        size -= 32;
+    }
+    for (int lane = 0; lane < 4; ++lane)
+        hash = Mix(hash ^ lanes[lane]) * Multiplier;
+
+    while (size >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        hash = Mix(hash ^ word);
+        bytes += 8;
+        size -= 8;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes, size);
+    return Mix(hash ^ tail ^ (static_cast<uint64_t>(size) << 59));
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::string HashToHex(uint64_t hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string text(16, '0');
+    for (int i = 15; i >= 0; --i, hash >>= 4)
+        text[i] = digits[hash & 15];
+    return text;
+}
+} // namespace Lis
@@ -0,0 +1,28 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Hash.h
+///
+/// summary:    Declares the content hash used for the cache keys
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   64-bit hash of a byte range: 8 bytes per multiply, several GB/s, so
+///   a cached asset can be keyed by its content at every start. Not a
+///   cryptographic hash.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+//////////////////////////////////////////////////////////////////////////
+/// The 16 lowercase hex digits, e.g. for a file name
+//////////////////////////////////////////////////////////////////////////
+std::string HashToHex(uint64_t hash);
+} // namespace Lis
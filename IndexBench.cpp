@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/IndexBench.cpp
+///
+/// summary:    Throughput of the queries of the sphere index
+//////////////////////////////////////////////////////////////////////////
+
+#include "SphereIndex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_index_bench [order,...] [points]
+///
+/// For every order, the cells of points uniform over the sphere are
+/// found one by one and in a batch on the shared pool, then their
+/// neighbours, then the caps about them are covered. The report is
+/// printed as JSON with the millions of queries per second.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const std::vector<std::string> orders = SplitList(argc > 1 ? argv[1] : "6,10,16,29");
+    const long points = argc > 2 ? std::atol(argv[2]) : 4000000;
+    if (orders.empty() || points <= 0)
+        throw std::invalid_argument("need at least one order and one point");
+
+    // Uniform over the sphere: uniform in the sine of the latitude
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<float> latitudes(points), longitudes(points);
+    for (long i = 0; i < points; ++i)
+    {
+        latitudes[i] = std::asin(uniform(random));
+        longitudes[i] = 3.14159265f * uniform(random);
+    }
+    std::vector<Lis::CellId> cells(points);
+
+    Lis::ThreadPool& pool = Lis::ThreadPool::GetShared();
+    std::cout << "{\n  \"threads\": " << pool.ThreadCount() << ",\n  \"points\": " << points << ",\n  \"results\": [\n";
+
+    for (size_t o = 0; o < orders.size(); ++o)
+    {
+        const Lis::SphereIndex index(static_cast<uint32_t>(std::stoul(orders[o])));
+
+        Clock::time_point start = Clock::now();
+        Lis::CellId checksum = 0;
+        for (long i = 0; i < points; ++i)
+            checksum += index.Cell(latitudes[i], longitudes[i]);
+        const double single = Seconds(start);
+
+        start = Clock::now();
+        index.Cells(latitudes.data(), longitudes.data(), points, cells.data(), pool);
+        const double batch = Seconds(start);
+
+        start = Clock::now();
+        Lis::CellId neighbours[8];
+        for (long i = 0; i < points; ++i)
+        {
+            index.Neighbours(cells[i], neighbours);
+            checksum += neighbours[i % 8];
+        }
+        const double neighbourSeconds = Seconds(start);
+
+        // Caps of ten cells across, about the first thousand points
+        const long caps = std::min(points, 1000L);
+        std::vector<Lis::CellRange> ranges;
+        uint64_t covered = 0;
+        start = Clock::now();
+        for (long i = 0; i < caps; ++i)
+        {
+            const float direction[3] = { std::cos(latitudes[i]) * std::cos(longitudes[i]), std::sin(latitudes[i]),
+                -std::cos(latitudes[i]) * std::sin(longitudes[i]) };
+            index.CoverCap(direction, 5.0 * std::sqrt(index.CellArea()), ranges);
+            covered += Lis::SphereIndex::CellCount(ranges);
+        }
+        const double capSeconds = Seconds(start);
+
+        std::cout << "    {\"order\": " << index.Order()
+            << ", \"cells\": " << index.CellCount()
+            << ", \"cell_km\": " << std::sqrt(index.CellArea()) * 6371.0
+            << ", \"mcells_per_sec\": " << points / single / 1e6
+            << ", \"batch_mcells_per_sec\": " << points / batch / 1e6
+            << ", \"mneighbours_per_sec\": " << points / neighbourSeconds / 1e6
+            << ", \"cap_us\": " << capSeconds / caps * 1e6
+            << ", \"cap_cells\": " << covered / caps
+            << ", \"checksum\": " << checksum % 1000
+            << "}" << (o + 1 == orders.size() ? "\n" : ",\n");
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
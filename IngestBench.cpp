@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/IngestBench.cpp
+///
+/// summary:    Throughput of the ingestion of observation files
+//////////////////////////////////////////////////////////////////////////
+
+#include "Observations.h"
+#include "ShallowWater.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+//////////////////////////////////////////////////////////////////////////
+std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Observations uniform over the sphere of a smooth field, the text
+///   file about bytes long and the binary file of the same ones.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void WriteFiles(const std::string& textPath, const std::string& binaryPath, size_t bytes)
+{
+    std::FILE* text = std::fopen(textPath.c_str(), "wb");
+    if (!text)
+        throw std::runtime_error("failed to create " + textPath);
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<Lis::Observation> observations;
+    std::fputs("latitude,longitude,temperature\n", text);
+    size_t written = 0;
+    char line[64];
+    while (written < bytes)
+    {
+        Lis::Observation observation;
+        observation.latitude = std::asin(uniform(random)) * 57.2957795f;
+        observation.longitude = 180.0f * uniform(random);
+        observation.value = 288.0f - 40.0f * std::sin(observation.latitude / 57.2957795f)
+            * std::sin(observation.latitude / 57.2957795f) + 0.5f * uniform(random);
+        const int length = std::snprintf(line, sizeof(line), "%.4f,%.4f,%.2f\n",
+            observation.latitude, observation.longitude, observation.value);
+        std::fwrite(line, 1, length, text);
+        written += length;
+        observations.push_back(observation);
+    }
+    if (std::fclose(text) != 0)
+        throw std::runtime_error("failed to write " + textPath);
+
+    Lis::WriteObservationFile(binaryPath, observations.data(), observations.size());
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_ingest_bench [grid] [megabytes] [method,...]
+///
+/// Writes a text file of about the megabytes of observations and the
+/// binary file of the same ones, then ingests both with every method
+/// onto the grid on the shared pool. The report is printed as JSON with
+/// the GB/s read, the observations per second, the cells reached and the
+/// memory of the accumulation grids. The files are removed at the end.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const Lis::ShallowWaterParams grid = Lis::ParseGridSpec(argc > 1 ? argv[1] : "720x360");
+    const long megabytes = argc > 2 ? std::atol(argv[2]) : 512;
+    const std::vector<std::string> methods = SplitList(argc > 3 ? argv[3] : "nearest,idw,bilinear");
+    if (megabytes <= 0 || methods.empty())
+        throw std::invalid_argument("need at least a megabyte and one method");
+
+    const std::string textPath = "lis_ingest_bench.csv";
+    const std::string binaryPath = "lis_ingest_bench.obs";
+    WriteFiles(textPath, binaryPath, static_cast<size_t>(megabytes) << 20);
+
+    Lis::ThreadPool& pool = Lis::ThreadPool::GetShared();
+    std::cout << "{\n  \"threads\": " << pool.ThreadCount() << ",\n  \"grid\": \"" << grid.longitudes << "x" << grid.latitudes
+        << "\",\n  \"results\": [\n";
+
+    Lis::GridField field(grid.longitudes, grid.latitudes);
+    for (size_t m = 0; m < methods.size(); ++m)
+    {
+        for (int binary = 0; binary < 2; ++binary)
+        {
+            Lis::ObservationParams params;
+            params.method = Lis::ParseRegridMethod(methods[m]);
+            Lis::ObservationGridder gridder(grid.longitudes, grid.latitudes, params);
+            const Lis::IngestStats stats = gridder.Ingest(binary ? binaryPath : textPath, pool);
+            const size_t filled = gridder.Resolve(field, pool);
+
+            std::cout << "    {\"method\": \"" << Lis::RegridMethodName(params.method)
+                << "\", \"format\": \"" << (binary ? "binary" : "text")
+                << "\", \"mb\": " << stats.bytes / 1048576.0
+                << ", \"gb_per_sec\": " << stats.bytes / stats.seconds / 1e9
+                << ", \"mobs_per_sec\": " << stats.observations / stats.seconds / 1e6
+                << ", \"observations\": " << stats.observations
+                << ", \"rejected\": " << stats.rejected
+                << ", \"chunks\": " << stats.chunks
+                << ", \"filled\": " << static_cast<double>(filled) / (static_cast<double>(grid.longitudes) * grid.latitudes)
+                << ", \"accumulator_mb\": " << gridder.AccumulatorBytes() / 1048576.0
+                << "}" << (m + 1 == methods.size() && binary ? "\n" : ",\n");
+        }
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    std::remove(textPath.c_str());
+    std::remove(binaryPath.c_str());
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,273 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/KtxFile.cpp
+///
+/// summary:    Implements the reader and the writer of KTX 1.1 textures
+//////////////////////////////////////////////////////////////////////////
+
+#include "KtxFile.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+namespace Lis
+{
+namespace
+{
+const uint8_t KtxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t KtxEndianness = 0x04030201;
+
+//////////////////////////////////////////////////////////////////////////
+/// The header after the identifier, in the byte order of the writer
+//////////////////////////////////////////////////////////////////////////
+struct KtxHeader
+{
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+static_assert(sizeof(KtxHeader) == 52, "the KTX header must stay 52 bytes");
+
+//////////////////////////////////////////////////////////////////////////
+/// Every block of the file is padded to 4 bytes
+//////////////////////////////////////////////////////////////////////////
+size_t Padding(size_t size)
+{
+    return (4 - size % 4) % 4;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Write(std::FILE* file, const void* data, size_t size)
+{
+    if (size && std::fwrite(data, size, 1, file) != 1)
+        throw std::runtime_error("failed to write the texture");
+}
+
+//////////////////////////////////////////////////////////////////////////
+void WriteUint32(std::FILE* file, uint32_t value)
+{
+    Write(file, &value, sizeof(value));
+}
+
+//////////////////////////////////////////////////////////////////////////
+void WritePadding(std::FILE* file, size_t size)
+{
+    static const uint8_t zeros[4] = { 0, 0, 0, 0 };
+    Write(file, zeros, Padding(size));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// A bounds-checked cursor over the mapping
+//////////////////////////////////////////////////////////////////////////
+class Cursor
+{
+public:
+    Cursor(const MappedFile& file)
+        : m_file(file)
+        , m_offset(0)
+    {
+    }
+
+    const uint8_t* Take(size_t size)
+    {
+        if (size > m_file.Size() - m_offset)
+            throw std::runtime_error(m_file.Path() + " is truncated");
+        const uint8_t* data = m_file.Data() + m_offset;
+        m_offset += size;
+        return data;
+    }
+
+    uint32_t TakeUint32()
+    {
+        uint32_t value;
+        std::memcpy(&value, Take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    void Skip(size_t size) { Take(size); }
+
+private:
+    const MappedFile& m_file;
+    size_t m_offset;
+};
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+void WriteKtx(const std::string& path, uint32_t internalFormat, uint32_t baseInternalFormat,
+    const std::vector<CompressedLevel>& levels, const std::map<std::string, std::string>& keyValues)
+{
+    if (levels.empty())
+        throw std::invalid_argument("a texture needs at least one level");
+
+    // Unique per process and thread
+    const uint64_t salt = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())
+        ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+    const std::string temporary = path + "." + HashToHex(HashBytes(&salt, sizeof(salt))) + ".tmp";
+
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("failed to create " + temporary);
+
+    try
+    {
+        std::vector<uint8_t> keyValueData;
+        for (const auto& keyValue : keyValues)
+        {
+            // The key and the value, both null-terminated
+            const uint32_t size = static_cast<uint32_t>(keyValue.first.size() + keyValue.second.size() + 2);
+            const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&size);
+            keyValueData.insert(keyValueData.end(), sizeBytes, sizeBytes + sizeof(size));
+            keyValueData.insert(keyValueData.end(), keyValue.first.begin(), keyValue.first.end());
+            keyValueData.push_back(0);
+            keyValueData.insert(keyValueData.end(), keyValue.second.begin(), keyValue.second.end());
+            keyValueData.push_back(0);
+            keyValueData.resize(keyValueData.size() + Padding(size), 0);
+        }
+
+        KtxHeader header;
+        header.endianness = KtxEndianness;
+        header.glType = 0;
+        header.glTypeSize = 1;
+        header.glFormat = 0;
+        header.glInternalFormat = internalFormat;
+        header.glBaseInternalFormat = baseInternalFormat;
+        header.pixelWidth = levels.front().width;
+        header.pixelHeight = levels.front().height;
+        header.pixelDepth = 0;
+        header.numberOfArrayElements = 0;
+        header.numberOfFaces = 1;
+        header.numberOfMipmapLevels = static_cast<uint32_t>(levels.size());
+        header.bytesOfKeyValueData = static_cast<uint32_t>(keyValueData.size());
+
+        Write(file, KtxIdentifier, sizeof(KtxIdentifier));
+        Write(file, &header, sizeof(header));
+        Write(file, keyValueData.data(), keyValueData.size());
+        for (const CompressedLevel& level : levels)
+        {
+            WriteUint32(file, static_cast<uint32_t>(level.data.size()));
+            Write(file, level.data.data(), level.data.size());
+            WritePadding(file, level.data.size());
+        }
+
+        const bool closed = std::fclose(file) == 0;
+        file = nullptr;
+        if (!closed)
+            throw std::runtime_error("failed to write " + temporary);
+
+        // Windows does not rename over an existing file
+        if (std::rename(temporary.c_str(), path.c_str()) != 0
+            && (std::remove(path.c_str()) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0))
+        {
+            throw std::runtime_error("failed to rename " + temporary + " to " + path);
+        }
+    }
+    catch (...)
+    {
+        if (file)
+            std::fclose(file);
+        std::remove(temporary.c_str());
+        throw;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+KtxTexture::KtxTexture(const std::string& path)
+    : m_file(path)
+{
+    Cursor cursor(m_file);
+    if (std::memcmp(cursor.Take(sizeof(KtxIdentifier)), KtxIdentifier, sizeof(KtxIdentifier)) != 0)
+        throw std::runtime_error(path + " is not a KTX 1.1 file");
+
+    KtxHeader header;
+    std::memcpy(&header, cursor.Take(sizeof(header)), sizeof(header));
+    if (header.endianness != KtxEndianness)
+        throw std::runtime_error(path + " has a foreign byte order");
+    if (header.glType != 0 || header.glFormat != 0)
+        throw std::runtime_error(path + " is not a compressed texture");
+    if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0
+        || header.numberOfArrayElements != 0 || header.numberOfFaces != 1)
+    {
+        throw std::runtime_error(path + " is not a 2D texture");
+    }
+
+    uint32_t maxLevels = 1;
+    while ((std::max(header.pixelWidth, header.pixelHeight) >> maxLevels) != 0)
+        ++maxLevels;
+    if (header.numberOfMipmapLevels == 0 || header.numberOfMipmapLevels > maxLevels)
+        throw std::runtime_error(path + " has an invalid number of levels");
+
+    m_internalFormat = header.glInternalFormat;
+    m_width = header.pixelWidth;
+    m_height = header.pixelHeight;
+
+    Cursor keyValues(m_file);
+    keyValues.Skip(sizeof(KtxIdentifier) + sizeof(header));
+    cursor.Skip(header.bytesOfKeyValueData);
+    for (size_t read = 0; read < header.bytesOfKeyValueData;)
+    {
+        const uint32_t size = keyValues.TakeUint32();
+        const char* data = reinterpret_cast<const char*>(keyValues.Take(size));
+        keyValues.Skip(Padding(size));
+        read += sizeof(size) + size + Padding(size);
+
+        const char* keyEnd = std::find(data, data + size, '\0');
+        const char* valueEnd = keyEnd == data + size ? keyEnd : std::find(keyEnd + 1, data + size, '\0');
+        m_keyValues[std::string(data, keyEnd)] = keyEnd == valueEnd ? std::string() : std::string(keyEnd + 1, valueEnd);
+    }
+
+    for (uint32_t level = 0; level < header.numberOfMipmapLevels; ++level)
+    {
+        const uint32_t size = cursor.TakeUint32();
+        const uint8_t* data = cursor.Take(size);
+        cursor.Skip(Padding(size));
+
+        // Catch a truncated or mislabeled file before the driver reads past a level
+        if (m_internalFormat == KTX_COMPRESSED_RGB_S3TC_DXT1
+            && size != Bc1Size(std::max(m_width >> level, 1u), std::max(m_height >> level, 1u)))
+        {
+            throw std::runtime_error(path + " has a level of unexpected size");
+        }
+        m_levels.push_back(Level{ data, size });
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+const uint8_t* KtxTexture::LevelData(uint32_t level, size_t& size) const
+{
+    const Level& entry = m_levels.at(level);
+    size = entry.size;
+    return entry.data;
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t KtxTexture::DataSize() const
+{
+    size_t total = 0;
+    for (const Level& level : m_levels)
+        total += level.size;
+    return total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::string KtxTexture::Value(const std::string& key) const
+{
+    const auto found = m_keyValues.find(key);
+    return found == m_keyValues.end() ? std::string() : found->second;
+}
+} // namespace Lis
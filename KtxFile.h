@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/KtxFile.h
+///
+/// summary:    Declares the reader and the writer of KTX 1.1 textures
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "BlockCompression.h"
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// The compressed formats written by the bakers
+//////////////////////////////////////////////////////////////////////////
+const uint32_t KTX_COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+const uint32_t KTX_RGB = 0x1907;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Write a compressed 2D texture, the levels largest first. The file
+///   is written next to `path` and renamed over it: a reader never sees
+///   a partial file, even if two processes bake the same texture.
+/// </summary>
+/// <exception cref="std::runtime_error"> The file cannot be written </exception>
+//////////////////////////////////////////////////////////////////////////
+void WriteKtx(const std::string& path, uint32_t internalFormat, uint32_t baseInternalFormat,
+    const std::vector<CompressedLevel>& levels, const std::map<std::string, std::string>& keyValues);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   A compressed 2D texture mapped from a KTX file: the levels point
+///   straight into the mapping and can be passed to the driver as is.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class KtxTexture
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <exception cref="std::runtime_error">
+    ///   The file cannot be mapped, is not a KTX 1.1 file, is truncated or
+    ///   holds anything but a little-endian compressed 2D texture
+    /// </exception>
+    //////////////////////////////////////////////////////////////////////////
+    explicit KtxTexture(const std::string& path);
+
+    uint32_t InternalFormat() const { return m_internalFormat; }
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+    uint32_t Levels() const { return static_cast<uint32_t>(m_levels.size()); }
+
+    const uint8_t* LevelData(uint32_t level, size_t& size) const;
+
+    /// The total size of the levels, i.e. the texture memory
+    size_t DataSize() const;
+
+    /// The value of the key, empty if there is none
+    std::string Value(const std::string& key) const;
+
+private:
+    struct Level
+    {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    MappedFile m_file;
+    uint32_t m_internalFormat;
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<Level> m_levels;
+    std::map<std::string, std::string> m_keyValues;
+};
+} // namespace Lis
@@ -6,25 +6,245 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 
 // Qt part
+#include <QtCore/QCommandLineParser>
 #include <QtGui/QGuiApplication>
+#include <QtGui/QKeyEvent>
 #include <QtGui/QSurfaceFormat>
 
 #include "PlanetWindow.h"
 #include "Logger.h"
+#include "Tracer.h"
+
+namespace
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	F12 writes the trace recorded so far, without waiting for the exit. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class TraceShortcut : public QObject
+{
+public:
+    explicit TraceShortcut(const std::string& path)
+        : m_path(path)
+    {
+    }
+
+    bool eventFilter(QObject* watched, QEvent* event) override
+    {
+        if (event->type() != QEvent::KeyPress || static_cast<QKeyEvent*>(event)->key() != Qt::Key_F12)
+            return QObject::eventFilter(watched, event);
+
+        try
+        {
+            Lis::Tracer::GetInstance().Write(m_path);
+        }
+        catch (const std::exception& e)
+        {
+            Lis::Logger::GetInstance().Error() << e.what();
+        }
+        return true;
+    }
+
+private:
+    std::string m_path;
+};
+} // namespace
 
 int main(int argc, char *argv[])
 try
 {
     QGuiApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Planetary weather phenomena emulator");
+    parser.addHelpOption();
+    const QCommandLineOption tilesOption("tiles", "Stream the planet imagery from a tile pack made by lis_tile_baker.", "pack");
+    parser.addOption(tilesOption);
+    const QCommandLineOption simRateOption("sim-rate", "World updates per second, independent of the frame rate.", "hertz", "30");
+    parser.addOption(simRateOption);
+    const QCommandLineOption weatherOption("weather", "Simulate the weather on a LONxLAT grid, e.g. 360x180; 'none' only shows the planet.", "grid", "none");
+    parser.addOption(weatherOption);
+    const QCommandLineOption spectralOption("spectral-filter", "Filter the height, humidity and temperature of the weather "
+        "to the spherical harmonics up to that degree, 0 for none.", "truncation", "0");
+    parser.addOption(spectralOption);
+    const QCommandLineOption particlesOption("particles", "Trace the wind of the weather with that many particles, "
+        "advected on the GPU; needs OpenGL 4.3.", "count", "0");
+    parser.addOption(particlesOption);
+    const QCommandLineOption observationsOption("observations", "Start the weather from the temperatures of a file: "
+        "latitude,longitude,kelvin lines or the binary format.", "file");
+    parser.addOption(observationsOption);
+    const QCommandLineOption regridOption("regrid", "Grid the observations by 'nearest', 'idw' or 'bilinear'.", "method", "idw");
+    parser.addOption(regridOption);
+    const QCommandLineOption recordOption("record", "Record the weather and the camera to a file, to replay or to restore.", "file");
+    parser.addOption(recordOption);
+    const QCommandLineOption recordCodecOption("record-codec", "Store the recorded fields 'raw' or 'rle' compressed.", "codec", "raw");
+    parser.addOption(recordCodecOption);
+    const QCommandLineOption recordEveryOption("record-every", "Record every nth step of the weather.", "steps", "1");
+    parser.addOption(recordEveryOption);
+    const QCommandLineOption replayOption("replay", "Replay a recording instead of simulating; Left, Right and Home seek.", "file");
+    parser.addOption(replayOption);
+    const QCommandLineOption restoreOption("restore", "Simulate on from the last frame of a recording.", "file");
+    parser.addOption(restoreOption);
+    const QCommandLineOption cellOrderOption("cell-order", "The order of the cells a left click picks, 0 to 29.", "order", "10");
+    parser.addOption(cellOrderOption);
+    const QCommandLineOption renderOption("render", "Draw the planet as a 'mesh', a ray traced 'impostor' or a level of detail 'terrain'; R switches.", "mode", "mesh");
+    parser.addOption(renderOption);
+    const QCommandLineOption planetsOption("planets", "Draw that many planets in a grid; + and - change it.", "count", "1");
+    parser.addOption(planetsOption);
+    const QCommandLineOption altitudeOption("altitude", "The eye above the ground in the terrain mode, planet radii; "
+        "the mouse wheel changes it.", "radii");
+    parser.addOption(altitudeOption);
+    const QCommandLineOption bodiesOption("bodies", "Draw a planetary system of that many bodies instead of the planets.", "count", "0");
+    parser.addOption(bodiesOption);
+    const QCommandLineOption aaOption("aa", "Anti-aliasing: off, msaa2, msaa4, msaa8, fxaa or taa; A switches.", "mode", "fxaa");
+    parser.addOption(aaOption);
+    const QCommandLineOption gpuBudgetOption("gpu-budget", "Scale the render resolution to keep the GPU time of a frame "
+        "within the budget, e.g. 8.3.", "ms");
+    parser.addOption(gpuBudgetOption);
+    const QCommandLineOption maxFpsOption("max-fps", "Cap the frame rate; the frames are rendered only when "
+        "something changed, up to the refresh rate by default.", "fps");
+    parser.addOption(maxFpsOption);
+    const QCommandLineOption inactiveFpsOption("inactive-fps", "Cap the frame rate while the window is not active.", "fps");
+    parser.addOption(inactiveFpsOption);
+    const QCommandLineOption continuousOption("continuous", "Render every refresh, changed or not.");
+    parser.addOption(continuousOption);
+    const QCommandLineOption profileOption("profile", "Time the frames and their passes, reported every interval.", "seconds");
+    parser.addOption(profileOption);
+    const QCommandLineOption profileJsonOption("profile-json", "Write the --profile reports to a JSON file instead of the log.", "path");
+    parser.addOption(profileJsonOption);
+    const QCommandLineOption traceOption("trace", "Record a timeline of the threads; written at exit and on F12, "
+        "open it in chrome://tracing or Perfetto.", "path");
+    parser.addOption(traceOption);
+    parser.process(app);
+
+    if (parser.isSet(traceOption))
+    {
+        Lis::Tracer& tracer = Lis::Tracer::GetInstance();
+        tracer.SetThreadName("main");
+        tracer.WriteAtExit(parser.value(traceOption).toStdString());
+        tracer.Start();
+    }
+
+    // The scene is drawn and anti-aliased offscreen: the window needs a single sample
     QSurfaceFormat format;
-    format.setSamples(16);
+    format.setDepthBufferSize(24);
     format.setOption(QSurfaceFormat::DebugContext);
+    bool validCount = false;
+    const int particles = parser.value(particlesOption).toInt(&validCount);
+    if (!validCount)
+        throw std::invalid_argument("invalid --particles: " + parser.value(particlesOption).toStdString());
+    if (particles > 0)
+    {
+        // The compute shaders of the particles
+        format.setVersion(4, 3);
+    }
 
     Lis::PlanetWindow window;
     window.setFormat(format);
+    if (parser.isSet(tilesOption))
+        window.setTilePack(parser.value(tilesOption));
+    bool validRate = false;
+    const double simRate = parser.value(simRateOption).toDouble(&validRate);
+    if (!validRate)
+        throw std::invalid_argument("invalid --sim-rate: " + parser.value(simRateOption).toStdString());
+    window.setSimulationRate(simRate);
+    window.setRenderMode(Lis::parsePlanetRenderMode(parser.value(renderOption)));
+    window.setAntiAliasing(Lis::parseAntiAliasing(parser.value(aaOption)));
+    if (parser.isSet(gpuBudgetOption))
+    {
+        bool validBudget = false;
+        Lis::DynamicResolutionParams resolution;
+        resolution.budgetMs = parser.value(gpuBudgetOption).toDouble(&validBudget);
+        if (!validBudget)
+            throw std::invalid_argument("invalid --gpu-budget: " + parser.value(gpuBudgetOption).toStdString());
+        window.setDynamicResolution(resolution);
+    }
+    Lis::FrameSchedulerParams scheduling;
+    scheduling.onDemand = !parser.isSet(continuousOption);
+    if (parser.isSet(maxFpsOption))
+    {
+        bool validFps = false;
+        scheduling.maxFps = parser.value(maxFpsOption).toDouble(&validFps);
+        if (!validFps)
+            throw std::invalid_argument("invalid --max-fps: " + parser.value(maxFpsOption).toStdString());
+    }
+    if (parser.isSet(inactiveFpsOption))
+    {
+        bool validFps = false;
+        scheduling.inactiveFps = parser.value(inactiveFpsOption).toDouble(&validFps);
+        if (!validFps)
+            throw std::invalid_argument("invalid --inactive-fps: " + parser.value(inactiveFpsOption).toStdString());
+    }
+    window.frameScheduler().SetParams(scheduling);
+    const int planets = parser.value(planetsOption).toInt(&validCount);
+    if (!validCount)
+        throw std::invalid_argument("invalid --planets: " + parser.value(planetsOption).toStdString());
+    window.setPlanetCount(planets);
+    const int bodies = parser.value(bodiesOption).toInt(&validCount);
+    if (!validCount)
+        throw std::invalid_argument("invalid --bodies: " + parser.value(bodiesOption).toStdString());
+    window.setBodyCount(bodies);
+    if (parser.isSet(altitudeOption))
+    {
+        bool validAltitude = false;
+        const float altitude = parser.value(altitudeOption).toFloat(&validAltitude);
+        if (!validAltitude)
+            throw std::invalid_argument("invalid --altitude: " + parser.value(altitudeOption).toStdString());
+        window.setTerrainAltitude(altitude);
+    }
+    // A replay or a checkpoint brings the grid of its own
+    const bool weather = parser.value(weatherOption) != "none" || parser.isSet(replayOption) || parser.isSet(restoreOption);
+    if (parser.isSet(replayOption))
+        window.setReplay(parser.value(replayOption));
+    else if (parser.isSet(restoreOption))
+        window.restoreCheckpoint(parser.value(restoreOption));
+    else if (weather)
+    {
+        Lis::ShallowWaterParams params = Lis::ParseGridSpec(parser.value(weatherOption).toStdString());
+        bool validTruncation = false;
+        params.spectralTruncation = parser.value(spectralOption).toUInt(&validTruncation);
+        if (!validTruncation)
+            throw std::invalid_argument("invalid --spectral-filter: " + parser.value(spectralOption).toStdString());
+        window.setWeather(params);
+    }
+    if (!weather && particles > 0)
+        throw std::invalid_argument("--particles needs the weather");
+    window.setWindParticles(particles);
+    if (parser.isSet(observationsOption))
+    {
+        if (!weather || parser.isSet(replayOption))
+            throw std::invalid_argument("--observations needs the weather simulation");
+        window.setObservations(parser.value(observationsOption), Lis::ParseRegridMethod(parser.value(regridOption).toStdString()));
+    }
+    if (parser.isSet(recordOption))
+    {
+        if (!weather || parser.isSet(replayOption))
+            throw std::invalid_argument("--record needs the weather simulation");
+        bool validEvery = false;
+        const int every = parser.value(recordEveryOption).toInt(&validEvery);
+        if (!validEvery || every <= 0)
+            throw std::invalid_argument("invalid --record-every: " + parser.value(recordEveryOption).toStdString());
+        window.setRecording(parser.value(recordOption), Lis::ParseRecordingCodec(parser.value(recordCodecOption).toStdString()), every);
+    }
+    bool validOrder = false;
+    const uint cellOrder = parser.value(cellOrderOption).toUInt(&validOrder);
+    if (!validOrder)
+        throw std::invalid_argument("invalid --cell-order: " + parser.value(cellOrderOption).toStdString());
+    window.setCellOrder(cellOrder);
+    if (parser.isSet(profileOption))
+    {
+        bool validInterval = false;
+        const double interval = parser.value(profileOption).toDouble(&validInterval);
+        if (!validInterval || interval <= 0)
+            throw std::invalid_argument("invalid --profile: " + parser.value(profileOption).toStdString());
+        window.profiler().setEnabled(true);
+        window.profiler().setReport(interval, parser.value(profileJsonOption));
+    }
+    TraceShortcut traceShortcut(parser.value(traceOption).toStdString());
+    if (parser.isSet(traceOption))
+        window.installEventFilter(&traceShortcut);
     window.resize(800, 600);
     window.show();
 
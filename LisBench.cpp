@@ -0,0 +1,583 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/LisBench.cpp
+//
+// summary:	headless frame-time benchmark of the planet renderer
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+// Qt part
+#include <QtGui/QGuiApplication>
+#include <QtGui/QSurfaceFormat>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtGui/QImage>
+
+#include "PlanetWindow.h"
+#include "Logger.h"
+#include "Tracer.h"
+
+namespace
+{
+/// <summary>	The reference of the quality is rendered that many times larger each way. </summary>
+const int ReferenceScale = 4;
+
+/// <summary>	The longest side of a reference, px: larger cases get a smaller scale. </summary>
+const int MaxReferenceSize = 8192;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct BenchCase
+{
+    QSize size;
+    Lis::AntiAliasing antiAliasing;
+    Lis::SphereMeshParams mesh;
+    QString tilePack;           ///< empty for the embedded texture
+    bool textureCache;          ///< load the embedded texture precompressed
+    QString weather;            ///< the simulation grid, empty for none
+    bool profile;               ///< time the passes of the measured frames
+    Lis::PlanetRenderMode mode;
+    int planets;
+    int bodies;                 ///< a planetary system instead of the planets, 0 for none
+    float altitude;             ///< of the terrain eye, 0 for the default
+    bool quality;               ///< compare the last frame with a supersampled reference
+    double gpuBudgetMs;         ///< of the dynamic resolution, 0 for the full resolution
+    int particles;              ///< the tracers of the wind, 0 for none
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct FrameStats
+{
+    double minMs;
+    double medianMs;
+    double p99Ms;
+    double meanMs;
+    double fps;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+FrameStats ComputeStats(std::vector<double> frameTimes)
+{
+    if (frameTimes.empty())
+        throw std::invalid_argument("no frames were measured");
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    // Nearest-rank percentiles
+    auto percentile = [&frameTimes](double p) {
+        const size_t rank = static_cast<size_t>(p * (frameTimes.size() - 1) + 0.5);
+        return frameTimes[std::min(rank, frameTimes.size() - 1)];
+    };
+
+    double total = 0;
+    for (double t : frameTimes)
+        total += t;
+
+    FrameStats stats;
+    stats.minMs = frameTimes.front();
+    stats.medianMs = percentile(0.5);
+    stats.p99Ms = percentile(0.99);
+    stats.meanMs = total / frameTimes.size();
+    stats.fps = stats.meanMs > 0 ? 1000.0 / stats.meanMs : 0;
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<QSize> ParseSizes(const QString& value)
+{
+    std::vector<QSize> sizes;
+    for (const QString& item : value.split(',', QString::SkipEmptyParts))
+    {
+        const QStringList dims = item.split('x');
+        bool okWidth = false, okHeight = false;
+        const int width = dims.size() == 2 ? dims[0].toInt(&okWidth) : 0;
+        const int height = dims.size() == 2 ? dims[1].toInt(&okHeight) : 0;
+        if (!okWidth || !okHeight || width <= 0 || height <= 0)
+            throw std::invalid_argument("invalid resolution: " + item.toStdString());
+        sizes.emplace_back(width, height);
+    }
+    return sizes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<int> ParseInts(const QString& value)
+{
+    std::vector<int> result;
+    for (const QString& item : value.split(',', QString::SkipEmptyParts))
+    {
+        bool ok = false;
+        const int number = item.toInt(&ok);
+        if (!ok || number < 0)
+            throw std::invalid_argument("invalid number: " + item.toStdString());
+        result.push_back(number);
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<float> ParseFloats(const QString& value)
+{
+    std::vector<float> result;
+    for (const QString& item : value.split(',', QString::SkipEmptyParts))
+    {
+        bool ok = false;
+        const float number = item.toFloat(&ok);
+        if (!ok || !(number > 0.0f))
+            throw std::invalid_argument("invalid number: " + item.toStdString());
+        result.push_back(number);
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QJsonObject DescribeRenderer()
+{
+    QJsonObject renderer;
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (!context)
+        return renderer;
+
+    QOpenGLFunctions* gl = context->functions();
+    renderer["vendor"] = reinterpret_cast<const char*>(gl->glGetString(GL_VENDOR));
+    renderer["renderer"] = reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER));
+    renderer["version"] = reinterpret_cast<const char*>(gl->glGetString(GL_VERSION));
+    return renderer;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void Configure(Lis::PlanetWindow& window, const BenchCase& benchCase)
+{
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    if (benchCase.particles > 0)
+        format.setVersion(4, 3);
+    window.setFormat(format);
+    window.setHeadless(benchCase.size);
+    window.setAntiAliasing(benchCase.antiAliasing);
+    window.setMeshParams(benchCase.mesh);
+    window.setTextureCacheEnabled(benchCase.textureCache);
+    if (!benchCase.tilePack.isEmpty())
+        window.setTilePack(benchCase.tilePack);
+    window.setRenderMode(benchCase.mode);
+    window.setPlanetCount(benchCase.planets);
+    window.setBodyCount(benchCase.bodies);
+    if (benchCase.altitude > 0.0f)
+        window.setTerrainAltitude(benchCase.altitude);
+    if (!benchCase.weather.isEmpty())
+        window.setWeather(Lis::ParseGridSpec(benchCase.weather.toStdString()));
+    window.setWindParticles(benchCase.particles);
+    if (benchCase.gpuBudgetMs > 0.0)
+    {
+        Lis::DynamicResolutionParams resolution;
+        resolution.budgetMs = benchCase.gpuBudgetMs;
+        window.setDynamicResolution(resolution);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Everything of a case but the anti-aliasing: the cases sharing it share a reference. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QString SceneKey(const BenchCase& benchCase)
+{
+    return QString("%1x%2 %3 %4 %5 %6 %7 %8 %9 %10 %11").arg(benchCase.size.width()).arg(benchCase.size.height())
+        .arg(QString::fromStdString(Lis::FormatSphereMeshSpec(benchCase.mesh))).arg(benchCase.tilePack)
+        .arg(benchCase.weather).arg(Lis::planetRenderModeName(benchCase.mode)).arg(benchCase.planets)
+        .arg(benchCase.bodies).arg(benchCase.altitude).arg(benchCase.textureCache).arg(benchCase.particles);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The frame of the world as the ground truth of the anti-aliasing: rendered
+/// 			without it ReferenceScale times larger each way, then each block of
+/// 			pixels averaged into one. The frames before it are rendered too, for the
+/// 			terrain to refine and the weather to be the same.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QImage RenderReference(const BenchCase& benchCase, int frame, int warmupFrames)
+{
+    const int scale = std::max(1, std::min(ReferenceScale,
+        MaxReferenceSize / std::max(benchCase.size.width(), benchCase.size.height())));
+    BenchCase reference = benchCase;
+    reference.size = benchCase.size * scale;
+    reference.antiAliasing = Lis::AntiAliasing::Off;
+    reference.gpuBudgetMs = 0.0;
+
+    Lis::PlanetWindow window;
+    Configure(window, reference);
+    window.setFrame(std::max(0, frame - warmupFrames));
+    while (window.frame() <= frame)
+        window.renderNow();
+    const QImage large = window.grabFramebuffer().convertToFormat(QImage::Format_RGB32);
+
+    QImage image(benchCase.size, QImage::Format_RGB32);
+    const int area = scale * scale;
+    for (int y = 0; y < image.height(); ++y)
+    {
+        QRgb* out = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x)
+        {
+            int red = 0, green = 0, blue = 0;
+            for (int sy = 0; sy < scale; ++sy)
+            {
+                const QRgb* in = reinterpret_cast<const QRgb*>(large.constScanLine(y * scale + sy)) + x * scale;
+                for (int sx = 0; sx < scale; ++sx)
+                {
+                    red += qRed(in[sx]);
+                    green += qGreen(in[sx]);
+                    blue += qBlue(in[sx]);
+                }
+            }
+            out[x] = qRgb((red + area / 2) / area, (green + area / 2) / area, (blue + area / 2) / area);
+        }
+    }
+    return image;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The peak signal to noise ratio of the RGB channels, dB; 100 for equal images. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+double Psnr(const QImage& image, const QImage& reference)
+{
+    if (image.size() != reference.size())
+        throw std::invalid_argument("the image and its reference differ in size");
+
+    const QImage a = image.convertToFormat(QImage::Format_RGB32);
+    const QImage b = reference.convertToFormat(QImage::Format_RGB32);
+    double squares = 0.0;
+    for (int y = 0; y < a.height(); ++y)
+    {
+        const QRgb* rowA = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const QRgb* rowB = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); ++x)
+        {
+            const int red = qRed(rowA[x]) - qRed(rowB[x]);
+            const int green = qGreen(rowA[x]) - qGreen(rowB[x]);
+            const int blue = qBlue(rowA[x]) - qBlue(rowB[x]);
+            squares += red * red + green * green + blue * blue;
+        }
+    }
+    const double mse = squares / (3.0 * a.width() * a.height());
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 100.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QJsonObject RunCase(const BenchCase& benchCase, int warmupFrames, int frames, QJsonObject& renderer,
+    std::map<QString, QImage>& references)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Lis::PlanetWindow window;
+    Configure(window, benchCase);
+
+    // The first frame creates the context and loads everything
+    window.renderNow();
+
+    for (int i = 0; i < warmupFrames; ++i)
+        window.renderNow();
+    // The dynamic resolution follows the GPU time of the profiler, the particle
+    // throughput is read from it
+    window.profiler().setEnabled(benchCase.profile || benchCase.gpuBudgetMs > 0.0 || benchCase.particles > 0);
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(frames);
+    for (int i = 0; i < frames; ++i)
+    {
+        const Clock::time_point start = Clock::now();
+        window.renderNow();
+        const Clock::time_point end = Clock::now();
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    if (renderer.isEmpty())
+        renderer = DescribeRenderer();
+
+    const FrameStats stats = ComputeStats(std::move(frameTimes));
+
+    QJsonObject result;
+    result["width"] = benchCase.size.width();
+    result["height"] = benchCase.size.height();
+    result["aa"] = Lis::antiAliasingName(benchCase.antiAliasing);
+    result["samples"] = Lis::antiAliasingSamples(benchCase.antiAliasing);
+    result["aa_gpu_mb"] = window.postProcess().gpuMemory() / (1024.0 * 1024.0);
+    if (const Lis::DynamicResolution* resolution = window.dynamicResolution())
+    {
+        // The scale the run settled at; the changes include the warmup
+        result["gpu_budget_ms"] = benchCase.gpuBudgetMs;
+        result["resolution_scale"] = resolution->Scale();
+        result["resolution_changes"] = static_cast<double>(resolution->Changes());
+        result["render_width"] = window.renderSize().width();
+        result["render_height"] = window.renderSize().height();
+    }
+    result["mode"] = Lis::planetRenderModeName(benchCase.mode);
+    result["planets"] = benchCase.planets;
+    result["planets_per_sec"] = benchCase.planets * stats.fps;
+    result["frames"] = frames;
+    result["min_ms"] = stats.minMs;
+    result["median_ms"] = stats.medianMs;
+    result["p99_ms"] = stats.p99Ms;
+    result["mean_ms"] = stats.meanMs;
+    result["fps"] = stats.fps;
+
+    // Startup: run twice to compare a cold and a warm program binary cache
+    const Lis::StartupTimes& startup = window.startupTimes();
+    result["first_frame_ms"] = startup.totalMs;
+    result["startup_context_ms"] = startup.contextMs;
+    result["startup_initialize_ms"] = startup.initializeMs;
+    result["startup_render_ms"] = startup.firstFrameMs;
+    result["programs_from_cache"] = window.programsFromCache();
+
+    // Geometry throughput: every frame draws the whole mesh once
+    const Lis::SphereMesh& mesh = window.mesh();
+    result["mesh"] = QString::fromStdString(Lis::FormatSphereMeshSpec(benchCase.mesh));
+    result["vertices"] = static_cast<double>(mesh.Vertices().size());
+    result["triangles"] = static_cast<double>(mesh.TriangleCount());
+    result["bytes_per_vertex"] = static_cast<int>(sizeof(Lis::PackedVertex));
+    result["index_bytes"] = static_cast<double>(mesh.IndexBytes());
+    result["acmr"] = mesh.Acmr();
+    result["mesh_generation_ms"] = window.meshGenerationTime();
+    if (benchCase.bodies > 0)
+    {
+        // The culling decides what is drawn: the state of the last frame
+        result["bodies"] = benchCase.bodies;
+        result["visible_bodies"] = static_cast<double>(window.visibleBodies());
+        result["draw_calls"] = window.bodyDrawCalls();
+        result["mtris_per_sec"] = mesh.TriangleCount() * window.visibleBodies() * stats.fps / 1e6;
+    }
+    else if (const Lis::Terrain* terrain = window.terrain())
+    {
+        // The selection of the last frame; settled by the warmup unless it is too short
+        const Lis::TerrainStats& terrainStats = terrain->Stats();
+        result["altitude"] = window.terrainAltitude();
+        result["terrain_patches"] = static_cast<double>(terrainStats.selectedPatches);
+        result["terrain_culled"] = static_cast<double>(terrainStats.culledPatches);
+        result["terrain_triangles"] = static_cast<double>(terrainStats.triangles);
+        result["terrain_resident"] = static_cast<double>(terrainStats.residentPatches);
+        result["terrain_generated"] = static_cast<double>(terrainStats.generatedPatches);
+        result["terrain_uploads"] = window.terrainRenderer()->uploads();
+        result["terrain_gpu_mb"] = window.terrainRenderer()->gpuMemory() / (1024.0 * 1024.0);
+        result["mtris_per_sec"] = terrainStats.triangles * stats.fps / 1e6;
+    }
+    else if (benchCase.mode == Lis::PlanetRenderMode::Mesh)
+    {
+        result["mtris_per_sec"] = mesh.TriangleCount() * benchCase.planets * stats.fps / 1e6;
+    }
+
+    // Streaming state at the end of the run: the frames include the tile uploads
+    if (const Lis::VirtualTexture* virtualTexture = window.virtualTexture())
+    {
+        result["tile_pack"] = benchCase.tilePack;
+        result["resident_tiles"] = static_cast<double>(virtualTexture->residentTiles());
+        result["loading_tiles"] = static_cast<double>(virtualTexture->loadingTiles());
+        result["texture_gpu_mb"] = virtualTexture->gpuMemory() / (1024.0 * 1024.0);
+    }
+    else
+    {
+        const Lis::TextureLoadInfo& texture = window.textureLoadInfo();
+        result["texture_from_cache"] = texture.fromCache;
+        result["texture_load_ms"] = texture.milliseconds;
+        result["texture_gpu_mb"] = texture.gpuBytes / (1024.0 * 1024.0);
+    }
+
+    // The weather is stepped on this thread in headless mode: the frames include the model
+    if (const Lis::FieldTexture* weather = window.weatherTexture())
+    {
+        result["weather"] = benchCase.weather;
+        result["field_persistent"] = weather->isPersistent();
+        result["field_upload_mb"] = weather->uploadedBytes() / (1024.0 * 1024.0);
+        result["field_stalls"] = weather->stalls();
+        result["field_gpu_mb"] = weather->gpuMemory() / (1024.0 * 1024.0);
+    }
+
+    // The advection alone, on the GPU; the streaks are in the "particles" pass
+    if (const Lis::WindParticles* particles = window.windParticles())
+    {
+        result["particles"] = particles->count();
+        result["particle_gpu_mb"] = particles->gpuMemory() / (1024.0 * 1024.0);
+        for (const Lis::ZoneTimes& zone : window.profiler().times())
+        {
+            if (zone.name != "particle update" || zone.gpu.count == 0)
+                continue;
+            result["particle_update_ms"] = zone.gpu.p50;
+            if (zone.gpu.p50 > 0.0)
+                result["particles_per_ms"] = particles->count() / zone.gpu.p50;
+        }
+    }
+
+    // Against the same frame supersampled; the cost of the mode is the frame time and the post pass
+    if (benchCase.quality)
+    {
+        const int lastFrame = window.frame() - 1;
+        const QImage image = window.grabFramebuffer();
+        const QString key = SceneKey(benchCase);
+        if (references.find(key) == references.end())
+            references[key] = RenderReference(benchCase, lastFrame, warmupFrames);
+        result["psnr_db"] = Psnr(image, references[key]);
+    }
+
+    // Per pass: the queries of the last frames are still pending, read what is available
+    if (benchCase.profile)
+        result["profile"] = window.profiler().toJson();
+    return result;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+try
+{
+    // Render farm nodes have no display: use the offscreen platform unless told otherwise
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless frame-time benchmark of the planet renderer");
+    parser.addHelpOption();
+    const QCommandLineOption framesOption("frames", "Number of measured frames per case.", "count", "300");
+    const QCommandLineOption warmupOption("warmup", "Number of frames rendered before measuring.", "count", "10");
+    const QCommandLineOption sizesOption("sizes", "Comma-separated list of resolutions.", "WxH,...", "800x600,1920x1080");
+    const QCommandLineOption aaOption("aa", "Comma-separated list of anti-aliasing modes (off, msaa2, msaa4, msaa8, fxaa, taa).",
+        "mode,...", "off,msaa4");
+    const QCommandLineOption gpuBudgetOption("gpu-budget", "Scale the render resolution to keep the GPU time of a frame within the budget.", "ms", "0");
+    const QCommandLineOption qualityOption("quality", "Compare the last frame of every case with a supersampled reference (PSNR).");
+    const QCommandLineOption meshesOption("meshes", "Comma-separated list of sphere meshes (uv:N[xM], ico:N, cube:N).", "spec,...", "uv:40");
+    const QCommandLineOption modesOption("modes", "Comma-separated list of render modes (mesh, impostor, terrain).", "mode,...", "mesh");
+    const QCommandLineOption planetsOption("planets", "Comma-separated list of planet counts.", "n,...", "1");
+    const QCommandLineOption altitudesOption("altitudes", "Comma-separated list of terrain eye altitudes, planet radii.", "r,...", "");
+    const QCommandLineOption bodiesOption("bodies", "Comma-separated list of planetary system sizes, drawn instanced.", "n,...", "");
+    const QCommandLineOption tilesOption("tiles", "Stream the imagery from a tile pack made by lis_tile_baker.", "pack");
+    const QCommandLineOption noTextureCacheOption("no-texture-cache", "Decode the embedded JPEG instead of loading its BC1 copy.");
+    const QCommandLineOption weatherOption("weather", "Simulate the weather on a LONxLAT grid and overlay it.", "grid");
+    const QCommandLineOption particlesOption("particles", "Comma-separated list of wind particle counts, advected on the GPU; "
+        "needs --weather.", "n,...", "0");
+    const QCommandLineOption profileOption("profile", "Report the CPU and GPU time of every pass.");
+    const QCommandLineOption traceOption("trace", "Write a timeline of the threads as Chrome trace events.", "path");
+    const QCommandLineOption outputOption("output", "JSON report path, '-' for stdout.", "path", "-");
+    parser.addOptions({ framesOption, warmupOption, sizesOption, aaOption, gpuBudgetOption, qualityOption, meshesOption, modesOption, planetsOption,
+        bodiesOption, altitudesOption, tilesOption, noTextureCacheOption, weatherOption, particlesOption, profileOption, traceOption, outputOption });
+    parser.process(app);
+
+    const int frames = parser.value(framesOption).toInt();
+    const int warmupFrames = parser.value(warmupOption).toInt();
+    if (frames <= 0 || warmupFrames < 0)
+        throw std::invalid_argument("frame counts must be positive");
+
+    // Keep stdout clean for the report
+    const QString outputPath = parser.value(outputOption);
+    if (outputPath == "-")
+        Lis::Logger::GetInstance().EnableConsoleChannel(Lis::LOG_NONE);
+
+    std::vector<Lis::SphereMeshParams> meshes;
+    for (const QString& spec : parser.value(meshesOption).split(',', QString::SkipEmptyParts))
+        meshes.push_back(Lis::ParseSphereMeshSpec(spec.toStdString()));
+
+    std::vector<Lis::PlanetRenderMode> modes;
+    for (const QString& name : parser.value(modesOption).split(',', QString::SkipEmptyParts))
+        modes.push_back(Lis::parsePlanetRenderMode(name));
+
+    std::vector<Lis::AntiAliasing> antiAliasings;
+    for (const QString& name : parser.value(aaOption).split(',', QString::SkipEmptyParts))
+        antiAliasings.push_back(Lis::parseAntiAliasing(name));
+    const bool quality = parser.isSet(qualityOption);
+    bool validBudget = false;
+    const double gpuBudgetMs = parser.value(gpuBudgetOption).toDouble(&validBudget);
+    if (!validBudget || gpuBudgetMs < 0.0)
+        throw std::invalid_argument("invalid --gpu-budget: " + parser.value(gpuBudgetOption).toStdString());
+
+    std::vector<int> particleCounts = ParseInts(parser.value(particlesOption));
+    if (particleCounts.empty())
+        particleCounts.push_back(0);
+    if (*std::max_element(particleCounts.begin(), particleCounts.end()) > 0 && !parser.isSet(weatherOption))
+        throw std::invalid_argument("the wind particles need --weather");
+
+    std::vector<float> altitudes = ParseFloats(parser.value(altitudesOption));
+    if (altitudes.empty())
+        altitudes.push_back(0.0f);
+
+    // The impostor has no mesh: one case per planet count and size is enough; the
+    // terrain has neither, one case per altitude, and no particles
+    std::vector<BenchCase> cases;
+    for (const QSize& size : ParseSizes(parser.value(sizesOption)))
+        for (Lis::AntiAliasing antiAliasing : antiAliasings)
+            for (Lis::PlanetRenderMode mode : modes)
+            {
+                if (mode == Lis::PlanetRenderMode::Terrain)
+                {
+                    for (float altitude : altitudes)
+                        cases.push_back(BenchCase{ size, antiAliasing, Lis::SphereMeshParams(), parser.value(tilesOption), !parser.isSet(noTextureCacheOption),
+                            parser.value(weatherOption), parser.isSet(profileOption), mode, 1, 0, altitude, quality, gpuBudgetMs, 0 });
+                    continue;
+                }
+
+                for (int planets : ParseInts(parser.value(planetsOption)))
+                    for (int particles : particleCounts)
+                        for (const Lis::SphereMeshParams& mesh : meshes)
+                        {
+                            if (planets == 0)
+                                throw std::invalid_argument("at least one planet must be drawn");
+                            cases.push_back(BenchCase{ size, antiAliasing, mesh, parser.value(tilesOption), !parser.isSet(noTextureCacheOption),
+                                parser.value(weatherOption), parser.isSet(profileOption), mode, planets, 0, 0.0f, quality, gpuBudgetMs, particles });
+                            if (mode == Lis::PlanetRenderMode::Impostor)
+                                break;
+                        }
+            }
+
+    // A planetary system is drawn with the instanced meshes whatever the modes and planets
+    for (const QSize& size : ParseSizes(parser.value(sizesOption)))
+        for (Lis::AntiAliasing antiAliasing : antiAliasings)
+            for (int bodies : ParseInts(parser.value(bodiesOption)))
+                for (const Lis::SphereMeshParams& mesh : meshes)
+                {
+                    if (bodies == 0)
+                        throw std::invalid_argument("a planetary system needs at least its star");
+                    cases.push_back(BenchCase{ size, antiAliasing, mesh, parser.value(tilesOption), !parser.isSet(noTextureCacheOption),
+                        parser.value(weatherOption), parser.isSet(profileOption), Lis::PlanetRenderMode::Mesh, 1, bodies, 0.0f, quality, gpuBudgetMs, 0 });
+                }
+    if (cases.empty())
+        throw std::invalid_argument("no benchmark cases were given");
+
+    if (parser.isSet(traceOption))
+    {
+        Lis::Tracer::GetInstance().SetThreadName("main");
+        Lis::Tracer::GetInstance().Start();
+    }
+
+    QJsonArray results;
+    QJsonObject renderer;
+    std::map<QString, QImage> references;
+    for (const BenchCase& benchCase : cases)
+        results.append(RunCase(benchCase, warmupFrames, frames, renderer, references));
+
+    if (parser.isSet(traceOption))
+        Lis::Tracer::GetInstance().Write(parser.value(traceOption).toStdString());
+
+    QJsonObject report;
+    report["renderer"] = renderer;
+    report["cases"] = results;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (outputPath == "-")
+    {
+        QTextStream(stdout) << json;
+        return EXIT_SUCCESS;
+    }
+
+    QFile output(outputPath);
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate) || output.write(json) != json.size())
+        throw std::runtime_error("failed to write the report to " + outputPath.toStdString());
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    Lis::Logger::GetInstance().Error() << "terminated: " << e.what();
+    return EXIT_FAILURE;
+}
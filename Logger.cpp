@@ -5,14 +5,21 @@
 //////////////////////////////////////////////////////////////////////////
 
 #include "Logger.h"
+#include "BoundedQueue.h"
+#include "Tracer.h"
 
+#include <algorithm>
 #include <iostream>
-#include <iomanip>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <mutex>
 #include <regex>
+#include <thread>
+#include <vector>
 
 // Use thread-safe implementation of std::localtime
 #ifdef _WIN32
@@ -27,6 +34,315 @@
 
 namespace Lis
 {
+namespace
+{
+//////////////////////////////////////////////////////////////////////////
+/// Max length of "YYYY-MM-DD hh:mm:ss.mmm " with the terminating zero
+//////////////////////////////////////////////////////////////////////////
+const size_t PreambleSize = 32;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Format the message preamble. The broken-down time only changes once
+///   a second, so every thread caches it instead of calling localtime.
+/// </summary>
+///
+/// <returns> The length of the preamble </returns>
+//////////////////////////////////////////////////////////////////////////
+size_t FormatPreamble(std::chrono::system_clock::time_point time, char (&preamble)[PreambleSize])
+{
+    static thread_local std::time_t cachedSecond = -1;
+    static thread_local char cachedDate[PreambleSize];
+
+    const std::time_t second = std::chrono::system_clock::to_time_t(time);
+    if (second != cachedSecond)
+    {
+        std::tm brokenTime;
+        safe_localtime(&second, &brokenTime);
+        std::strftime(cachedDate, sizeof(cachedDate), "%Y-%m-%d %H:%M:%S", &brokenTime);
+        cachedSecond = second;
+    }
+
+    std::chrono::system_clock::duration milliseconds = time.time_since_epoch();
+    milliseconds -= std::chrono::duration_cast<std::chrono::seconds>(milliseconds);
+
+    const int length = std::snprintf(preamble, sizeof(preamble), "%s.%03d ", cachedDate,
+        static_cast<int>(milliseconds / std::chrono::milliseconds(1)));
+    return length > 0 ? std::min(static_cast<size_t>(length), sizeof(preamble) - 1) : 0;
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Background writer of the asynchronous mode. Producers push complete
+///   records into a lock-free bounded queue; the writer thread takes them
+///   in batches, formats the preambles and writes every batch with one
+///   buffered write per channel. The channels are flushed on an error,
+///   on Flush(), when the writer has been idle for a while and on exit,
+///   not per batch: a writer that keeps up takes batches of a message or
+///   two and would flush nearly every line.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class Logger::AsyncWriter
+{
+public:
+    AsyncWriter(Logger& parent, size_t capacity, OverflowPolicy policy);
+    ~AsyncWriter();
+
+    void Push(LogLevel level, const char* message, size_t length);
+    void Flush();
+    uint64_t GetDroppedCount() const;
+
+private:
+    //////////////////////////////////////////////////////////////////////////
+    /// The text of a typical message is stored inline, so pushing it does
+    /// not allocate; longer ones go to the heap
+    //////////////////////////////////////////////////////////////////////////
+    struct Record
+    {
+        static const size_t InlineCapacity = 192;
+
+        LogLevel level;
+        uint32_t length;
+        std::chrono::system_clock::time_point time;
+        char text[InlineCapacity];
+        std::string longText;
+
+        const char* Text() const { return length <= InlineCapacity ? text : longText.data(); }
+    };
+
+    void Run();
+    void WakeUp();
+    bool WriteBatch(const std::vector<Record>& batch);
+    void FlushChannels();
+
+    static const size_t MaxBatchSize = 512;
+
+    Logger& m_parent;
+    const OverflowPolicy m_policy;
+    BoundedQueue<Record> m_queue;
+
+    std::atomic<uint64_t> m_accepted;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_flushed;            ///< m_written at the last flush of the channels
+    std::atomic<uint64_t> m_flushRequests;
+    uint64_t m_flushRequestsServed;
+    std::atomic<uint64_t> m_dropped;
+    uint64_t m_droppedReported;
+
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_sleeping;
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    std::condition_variable m_progress;
+
+    // Output buffers, owned by the writer thread
+    std::string m_consoleBuffer;
+    std::string m_fileBuffer;
+
+    std::thread m_thread;
+};
+
+//////////////////////////////////////////////////////////////////////////
+Logger::AsyncWriter::AsyncWriter(Logger& parent, size_t capacity, OverflowPolicy policy)
+    : m_parent(parent)
+    , m_policy(policy)
+    , m_queue(capacity)
+    , m_accepted(0)
+    , m_written(0)
+    , m_flushed(0)
+    , m_flushRequests(0)
+    , m_flushRequestsServed(0)
+    , m_dropped(0)
+    , m_droppedReported(0)
+    , m_stop(false)
+    , m_sleeping(false)
+{
+    m_thread = std::thread(&AsyncWriter::Run, this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+Logger::AsyncWriter::~AsyncWriter()
+{
+    // The writer drains the queue before leaving
+    m_stop.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_wakeUp.notify_one();
+    }
+    m_thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::AsyncWriter::Push(LogLevel level, const char* message, size_t length)
+{
+    Record record;
+    record.level = level;
+    record.length = static_cast<uint32_t>(length);
+    record.time = std::chrono::system_clock::now();
+    if (length <= Record::InlineCapacity)
+        std::memcpy(record.text, message, length);
+    else
+        record.longText.assign(message, length);
+    while (!m_queue.TryPush(std::move(record)))
+    {
+        if (m_policy != OVERFLOW_BLOCK)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        WakeUp();
+        std::this_thread::yield();
+    }
+
+    m_accepted.fetch_add(1, std::memory_order_release);
+    WakeUp();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::AsyncWriter::WakeUp()
+{
+    // Producers touch the mutex only when the writer is really asleep, and
+    // only the first of them: the writer drains the queue once awake
+    if (m_sleeping.load(std::memory_order_acquire) && m_sleeping.exchange(false, std::memory_order_acq_rel))
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_wakeUp.notify_one();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::AsyncWriter::Flush()
+{
+    const uint64_t target = m_accepted.load(std::memory_order_acquire);
+    m_flushRequests.fetch_add(1);
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_wakeUp.notify_one();
+    m_progress.wait(lock, [this, target] {
+        return m_flushed.load(std::memory_order_acquire) >= target;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint64_t Logger::AsyncWriter::GetDroppedCount() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::AsyncWriter::Run()
+{
+    Tracer::GetInstance().SetThreadName("logger");
+    std::vector<Record> batch;
+    batch.reserve(MaxBatchSize);
+
+    bool idle = false;
+    for (;;)
+    {
+        // Read before the queue: the messages of a request are in it then
+        const uint64_t requests = m_flushRequests.load();
+        Record record;
+        while (batch.size() < MaxBatchSize && m_queue.TryPop(record))
+            batch.push_back(std::move(record));
+
+        if (!batch.empty())
+        {
+            const bool error = WriteBatch(batch);
+            const uint64_t written = m_written.fetch_add(batch.size(), std::memory_order_release) + batch.size();
+            batch.clear();
+            idle = false;
+            if (error)
+            {
+                FlushChannels();
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_flushed.store(written, std::memory_order_release);
+                m_progress.notify_all();
+            }
+            continue;
+        }
+
+        const bool stop = m_stop.load();
+        if (requests != m_flushRequestsServed || idle || stop)
+        {
+            const uint64_t written = m_written.load(std::memory_order_relaxed);
+            if (m_flushed.load(std::memory_order_relaxed) != written)
+                FlushChannels();
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_flushed.store(written, std::memory_order_release);
+            m_flushRequestsServed = requests;
+            m_progress.notify_all();
+        }
+        if (stop)
+            break;
+
+        // Nothing to do: sleep until a producer or Flush() wakes us up. The
+        // timeout covers the race between the last check and the sleep flag
+        // and flushes what an idle writer holds.
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_sleeping.store(true, std::memory_order_release);
+        idle = false;
+        if (m_queue.Empty() && !m_stop.load() && m_flushRequests.load() == m_flushRequestsServed)
+            idle = m_wakeUp.wait_for(lock, std::chrono::milliseconds(50)) == std::cv_status::timeout;
+        m_sleeping.store(false, std::memory_order_release);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::AsyncWriter::FlushChannels()
+{
+    std::cout.flush();
+    if (m_parent.m_logFile.is_open())
+        m_parent.m_logFile.flush();
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool Logger::AsyncWriter::WriteBatch(const std::vector<Record>& batch)
+{
+    bool error = false;
+    const LogLevel consoleLevel = m_parent.m_consoleLevel.load(std::memory_order_relaxed);
+    const LogLevel fileLevel = m_parent.m_fileLevel.load(std::memory_order_relaxed);
+    const bool toFile = m_parent.m_logFile.good();
+
+    // The console buffer is used to build every line and the file buffer
+    // gets its own copy only when the channels want different messages
+    m_consoleBuffer.clear();
+    m_fileBuffer.clear();
+    for (const Record& record : batch)
+    {
+        char preamble[PreambleSize];
+        const size_t lineStart = m_consoleBuffer.size();
+        m_consoleBuffer.append(preamble, FormatPreamble(record.time, preamble));
+        m_consoleBuffer.append(record.Text(), record.length);
+        m_consoleBuffer.push_back('\n');
+        error = error || record.level >= LOG_ERROR;
+
+        if (toFile && record.level >= fileLevel)
+            m_fileBuffer.append(m_consoleBuffer, lineStart, std::string::npos);
+        if (record.level < consoleLevel)
+            m_consoleBuffer.resize(lineStart);
+    }
+
+    const uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+    if (m_policy == OVERFLOW_COUNT && dropped != m_droppedReported)
+    {
+        const std::string notice = "logger queue overflow: " +
+            std::to_string(dropped - m_droppedReported) + " message(s) dropped\n";
+        if (LOG_ERROR >= consoleLevel)
+            m_consoleBuffer.append(notice);
+        if (toFile && LOG_ERROR >= fileLevel)
+            m_fileBuffer.append(notice);
+        m_droppedReported = dropped;
+    }
+
+    if (!m_consoleBuffer.empty())
+        std::cout.write(m_consoleBuffer.data(), m_consoleBuffer.size());
+    if (!m_fileBuffer.empty())
+        m_parent.m_logFile.write(m_fileBuffer.data(), m_fileBuffer.size());
+    return error;
+}
+
 //////////////////////////////////////////////////////////////////////////
 Logger& Logger::GetInstance()
 {
@@ -38,12 +354,78 @@ Logger& Logger::GetInstance()
 Logger::Logger()
     : m_consoleLevel(LOG_INFO)
     , m_fileLevel(LOG_NONE)
+    , m_minLevel(LOG_INFO)
 {}
 
+//////////////////////////////////////////////////////////////////////////
+LineBuffer* Logger::AcquireLineBuffer()
+{
+    static thread_local LineBuffer line;
+    if (line.m_inUse)
+        return nullptr;
+
+    line.m_inUse = true;
+    line.Clear();
+    return &line;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::ReleaseLineBuffer(LineBuffer* line)
+{
+    line->m_inUse = false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::UpdateMinLevel()
+{
+    m_minLevel = std::min(m_consoleLevel.load(), m_fileLevel.load());
+}
+
+//////////////////////////////////////////////////////////////////////////
+Logger::~Logger()
+{
+    // Drain the queue on shutdown
+    DisableAsyncMode();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::EnableAsyncMode(size_t capacity, OverflowPolicy policy)
+{
+    if (!m_async)
+        m_async.reset(new AsyncWriter(*this, capacity, policy));
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::DisableAsyncMode()
+{
+    m_async.reset();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Logger::Flush()
+{
+    if (m_async)
+    {
+        m_async->Flush();
+        return;
+    }
+
+    std::cout.flush();
+    if (m_logFile.is_open())
+        m_logFile.flush();
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint64_t Logger::GetDroppedCount() const
+{
+    return m_async ? m_async->GetDroppedCount() : 0;
+}
+
 //////////////////////////////////////////////////////////////////////////
 void Logger::EnableConsoleChannel(LogLevel level)
 {
     m_consoleLevel = level;
+    UpdateMinLevel();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -54,6 +436,7 @@ void Logger::EnableFileChannel(bool overwrite, LogLevel level)
         if (m_logFile.is_open())
             m_logFile.close();
         m_fileLevel = level;
+        UpdateMinLevel();
         return;
     }
 
@@ -88,6 +471,7 @@ void Logger::EnableFileChannel(bool overwrite, LogLevel level)
         else
         {
             m_fileLevel = level;
+            UpdateMinLevel();
         }
     }
     catch (const std::exception& e)
@@ -97,8 +481,9 @@ void Logger::EnableFileChannel(bool overwrite, LogLevel level)
 }
 
 //////////////////////////////////////////////////////////////////////////
-void Logger::PutMessage(LogLevel level, const std::string& message)
+void Logger::PutMessage(LogLevel level, const char* message, size_t length)
 {
+    LIS_TRACE_ZONE("Logger::PutMessage");
     static std::mutex outputLock;
 
     // Check if the requested log level is allowed in any of
@@ -106,38 +491,33 @@ void Logger::PutMessage(LogLevel level, const std::string& message)
     if (level < m_consoleLevel && level < m_fileLevel)
         return;
 
-    // Prepare the preamble of the message
-    std::string preamble;
+    if (m_async)
     {
-        std::ostringstream buf;
-        const std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-        const std::time_t timeNow = std::chrono::system_clock::to_time_t(now);
-        std::tm brokenTime;
-        safe_localtime(&timeNow, &brokenTime);
-        std::chrono::system_clock::duration milliseconds = now.time_since_epoch();
-        milliseconds -= std::chrono::duration_cast<std::chrono::seconds>(milliseconds);
-
-        buf << std::setw(4) << std::setfill('0') << brokenTime.tm_year + 1900
-            << '-' << std::setw(2) << std::setfill('0') << brokenTime.tm_mon + 1
-            << '-' << std::setw(2) << std::setfill('0') << brokenTime.tm_mday
-            << ' ' << std::setw(2) << std::setfill('0') << brokenTime.tm_hour
-            << ':' << std::setw(2) << std::setfill('0') << brokenTime.tm_min
-            << ':' << std::setw(2) << std::setfill('0') << brokenTime.tm_sec
-            << '.' << std::setw(3) << std::setfill('0') << milliseconds / std::chrono::milliseconds(1)
-            << ' ';
-        preamble = std::move(buf.str());
+        m_async->Push(level, message, length);
+        return;
     }
 
+    // Prepare the preamble of the message
+    char preamble[PreambleSize];
+    const size_t preambleLength = FormatPreamble(std::chrono::system_clock::now(), preamble);
+
+    // The streams are flushed on errors only, which must not be lost in a
+    // crash; the others wait for the buffer or Flush()
+    const bool flush = level >= LOG_ERROR;
     {
         std::lock_guard<std::mutex> lock(outputLock);
         if (level >= m_consoleLevel)
         {
-            std::cout << preamble << message << std::endl;
+            std::cout.write(preamble, preambleLength).write(message, length).put('\n');
+            if (flush)
+                std::cout.flush();
         }
 
         if (level >= m_fileLevel && m_logFile.good())
         {
-            m_logFile << preamble << message << std::endl;
+            m_logFile.write(preamble, preambleLength).write(message, length).put('\n');
+            if (flush)
+                m_logFile.flush();
         }
     }
 }
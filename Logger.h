@@ -6,10 +6,16 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <memory>
+#include <type_traits>
 
 namespace Lis
 {
@@ -22,6 +28,73 @@ enum LogLevel
     LOG_NONE
 };
 
+//////////////////////////////////////////////////////////////////////////
+/// What the asynchronous logger does when its queue is full
+//////////////////////////////////////////////////////////////////////////
+enum OverflowPolicy
+{
+    OVERFLOW_BLOCK,     ///< wait until the writer thread frees a slot
+    OVERFLOW_DROP,      ///< silently discard the new message
+    OVERFLOW_COUNT      ///< discard the new message and report the count
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// The lowest level compiled in: statements below it compile to nothing.
+/// Set with -DLIS_LOG_MIN_LEVEL=LOG_INFO (see the CMake option).
+//////////////////////////////////////////////////////////////////////////
+#ifndef LIS_LOG_MIN_LEVEL
+# define LIS_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+const LogLevel CompiledLogLevel = LIS_LOG_MIN_LEVEL;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Fixed-capacity line storage. Short messages never leave the inline
+///   array; only a line longer than the capacity spills to the heap.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class LineBuffer
+{
+public:
+    static const size_t InlineCapacity = 1024;
+
+    LineBuffer() : m_size(0), m_inUse(false) {}
+    LineBuffer(const LineBuffer&) = delete;
+    LineBuffer& operator=(const LineBuffer&) = delete;
+
+    void Append(const char* text, size_t length)
+    {
+        if (m_overflow.empty() && m_size + length <= InlineCapacity)
+        {
+            std::memcpy(m_inline + m_size, text, length);
+            m_size += length;
+            return;
+        }
+
+        if (m_overflow.empty())
+            m_overflow.assign(m_inline, m_size);
+        m_overflow.append(text, length);
+    }
+
+    const char* Data() const { return m_overflow.empty() ? m_inline : m_overflow.data(); }
+    size_t Size() const { return m_overflow.empty() ? m_size : m_overflow.size(); }
+
+    void Clear()
+    {
+        m_size = 0;
+        m_overflow.clear();
+    }
+
+private:
+    friend class Logger;
+
+    char m_inline[InlineCapacity];
+    size_t m_size;
+    std::string m_overflow;
+    bool m_inUse;
+};
+
 //////////////////////////////////////////////////////////////////////////
 class Logger
 {
@@ -31,6 +104,10 @@ class Logger
     ///   and put it into the logging streams. Instances of this class
     ///   could be obtained via Logger::Debug(), Logger::Info() and
     ///   Logger::Error() methods only.
+    ///
+    ///   The level is checked on construction: a filtered out printer never
+    ///   touches its arguments. An enabled one writes into the thread-local
+    ///   LineBuffer, so the common case does no heap allocation.
     /// </summary>
     //////////////////////////////////////////////////////////////////////////
     class MessagePrinter
@@ -38,19 +115,37 @@ class Logger
         friend class Logger;
         Logger& m_parent;
         LogLevel m_level;
-        std::unique_ptr<std::ostringstream> m_buf;
+        LineBuffer* m_line;
+        std::unique_ptr<LineBuffer> m_ownLine;
 
     protected:
         MessagePrinter(Logger& parent, LogLevel level)
-            : m_parent(parent), m_level(level), m_buf(new std::ostringstream())
-        {}
+            : m_parent(parent), m_level(level), m_line(nullptr)
+        {
+            if (!parent.IsLevelEnabled(level))
+                return;
+
+            // A message built while another one is in progress on the same
+            // thread (e.g. logging from an operator<<) gets its own buffer
+            m_line = AcquireLineBuffer();
+            if (!m_line)
+            {
+                m_ownLine.reset(new LineBuffer());
+                m_line = m_ownLine.get();
+            }
+        }
 
     public:
         //////////////////////////////////////////////////////////////////////////
-        /// Default move constructor is enabled on purpose to allow proper work of
+        /// Move constructor is enabled on purpose to allow proper work of
         /// the Logger's methods Debug(), Info() and Error()
         //////////////////////////////////////////////////////////////////////////
-        MessagePrinter(MessagePrinter&&) = default;
+        MessagePrinter(MessagePrinter&& other)
+            : m_parent(other.m_parent), m_level(other.m_level), m_line(other.m_line)
+            , m_ownLine(std::move(other.m_ownLine))
+        {
+            other.m_line = nullptr;
+        }
 
         //////////////////////////////////////////////////////////////////////////
         /// Message is put to the logging stream on object destruction (at the
@@ -58,20 +153,160 @@ class Logger
         //////////////////////////////////////////////////////////////////////////
         ~MessagePrinter()
         {
-            m_parent.PutMessage(m_level, m_buf->str());
+            if (!m_line)
+                return;
+
+            m_parent.PutMessage(m_level, m_line->Data(), m_line->Size());
+            if (!m_ownLine)
+                ReleaseLineBuffer(m_line);
         }
 
         //////////////////////////////////////////////////////////////////////////
-        /// The only useful method here: put something into the stream
+        /// The only useful method here: put something into the stream.
+        /// Strings and numbers are formatted in place, anything else falls
+        /// back to std::ostream formatting.
         //////////////////////////////////////////////////////////////////////////
+        MessagePrinter& operator << (const char* data)
+        {
+            if (m_line)
+            {
+                if (!data)
+                    data = "(null)";
+                m_line->Append(data, std::strlen(data));
+            }
+            return *this;
+        }
+
+        MessagePrinter& operator << (const signed char* data)
+        {
+            return *this << reinterpret_cast<const char*>(data);
+        }
+
+        MessagePrinter& operator << (const unsigned char* data)
+        {
+            return *this << reinterpret_cast<const char*>(data);
+        }
+
+        MessagePrinter& operator << (const std::string& data)
+        {
+            if (m_line)
+                m_line->Append(data.data(), data.size());
+            return *this;
+        }
+
+        MessagePrinter& operator << (char data)
+        {
+            if (m_line)
+                m_line->Append(&data, 1);
+            return *this;
+        }
+
+        // Characters as std::ostream prints them, uint8_t included
+        MessagePrinter& operator << (signed char data)
+        {
+            return *this << static_cast<char>(data);
+        }
+
+        MessagePrinter& operator << (unsigned char data)
+        {
+            return *this << static_cast<char>(data);
+        }
+
+        MessagePrinter& operator << (bool data)
+        {
+            // Same as std::ostream without std::boolalpha
+            return *this << (data ? '1' : '0');
+        }
+
+        MessagePrinter& operator << (const void* data)
+        {
+            if (m_line)
+                AppendFormatted("%p", data);
+            return *this;
+        }
+
+        template<class T>
+        typename std::enable_if<std::is_integral<T>::value, MessagePrinter&>::type
+        operator << (T data)
+        {
+            if (m_line)
+                AppendInteger(data);
+            return *this;
+        }
+
         template<class T>
-        MessagePrinter& operator << (const T& data)
+        typename std::enable_if<std::is_floating_point<T>::value, MessagePrinter&>::type
+        operator << (T data)
         {
-            *m_buf << data;
+            // %g matches the default std::ostream precision and notation
+            if (m_line)
+                AppendFormatted("%g", static_cast<double>(data));
             return *this;
         }
+
+        template<class T>
+        typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_pointer<T>::value
+            && !std::is_array<T>::value, MessagePrinter&>::type
+        operator << (const T& data)
+        {
+            if (m_line)
+            {
+                std::ostringstream buf;
+                buf << data;
+                *this << buf.str();
+            }
+            return *this;
+        }
+
+    private:
+        template<class T>
+        void AppendInteger(T data)
+        {
+            // Digits are produced backwards from the end of the buffer
+            char buf[24];
+            char* end = buf + sizeof(buf);
+            char* begin = end;
+            typename std::make_unsigned<T>::type value = static_cast<typename std::make_unsigned<T>::type>(data);
+            const bool negative = data < 0;
+            if (negative)
+                value = 0 - value;
+            do
+            {
+                *--begin = static_cast<char>('0' + value % 10);
+                value /= 10;
+            } while (value != 0);
+            if (negative)
+                *--begin = '-';
+            m_line->Append(begin, static_cast<size_t>(end - begin));
+        }
+
+        template<class T>
+        void AppendFormatted(const char* format, T data)
+        {
+            char buf[64];
+            const int length = std::snprintf(buf, sizeof(buf), format, data);
+            if (length > 0)
+                m_line->Append(buf, std::min(static_cast<size_t>(length), sizeof(buf) - 1));
+        }
     };
 
+    //////////////////////////////////////////////////////////////////////////
+    /// Printer of the statements below LIS_LOG_MIN_LEVEL: every method is an
+    /// empty inline function, so the whole statement is optimized away
+    //////////////////////////////////////////////////////////////////////////
+    class NullPrinter
+    {
+    public:
+        template<class T>
+        NullPrinter& operator << (const T&)
+        {
+            return *this;
+        }
+    };
+
+    template<LogLevel Level>
+    using Printer = typename std::conditional<(Level >= CompiledLogLevel), MessagePrinter, NullPrinter>::type;
+
 public:
     //////////////////////////////////////////////////////////////////////////
     /// <summary>
@@ -85,9 +320,9 @@ public:
     ///   Put the debug message into the log
     /// </summary>
     //////////////////////////////////////////////////////////////////////////
-    MessagePrinter Debug()
+    Printer<LOG_DEBUG> Debug()
     {
-        return MessagePrinter(*this, LOG_DEBUG);
+        return MakePrinter<LOG_DEBUG>();
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -95,9 +330,9 @@ public:
     ///   Put the informational message into the log
     /// </summary>
     //////////////////////////////////////////////////////////////////////////
-    MessagePrinter Info()
+    Printer<LOG_INFO> Info()
     {
-        return MessagePrinter(*this, LOG_INFO);
+        return MakePrinter<LOG_INFO>();
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -105,9 +340,20 @@ public:
     ///   Put the error message into the log
     /// </summary>
     //////////////////////////////////////////////////////////////////////////
-    MessagePrinter Error()
+    Printer<LOG_ERROR> Error()
     {
-        return MessagePrinter(*this, LOG_ERROR);
+        return MakePrinter<LOG_ERROR>();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Check if a message of the level would be written by any channel.
+    ///   Compiled out levels are rejected at compile time.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    bool IsLevelEnabled(LogLevel level) const
+    {
+        return level >= CompiledLogLevel && level >= m_minLevel.load(std::memory_order_relaxed);
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -129,13 +375,85 @@ public:
     //////////////////////////////////////////////////////////////////////////
     void EnableFileChannel(bool overwrite = true, LogLevel level = LOG_DEBUG);
 
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Switch to the asynchronous mode: the calling threads only push the
+    ///   messages into a bounded queue, a background thread formats them and
+    ///   writes in batches. Should be called before other threads start to
+    ///   log; the channels should be configured before as well.
+    /// </summary>
+    ///
+    /// <param name="capacity"> The queue size, must be a power of two </param>
+    /// <param name="policy"> What to do with a message if the queue is full </param>
+    //////////////////////////////////////////////////////////////////////////
+    void EnableAsyncMode(size_t capacity = 8192, OverflowPolicy policy = OVERFLOW_BLOCK);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Write out all the queued messages and return to the synchronous mode
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void DisableAsyncMode();
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Wait until every message logged before the call is written out
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Flush();
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Get the number of messages discarded due to the queue overflow
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    uint64_t GetDroppedCount() const;
+
 protected:
-    void PutMessage(LogLevel level, const std::string& message);
+    void PutMessage(LogLevel level, const char* message, size_t length);
 
 private:
+    class AsyncWriter;
+    friend class AsyncWriter;
+
     Logger();
-    LogLevel m_consoleLevel;
-    LogLevel m_fileLevel;
+    ~Logger();
+
+    template<LogLevel Level>
+    typename std::enable_if<(Level >= CompiledLogLevel), MessagePrinter>::type MakePrinter()
+    {
+        return MessagePrinter(*this, Level);
+    }
+
+    template<LogLevel Level>
+    typename std::enable_if<(Level < CompiledLogLevel), NullPrinter>::type MakePrinter()
+    {
+        return NullPrinter();
+    }
+
+    static LineBuffer* AcquireLineBuffer();
+    static void ReleaseLineBuffer(LineBuffer* line);
+    void UpdateMinLevel();
+
+    std::atomic<LogLevel> m_consoleLevel;
+    std::atomic<LogLevel> m_fileLevel;
+    std::atomic<LogLevel> m_minLevel;
     std::ofstream m_logFile;
+    std::unique_ptr<AsyncWriter> m_async;
 };
 } // namespace Lis
+
+//////////////////////////////////////////////////////////////////////////
+/// Logging statements for the hot paths. Unlike Logger::Debug() & Co the
+/// arguments are not even evaluated when the level is filtered out, and
+/// the statements below LIS_LOG_MIN_LEVEL compile to nothing at all:
+///
+///     LIS_LOG_DEBUG() << "expensive " << Describe(object);
+//////////////////////////////////////////////////////////////////////////
+#define LIS_LOG_STATEMENT(level, method) \
+    if (!((level) >= ::Lis::CompiledLogLevel && ::Lis::Logger::GetInstance().IsLevelEnabled(level))) ; \
+    else ::Lis::Logger::GetInstance().method()
+
+#define LIS_LOG_DEBUG() LIS_LOG_STATEMENT(::Lis::LOG_DEBUG, Debug)
+#define LIS_LOG_INFO() LIS_LOG_STATEMENT(::Lis::LOG_INFO, Info)
+#define LIS_LOG_ERROR() LIS_LOG_STATEMENT(::Lis::LOG_ERROR, Error)
@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/LoggerBench.cpp
+///
+/// summary:    Throughput benchmark of the synchronous and asynchronous
+///             logging paths
+//////////////////////////////////////////////////////////////////////////
+
+#include "Logger.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+//////////////////////////////////////////////////////////////////////////
+struct BenchResult
+{
+    double producerSeconds;     ///< until every thread has returned from its calls
+    double totalSeconds;        ///< until every message is written out
+    uint64_t dropped;
+};
+
+//////////////////////////////////////////////////////////////////////////
+BenchResult RunProducers(int threads, int messages)
+{
+    Lis::Logger& log = Lis::Logger::GetInstance();
+
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&log, t, messages] {
+            for (int i = 0; i < messages; ++i)
+                log.Info() << "benchmark message " << i << " from thread " << t << ", value " << i * 0.5;
+        });
+    }
+    for (std::thread& producer : producers)
+        producer.join();
+    const Clock::time_point produced = Clock::now();
+
+    log.Flush();
+    const Clock::time_point written = Clock::now();
+
+    BenchResult result;
+    result.producerSeconds = std::chrono::duration<double>(produced - start).count();
+    result.totalSeconds = std::chrono::duration<double>(written - start).count();
+    result.dropped = log.GetDroppedCount();
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void PrintResult(const char* mode, const BenchResult& result, int threads, int messages, bool last)
+{
+    const double total = static_cast<double>(threads) * messages;
+    std::cout << "    {\"mode\": \"" << mode << "\""
+        << ", \"producer_seconds\": " << result.producerSeconds
+        << ", \"total_seconds\": " << result.totalSeconds
+        << ", \"producer_ns_per_message\": " << result.producerSeconds * 1e9 * threads / total
+        << ", \"messages_per_second\": " << total / result.totalSeconds
+        << ", \"dropped\": " << result.dropped << "}" << (last ? "\n" : ",\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+Lis::OverflowPolicy ParsePolicy(const char* name)
+{
+    if (!std::strcmp(name, "block"))
+        return Lis::OVERFLOW_BLOCK;
+    if (!std::strcmp(name, "drop"))
+        return Lis::OVERFLOW_DROP;
+    if (!std::strcmp(name, "count"))
+        return Lis::OVERFLOW_COUNT;
+    throw std::invalid_argument(std::string("unknown overflow policy: ") + name);
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_logger_bench [threads] [messages per thread] [block|drop|count]
+///
+/// Messages go to the log file only, the report is printed as JSON.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const int threads = argc > 1 ? std::atoi(argv[1]) : 4;
+    const int messages = argc > 2 ? std::atoi(argv[2]) : 100000;
+    const Lis::OverflowPolicy policy = argc > 3 ? ParsePolicy(argv[3]) : Lis::OVERFLOW_BLOCK;
+    if (threads <= 0 || messages <= 0)
+        throw std::invalid_argument("thread and message counts must be positive");
+
+    Lis::Logger& log = Lis::Logger::GetInstance();
+    log.EnableConsoleChannel(Lis::LOG_NONE);
+    log.EnableFileChannel(true, Lis::LOG_DEBUG);
+
+    const BenchResult sync = RunProducers(threads, messages);
+
+    log.EnableAsyncMode(8192, policy);
+    const BenchResult async = RunProducers(threads, messages);
+    log.DisableAsyncMode();
+
+    std::cout << "{\n  \"threads\": " << threads << ",\n  \"messages_per_thread\": " << messages
+        << ",\n  \"results\": [\n";
+    PrintResult("sync", sync, threads, messages, false);
+    PrintResult("async", async, threads, messages, true);
+    std::cout << "  ]\n}" << std::endl;
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
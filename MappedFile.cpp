@@ -0,0 +1,141 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/MappedFile.cpp
+///
+/// summary:    Implements the read-only memory mapping of a file
+//////////////////////////////////////////////////////////////////////////
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace Lis
+{
+#ifdef _WIN32
+//////////////////////////////////////////////////////////////////////////
+MappedFile::MappedFile(const std::string& path)
+    : m_path(path)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(nullptr)
+{
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("failed to open " + path);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size))
+    {
+        CloseHandle(m_file);
+        throw std::runtime_error("failed to get the size of " + path);
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::runtime_error("failed to map " + path);
+    }
+    m_data = static_cast<const uint8_t*>(view);
+}
+
+//////////////////////////////////////////////////////////////////////////
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    CloseHandle(m_file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void MappedFile::Prefetch(size_t offset, size_t size) const
+{
+    (void)offset;
+    (void)size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void MappedFile::Release(size_t offset, size_t size) const
+{
+    (void)offset;
+    (void)size;
+}
+#else
+//////////////////////////////////////////////////////////////////////////
+MappedFile::MappedFile(const std::string& path)
+    : m_path(path)
+    , m_data(nullptr)
+    , m_size(0)
+{
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        throw std::runtime_error("failed to open " + path);
+
+    struct stat status;
+    if (fstat(file, &status) != 0)
+    {
+        close(file);
+        throw std::runtime_error("failed to get the size of " + path);
+    }
+    m_size = static_cast<size_t>(status.st_size);
+
+    // The mapping keeps its own reference to the file
+    void* view = m_size ? mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0) : nullptr;
+    close(file);
+    if (view == MAP_FAILED)
+        throw std::runtime_error("failed to map " + path);
+    m_data = static_cast<const uint8_t*>(view);
+}
+
+//////////////////////////////////////////////////////////////////////////
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void MappedFile::Prefetch(size_t offset, size_t size) const
+{
+    // The advice takes whole pages: from the one holding the start
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t first = offset / page * page;
+    const size_t last = std::min(offset + size, m_size);
+    if (m_data && first < last)
+        posix_madvise(const_cast<uint8_t*>(m_data) + first, last - first, POSIX_MADV_WILLNEED);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void MappedFile::Release(size_t offset, size_t size) const
+{
+    // Only the pages entirely in the range: the neighbours may still be read
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t first = (offset + page - 1) / page * page;
+    const size_t last = std::min(offset + size, m_size) / page * page;
+    if (m_data && first < last)
+        madvise(const_cast<uint8_t*>(m_data) + first, last - first, MADV_DONTNEED);
+}
+#endif
+} // namespace Lis
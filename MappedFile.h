@@ -0,0 +1,58 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/MappedFile.h
+///
+/// summary:    Declares the read-only memory mapping of a file
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The whole file mapped read-only. The pages are read by the OS on
+///   first access and shared with the page cache, so nothing is copied
+///   until the data are used.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <exception cref="std::runtime_error"> The file cannot be mapped </exception>
+    //////////////////////////////////////////////////////////////////////////
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+    const std::string& Path() const { return m_path; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Hints for a file streamed through in chunks: Prefetch() has the
+    ///   OS read a range ahead, Release() drops the pages of a range done
+    ///   with from the process, so only the chunks in flight are resident.
+    ///   They stay in the page cache. No-ops where not supported.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Prefetch(size_t offset, size_t size) const;
+    void Release(size_t offset, size_t size) const;
+
+private:
+    std::string m_path;
+    const uint8_t* m_data;
+    size_t m_size;
+#ifdef _WIN32
+    void* m_file;
+    void* m_mapping;
+#endif
+};
+} // namespace Lis
@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/MeshBench.cpp
+///
+/// summary:    Generation time of the sphere meshes on the shared pool
+//////////////////////////////////////////////////////////////////////////
+
+#include "SphereMesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<std::string> SplitSpecs(const std::string& list)
+{
+    std::vector<std::string> specs;
+    std::istringstream stream(list);
+    std::string spec;
+    while (std::getline(stream, spec, ','))
+    {
+        if (!spec.empty())
+            specs.push_back(spec);
+    }
+    return specs;
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_mesh_bench [spec,...] [runs]
+///
+/// Every mesh is generated runs times, the report is printed as JSON
+/// with the best and the median wall time.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const std::vector<std::string> specs = SplitSpecs(argc > 1 ? argv[1] : "uv:1024,uv:4096,ico:6,cube:256");
+    const int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+    if (specs.empty() || runs <= 0)
+        throw std::invalid_argument("need at least one mesh and one run");
+
+    Lis::ThreadPool& pool = Lis::ThreadPool::GetShared();
+    std::cout << "{\n  \"threads\": " << pool.ThreadCount() << ",\n  \"results\": [\n";
+
+    for (size_t s = 0; s < specs.size(); ++s)
+    {
+        const Lis::SphereMeshParams params = Lis::ParseSphereMeshSpec(specs[s]);
+
+        std::vector<double> times;
+        size_t triangles = 0, bytes = 0;
+        for (int run = 0; run < runs; ++run)
+        {
+            const Clock::time_point start = Clock::now();
+            const Lis::SphereMesh mesh = Lis::SphereMesh::Generate(params, pool);
+            times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            triangles = mesh.TriangleCount();
+            bytes = mesh.VertexBytes() + mesh.IndexBytes();
+        }
+        std::sort(times.begin(), times.end());
+
+        std::cout << "    {\"mesh\": \"" << Lis::FormatSphereMeshSpec(params) << "\""
+            << ", \"triangles\": " << triangles
+            << ", \"bytes\": " << bytes
+            << ", \"min_ms\": " << times.front()
+            << ", \"median_ms\": " << times[times.size() / 2]
+            << ", \"mtris_per_sec\": " << triangles / times.front() / 1e3
+            << "}" << (s + 1 == specs.size() ? "\n" : ",\n");
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
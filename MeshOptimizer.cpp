@@ -0,0 +1,346 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/MeshOptimizer.cpp
+///
+/// summary:    Implements the index and vertex reordering
+//////////////////////////////////////////////////////////////////////////
+
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+//////////////////////////////////////////////////////////////////////////
+/// Tuning constants from the Forsyth's paper
+//////////////////////////////////////////////////////////////////////////
+const int MaxCacheSize = 32;
+const float CacheDecayPower = 1.5f;
+const float LastTriangleScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+
+//////////////////////////////////////////////////////////////////////////
+float VertexScore(int cachePosition, uint32_t activeTriangles)
+{
+    // The vertex is not used by any of the remaining triangles
+    if (activeTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The vertices of the last triangle get a fixed score on purpose:
+        // it doesn't matter which of them is used first
+        if (cachePosition < 3)
+        {
+            score = LastTriangleScore;
+        }
+        else
+        {
+            const float scaler = 1.0f / (MaxCacheSize - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, CacheDecayPower);
+        }
+    }
+
+    // Boost the vertices with few triangles left, so lone triangles
+    // do not stay behind to be drawn with a cold cache
+    return score + ValenceBoostScale * std::pow(static_cast<float>(activeTriangles), -ValenceBoostPower);
+}
+
+//////////////////////////////////////////////////////////////////////////
+template<class Index>
+double SimulateFifoCache(const Index* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+    if (indexCount % 3 != 0)
+        throw std::invalid_argument("index count is not a multiple of three");
+    if (indexCount == 0)
+        return 0;
+
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    uint32_t time = static_cast<uint32_t>(cacheSize) + 1;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        const Index v = indices[i];
+        if (v >= vertexCount)
+            throw std::out_of_range("vertex index is out of range");
+        if (time - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = time++;
+            ++misses;
+        }
+    }
+    return static_cast<double>(misses) / (indexCount / 3);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void CheckIndices(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    if (indices.size() % 3 != 0)
+        throw std::invalid_argument("index count is not a multiple of three");
+    for (uint32_t index : indices)
+    {
+        if (index >= vertexCount)
+            throw std::out_of_range("vertex index is out of range");
+    }
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    CheckIndices(indices, vertexCount);
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Vertex -> triangles adjacency in the compressed row form. The first
+    // activeTriangles[v] entries of every row are the not yet emitted ones.
+    std::vector<uint32_t> activeTriangles(vertexCount, 0);
+    for (uint32_t index : indices)
+        ++activeTriangles[index];
+
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + activeTriangles[v];
+
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        vertexScore[v] = VertexScore(-1, activeTriangles[v]);
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]]
+            + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    // The cache holds up to three extra entries while a triangle is added
+    uint32_t cache[MaxCacheSize + 3];
+    int cacheSize = 0;
+    size_t scanCursor = 0;
+    int64_t bestTriangle = -1;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+    {
+        // No candidates around the cache: take the next remaining triangle
+        if (bestTriangle < 0)
+        {
+            while (emitted[scanCursor])
+                ++scanCursor;
+            bestTriangle = static_cast<int64_t>(scanCursor);
+        }
+
+        const size_t triangle = static_cast<size_t>(bestTriangle);
+        const uint32_t* corners = &indices[triangle * 3];
+        emitted[triangle] = true;
+        result.insert(result.end(), corners, corners + 3);
+
+        // Retire the triangle from the adjacency of its vertices
+        for (int c = 0; c < 3; ++c)
+        {
+            const uint32_t v = corners[c];
+            uint32_t* row = &adjacency[offsets[v]];
+            uint32_t* rowEnd = row + activeTriangles[v];
+            uint32_t* found = std::find(row, rowEnd, static_cast<uint32_t>(triangle));
+            assert(found != rowEnd);
+            std::swap(*found, *(rowEnd - 1));
+            --activeTriangles[v];
+        }
+
+        // Move the triangle's vertices to the front of the LRU cache
+        uint32_t newCache[MaxCacheSize + 3];
+        int newCacheSize = 0;
+        for (int c = 0; c < 3; ++c)
+            newCache[newCacheSize++] = corners[c];
+        for (int i = 0; i < cacheSize; ++i)
+        {
+            const uint32_t v = cache[i];
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+                newCache[newCacheSize++] = v;
+        }
+
+        // Rescore everything that was touched, including the evicted vertices
+        for (int i = 0; i < newCacheSize; ++i)
+        {
+            const uint32_t v = newCache[i];
+            cachePosition[v] = i < MaxCacheSize ? i : -1;
+            vertexScore[v] = VertexScore(cachePosition[v], activeTriangles[v]);
+        }
+
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < newCacheSize; ++i)
+        {
+            const uint32_t v = newCache[i];
+            const uint32_t* row = &adjacency[offsets[v]];
+            for (uint32_t a = 0; a < activeTriangles[v]; ++a)
+            {
+                const uint32_t t = row[a];
+                const float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]]
+                    + vertexScore[indices[t * 3 + 2]];
+                triangleScore[t] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        cacheSize = std::min(newCacheSize, MaxCacheSize);
+        std::copy(newCache, newCache + cacheSize, cache);
+    }
+
+    indices.swap(result);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void OptimizeOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t vertexCount)
+{
+    CheckIndices(indices, vertexCount);
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Hard cluster boundaries: the triangles that miss the cache on every
+    // vertex start a new strip anyway, so reordering there costs nothing
+    const size_t cacheSize = 16;
+    std::vector<size_t> clusterStarts;
+    {
+        std::vector<uint32_t> timestamps(vertexCount, 0);
+        uint32_t time = cacheSize + 1;
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            int misses = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                const uint32_t v = indices[t * 3 + c];
+                if (time - timestamps[v] > cacheSize)
+                {
+                    timestamps[v] = time++;
+                    ++misses;
+                }
+            }
+            if (misses == 3 || t == 0)
+                clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    double meshCenter[3] = { 0, 0, 0 };
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+            meshCenter[axis] += positions[v * 3 + axis];
+    }
+    for (int axis = 0; axis < 3; ++axis)
+        meshCenter[axis] /= static_cast<double>(std::max<size_t>(vertexCount, 1));
+
+    // Sort key: how much the cluster faces away from the mesh center.
+    // Outward clusters are drawn first and occlude the inner ones.
+    struct Cluster
+    {
+        size_t begin;
+        size_t end;
+        double key;
+    };
+    std::vector<Cluster> clusters;
+    clusters.reserve(clusterStarts.size() - 1);
+    for (size_t c = 0; c + 1 < clusterStarts.size(); ++c)
+    {
+        double center[3] = { 0, 0, 0 };
+        double normal[3] = { 0, 0, 0 };
+        double totalArea = 0;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+        {
+            const float* p0 = positions + indices[t * 3] * 3;
+            const float* p1 = positions + indices[t * 3 + 1] * 3;
+            const float* p2 = positions + indices[t * 3 + 2] * 3;
+            const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            const double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0] };
+            const double area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                center[axis] += area * (p0[axis] + p1[axis] + p2[axis]) / 3.0;
+                normal[axis] += n[axis];
+            }
+            totalArea += area;
+        }
+
+        double key = 0;
+        const double normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (totalArea > 0 && normalLength > 0)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+                key += (center[axis] / totalArea - meshCenter[axis]) * normal[axis] / normalLength;
+        }
+        clusters.push_back(Cluster{ clusterStarts[c], clusterStarts[c + 1], key });
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+        return a.key > b.key;
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (const Cluster& cluster : clusters)
+        result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+    indices.swap(result);
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    CheckIndices(indices, vertexCount);
+
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertexCount, unused);
+    uint32_t next = 0;
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == unused)
+            remap[index] = next++;
+        index = remap[index];
+    }
+    return remap;
+}
+
+//////////////////////////////////////////////////////////////////////////
+double ComputeAcmr(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize)
+{
+    return ComputeAcmr(indices.data(), indices.size(), vertexCount, cacheSize);
+}
+
+//////////////////////////////////////////////////////////////////////////
+double ComputeAcmr(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+    return SimulateFifoCache(indices, indexCount, vertexCount, cacheSize);
+}
+
+//////////////////////////////////////////////////////////////////////////
+double ComputeAcmr(const uint16_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+    return SimulateFifoCache(indices, indexCount, vertexCount, cacheSize);
+}
+} // namespace Lis
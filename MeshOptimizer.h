@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/MeshOptimizer.h
+///
+/// summary:    Declares the index and vertex reordering for the GPU
+///             post-transform cache, overdraw and vertex fetch
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Reorder the triangles of an indexed triangle list to improve the
+///   post-transform vertex cache hit rate (T. Forsyth, "Linear-Speed
+///   Vertex Cache Optimisation"). Works for any FIFO or LRU cache size.
+/// </summary>
+///
+/// <param name="indices"> The triangle list, reordered in place </param>
+/// <param name="vertexCount"> The number of vertices referenced </param>
+//////////////////////////////////////////////////////////////////////////
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Reorder clusters of a cache-optimized triangle list so the outer,
+///   outward facing ones are drawn first (P. Sander et al., "Fast
+///   Triangle Reordering for Vertex Locality and Reduced Overdraw").
+///   Clusters are split where the cache simulation restarts, so the
+///   vertex cache efficiency is preserved.
+/// </summary>
+///
+/// <param name="indices"> The triangle list, reordered in place </param>
+/// <param name="positions"> XYZ triplets of the vertex positions </param>
+/// <param name="vertexCount"> The number of vertices </param>
+//////////////////////////////////////////////////////////////////////////
+void OptimizeOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t vertexCount);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Renumber the vertices in the order of their first use, so the vertex
+///   fetch walks the buffer linearly.
+/// </summary>
+///
+/// <param name="indices"> The triangle list, renumbered in place </param>
+/// <param name="vertexCount"> The number of vertices </param>
+///
+/// <returns> remap[old index] = new index, unused vertices are dropped
+///           and mapped to UINT32_MAX </returns>
+//////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Average cache miss ratio: transformed vertices per triangle for a
+///   FIFO cache of the given size. 0.5 is the ideal for big grids, 3 is
+///   the worst case.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+double ComputeAcmr(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize = 16);
+double ComputeAcmr(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = 16);
+double ComputeAcmr(const uint16_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = 16);
+} // namespace Lis
@@ -0,0 +1,259 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ModelRecording.cpp
+///
+/// summary:    Implements the checkpoints of the shallow-water model in a
+///             recording
+//////////////////////////////////////////////////////////////////////////
+
+#include "ModelRecording.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace Lis
+{
+namespace
+{
+//////////////////////////////////////////////////////////////////////////
+/// Ahead of the params in the metadata, then their version: each field
+/// on its own, little-endian and of a fixed width, in the order of
+/// WriteParams(). A new field bumps the version and is read after the
+/// others, its default kept by the older versions.
+//////////////////////////////////////////////////////////////////////////
+const char MetadataTag[4] = { 'S', 'W', 'M', 'P' };
+const uint32_t MetadataVersion = 2;     ///< 2: the spectral filter
+
+//////////////////////////////////////////////////////////////////////////
+/// Before the versions: the params as their bytes on x86-64, after the
+/// tag and their size. That of the grid and the planet, version 1 as it
+/// happens, or that with the spectral filter and 4 bytes of padding.
+//////////////////////////////////////////////////////////////////////////
+const char LegacyMetadataTag[4] = { 'S', 'W', 'M', '1' };
+const uint32_t LegacyParamsBytes = 96;
+const uint32_t LegacySpectralParamsBytes = 120;
+
+void PutU32(std::string& out, uint32_t value)
+{
+    for (int byte = 0; byte < 4; ++byte)
+        out.push_back(static_cast<char>((value >> (8 * byte)) & 0xff));
+}
+
+void PutF64(std::string& out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int byte = 0; byte < 8; ++byte)
+        out.push_back(static_cast<char>((bits >> (8 * byte)) & 0xff));
+}
+
+/// Reads the metadata from the front, throws at its end
+class MetadataReader
+{
+public:
+    explicit MetadataReader(const std::string& metadata)
+        : m_metadata(metadata)
+        , m_offset(0)
+    {
+    }
+
+    bool AtEnd() const { return m_offset == m_metadata.size(); }
+
+    bool Tag(const char (&tag)[4])
+    {
+        if (m_metadata.size() < sizeof(tag) || std::memcmp(m_metadata.data(), tag, sizeof(tag)) != 0)
+            return false;
+        m_offset = sizeof(tag);
+        return true;
+    }
+
+    void Skip(size_t bytes)
+    {
+        Take(bytes);
+    }
+
+    uint32_t U32()
+    {
+        const unsigned char* bytes = Take(4);
+        uint32_t value = 0;
+        for (int byte = 0; byte < 4; ++byte)
+            value |= static_cast<uint32_t>(bytes[byte]) << (8 * byte);
+        return value;
+    }
+
+    double F64()
+    {
+        const unsigned char* bytes = Take(8);
+        uint64_t bits = 0;
+        for (int byte = 0; byte < 8; ++byte)
+            bits |= static_cast<uint64_t>(bytes[byte]) << (8 * byte);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+private:
+    const unsigned char* Take(size_t bytes)
+    {
+        if (m_metadata.size() - m_offset < bytes)
+            throw std::runtime_error("not a recording of the weather model");
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(m_metadata.data()) + m_offset;
+        m_offset += bytes;
+        return data;
+    }
+
+    const std::string& m_metadata;
+    size_t m_offset;
+};
+
+void WriteParams(const ShallowWaterParams& params, std::string& out)
+{
+    // Version 1
+    PutU32(out, params.longitudes);
+    PutU32(out, params.latitudes);
+    PutF64(out, params.radius);
+    PutF64(out, params.rotationRate);
+    PutF64(out, params.gravity);
+    PutF64(out, params.meanDepth);
+    PutF64(out, params.timeStep);
+    PutF64(out, params.courantNumber);
+    PutF64(out, params.radiativeTimescale);
+    PutF64(out, params.evaporationTimescale);
+    PutF64(out, params.surfaceHumidity);
+    PutF64(out, params.equatorTemperature);
+    PutF64(out, params.poleTemperature);
+
+    // Version 2
+    PutU32(out, params.spectralTruncation);
+    PutU32(out, params.spectralInterval);
+    PutU32(out, params.spectralOrder);
+    PutF64(out, params.spectralTimescale);
+}
+
+/// The fields of the version 1, the same in the legacy layout
+void ReadGridAndPlanet(MetadataReader& in, ShallowWaterParams& params)
+{
+    params.longitudes = in.U32();
+    params.latitudes = in.U32();
+    params.radius = in.F64();
+    params.rotationRate = in.F64();
+    params.gravity = in.F64();
+    params.meanDepth = in.F64();
+    params.timeStep = in.F64();
+    params.courantNumber = in.F64();
+    params.radiativeTimescale = in.F64();
+    params.evaporationTimescale = in.F64();
+    params.surfaceHumidity = in.F64();
+    params.equatorTemperature = in.F64();
+    params.poleTemperature = in.F64();
+}
+
+/// The fields of the version 2, after the bytes the legacy layout pads with
+void ReadSpectralFilter(MetadataReader& in, ShallowWaterParams& params, size_t padding)
+{
+    params.spectralTruncation = in.U32();
+    params.spectralInterval = in.U32();
+    params.spectralOrder = in.U32();
+    in.Skip(padding);
+    params.spectralTimescale = in.F64();
+}
+
+ShallowWaterParams ReadParams(const std::string& metadata)
+{
+    ShallowWaterParams params;
+    MetadataReader in(metadata);
+    if (in.Tag(MetadataTag))
+    {
+        const uint32_t version = in.U32();
+        if (version == 0)
+            throw std::runtime_error("not a recording of the weather model");
+        if (version > MetadataVersion)
+            throw std::runtime_error("the weather model of the recording is of version " + std::to_string(version)
+                + ", newer than this one");
+        ReadGridAndPlanet(in, params);
+        if (version >= 2)
+            ReadSpectralFilter(in, params, 0);
+    }
+    else if (in.Tag(LegacyMetadataTag))
+    {
+        const uint32_t size = in.U32();
+        if (size != LegacyParamsBytes && size != LegacySpectralParamsBytes)
+            throw std::runtime_error("not a recording of the weather model");
+        ReadGridAndPlanet(in, params);
+        if (size == LegacySpectralParamsBytes)
+            ReadSpectralFilter(in, params, 4);
+    }
+    else
+    {
+        throw std::runtime_error("not a recording of the weather model");
+    }
+    if (!in.AtEnd())
+        throw std::runtime_error("not a recording of the weather model");
+    return params;
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<RecordedField> ModelRecordingFields(const ShallowWaterParams& params)
+{
+    std::vector<RecordedField> fields;
+    for (uint32_t field = 0; field < ShallowWaterModel::StateFieldCount; ++field)
+        fields.push_back(RecordedField{ ShallowWaterModel::StateFieldName(field), params.longitudes, params.latitudes, sizeof(float) });
+    fields.push_back(RecordedField{ "clock", 1, 1, sizeof(ModelClock) });
+    return fields;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::string ModelRecordingMetadata(const ShallowWaterParams& params)
+{
+    std::string metadata(MetadataTag, sizeof(MetadataTag));
+    PutU32(metadata, MetadataVersion);
+    WriteParams(params, metadata);
+    return metadata;
+}
+
+//////////////////////////////////////////////////////////////////////////
+ShallowWaterParams ModelRecordingParams(const RecordingReader& reader)
+{
+    const ShallowWaterParams params = ReadParams(reader.Metadata());
+
+    // The fields must be the ones the params make
+    const std::vector<RecordedField> expected = ModelRecordingFields(params);
+    const std::vector<RecordedField>& fields = reader.Fields();
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        if (i >= fields.size() || fields[i].name != expected[i].name || fields[i].Bytes() != expected[i].Bytes())
+            throw std::runtime_error("the recording does not match its weather model");
+    }
+    return params;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ModelFrame(const ShallowWaterModel& model, ModelClock& clock, const void** fields, size_t* rowStrides)
+{
+    for (uint32_t field = 0; field < ShallowWaterModel::StateFieldCount; ++field)
+    {
+        const GridField& state = model.StateField(field);
+        fields[field] = state.Row(0);
+        rowStrides[field] = state.Pitch() * sizeof(float);
+    }
+    clock.time = model.Time();
+    clock.steps = model.Steps();
+    fields[ShallowWaterModel::StateFieldCount] = &clock;
+    rowStrides[ShallowWaterModel::StateFieldCount] = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RestoreModel(const RecordingReader& reader, uint64_t frame, ShallowWaterModel& model)
+{
+    const ShallowWaterParams params = ModelRecordingParams(reader);
+    if (params.longitudes != model.Params().longitudes || params.latitudes != model.Params().latitudes)
+        throw std::runtime_error("the recording is of another grid");
+
+    ModelClock clock;
+    reader.Read(frame, ShallowWaterModel::StateFieldCount, &clock);
+    model.Restore(clock.time, clock.steps, [&reader, frame](uint32_t field, GridField& state) {
+        reader.Read(frame, field, state.Row(0), state.Pitch() * sizeof(float));
+    });
+}
+} // namespace Lis
@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ModelRecording.h
+///
+/// summary:    Declares the checkpoints of the shallow-water model in a
+///             recording
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Recording.h"
+#include "ShallowWater.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// The clock of the model in a frame, the "clock" field
+//////////////////////////////////////////////////////////////////////////
+struct ModelClock
+{
+    double time;        ///< of the model, s
+    uint64_t steps;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The fields of a recording of the model on the grid: its state in the
+///   order of ShallowWaterModel::StateField(), then the clock. A caller
+///   may append fields of its own after them.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+std::vector<RecordedField> ModelRecordingFields(const ShallowWaterParams& params);
+
+/// The fields of ModelRecordingFields() before the ones of the caller
+const uint32_t ModelRecordingFieldCount = ShallowWaterModel::StateFieldCount + 1;
+
+/// The params of the model, the metadata of its recordings: versioned, little-endian
+std::string ModelRecordingMetadata(const ShallowWaterParams& params);
+
+//////////////////////////////////////////////////////////////////////////
+/// <exception cref="std::runtime_error"> Not a recording of the model </exception>
+//////////////////////////////////////////////////////////////////////////
+ShallowWaterParams ModelRecordingParams(const RecordingReader& reader);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The first ModelRecordingFieldCount pointers and row strides of a
+///   frame of RecordingWriter::WriteFrame(): the fields of the model in
+///   place and the clock, which must outlive the call.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void ModelFrame(const ShallowWaterModel& model, ModelClock& clock, const void** fields, size_t* rowStrides);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Restore the model of the params of the recording from a frame.
+/// </summary>
+/// <exception cref="std::runtime_error"> Not a recording of the model of
+///   these params, or the frame is damaged </exception>
+//////////////////////////////////////////////////////////////////////////
+void RestoreModel(const RecordingReader& reader, uint64_t frame, ShallowWaterModel& model);
+} // namespace Lis
@@ -0,0 +1,559 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Observations.cpp
+///
+/// summary:    Implements the streaming ingestion of scattered
+///             observations and their regridding onto the planet grid
+//////////////////////////////////////////////////////////////////////////
+
+#include "Observations.h"
+#include "MappedFile.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+const char FileMagic[8] = { 'L', 'I', 'S', 'O', 'B', 'S', '\0', '\0' };
+const uint32_t FileVersion = 1;
+
+//////////////////////////////////////////////////////////////////////////
+/// The binary layout, little-endian: the header, then the records
+//////////////////////////////////////////////////////////////////////////
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordBytes;
+    uint64_t count;
+    uint8_t reserved[8];
+};
+
+static_assert(sizeof(FileHeader) == 32, "the observation file header must stay 32 bytes");
+
+//////////////////////////////////////////////////////////////////////////
+double Pow10(int exponent)
+{
+    static const double Exact[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    return exponent <= 22 ? Exact[exponent] : std::pow(10.0, exponent);
+}
+
+bool IsDigit(char c)
+{
+    return static_cast<unsigned>(c - '0') < 10;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The decimal number at p, e.g. -12.5e3, and p past it; false if
+///   there is none. Not correctly rounded in the last bit like strtod,
+///   but it needs no terminator and no locale.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+bool ParseNumber(const char*& p, const char* end, double& value)
+{
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+
+    // Up to 19 significant digits fit the mantissa, the others only scale it
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; s < end && IsDigit(*s); ++s)
+    {
+        any = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            ++exponent;
+        }
+    }
+    if (s < end && *s == '.')
+    {
+        for (++s; s < end && IsDigit(*s); ++s)
+        {
+            any = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any)
+        return false;
+
+    if (s < end && (*s == 'e' || *s == 'E'))
+    {
+        const char* e = s + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+            negativeExponent = *e++ == '-';
+        int power = 0;
+        bool anyExponent = false;
+        for (; e < end && IsDigit(*e); ++e)
+        {
+            anyExponent = true;
+            power = std::min(power * 10 + (*e - '0'), 9999);
+        }
+        if (anyExponent)
+        {
+            exponent += negativeExponent ? -power : power;
+            s = e;
+        }
+    }
+
+    double result = static_cast<double>(mantissa);
+    if (exponent < 0)
+        result /= Pow10(-exponent);
+    else if (exponent > 0)
+        result *= Pow10(exponent);
+    value = negative ? -result : result;
+    p = s;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// A field that is a number and nothing else but blanks
+bool ParseField(const char* p, const char* end, double& value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+    if (!ParseNumber(p, end, value))
+        return false;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p == end;
+}
+
+/// A column of the grid: the longitudes wrap around
+int Wrap(int x, int width)
+{
+    x %= width;
+    return x < 0 ? x + width : x;
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+RegridMethod ParseRegridMethod(const std::string& name)
+{
+    if (name == "nearest")
+        return RegridMethod::Nearest;
+    if (name == "idw")
+        return RegridMethod::InverseDistance;
+    if (name == "bilinear")
+        return RegridMethod::Bilinear;
+    throw std::invalid_argument("unknown regrid method: " + name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+const char* RegridMethodName(RegridMethod method)
+{
+    switch (method)
+    {
+    case RegridMethod::Nearest:
+        return "nearest";
+    case RegridMethod::Bilinear:
+        return "bilinear";
+    default:
+        return "idw";
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void WriteObservationFile(const std::string& path, const Observation* observations, size_t count)
+{
+    FileHeader header = {};
+    std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+    header.version = FileVersion;
+    header.recordBytes = sizeof(Observation);
+    header.count = count;
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("failed to create " + path);
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && (count == 0 || std::fwrite(observations, sizeof(Observation) * count, 1, file) == 1);
+    if (std::fclose(file) != 0 || !written)
+        throw std::runtime_error("failed to write " + path);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Two numbers per cell. Nearest: the squared distance of the closest
+///   observation so far, and its value. The others: the sum of the
+///   weights and the sum of the weighted values. Doubles: a cell may sum
+///   millions of observations.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class ObservationGridder::Accumulator
+{
+public:
+    Accumulator(uint32_t width, uint32_t height, const ObservationParams& params)
+        : m_width(static_cast<int>(width))
+        , m_height(static_cast<int>(height))
+        , m_params(params)
+        , m_nearest(params.method == RegridMethod::Nearest)
+        , m_weights(static_cast<size_t>(width) * height, Empty())
+        , m_sums(static_cast<size_t>(width) * height, 0.0)
+    {
+        // The distances are in degrees of arc, the meridians converge by the cosine
+        m_cosLatitude.resize(height);
+        for (uint32_t y = 0; y < height; ++y)
+            m_cosLatitude[y] = std::cos(((y + 0.5) / height - 0.5) * 3.14159265358979323846);
+
+        // Closer than a hundredth of a cell counts as on the center
+        const double cell = 180.0 / height;
+        m_epsilon = std::pow(0.01 * cell * 0.01 * cell, 0.5 * params.power);
+    }
+
+    /// Whether the observation was in range
+    bool Add(double latitude, double longitude, double value)
+    {
+        if (!(latitude >= -90.0 && latitude <= 90.0) || !std::isfinite(longitude) || !std::isfinite(value))
+            return false;
+
+        double turns = (longitude + 180.0) / 360.0;
+        turns -= std::floor(turns);
+        const double gx = turns * m_width - 0.5;
+        const double gy = (latitude + 90.0) / 180.0 * m_height - 0.5;
+        dirty = true;
+
+        if (m_params.method == RegridMethod::Bilinear)
+        {
+            const int x0 = static_cast<int>(std::floor(gx));
+            const int y0 = static_cast<int>(std::floor(gy));
+            const double fx = gx - x0;
+            const double fy = gy - y0;
+            for (int j = 0; j < 2; ++j)
+            {
+                const int y = y0 + j;
+                if (y < 0 || y >= m_height)
+                    continue;
+                const double wy = j ? fy : 1.0 - fy;
+                for (int i = 0; i < 2; ++i)
+                {
+                    const size_t cell = static_cast<size_t>(y) * m_width + Wrap(x0 + i, m_width);
+                    const double w = wy * (i ? fx : 1.0 - fx);
+                    m_weights[cell] += w;
+                    m_sums[cell] += w * value;
+                }
+            }
+            return true;
+        }
+
+        // The cells within the radius of the one holding the observation
+        const int radius = static_cast<int>(m_params.radius);
+        const int cx = static_cast<int>(std::floor(gx + 0.5));
+        const int cy = std::max(0, std::min(m_height - 1, static_cast<int>(std::floor(gy + 0.5))));
+        const double cellX = 360.0 / m_width * m_cosLatitude[cy];
+        const double cellY = 180.0 / m_height;
+        for (int y = std::max(0, cy - radius); y <= std::min(m_height - 1, cy + radius); ++y)
+        {
+            const double dy = (y - gy) * cellY;
+            double* weights = &m_weights[static_cast<size_t>(y) * m_width];
+            double* sums = &m_sums[static_cast<size_t>(y) * m_width];
+            for (int x = cx - radius; x <= cx + radius; ++x)
+            {
+                const double dx = (x - gx) * cellX;
+                const double distance = dx * dx + dy * dy;
+                const int column = Wrap(x, m_width);
+                if (m_nearest)
+                {
+                    if (distance < weights[column])
+                    {
+                        weights[column] = distance;
+                        sums[column] = value;
+                    }
+                    continue;
+                }
+                const double w = 1.0 / ((m_params.power == 2.0f ? distance : std::pow(distance, 0.5 * m_params.power)) + m_epsilon);
+                weights[column] += w;
+                sums[column] += w * value;
+            }
+        }
+        return true;
+    }
+
+    /// Add the rows of another one and clear them there
+    void Drain(Accumulator& other, uint32_t firstRow, uint32_t lastRow)
+    {
+        const size_t first = static_cast<size_t>(firstRow) * m_width;
+        const size_t last = static_cast<size_t>(lastRow) * m_width;
+        for (size_t cell = first; cell < last; ++cell)
+        {
+            if (m_nearest)
+            {
+                if (other.m_weights[cell] < m_weights[cell])
+                {
+                    m_weights[cell] = other.m_weights[cell];
+                    m_sums[cell] = other.m_sums[cell];
+                }
+            }
+            else
+            {
+                m_weights[cell] += other.m_weights[cell];
+                m_sums[cell] += other.m_sums[cell];
+            }
+            other.m_weights[cell] = other.Empty();
+            other.m_sums[cell] = 0.0;
+        }
+        dirty = true;
+    }
+
+    bool Has(size_t cell) const
+    {
+        return m_nearest ? m_weights[cell] != Empty() : m_weights[cell] > 0.0;
+    }
+
+    float Value(size_t cell) const
+    {
+        return static_cast<float>(m_nearest ? m_sums[cell] : m_sums[cell] / m_weights[cell]);
+    }
+
+    size_t Bytes() const
+    {
+        return (m_weights.size() + m_sums.size()) * sizeof(double);
+    }
+
+    bool dirty = false;
+
+private:
+    double Empty() const
+    {
+        return m_nearest ? std::numeric_limits<double>::infinity() : 0.0;
+    }
+
+    int m_width;
+    int m_height;
+    ObservationParams m_params;
+    bool m_nearest;
+    double m_epsilon;
+    std::vector<double> m_cosLatitude;
+    std::vector<double> m_weights;
+    std::vector<double> m_sums;
+};
+
+//////////////////////////////////////////////////////////////////////////
+ObservationGridder::ObservationGridder(uint32_t width, uint32_t height, const ObservationParams& params)
+    : m_width(width)
+    , m_height(height)
+    , m_params(params)
+{
+    if (width == 0 || height == 0)
+        throw std::invalid_argument("the observation grid must not be empty");
+    if (params.chunkBytes < 4096 || !(params.power > 0.0f))
+        throw std::invalid_argument("invalid observation params");
+    if (params.latitudeColumn == params.longitudeColumn || params.latitudeColumn == params.valueColumn
+        || params.longitudeColumn == params.valueColumn)
+        throw std::invalid_argument("the observation columns must differ");
+
+    m_total = std::make_unique<Accumulator>(width, height, params);
+}
+
+//////////////////////////////////////////////////////////////////////////
+ObservationGridder::~ObservationGridder() = default;
+
+//////////////////////////////////////////////////////////////////////////
+IngestStats ObservationGridder::Ingest(const std::string& path, ThreadPool& pool)
+{
+    LIS_TRACE_ZONE("ObservationGridder::Ingest");
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const MappedFile file(path);
+    IngestStats stats;
+    stats.bytes = file.Size();
+
+    // The binary files are records after the header; the chunks hold whole ones
+    FileHeader header = {};
+    const bool binary = file.Size() >= sizeof(header) && std::memcmp(file.Data(), FileMagic, sizeof(FileMagic)) == 0;
+    size_t dataBegin = 0;
+    size_t dataEnd = file.Size();
+    size_t chunkBytes = m_params.chunkBytes;
+    if (binary)
+    {
+        std::memcpy(&header, file.Data(), sizeof(header));
+        if (header.version != FileVersion || header.recordBytes != sizeof(Observation)
+            || header.count > (file.Size() - sizeof(header)) / sizeof(Observation))
+            throw std::runtime_error("damaged observation file: " + path);
+        dataBegin = sizeof(header);
+        dataEnd = dataBegin + header.count * sizeof(Observation);
+        chunkBytes -= chunkBytes % sizeof(Observation);
+    }
+    const size_t chunks = (dataEnd - dataBegin + chunkBytes - 1) / chunkBytes;
+    stats.chunks = chunks;
+
+    const char* text = reinterpret_cast<const char*>(file.Data());
+    const ObservationParams& params = m_params;
+    const uint32_t lastColumn = std::max(params.latitudeColumn, std::max(params.longitudeColumn, params.valueColumn));
+    std::atomic<uint64_t> observations(0), rejected(0);
+    pool.ParallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+        std::unique_ptr<Accumulator> accumulator = Acquire();
+        uint64_t parsed = 0, bad = 0;
+        for (size_t chunk = first; chunk < last; ++chunk)
+        {
+            const size_t begin = dataBegin + chunk * chunkBytes;
+            const size_t end = std::min(begin + chunkBytes, dataEnd);
+            file.Prefetch(end, chunkBytes);
+
+            if (binary)
+            {
+                for (size_t offset = begin; offset < end; offset += sizeof(Observation))
+                {
+                    Observation observation;
+                    std::memcpy(&observation, file.Data() + offset, sizeof(observation));
+                    if (accumulator->Add(observation.latitude, observation.longitude, observation.value))
+                        ++parsed;
+                    else
+                        ++bad;
+                }
+            }
+            else
+            {
+                // The lines starting in the chunk, the last one read to its end
+                const char* fileEnd = text + dataEnd;
+                const char* p = text + begin;
+                if (begin > 0 && p[-1] != '\n')
+                {
+                    p = static_cast<const char*>(std::memchr(p, '\n', fileEnd - p));
+                    p = p ? p + 1 : fileEnd;
+                }
+                while (p < text + end)
+                {
+                    const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', fileEnd - p));
+                    if (!lineEnd)
+                        lineEnd = fileEnd;
+
+                    double numbers[3] = {};
+                    bool valid = true;
+                    const char* field = p;
+                    for (uint32_t column = 0; column <= lastColumn && valid; ++column)
+                    {
+                        const char* fieldEnd = static_cast<const char*>(std::memchr(field, params.separator, lineEnd - field));
+                        if (!fieldEnd)
+                            fieldEnd = lineEnd;
+                        if (column == params.latitudeColumn)
+                            valid = ParseField(field, fieldEnd, numbers[0]);
+                        else if (column == params.longitudeColumn)
+                            valid = ParseField(field, fieldEnd, numbers[1]);
+                        else if (column == params.valueColumn)
+                            valid = ParseField(field, fieldEnd, numbers[2]);
+                        if (fieldEnd == lineEnd && column < lastColumn)
+                            valid = false;
+                        field = fieldEnd + 1;
+                    }
+
+                    // A blank line is no observation, a bad one is counted
+                    const bool blank = lineEnd - p == 0 || (lineEnd - p == 1 && *p == '\r');
+                    if (valid && accumulator->Add(numbers[0], numbers[1], numbers[2]))
+                        ++parsed;
+                    else if (!blank)
+                        ++bad;
+                    p = lineEnd + 1;
+                }
+            }
+            file.Release(begin, end - begin);
+        }
+        observations += parsed;
+        rejected += bad;
+        Return(std::move(accumulator));
+    });
+
+    // The grids of the tasks into the total, by bands of rows
+    std::vector<Accumulator*> used;
+    for (const std::unique_ptr<Accumulator>& accumulator : m_free)
+    {
+        if (accumulator->dirty)
+            used.push_back(accumulator.get());
+    }
+    pool.ParallelFor(0, m_height, 4, [&](size_t first, size_t last) {
+        for (Accumulator* accumulator : used)
+            m_total->Drain(*accumulator, static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+    });
+    for (Accumulator* accumulator : used)
+        accumulator->dirty = false;
+
+    stats.observations = observations;
+    stats.rejected = rejected;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ObservationGridder::Add(const Observation* observations, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        m_total->Add(observations[i].latitude, observations[i].longitude, observations[i].value);
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t ObservationGridder::Resolve(GridField& field, ThreadPool& pool)
+{
+    LIS_TRACE_ZONE("ObservationGridder::Resolve");
+    if (field.Width() != m_width || field.Height() != m_height)
+        field = GridField(m_width, m_height);
+
+    std::atomic<size_t> filled(0);
+    pool.ParallelFor(0, m_height, 4, [&](size_t first, size_t last) {
+        size_t cells = 0;
+        for (size_t y = first; y < last; ++y)
+        {
+            float* row = field.Row(static_cast<uint32_t>(y));
+            for (uint32_t x = 0; x < m_width; ++x)
+            {
+                const size_t cell = y * m_width + x;
+                const bool has = m_total->Has(cell);
+                row[x] = has ? m_total->Value(cell) : m_params.missing;
+                cells += has;
+            }
+        }
+        filled += cells;
+    });
+    return filled;
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t ObservationGridder::AccumulatorBytes() const
+{
+    return (m_accumulators + 1) * m_total->Bytes();
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::unique_ptr<ObservationGridder::Accumulator> ObservationGridder::Acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_free.empty())
+        {
+            std::unique_ptr<Accumulator> accumulator = std::move(m_free.back());
+            m_free.pop_back();
+            return accumulator;
+        }
+        ++m_accumulators;
+    }
+    return std::make_unique<Accumulator>(m_width, m_height, m_params);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ObservationGridder::Return(std::unique_ptr<Accumulator> accumulator)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_free.push_back(std::move(accumulator));
+}
+} // namespace Lis
@@ -0,0 +1,152 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Observations.h
+///
+/// summary:    Declares the streaming ingestion of scattered observations
+///             and their regridding onto the planet grid
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "GridField.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   A value measured at a point, e.g. by a station or a satellite
+///   footprint. Degrees: the latitude north, the longitude east of
+///   Greenwich, any turn.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct Observation
+{
+    float latitude;
+    float longitude;
+    float value;
+};
+
+static_assert(sizeof(Observation) == 12, "Observation is the record of the binary files");
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   How the scattered observations become the values of the cells
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+enum class RegridMethod
+{
+    Nearest,            ///< the closest observation within the radius
+    InverseDistance,    ///< the observations within the radius, weighted by a power of the distance
+    Bilinear            ///< each observation spread over the four cell centers about it
+};
+
+/// "nearest", "idw" or "bilinear"; throws std::invalid_argument otherwise
+RegridMethod ParseRegridMethod(const std::string& name);
+const char* RegridMethodName(RegridMethod method);
+
+//////////////////////////////////////////////////////////////////////////
+struct ObservationParams
+{
+    RegridMethod method = RegridMethod::InverseDistance;
+    uint32_t radius = 1;            ///< cells about an observation the nearest and idw reach
+    float power = 2.0f;             ///< of the inverse distance
+    float missing = std::numeric_limits<float>::quiet_NaN();    ///< the cells no observation reaches
+
+    // The columns of the text files, from 0; the other columns are skipped
+    char separator = ',';
+    uint32_t latitudeColumn = 0;
+    uint32_t longitudeColumn = 1;
+    uint32_t valueColumn = 2;
+
+    size_t chunkBytes = 8u << 20;   ///< of the file a task parses at once
+};
+
+//////////////////////////////////////////////////////////////////////////
+struct IngestStats
+{
+    uint64_t bytes = 0;
+    uint64_t observations = 0;
+    uint64_t rejected = 0;          ///< the lines that did not parse, e.g. a header, or out of range
+    uint64_t chunks = 0;
+    double seconds = 0.0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Write observations in the binary format Ingest() reads: a 32-byte
+///   header ("LISOBS" and the count) then the records as they are in
+///   memory, little-endian.
+/// </summary>
+/// <exception cref="std::runtime_error"> The file cannot be written </exception>
+//////////////////////////////////////////////////////////////////////////
+void WriteObservationFile(const std::string& path, const Observation* observations, size_t count);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Grids observations onto a width x height lat-lon grid, the layout
+///   of ShallowWaterModel and of the imagery: row 0 at the south pole,
+///   column 0 from 180 degrees west.
+///
+///   Ingest() streams a file through its memory mapping in chunks, each
+///   parsed on the pool straight into a per-task accumulation grid: no
+///   observation is stored, and the pages of a parsed chunk are released,
+///   so the memory is the grids and the chunks in flight whatever the
+///   size of the file. The files are the binary format of
+///   WriteObservationFile() or text, one observation per line.
+///
+///   Any number of files and Add() calls accumulate until Resolve().
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class ObservationGridder
+{
+public:
+    /// Throws std::invalid_argument for an empty grid or invalid params
+    ObservationGridder(uint32_t width, uint32_t height, const ObservationParams& params = ObservationParams());
+    ~ObservationGridder();
+
+    ObservationGridder(const ObservationGridder&) = delete;
+    ObservationGridder& operator=(const ObservationGridder&) = delete;
+
+    const ObservationParams& Params() const { return m_params; }
+
+    /// Throws std::runtime_error if the file cannot be mapped or is a damaged binary one
+    IngestStats Ingest(const std::string& path, ThreadPool& pool = ThreadPool::GetShared());
+
+    void Add(const Observation* observations, size_t count);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The gridded values so far into a field of the grid size; missing
+    ///   where no observation reaches. Returns the cells with a value.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    size_t Resolve(GridField& field, ThreadPool& pool = ThreadPool::GetShared());
+
+    /// The bytes of the accumulation grids, the bound of the memory
+    size_t AccumulatorBytes() const;
+
+private:
+    class Accumulator;
+
+    std::unique_ptr<Accumulator> Acquire();
+    void Return(std::unique_ptr<Accumulator> accumulator);
+
+    uint32_t m_width;
+    uint32_t m_height;
+    ObservationParams m_params;
+    std::unique_ptr<Accumulator> m_total;
+
+    // The grids of the tasks, reused: as many as ran at once
+    std::mutex m_lock;
+    std::vector<std::unique_ptr<Accumulator>> m_free;
+    size_t m_accumulators = 0;
+};
+} // namespace Lis
@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/PackedFormats.h
+///
+/// summary:    Declares the compact vertex attribute encodings
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Convert a float to IEEE 754 half precision (round to nearest even).
+///   Values out of the half range become infinities, NaN stays NaN.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+inline uint16_t PackHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t magnitude = bits & 0x7fffffffu;
+
+    // NaN and infinity
+    if (magnitude >= 0x7f800000u)
+        return static_cast<uint16_t>(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+
+    // Overflow to infinity
+    if (magnitude >= 0x477ff000u)
+        return static_cast<uint16_t>(sign | 0x7c00u);
+
+    // Subnormal halves and zero: let the FPU do the rounding
+    if (magnitude < 0x38800000u)
+    {
+        float absolute;
+        std::memcpy(&absolute, &magnitude, sizeof(absolute));
+        return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::nearbyint(absolute * 16777216.0f)));
+    }
+
+    // Normal numbers: rebias the exponent and round the mantissa to even
+    const uint32_t rounded = magnitude + 0xfffu + ((magnitude >> 13) & 1u);
+    return static_cast<uint16_t>(sign | ((rounded - 0x38000000u) >> 13));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Convert a half precision number back to float
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+inline float UnpackHalf(uint16_t half)
+{
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1fu;
+    const uint32_t mantissa = half & 0x3ffu;
+
+    float result;
+    if (exponent == 0)
+    {
+        result = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -result : result;
+    }
+
+    const uint32_t bits = exponent == 0x1fu
+        ? sign | 0x7f800000u | (mantissa << 13)
+        : sign | ((exponent + 112u) << 23) | (mantissa << 13);
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Encode a unit vector with the octahedral mapping into two signed
+///   normalized 16-bit components (GL_SHORT, normalized). The shader
+///   counterpart is decodeOctahedral() in vertex.shader.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+inline void PackOctahedral(float x, float y, float z, int16_t (&packed)[2])
+{
+    const float invL1 = 1.0f / (std::fabs(x) + std::fabs(y) + std::fabs(z));
+    float u = x * invL1;
+    float v = y * invL1;
+
+    // Fold the lower hemisphere over the diagonals
+    if (z < 0.0f)
+    {
+        const float foldedU = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        const float foldedV = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = foldedU;
+        v = foldedV;
+    }
+
+    packed[0] = static_cast<int16_t>(std::lround(std::fmax(-1.0f, std::fmin(1.0f, u)) * 32767.0f));
+    packed[1] = static_cast<int16_t>(std::lround(std::fmax(-1.0f, std::fmin(1.0f, v)) * 32767.0f));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Decode an octahedral vector, the CPU mirror of decodeOctahedral()
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+inline void UnpackOctahedral(const int16_t (&packed)[2], float (&direction)[3])
+{
+    float x = std::fmax(packed[0] / 32767.0f, -1.0f);
+    float y = std::fmax(packed[1] / 32767.0f, -1.0f);
+    const float z = 1.0f - std::fabs(x) - std::fabs(y);
+    const float t = std::fmax(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+
+    const float invLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+    direction[0] = x * invLength;
+    direction[1] = y * invLength;
+    direction[2] = z * invLength;
+}
+} // namespace Lis
@@ -6,42 +6,303 @@
 
 #include "PlanetWindow.h"
 #include "Logger.h"
+#include "ModelRecording.h"
+#include "PackedFormats.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include "TripleBuffer.h"
 
 #include <QtGui/QScreen>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 #include <QtCore/QFile>
 
+#include <algorithm>
+#include <atomic>
 #include <stdexcept>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
 
 namespace Lis
 {
+namespace
+{
+const double Pi = 3.14159265358979323846;
+
+/// <summary>	Degrees per second of the world time. </summary>
+const double RotationSpeed = 20.0;
+
+/// <summary>	The texture unit of the weather fields, after the ones of the imagery. </summary>
+const int WeatherUnit = 2;
+
+/// <summary>	The distance of the plane of the planets from the eye. </summary>
+const float PlanetDistance = 2.0f;
+
+/// <summary>	The bodies smaller than this on the screen are not drawn, pixels of radius. </summary>
+const float MinBodyPixels = 0.5f;
+
+/// <summary>	The terrain altitudes the mouse wheel reaches, planet radii. </summary>
+const float MinTerrainAltitude = 1e-5f;
+const float MaxTerrainAltitude = 10.0f;
+
+/// <summary>	The frames rendered on after a change for the TAA history to converge,
+/// 			and for the feedback of the virtual texture to come back. </summary>
+const int TaaSettleFrames = 16;
+const int FeedbackSettleFrames = 2;
+
+/// <summary>	A corner of the quad of a planet. </summary>
+struct ImpostorVertex
+{
+    GLfloat corner[2];
+    GLfloat sphere[4];      ///< view-space center and radius
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Four halves per cell: the temperature, K, the relative humidity, and the
+/// 			wind eastward and northward, m/s.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void packWeatherRow(const float* t, const float* q, const float* u, const float* v, uint32_t width, uint16_t* out)
+{
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        out[4 * x] = PackHalf(t[x]);
+        out[4 * x + 1] = PackHalf(q[x] / SaturationHumidity(t[x]));
+        out[4 * x + 2] = PackHalf(u[x]);
+        out[4 * x + 3] = PackHalf(v[x]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void packWeather(const ShallowWaterModel& model, std::vector<uint16_t>& texels)
+{
+    const uint32_t width = model.Temperature().Width();
+    for (uint32_t y = 0; y < model.Temperature().Height(); ++y)
+    {
+        packWeatherRow(model.Temperature().Row(y), model.Humidity().Row(y), model.ZonalWind().Row(y),
+            model.MeridionalWind().Row(y), width, texels.data() + static_cast<size_t>(y) * width * 4);
+    }
+}
+
+/// <summary>	The field of the camera in the recordings, after the ones of the model. </summary>
+const uint32_t CameraField = ModelRecordingFieldCount;
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PlanetRenderMode parsePlanetRenderMode(const QString& name)
+{
+    if (name == "mesh")
+        return PlanetRenderMode::Mesh;
+    if (name == "impostor")
+        return PlanetRenderMode::Impostor;
+    if (name == "terrain")
+        return PlanetRenderMode::Terrain;
+    throw std::invalid_argument("unknown render mode: " + name.toStdString());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QString planetRenderModeName(PlanetRenderMode mode)
+{
+    switch (mode)
+    {
+    case PlanetRenderMode::Impostor:
+        return "impostor";
+    case PlanetRenderMode::Terrain:
+        return "terrain";
+    default:
+        return "mesh";
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The model belongs to the world thread; the texels go to the render thread.
+/// 			Shared with the step function, so it outlives the thread whatever the
+/// 			order of destruction.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct PlanetWindow::Weather
+{
+    explicit Weather(const ShallowWaterParams& params)
+        : model(params)
+        , frames(std::vector<uint16_t>(model.CellCount() * 4))
+    {
+        packWeather(model, frames.WriteBuffer());
+        frames.Publish();
+    }
+
+    ~Weather()
+    {
+        if (!recorder)
+            return;
+        try
+        {
+            recorder->Finish();
+            Logger::GetInstance().Info() << "recorded " << recorder->FrameCount() << " frames, "
+                << recorder->Bytes() / 1048576 << " MB";
+        }
+        catch (const std::exception& e)
+        {
+            Logger::GetInstance().Error() << e.what();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Append the state after a step, every recordEvery steps of the model. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void record(const PlanetState& state)
+    {
+        if (!recorder || model.Steps() % recordEvery != 0)
+            return;
+        try
+        {
+            const void* fields[CameraField + 1];
+            size_t rowStrides[CameraField + 1];
+            ModelClock clock;
+            ModelFrame(model, clock, fields, rowStrides);
+            fields[CameraField] = &state;
+            rowStrides[CameraField] = 0;
+            recorder->WriteFrame(model.Time(), fields, rowStrides);
+        }
+        catch (const std::exception& e)
+        {
+            Logger::GetInstance().Error() << "the recording stopped: " << e.what();
+            recorder.reset();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Show the next frame of the replay, or the one sought; the upload finds
+    /// 			it read ahead by the prefetcher.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void replay(PlanetState& state)
+    {
+        if (replayFailed)
+            return;
+        const int64_t sought = seek.exchange(-1);
+        const uint64_t frame = sought >= 0 ? static_cast<uint64_t>(sought)
+            : static_cast<uint64_t>(replayFrame + 1) % recording->FrameCount();
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        try
+        {
+            // The fields of the model in the order of ShallowWaterModel::StateField()
+            const std::vector<const void*>& fields = prefetcher->Frame(frame);
+            const float* t = static_cast<const float*>(fields[STATE_TEMPERATURE]);
+            const float* q = static_cast<const float*>(fields[STATE_HUMIDITY]);
+            const float* u = static_cast<const float*>(fields[STATE_ZONAL_WIND]);
+            const float* v = static_cast<const float*>(fields[STATE_MERIDIONAL_WIND]);
+            if (!t || !q || !u || !v)
+                throw std::runtime_error("frame " + std::to_string(frame) + " of the recording has no weather");
+
+            const uint32_t width = model.Params().longitudes;
+            std::vector<uint16_t>& texels = frames.WriteBuffer();
+            for (uint32_t y = 0; y < model.Params().latitudes; ++y)
+            {
+                const size_t row = static_cast<size_t>(y) * width;
+                packWeatherRow(t + row, q + row, u + row, v + row, width, texels.data() + row * 4);
+            }
+            frames.Publish();
+            if (fields[CameraField])
+                std::memcpy(&state, fields[CameraField], sizeof(state));
+        }
+        catch (const std::exception& e)
+        {
+            Logger::GetInstance().Error() << "the replay stopped: " << e.what();
+            replayFailed = true;
+            return;
+        }
+        replayFrame = static_cast<int64_t>(frame);
+        if (sought >= 0)
+        {
+            Logger::GetInstance().Info() << "replay at frame " << frame << " of " << recording->FrameCount() << ", "
+                << recording->FrameTime(frame) / 3600.0 << " h of the model, in "
+                << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms";
+        }
+    }
+
+    ShallowWaterModel model;
+    TripleBuffer<std::vector<uint16_t>> frames;
+
+    std::unique_ptr<RecordingWriter> recorder;
+    uint64_t recordEvery = 1;
+
+    std::unique_ptr<RecordingReader> recording;
+    std::unique_ptr<ReplayPrefetcher> prefetcher;
+    std::atomic<int64_t> replayFrame{ -1 };     ///< shown last, -1 before the first
+    std::atomic<int64_t> seek{ -1 };            ///< asked for by the keys, -1 for none
+    bool replayFailed = false;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 PlanetWindow::PlanetWindow()
-    : m_positionBuffer(QOpenGLBuffer::VertexBuffer)
+    : m_vertexBuffer(QOpenGLBuffer::VertexBuffer)
     , m_indexBuffer(QOpenGLBuffer::IndexBuffer)
-    , m_colorBuffer(QOpenGLBuffer::PixelPackBuffer)
     , m_vao(new QOpenGLVertexArrayObject(this))
     , m_program(new QOpenGLShaderProgram(this))
     , m_glLogger(new QOpenGLDebugLogger(this))
+    , m_postProcess(new PostProcess())
+    , m_impostorVertices(QOpenGLBuffer::VertexBuffer)
+    , m_impostorIndices(QOpenGLBuffer::IndexBuffer)
+    , m_terrainAltitude(PlanetDistance / m_radius - 1.0f)
 {
-    generateSphereVertices();
+    // The tessellation runs on the pool while the window is being shown
+    setMeshParams(m_meshParams);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 PlanetWindow::~PlanetWindow()
 {
-    // make sure the context is current when deleting the texture
-    // and the buffers
+    // The render thread still calls render(): stop it first, then make the
+    // context it gives back current here when deleting the texture and the buffers
+    stopRendering();
     setCurrentContext();
+
+    // The profiler outlives the controller its listener feeds
+    profiler().setGpuFrameListener(nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::prepare()
+{
+    // A headless window steps the world itself, by the frame count, to keep the frames reproducible
+    std::shared_ptr<Weather> weather = m_weather;
+    m_world = std::make_unique<FixedStepScheduler<PlanetState>>(1.0 / m_simulationRate, PlanetState{ m_startRotation },
+        [weather](PlanetState& state, double step) {
+            if (weather && weather->prefetcher)
+            {
+                weather->replay(state);
+                return;
+            }
+            state.rotation += RotationSpeed * step;
+            if (weather)
+            {
+                weather->model.Step();
+                weather->record(state);
+                packWeather(weather->model, weather->frames.WriteBuffer());
+                weather->frames.Publish();
+            }
+        });
+    if (!isHeadless())
+        m_world->Start();
+
+    // The JPEG decode or the cache lookup overlaps the context creation and the shaders
+    if (m_tilePackPath.isEmpty())
+    {
+        const bool useCache = m_textureCacheEnabled;
+        m_pendingTexture = ThreadPool::GetShared().Submit([useCache] {
+            return prepareTexture(":/images/land_ocean_ice_2048.jpg", useCache);
+        });
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void PlanetWindow::initialize()
 {
-    assert(!m_texture && "PlanetWindows::initialize seems to be called twice");
+    LIS_TRACE_ZONE("PlanetWindow::initialize");
+    assert(!m_vao->isCreated() && "PlanetWindows::initialize seems to be called twice");
 
     // initialize the logger
     if (m_glLogger->initialize())
@@ -50,146 +311,1090 @@ void PlanetWindow::initialize()
             SLOT(onGLDebugMessage(QOpenGLDebugMessage)), Qt::DirectConnection);
     }
 
-    // load the embedded texture
-    m_texture = std::make_unique<QOpenGLTexture>(QImage(QString(":/images/land_ocean_ice_2048.jpg")));
+    // Link the programs while the workers decode the texture and generate the mesh;
+    // a warm start restores the binaries linked by the previous one
+    ProgramCache programCache;
+    if (m_tilePackPath.isEmpty())
+    {
+        m_programsFromCache += programCache.build(*m_program, { shaderFile(QOpenGLShader::Vertex, "vertex.shader"),
+            shaderFile(QOpenGLShader::Fragment, "fragment.shader") }) ? 1 : 0;
+
+        // Linked up front, so the render mode switches without a hitch
+        m_impostorProgram = std::make_unique<QOpenGLShaderProgram>();
+        m_programsFromCache += programCache.build(*m_impostorProgram, { shaderFile(QOpenGLShader::Vertex, "sphere-vertex.shader"),
+            shaderFile(QOpenGLShader::Fragment, "sphere-fragment.shader") }) ? 1 : 0;
+    }
+    else
+    {
+        // stream the imagery; the feedback program shares the vertex layout
+        m_virtualTexture = std::make_unique<VirtualTexture>(m_tilePackPath);
+        m_virtualTexture->initialize();
 
-    // load and link the shader program
-    loadShader(QOpenGLShader::Vertex, "/vertex.shader");
-    loadShader(QOpenGLShader::Fragment, "/fragment.shader");
-    if (!m_program->link())
-        throw std::runtime_error("failed to link shader program: " +
-            m_program->log().toStdString());
+        m_feedbackProgram = std::make_unique<QOpenGLShaderProgram>();
+        m_programsFromCache += programCache.build(*m_program, { shaderFile(QOpenGLShader::Vertex, "vertex.shader"),
+            shaderFile(QOpenGLShader::Fragment, "vt-fragment.shader") }) ? 1 : 0;
+        m_programsFromCache += programCache.build(*m_feedbackProgram, { shaderFile(QOpenGLShader::Vertex, "vertex.shader"),
+            shaderFile(QOpenGLShader::Fragment, "vt-feedback.shader") }) ? 1 : 0;
+    }
 
     m_matrixUniform = m_program->uniformLocation("matrix");
     m_textureUniform = m_program->uniformLocation("texture");
+    m_radiusUniform = m_program->uniformLocation("radius");
 
     // Create VAO for the first object to render
     m_vao->create();
     // Setup VBO and IBO. These will be remembered by the currently bound VAO
     m_vao->bind();
 
-    // VBO
-    m_positionBuffer.create();
-    m_positionBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    m_positionBuffer.bind();
-    const int posBufSize = static_cast<int>(m_vertices.size() * 3 * sizeof(float));
-    m_positionBuffer.allocate(m_vertices.data(), posBufSize);
+    // One interleaved VBO: octahedral normal (2 x snorm16) + UV (2 x half).
+    // The data arrive in uploadMesh() when the generator is done.
+    m_vertexBuffer.create();
+    m_vertexBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_vertexBuffer.bind();
 
-    m_program->enableAttributeArray("vertexPosition");
-    m_program->setAttributeBuffer("vertexPosition", GL_FLOAT, 0, 3);
+    const int stride = static_cast<int>(sizeof(PackedVertex));
+    m_program->enableAttributeArray("octNormal");
+    m_program->setAttributeBuffer("octNormal", GL_SHORT, offsetof(PackedVertex, normal), 2, stride);
+    m_program->enableAttributeArray("texCoord");
+    m_program->setAttributeBuffer("texCoord", GL_HALF_FLOAT, offsetof(PackedVertex, texCoord), 2, stride);
 
     // IBO
     m_indexBuffer.create();
     m_indexBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
     m_indexBuffer.bind();
-    const int idxBufSize = static_cast<int>(m_indexes.size() * sizeof(GLuint));
-    m_indexBuffer.allocate(m_indexes.data(), idxBufSize);
 
-    m_colorBuffer.create();
-    m_colorBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    m_colorBuffer.bind();
-    const int colorBufSize = static_cast<int>(m_texCoords.size() * 2 * sizeof(float));
-    m_colorBuffer.allocate(m_texCoords.data(), colorBufSize);
+    m_vao->release();
 
-    m_program->enableAttributeArray("texCoord");
-    m_program->setAttributeBuffer("texCoord", GL_FLOAT, 0, 4);
+    if (m_impostorProgram)
+    {
+        // The quads arrive in uploadImpostors() once the layout is known
+        m_impostorVao = std::make_unique<QOpenGLVertexArrayObject>();
+        m_impostorVao->create();
+        m_impostorVao->bind();
+        m_impostorVertices.create();
+        m_impostorVertices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_impostorVertices.bind();
+        const int impostorStride = static_cast<int>(sizeof(ImpostorVertex));
+        m_impostorProgram->enableAttributeArray("corner");
+        m_impostorProgram->setAttributeBuffer("corner", GL_FLOAT, offsetof(ImpostorVertex, corner), 2, impostorStride);
+        m_impostorProgram->enableAttributeArray("sphere");
+        m_impostorProgram->setAttributeBuffer("sphere", GL_FLOAT, offsetof(ImpostorVertex, sphere), 4, impostorStride);
+        m_impostorIndices.create();
+        m_impostorIndices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_impostorIndices.bind();
+        m_impostorVao->release();
+    }
+
+    if (m_weather)
+    {
+        const ShallowWaterParams& params = m_weather->model.Params();
+        m_weatherTexture = std::make_unique<FieldTexture>(QSize(params.longitudes, params.latitudes), FieldFormat::RGBA16F);
+        m_weatherTexture->initialize();
+    }
+
+    if (m_particleCount > 0)
+    {
+        if (!m_weather)
+            throw std::runtime_error("the wind particles need the weather simulation");
+        WindParticleParams params;
+        params.count = m_particleCount;
+        m_windParticles = std::make_unique<WindParticles>(params);
+        m_windParticles->initialize(shaderFile(QOpenGLShader::Compute, "particle-compute.shader"),
+            { shaderFile(QOpenGLShader::Vertex, "particle-vertex.shader"),
+                shaderFile(QOpenGLShader::Fragment, "particle-fragment.shader") });
+    }
+
+    if (m_pendingTexture.valid())
+        uploadPendingTexture();
+
+    m_postProcess->initialize(shaderFile(QOpenGLShader::Vertex, "post-vertex.shader"),
+        shaderFile(QOpenGLShader::Fragment, "fxaa-fragment.shader"), shaderFile(QOpenGLShader::Fragment, "taa-fragment.shader"));
+
+    // The sphere is convex: with the back faces culled nothing is overdrawn
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setMeshParams(const SphereMeshParams& params)
+{
+    // A mesh still being generated is simply dropped when it is done
+    m_meshParams = params;
+    m_meshRequested = std::chrono::steady_clock::now();
+    m_pendingMesh = SphereMesh::GenerateAsync(params);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setRenderMode(PlanetRenderMode mode)
+{
+    if (mode != PlanetRenderMode::Mesh && !m_tilePackPath.isEmpty())
+        throw std::invalid_argument("the " + planetRenderModeName(mode).toStdString() + " cannot draw the imagery of a tile pack");
+    m_renderMode = mode;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PlanetRenderMode PlanetWindow::renderMode() const
+{
+    return m_renderMode;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setAntiAliasing(AntiAliasing mode)
+{
+    m_postProcess->setAntiAliasing(mode);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+AntiAliasing PlanetWindow::antiAliasing() const
+{
+    return m_postProcess->antiAliasing();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const PostProcess& PlanetWindow::postProcess() const
+{
+    return *m_postProcess;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setDynamicResolution(const DynamicResolutionParams& params)
+{
+    m_dynamicResolution = std::make_unique<DynamicResolution>(params);
+
+    // The times arrive frames late, before the frame that uses the new scale
+    DynamicResolution* controller = m_dynamicResolution.get();
+    FrameScheduler* scheduler = &frameScheduler();
+    profiler().setGpuFrameListener([controller, scheduler](double gpuMs) {
+        if (controller->AddFrame(gpuMs))
+        {
+            scheduler->Invalidate(FRAME_SURFACE);
+            Logger::GetInstance().Info() << "resolution scale " << controller->Scale() << ": gpu "
+                << controller->AverageMs() << " ms for a budget of " << controller->Params().budgetMs << " ms";
+        }
+    });
+    profiler().setEnabled(true);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const DynamicResolution* PlanetWindow::dynamicResolution() const
+{
+    return m_dynamicResolution.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QSize PlanetWindow::renderSize() const
+{
+    return m_renderSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setFrame(int frame)
+{
+    if (frame < 0)
+        throw std::invalid_argument("the frame must not be negative");
+    m_frame = frame;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int PlanetWindow::frame() const
+{
+    return m_frame;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setPlanetCount(int count)
+{
+    if (count < 1)
+        throw std::invalid_argument("at least one planet must be drawn");
+    m_planetCount = count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int PlanetWindow::planetCount() const
+{
+    return m_planetCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setBodyCount(int count)
+{
+    if (count < 0)
+        throw std::invalid_argument("the body count must not be negative");
+    if (count == 0)
+    {
+        m_system.reset();
+        m_visibleBodies.clear();
+        return;
+    }
+
+    m_system = std::make_unique<PlanetarySystem>(PlanetarySystem::Generate(count, BodyRenderer::Layers));
+
+    // The layers are decoded on the pool from now on, the program is linked by the first frame
+    if (!m_bodyRenderer)
+        m_bodyRenderer = std::make_unique<BodyRenderer>();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int PlanetWindow::bodyCount() const
+{
+    return m_system ? static_cast<int>(m_system->BodyCount()) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t PlanetWindow::visibleBodies() const
+{
+    return m_visibleBodies.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int PlanetWindow::bodyDrawCalls() const
+{
+    return m_system && m_bodyRenderer ? m_bodyRenderer->drawCalls() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setTerrainAltitude(float altitude)
+{
+    if (!(altitude > 0.0f))
+        throw std::invalid_argument("the terrain altitude must be positive");
+    m_terrainAltitude = altitude;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+float PlanetWindow::terrainAltitude() const
+{
+    return m_terrainAltitude;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const Terrain* PlanetWindow::terrain() const
+{
+    return m_terrain.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const TerrainRenderer* PlanetWindow::terrainRenderer() const
+{
+    return m_terrainRenderer.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setTilePack(const QString& path)
+{
+    assert(!m_vao->isCreated() && "PlanetWindow::setTilePack must be called before initialize");
+    if (m_renderMode != PlanetRenderMode::Mesh)
+        throw std::invalid_argument("the " + planetRenderModeName(m_renderMode).toStdString() + " cannot draw the imagery of a tile pack");
+    m_tilePackPath = path;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setTextureCacheEnabled(bool enabled)
+{
+    assert(!m_vao->isCreated() && "PlanetWindow::setTextureCacheEnabled must be called before initialize");
+    m_textureCacheEnabled = enabled;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setSimulationRate(double hertz)
+{
+    assert(!m_world && "PlanetWindow::setSimulationRate must be called before the first frame");
+    if (!(hertz > 0.0))
+        throw std::invalid_argument("the simulation rate must be positive");
+    m_simulationRate = hertz;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setWeather(const ShallowWaterParams& params)
+{
+    assert(!m_world && "PlanetWindow::setWeather must be called before the first frame");
+    m_weather = std::make_shared<Weather>(params);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setRecording(const QString& path, RecordingCodec codec, int every)
+{
+    assert(!m_world && "PlanetWindow::setRecording must be called before the first frame");
+    if (!m_weather || m_weather->prefetcher)
+        throw std::runtime_error("the recording needs the weather simulation");
+    if (every <= 0)
+        throw std::invalid_argument("the recording must keep every first or later step");
+
+    std::vector<RecordedField> fields = ModelRecordingFields(m_weather->model.Params());
+    fields.push_back(RecordedField{ "camera", 1, 1, sizeof(PlanetState) });
+    RecordingOptions options;
+    options.codec = codec;
+    m_weather->recorder = std::make_unique<RecordingWriter>(path.toStdString(), fields, options,
+        ModelRecordingMetadata(m_weather->model.Params()));
+    m_weather->recordEvery = static_cast<uint64_t>(every);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setReplay(const QString& path)
+{
+    assert(!m_world && "PlanetWindow::setReplay must be called before the first frame");
+    std::unique_ptr<RecordingReader> recording = std::make_unique<RecordingReader>(path.toStdString());
+    if (recording->FrameCount() == 0)
+        throw std::runtime_error("the recording " + path.toStdString() + " has no frame");
+
+    m_weather = std::make_shared<Weather>(ModelRecordingParams(*recording));
+    m_weather->prefetcher = std::make_unique<ReplayPrefetcher>(*recording);
+    m_weather->recording = std::move(recording);
+    Logger::GetInstance().Info() << "replaying " << m_weather->recording->FrameCount() << " frames of "
+        << path.toStdString() << ", " << m_weather->recording->Bytes() / 1048576 << " MB";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::restoreCheckpoint(const QString& path)
+{
+    assert(!m_world && "PlanetWindow::restoreCheckpoint must be called before the first frame");
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const RecordingReader recording(path.toStdString());
+    if (recording.FrameCount() == 0)
+        throw std::runtime_error("the recording " + path.toStdString() + " has no frame");
+
+    const uint64_t frame = recording.FrameCount() - 1;
+    m_weather = std::make_shared<Weather>(ModelRecordingParams(recording));
+    RestoreModel(recording, frame, m_weather->model);
+    packWeather(m_weather->model, m_weather->frames.WriteBuffer());
+    m_weather->frames.Publish();
+
+    const int camera = recording.FieldIndex("camera");
+    if (camera >= 0 && recording.Fields()[camera].Bytes() == sizeof(PlanetState) && recording.Has(frame, camera))
+    {
+        PlanetState state;
+        recording.Read(frame, camera, &state);
+        m_startRotation = state.rotation;
+    }
+    Logger::GetInstance().Info() << "restored step " << m_weather->model.Steps() << " from " << path.toStdString() << " in "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+IngestStats PlanetWindow::setObservations(const QString& path, RegridMethod method)
+{
+    assert(!m_world && "PlanetWindow::setObservations must be called before the first frame");
+    if (!m_weather || m_weather->prefetcher)
+        throw std::runtime_error("the observations need the weather simulation");
+
+    const ShallowWaterParams& params = m_weather->model.Params();
+    ObservationParams observationParams;
+    observationParams.method = method;
+    ObservationGridder gridder(params.longitudes, params.latitudes, observationParams);
+    const IngestStats stats = gridder.Ingest(path.toStdString());
+
+    GridField observed(params.longitudes, params.latitudes);
+    const size_t filled = gridder.Resolve(observed);
+    m_weather->model.AssimilateTemperature(observed);
+    packWeather(m_weather->model, m_weather->frames.WriteBuffer());
+    m_weather->frames.Publish();
+
+    Logger::GetInstance().Info() << "observations " << path.toStdString() << ": " << stats.observations << " gridded by "
+        << RegridMethodName(method) << " onto " << filled << " cells, " << stats.rejected << " rejected, "
+        << stats.bytes / stats.seconds / 1e6 << " MB/s";
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const FieldTexture* PlanetWindow::weatherTexture() const
+{
+    return m_weatherTexture.get();
+}
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setWindParticles(int count)
+{
+    assert(!m_world && "PlanetWindow::setWindParticles must be called before the first frame");
+    if (count < 0)
+        throw std::invalid_argument("the wind particles must not be negative");
+    m_particleCount = count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const WindParticles* PlanetWindow::windParticles() const
+{
+    return m_windParticles.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::setCellOrder(uint32_t order)
+{
+    m_cellIndex = SphereIndex(order);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const SphereIndex& PlanetWindow::cellIndex() const
+{
+    return m_cellIndex;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PlanetPick PlanetWindow::pick(const QPoint& pixel) const
+{
+    PlanetPick result;
+    const QSize size = framebufferSize();
+    if (!m_pickable || size.isEmpty())
+        return result;
+
+    // The ray through the center of the pixel, in the view space of the planets
+    const float x = 2.0f * (pixel.x() + 0.5f) / size.width() - 1.0f;
+    const float y = 1.0f - 2.0f * (pixel.y() + 0.5f) / size.height();
+    const QMatrix4x4 inverse = m_pickCamera.inverted();
+    const QVector3D origin = inverse.map(QVector3D(x, y, -1.0f));
+    const QVector3D ray = (inverse.map(QVector3D(x, y, 1.0f)) - origin).normalized();
+
+    // The nearest sphere in front of the eye
+    float nearest = std::numeric_limits<float>::max();
+    QVector3D surface;
+    for (size_t i = 0; i < m_planets.size(); ++i)
+    {
+        const QVector3D center = m_planets[i].toVector3D();
+        const float radius = m_planets[i].w();
+        const QVector3D offset = origin - center;
+        const float b = QVector3D::dotProduct(offset, ray);
+        const float discriminant = b * b - (offset.lengthSquared() - radius * radius);
+        if (discriminant < 0.0f)
+            continue;
+        const float distance = -b - std::sqrt(discriminant);
+        if (distance < 0.0f || distance >= nearest)
+            continue;
+        nearest = distance;
+        result.planet = static_cast<int>(i);
+        surface = (origin + ray * distance - center) / radius;
+    }
+    if (result.planet < 0)
+        return result;
+
+    // Back to the frame of the planet, where the cells are: the spin is a rotation
+    const QVector3D local = m_pickSpin.transposed().mapVector(surface);
+    const float direction[3] = { local.x(), local.y(), local.z() };
+    result.latitude = std::asin(std::max(-1.0f, std::min(1.0f, local.y())));
+    result.longitude = std::atan2(-local.z(), local.x());
+    result.cell = m_cellIndex.CellOf(direction);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const TextureLoadInfo& PlanetWindow::textureLoadInfo() const
+{
+    return m_textureLoadInfo;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int PlanetWindow::programsFromCache() const
+{
+    return m_programsFromCache;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const VirtualTexture* PlanetWindow::virtualTexture() const
+{
+    return m_virtualTexture.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const SphereMesh& PlanetWindow::mesh() const
+{
+    return m_mesh;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+double PlanetWindow::meshGenerationTime() const
+{
+    return m_meshGenerationTime;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::uploadMesh()
+{
+    LIS_TRACE_ZONE("PlanetWindow::uploadMesh");
+    // Rethrows the generator errors, e.g. an oversized mesh
+    m_mesh = m_pendingMesh.get();
+    m_meshGenerationTime = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - m_meshRequested).count();
+
+    m_vertexBuffer.bind();
+    m_vertexBuffer.allocate(m_mesh.Vertices().data(), static_cast<int>(m_mesh.VertexBytes()));
+    m_vertexBuffer.release();
+
+    // The element array binding belongs to the VAO
+    m_vao->bind();
+    m_indexBuffer.bind();
+    m_indexBuffer.allocate(m_mesh.IndexData(), static_cast<int>(m_mesh.IndexBytes()));
     m_vao->release();
+
+    Logger::GetInstance().Info() << "sphere mesh " << FormatSphereMeshSpec(m_meshParams) << ": "
+        << m_mesh.Vertices().size() << " vertices, " << m_mesh.TriangleCount() << " triangles, "
+        << (m_mesh.HasShortIndices() ? 16 : 32) << "-bit indices, ready in " << m_meshGenerationTime << " ms";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::uploadPendingTexture()
+{
+    // Rethrows the read and decode errors
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PreparedTexture prepared = m_pendingTexture.get();
+    const double waitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    m_texture = uploadTexture(prepared, &m_textureLoadInfo);
+    Logger::GetInstance().Info() << "waited " << waitMs << " ms for the texture";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::uploadWeather()
+{
+    LIS_TRACE_ZONE("PlanetWindow::uploadWeather");
+    // A new model state changes every texel; the texture takes whatever the ring holds per frame
+    if (m_weather->frames.Update())
+        m_weatherTexture->markAllDirty();
+
+    const std::vector<uint16_t>& texels = m_weather->frames.ReadBuffer();
+    const size_t width = static_cast<size_t>(m_weatherTexture->size().width());
+    m_weatherTexture->update([&texels, width](const QRect& tile, uchar* out, int stride) {
+        for (int y = 0; y < tile.height(); ++y)
+        {
+            std::memcpy(out + y * stride, texels.data() + ((tile.y() + y) * width + tile.x()) * 4,
+                tile.width() * 4 * sizeof(uint16_t));
+        }
+    });
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void PlanetWindow::render()
 {
-    const qreal retinaScale = devicePixelRatio();
-    glViewport(0, 0, width() * retinaScale, height() * retinaScale);
+    LIS_TRACE_ZONE("PlanetWindow::render");
+    // The interactive window keeps drawing while the mesh is generated;
+    // a headless one measures the frames of the requested mesh only
+    if (m_pendingMesh.valid())
+    {
+        if (isHeadless() || m_pendingMesh.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            ProfileZone zone(profiler(), "mesh upload");
+            uploadMesh();
+        }
+    }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // The scene is rendered at the scale the GPU time allows, the output keeps its size
+    const QSize output = framebufferSize();
+    QSize viewport = output;
+    if (m_dynamicResolution)
+    {
+        const float scale = m_dynamicResolution->Scale();
+        viewport = QSize(std::max(1, static_cast<int>(std::lround(output.width() * scale))),
+            std::max(1, static_cast<int>(std::lround(output.height() * scale))));
+        profiler().setCounter("resolution scale", scale);
+    }
+    m_renderSize = viewport;
+
+    // Place the frame between the last two world states; never waits for the update thread
+    double rotation = 0.0;
+    double worldTime = 0.0;
+    {
+        // Headless, the steps of the world run here
+        ProfileZone zone(profiler(), "world", false);
+        worldTime = isHeadless() ? m_frame / refreshRate() : m_world->WorldTime();
+        if (isHeadless())
+            m_world->AdvanceTo(worldTime);
+        const FixedStepScheduler<PlanetState>::Frame& world = m_world->Latest();
+        const double alpha = world.Alpha(worldTime, m_world->Step());
+        rotation = world.previous.rotation + alpha * (world.current.rotation - world.previous.rotation);
+    }
+    if (m_weatherTexture)
+    {
+        ProfileZone zone(profiler(), "weather upload");
+        uploadWeather();
+    }
+    const bool particlesShown = m_windParticles && !m_system && m_renderMode != PlanetRenderMode::Terrain;
+    if (particlesShown)
+    {
+        // The particles move by the world time, a frame at most a quarter of a second
+        // of it after a stall; the first update only scatters them
+        ProfileZone zone(profiler(), "particle update");
+        const double seconds = m_particleTime < 0.0 ? 0.0 : std::min(std::max(worldTime - m_particleTime, 0.0), 0.25);
+        m_particleTime = worldTime;
+        m_weatherTexture->bind(WeatherUnit);
+        m_windParticles->update(WeatherUnit, static_cast<float>(seconds),
+            static_cast<float>(m_simulationRate * m_weather->model.TimeStep()),
+            static_cast<float>(m_weather->model.Params().radius));
+    }
+
+    // The scene goes to the target of the anti-aliasing, then through its pass to the output
+    m_postProcess->begin(viewport);
+    drawScene(viewport, rotation);
+    {
+        ProfileZone zone(profiler(), "post");
+        m_postProcess->end(outputFramebuffer(), output);
+    }
+    ++m_frame;
+
+    // A change shows fully some frames later; the world steps keep the frames coming anyway
+    if (frameScheduler().FrameChanges() & (FRAME_INPUT | FRAME_SURFACE | FRAME_STREAMING))
+    {
+        m_settleFrames = std::max(antiAliasing() == AntiAliasing::Taa ? TaaSettleFrames : 0,
+            m_virtualTexture ? FeedbackSettleFrames : 0);
+    }
+    else if (m_settleFrames > 0)
+    {
+        --m_settleFrames;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::checkChanges()
+{
+    uint32_t changes = 0;
+    if (m_world && m_world->HasNewFrame())
+        changes |= FRAME_SIMULATION;
+    if (m_pendingMesh.valid() && m_pendingMesh.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        changes |= FRAME_STREAMING;
+    if (m_virtualTexture && m_virtualTexture->loadingTiles() > 0)
+        changes |= FRAME_STREAMING;
+    if (m_terrain && m_renderMode == PlanetRenderMode::Terrain && m_terrain->Stats().pendingPatches > 0)
+        changes |= FRAME_STREAMING;
+    if (m_settleFrames > 0)
+        changes |= FRAME_SETTLING;
+    if (changes)
+        frameScheduler().Invalidate(changes);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::drawScene(const QSize& viewport, double rotation)
+{
+    m_pickable = false;
+    if (m_system)
+    {
+        drawBodies(viewport, rotation / RotationSpeed);
+        return;
+    }
+
+    // The camera, and the rotation every planet shares
+    QMatrix4x4 camera;
+    const float aspect = static_cast<float>(viewport.width()) / std::max(viewport.height(), 1);
+    camera.perspective(60.0f, aspect, 0.1f, 100.0f);
+    QMatrix4x4 spin;
+    spin.rotate(static_cast<float>(std::fmod(rotation, 360.0)), 0, 1, 0);
+    if (m_renderMode == PlanetRenderMode::Terrain)
+    {
+        drawTerrain(viewport, spin);
+        return;
+    }
+    const std::vector<QVector4D>& planets = planetLayout(aspect);
+    const QMatrix4x4 projection = m_postProcess->jitter() * camera;
+    m_pickable = true;
+    m_pickCamera = camera;
+    m_pickSpin = spin;
+
+    // The motion TAA follows: a single planet turns under the pixels, a grid of them
+    // turns about as many centers and is left to the clamp of the history
+    QMatrix4x4 motion = camera;
+    if (planets.size() == 1)
+    {
+        motion.translate(planets.front().toVector3D());
+        motion *= spin;
+    }
+    m_postProcess->setViewProjection(motion);
+
+    if (m_virtualTexture)
+    {
+        // The tiles requested by the previous frames are uploaded first, then this
+        // frame tells which ones it needs
+        {
+            ProfileZone zone(profiler(), "tile upload");
+            m_virtualTexture->update();
+        }
+        ProfileZone zone(profiler(), "feedback");
+        m_virtualTexture->beginFeedback(viewport);
+        if (!m_feedbackProgram->bind())
+            throw std::runtime_error("failed to bind the feedback program to active GL context");
+        m_virtualTexture->setFeedbackUniforms(*m_feedbackProgram);
+        for (const QVector4D& planet : planets)
+        {
+            QMatrix4x4 matrix = projection;
+            matrix.translate(planet.toVector3D());
+            m_feedbackProgram->setUniformValue("matrix", matrix * spin);
+            m_feedbackProgram->setUniformValue("radius", planet.w());
+            drawMesh();
+        }
+        m_feedbackProgram->release();
+        m_virtualTexture->endFeedback();
+    }
+
+    {
+        ProfileZone zone(profiler(), "globe");
+        glViewport(0, 0, viewport.width(), viewport.height());
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (m_renderMode == PlanetRenderMode::Impostor)
+            drawImpostors(projection, spin);
+        else
+            drawMeshes(projection, spin);
+    }
+
+    if (m_windParticles)
+    {
+        // Over the depth of the globes: the far side of every planet is hidden
+        ProfileZone zone(profiler(), "particles");
+        for (const QVector4D& planet : planets)
+        {
+            QMatrix4x4 matrix = projection;
+            matrix.translate(planet.toVector3D());
+            m_windParticles->draw(matrix * spin, planet.w());
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const std::vector<QVector4D>& PlanetWindow::planetLayout(float aspect)
+{
+    if (m_planets.size() == static_cast<size_t>(m_planetCount) && aspect == m_layoutAspect)
+        return m_planets;
+
+    // A grid of square cells in the plane of the single planet, as close to the
+    // shape of the view as the count allows; one planet keeps the full radius
+    const float halfHeight = PlanetDistance * 0.57735027f;     // tan 30: half the vertical field of view
+    const float halfWidth = halfHeight * aspect;
+    const int columns = std::max(1, static_cast<int>(std::lround(std::sqrt(m_planetCount * aspect))));
+    const int rows = (m_planetCount + columns - 1) / columns;
+    const float cell = std::min(2.0f * halfWidth / columns, 2.0f * halfHeight / rows);
+    const float radius = std::min(m_radius, 0.45f * cell);
+
+    m_planets.clear();
+    for (int i = 0; i < m_planetCount; ++i)
+    {
+        const float x = (i % columns - (columns - 1) * 0.5f) * cell;
+        const float y = ((rows - 1) * 0.5f - i / columns) * cell;
+        m_planets.emplace_back(x, y, -PlanetDistance, radius);
+    }
+    m_layoutAspect = aspect;
+    m_impostorsDirty = true;
+    return m_planets;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::uploadImpostors()
+{
+    // Static quads: the camera does not move and the planets only turn about their axes
+    static const GLfloat corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+    std::vector<ImpostorVertex> vertices;
+    std::vector<GLuint> indices;
+    vertices.reserve(m_planets.size() * 4);
+    indices.reserve(m_planets.size() * 6);
+    for (const QVector4D& planet : m_planets)
+    {
+        const GLuint first = static_cast<GLuint>(vertices.size());
+        for (const GLfloat* corner : corners)
+            vertices.push_back(ImpostorVertex{ { corner[0], corner[1] }, { planet.x(), planet.y(), planet.z(), planet.w() } });
+        indices.insert(indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+    }
+
+    m_impostorVertices.bind();
+    m_impostorVertices.allocate(vertices.data(), static_cast<int>(vertices.size() * sizeof(ImpostorVertex)));
+    m_impostorVertices.release();
+
+    m_impostorVao->bind();
+    m_impostorIndices.bind();
+    m_impostorIndices.allocate(indices.data(), static_cast<int>(indices.size() * sizeof(GLuint)));
+    m_impostorVao->release();
+    m_impostorsDirty = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::bindPlanetTextures(QOpenGLShaderProgram& program, int textureUniform)
+{
+    if (m_virtualTexture)
+    {
+        m_virtualTexture->bind(program, 0);
+    }
+    else
+    {
+        // Use texture unit 0
+        m_texture->bind();
+        program.setUniformValue(textureUniform, 0);
+    }
+
+    if (m_weatherTexture)
+        m_weatherTexture->bind(WeatherUnit);
+    program.setUniformValue("weather", WeatherUnit);
+    program.setUniformValue("weatherOpacity", m_weatherTexture ? 1.0f : 0.0f);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::drawMeshes(const QMatrix4x4& projection, const QMatrix4x4& spin)
+{
     if (!m_program->bind())
         throw std::runtime_error("failed to bind the shader program to active GL context");
 
-    m_texture->bind();
+    bindPlanetTextures(*m_program, m_textureUniform);
+    for (const QVector4D& planet : m_planets)
+    {
+        QMatrix4x4 matrix = projection;
+        matrix.translate(planet.toVector3D());
+        m_program->setUniformValue(m_matrixUniform, matrix * spin);
+        m_program->setUniformValue(m_radiusUniform, planet.w());
+        drawMesh();
+    }
+
+    m_program->release();
+}
 
-    // Calculate the rotation matrix
-    QMatrix4x4 matrix;
-    matrix.perspective(60.0f, 4.0f / 3.0f, 0.1f, 100.0f);
-    matrix.translate(0, 0, -2);
-    matrix.rotate(20.0f * m_frame / screen()->refreshRate(), 0, 1, 0);
-    m_program->setUniformValue(m_matrixUniform, matrix);
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::drawImpostors(const QMatrix4x4& projection, const QMatrix4x4& spin)
+{
+    if (m_impostorsDirty)
+        uploadImpostors();
 
-    // Use texture unit 0
-    m_program->setUniformValue(m_textureUniform, 0);
+    if (!m_impostorProgram->bind())
+        throw std::runtime_error("failed to bind the impostor program to active GL context");
 
-    // Draw the mesh
-    m_vao->bind();
-    glDrawElements(GL_TRIANGLE_STRIP, static_cast<GLsizei>(m_indexes.size()), GL_UNSIGNED_INT, 0);
-    m_vao->release();
+    bindPlanetTextures(*m_impostorProgram, m_impostorProgram->uniformLocation("tex"));
+    m_impostorProgram->setUniformValue("projection", projection);
+    m_impostorProgram->setUniformValue("rotation", spin);
+    m_impostorProgram->setUniformValue("color", QVector4D(1, 1, 1, 1));
 
-    m_program->release();
+    // Unlit, as the mesh
+    m_impostorProgram->setUniformValue("lightPos", QVector4D(0, 0, 1, 0));
+    m_impostorProgram->setUniformValue("minLight", 1.0f);
 
-    ++m_frame;
+    // The edge is blended, premultiplied; the quads of the billboards face either way
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_CULL_FACE);
+
+    m_impostorVao->bind();
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(m_planets.size() * 6), GL_UNSIGNED_INT, 0);
+    m_impostorVao->release();
+
+    glEnable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    m_impostorProgram->release();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void PlanetWindow::loadShader(QOpenGLShader::ShaderType type, const std::string& path)
+void PlanetWindow::drawBodies(const QSize& viewport, double time)
 {
-    const QString shaderPath = QCoreApplication::applicationDirPath() + path.c_str();
-    if (!m_program->addCacheableShaderFromSourceFile(type, shaderPath))
-        throw std::runtime_error("failed to compile the shader " + shaderPath.toStdString()
-            + ": " + m_program->log().toStdString());
+    {
+        ProfileZone zone(profiler(), "bodies update", false);
+        m_system->Update(time);
+    }
+
+    // The whole system from above the plane of the orbits
+    const float extent = m_system->Extent();
+    QMatrix4x4 projection;
+    projection.perspective(60.0f, static_cast<float>(viewport.width()) / std::max(viewport.height(), 1), 0.1f, 4.0f * extent);
+    QMatrix4x4 view;
+    view.lookAt(QVector3D(0.0f, 0.6f * extent, 1.6f * extent), QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    const QMatrix4x4 viewProjection = projection * view;
+    m_postProcess->setViewProjection(viewProjection);
+    {
+        ProfileZone zone(profiler(), "culling", false);
+        const float pixelScale = projection(1, 1) * viewport.height() * 0.5f;
+        m_system->Cull(viewProjection.constData(), pixelScale, MinBodyPixels, m_visibleBodies);
+    }
+
+    if (!m_bodyRenderer->isInitialized())
+    {
+        m_bodyRenderer->initialize({ shaderFile(QOpenGLShader::Vertex, "body-vertex.shader"),
+            shaderFile(QOpenGLShader::Fragment, "body-fragment.shader") }, m_vertexBuffer, m_indexBuffer);
+    }
+
+    ProfileZone zone(profiler(), "bodies");
+    glViewport(0, 0, viewport.width(), viewport.height());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_bodyRenderer->draw(m_visibleBodies, m_postProcess->jitter() * viewProjection, m_mesh);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void PlanetWindow::onGLDebugMessage(QOpenGLDebugMessage message)
+void PlanetWindow::drawTerrain(const QSize& viewport, const QMatrix4x4& spin)
 {
-    Logger::GetInstance().Debug() << message.message().toStdString();
+    if (!m_terrain)
+    {
+        m_terrain = std::make_unique<Terrain>(TerrainParams());
+        m_terrainRenderer = std::make_unique<TerrainRenderer>(*m_terrain);
+        m_terrainRenderer->initialize({ shaderFile(QOpenGLShader::Vertex, "terrain-vertex.shader"),
+            shaderFile(QOpenGLShader::Fragment, "terrain-fragment.shader") });
+    }
+
+    // The eye stays above the ground under it, wherever the planet turned; close
+    // to the ground the view tilts from the nadir toward the horizon
+    const QVector3D nadir = spin.transposed().mapVector(QVector3D(0.0f, 0.0f, 1.0f));
+    const float direction[3] = { nadir.x(), nadir.y(), nadir.z() };
+    const float eyeRadius = 1.0f + m_terrain->Elevation(direction) + m_terrainAltitude;
+    const float tilt = 70.0f * (1.0f - std::min(m_terrainAltitude / 0.5f, 1.0f));
+
+    QMatrix4x4 rotation;
+    rotation.rotate(-tilt, 1.0f, 0.0f, 0.0f);
+    QMatrix4x4 modelView;
+    modelView.rotate(-tilt, 1.0f, 0.0f, 0.0f);
+    modelView.translate(0.0f, 0.0f, -eyeRadius * m_radius);
+    modelView *= spin;
+    modelView.scale(m_radius);
+
+    // The near plane follows the altitude, the far one is past the horizon
+    QMatrix4x4 projection;
+    const float aspect = static_cast<float>(viewport.width()) / std::max(viewport.height(), 1);
+    projection.perspective(60.0f, aspect, std::max(0.25f * m_terrainAltitude * m_radius, 1e-6f), (eyeRadius + 1.1f) * m_radius);
+    const QMatrix4x4 matrix = projection * modelView;
+    m_postProcess->setViewProjection(matrix);
+
+    {
+        ProfileZone zone(profiler(), "terrain select", false);
+        const QVector3D eye = modelView.inverted().map(QVector3D(0.0f, 0.0f, 0.0f));
+        const TerrainView view{ matrix.constData(), { eye.x(), eye.y(), eye.z() }, projection(1, 1) * viewport.height() * 0.5f };
+        m_terrain->Select(view, m_terrainPatches);
+
+        // Headless, the frames are reproducible: the requests of a frame are there for the next
+        if (isHeadless())
+            m_terrain->Finish();
+    }
+
+    ProfileZone zone(profiler(), "globe");
+    glViewport(0, 0, viewport.width(), viewport.height());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    QOpenGLShaderProgram& program = m_terrainRenderer->program();
+    if (!program.bind())
+        throw std::runtime_error("failed to bind the terrain program to active GL context");
+    bindPlanetTextures(program, program.uniformLocation("tex"));
+    program.setUniformValue("matrix", m_postProcess->jitter() * matrix);
+
+    // A light over the shoulder of the eye, in the planet frame
+    rotation *= spin;
+    program.setUniformValue("light", rotation.transposed().mapVector(QVector3D(-0.4f, 0.6f, 0.7f).normalized()));
+    program.setUniformValue("minLight", 0.15f);
+
+    m_terrainRenderer->draw(m_terrainPatches);
+    program.release();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void PlanetWindow::generateSphereVertices()
+void PlanetWindow::drawMesh()
 {
-    static float pi = std::atan(1) * 4;
+    m_vao->bind();
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(m_mesh.IndexCount()),
+        m_mesh.HasShortIndices() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, 0);
+    m_vao->release();
+}
 
-    // North pole
-    m_vertices.emplace_back(QVector3D(0, m_radius, 0));
-    m_texCoords.emplace_back(QVector2D(0, 1));
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::seekReplay(int key)
+{
+    // The world thread shows the frame at its next update
+    const int64_t count = static_cast<int64_t>(m_weather->recording->FrameCount());
+    const int64_t step = std::max<int64_t>(count / 10, 1);
+    const int64_t current = std::max<int64_t>(m_weather->replayFrame, 0);
+    m_weather->seek = key == Qt::Key_Home ? 0
+        : key == Qt::Key_Left ? std::max<int64_t>(current - step, 0) : std::min(current + step, count - 1);
+}
 
-    // +1.0f because there's a gap between the poles and the first parallel
-    const float latitudeSpacing = 1.0f / (m_numLatLines + 1.0f);
-    const float longitudeSpacing = 1.0f / (m_numLongLines);
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ShaderFile PlanetWindow::shaderFile(QOpenGLShader::ShaderType type, const char* name) const
+{
+    // The shaders are copied next to the executable
+    return ShaderFile{ type, QCoreApplication::applicationDirPath() + "/" + name };
+}
 
-    for (GLuint latitude = 0; latitude < m_numLatLines; ++latitude)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::keyPressed(int key, Qt::KeyboardModifiers modifiers)
+{
+    try
     {
-        for (GLuint longitude = 0; longitude < m_numLongLines; ++longitude)
+        switch (key)
         {
-            // Scale coordinates into the 0..1 texture coordinate range,
-            // with north at the top (y = 1).
-            const float x = longitude * longitudeSpacing;
-            const float y = 1.0f - (latitude + 1) * latitudeSpacing;
-            m_texCoords.emplace_back(QVector2D(x, y));
-
-            // Convert to spherical coordinates:
-            // theta is a longitude angle (around the equator) in radians;
-            // phi is a latitude angle (north or south of the equator)
-            const float theta = x * 2.0f * pi;
-            const float phi = (y - 0.5f) * pi;
-
-            // This determines the radius of the ring of this line of latitude.
-            // It's widest at the equator, and narrows as phi increases/decreases
-            const float c = std::cos(phi);
-
-            // The current coordinate
-            m_vertices.emplace_back(QVector3D(c * std::cos(theta),
-                std::sin(phi),
-                c * sin(theta)) * m_radius);
-
-            // The indexes of adjacent vertices to draw the triangles
-            m_indexes.push_back(latitude * m_numLongLines + (longitude % m_numLongLines));
-            m_indexes.push_back((latitude + 1) * m_numLongLines + (longitude % m_numLongLines));
+        case Qt::Key_R:
+            setRenderMode(m_renderMode == PlanetRenderMode::Mesh ? PlanetRenderMode::Impostor
+                : m_renderMode == PlanetRenderMode::Impostor ? PlanetRenderMode::Terrain : PlanetRenderMode::Mesh);
+            break;
+        case Qt::Key_Plus:
+            setPlanetCount(std::min(m_planetCount * 4, 1 << 16));
+            break;
+        case Qt::Key_Minus:
+            setPlanetCount(std::max(m_planetCount / 4, 1));
+            break;
+        case Qt::Key_A:
+            setAntiAliasing(static_cast<AntiAliasing>((static_cast<int>(antiAliasing()) + 1) % (static_cast<int>(AntiAliasing::Taa) + 1)));
+            break;
+        case Qt::Key_Left:
+        case Qt::Key_Right:
+        case Qt::Key_Home:
+            if (!m_weather || !m_weather->prefetcher)
+            {
+                GlWindow::keyPressed(key, modifiers);
+                return;
+            }
+            seekReplay(key);
+            return;
+        default:
+            GlWindow::keyPressed(key, modifiers);
+            return;
         }
     }
+    catch (const std::exception& e)
+    {
+        Logger::GetInstance().Error() << e.what();
+        return;
+    }
+    Logger::GetInstance().Info() << "rendering " << m_planetCount << " planets, "
+        << planetRenderModeName(m_renderMode).toStdString() << ", anti-aliasing "
+        << antiAliasingName(antiAliasing()).toStdString();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::wheelTurned(const QPoint& angleDelta)
+{
+    if (m_renderMode != PlanetRenderMode::Terrain)
+    {
+        GlWindow::wheelTurned(angleDelta);
+        return;
+    }
+
+    // A notch is a fifth of the altitude: the approach slows down near the ground
+    const float notches = angleDelta.y() / 120.0f;
+    m_terrainAltitude = std::max(MinTerrainAltitude, std::min(MaxTerrainAltitude,
+        m_terrainAltitude * std::pow(0.8f, notches)));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::mouseClicked(const QPoint& position, Qt::MouseButton button)
+{
+    if (button != Qt::LeftButton)
+    {
+        GlWindow::mouseClicked(position, button);
+        return;
+    }
+
+    const PlanetPick picked = pick(position);
+    if (picked.planet < 0)
+    {
+        Logger::GetInstance().Info() << "no planet at " << position.x() << ", " << position.y();
+        return;
+    }
+
+    const double degrees = 180.0 / Pi;
+    auto line = Logger::GetInstance().Info();
+    line << "planet " << picked.planet << " at " << picked.latitude * degrees << ", " << picked.longitude * degrees
+        << " degrees: cell " << picked.cell << " of order " << m_cellIndex.Order();
+    if (!m_weatherTexture)
+        return;
+
+    // The grid cell of the weather holding the center of the cell; the texels are the ones of the last frame
+    double latitude, longitude;
+    m_cellIndex.Center(picked.cell, latitude, longitude);
+    const int width = m_weatherTexture->size().width();
+    const int height = m_weatherTexture->size().height();
+    const double u = longitude / (2.0 * Pi);
+    const int column = std::min(width - 1, static_cast<int>((u - std::floor(u)) * width));
+    const int row = std::max(0, std::min(height - 1, static_cast<int>((latitude / Pi + 0.5) * height)));
+    const uint16_t* texel = m_weather->frames.ReadBuffer().data() + (static_cast<size_t>(row) * width + column) * 4;
+    line << ", " << UnpackHalf(texel[0]) - 273.15f << " C, humidity " << 100.0f * UnpackHalf(texel[1])
+        << " %, wind " << UnpackHalf(texel[2]) << " m/s east, " << UnpackHalf(texel[3]) << " m/s north";
+}
 
-    // South pole
-    m_vertices.emplace_back(QVector3D(0, -m_radius, 0));
-    m_texCoords.emplace_back(QVector2D(0, 0));
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PlanetWindow::onGLDebugMessage(QOpenGLDebugMessage message)
+{
+    // Debug contexts may report thousands of messages per second: skip
+    // the string conversion entirely if the debug level is filtered out
+    LIS_LOG_DEBUG() << message.message().toStdString();
 }
 } // namespace Lis
@@ -6,18 +6,67 @@
 
 #pragma once
 
+#include "BodyRenderer.h"
+#include "DynamicResolution.h"
+#include "FieldTexture.h"
+#include "FixedStepScheduler.h"
 #include "GlWindow.h"
+#include "Observations.h"
+#include "PlanetarySystem.h"
+#include "PostProcess.h"
+#include "ProgramCache.h"
+#include "Recording.h"
+#include "ShallowWater.h"
+#include "SphereIndex.h"
+#include "SphereMesh.h"
+#include "Terrain.h"
+#include "TerrainRenderer.h"
+#include "TextureCache.h"
+#include "VirtualTexture.h"
+#include "WindParticles.h"
 #include <QtGui/QOpenGLBuffer>
 #include <QtGui/QOpenGLShader>
 #include <QtGui/QOpenGLTexture>
 #include <QtGui/QOpenGLDebugLogger>
 #include <QtGui/QOpenGLVertexArrayObject>
+#include <QtGui/QVector4D>
 
+#include <chrono>
+#include <future>
 #include <memory>
 #include <vector>
 
 namespace Lis
 {
+/// <summary>	The world the update thread advances and the frames interpolate. </summary>
+struct PlanetState
+{
+    double rotation;    ///< degrees about the polar axis
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	How the planets are drawn. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+enum class PlanetRenderMode
+{
+    Mesh,       ///< the tessellated sphere of setMeshParams()
+    Impostor,   ///< a quad per planet, the sphere ray traced per pixel
+    Terrain     ///< a single planet, the level of detail terrain seen from setTerrainAltitude()
+};
+
+/// <summary>	"mesh", "impostor" or "terrain"; throws std::invalid_argument otherwise. </summary>
+PlanetRenderMode parsePlanetRenderMode(const QString& name);
+QString planetRenderModeName(PlanetRenderMode mode);
+
+/// <summary>	What a pixel of the last frame shows. </summary>
+struct PlanetPick
+{
+    int planet = -1;            ///< of the layout, -1 for none
+    double latitude = 0.0;      ///< rad
+    double longitude = 0.0;     ///< rad, east of the meridian of the texture seam
+    CellId cell = 0;            ///< of the cell index
+};
+
 class PlanetWindow : public GlWindow
 {
     Q_OBJECT
@@ -25,37 +74,311 @@ public:
     PlanetWindow();
     virtual ~PlanetWindow();
 
+    void prepare() override;
     void initialize() override;
     void render() override;
 
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Select the tessellation of the globe. The mesh is generated on
+    /// 			the thread pool and replaces the drawn one as soon as it is
+    /// 			ready; a headless window waits for it in the next frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setMeshParams(const SphereMeshParams& params);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Switch between the mesh, the impostor and the terrain, at any time;
+    /// 			R in the window. The impostor and the terrain sample the embedded
+    /// 			texture, they cannot be combined with a tile pack.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setRenderMode(PlanetRenderMode mode);
+    PlanetRenderMode renderMode() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Select how the edges are smoothed, at any time; A in the window.
+    /// 			Off by default.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setAntiAliasing(AntiAliasing mode);
+    AntiAliasing antiAliasing() const;
+
+    /// <summary>	The scene target and its passes. </summary>
+    const PostProcess& postProcess() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Render the scene at a fraction of the output resolution that keeps
+    /// 			the GPU time of the frames within the budget, and stretch it over
+    /// 			the output. The GPU time is the frame of the profiler, which this
+    /// 			enables; without timer queries the scale stays at its maximum. The
+    /// 			scale is the "resolution scale" counter of the profiler.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setDynamicResolution(const DynamicResolutionParams& params);
+
+    /// <summary>	The controller of the scale, null unless set. </summary>
+    const DynamicResolution* dynamicResolution() const;
+
+    /// <summary>	The size the scene was rendered at by the last frame. </summary>
+    QSize renderSize() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The frames rendered. Headless, the world time is the frame over
+    /// 			the refresh rate: setting the frame renders the same world again,
+    /// 			e.g. the reference of an image at another size.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setFrame(int frame);
+    int frame() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Draw the planet that many times, in a grid filling the view; at
+    /// 			any time, + and - in the window. 1 by default.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setPlanetCount(int count);
+    int planetCount() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Draw a planetary system of that many bodies (a star, planets and
+    /// 			moons) instead of the planets, with one instanced draw of the
+    /// 			bodies left by the frustum and the size culling. 0, the default,
+    /// 			draws the planets.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setBodyCount(int count);
+    int bodyCount() const;
+
+    /// <summary>	The bodies drawn by the last frame. </summary>
+    size_t visibleBodies() const;
+
+    /// <summary>	The draw calls of the bodies in the last frame. </summary>
+    int bodyDrawCalls() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The height of the eye above the ground, planet radii, in the
+    /// 			terrain mode; the mouse wheel in the window. The view tilts toward
+    /// 			the horizon close to the ground.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setTerrainAltitude(float altitude);
+    float terrainAltitude() const;
+
+    /// <summary>	The terrain, null until the terrain mode draws a frame. </summary>
+    const Terrain* terrain() const;
+    const TerrainRenderer* terrainRenderer() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Stream the planet imagery from a tile pack instead of the embedded
+    /// 			2048 px texture. Must be called before the first frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setTilePack(const QString& path);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Load the embedded texture from the BC1 cache (the default) or decode
+    /// 			the JPEG every time. Must be called before the first frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setTextureCacheEnabled(bool enabled);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Set the world updates per second, independent of the frame rate
+    /// 			(30 by default). Must be called before the first frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setSimulationRate(double hertz);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Simulate the weather on the grid, one model step per world update,
+    /// 			and overlay the temperature and the clouds on the globe. Must be
+    /// 			called before the first frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setWeather(const ShallowWaterParams& params);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Grid the temperatures of an observation file, text (latitude,
+    /// 			longitude, kelvin per line) or binary, onto the weather and
+    /// 			start from them where they reach. Needs the weather; must be
+    /// 			called before the first frame.
+    /// </summary>
+    /// <exception cref="std::runtime_error">	The file cannot be read. </exception>
+    ////////////////////////////////////////////////////////////////////////////////
+    IngestStats setObservations(const QString& path, RegridMethod method);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Record the weather and the camera after every nth step of the model,
+    /// 			a checkpoint of each; the file is finished when the window closes.
+    /// 			Needs the weather; must be called before the first frame.
+    /// </summary>
+    /// <exception cref="std::runtime_error">	The file cannot be created. </exception>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setRecording(const QString& path, RecordingCodec codec, int every);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Replay a recording instead of simulating: a frame of the weather and
+    /// 			the camera per world update, looping. Left and Right seek a tenth
+    /// 			of it, Home back to the start. Replaces the weather; must be called
+    /// 			before the first frame.
+    /// </summary>
+    /// <exception cref="std::runtime_error">	Not a recording of the weather. </exception>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setReplay(const QString& path);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Simulate on from the last frame of a recording, the weather and the
+    /// 			camera. Replaces the weather; must be called before the first frame.
+    /// </summary>
+    /// <exception cref="std::runtime_error">	Not a recording of the weather. </exception>
+    ////////////////////////////////////////////////////////////////////////////////
+    void restoreCheckpoint(const QString& path);
+
+    /// <summary>	The streamed weather fields, null without the simulation. </summary>
+    const FieldTexture* weatherTexture() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Trace the wind of the weather with that many particles, advected
+    /// 			and drawn on the GPU over the meshes and the impostors. 0, the
+    /// 			default, draws none. Needs the weather and compute shaders. Must
+    /// 			be called before the first frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setWindParticles(int count);
+
+    /// <summary>	The tracers of the wind, null unless set. </summary>
+    const WindParticles* windParticles() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The cells of the surface the picks and the queries are in; order 10
+    /// 			(about 6 km on the Earth) by default.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setCellOrder(uint32_t order);
+    const SphereIndex& cellIndex() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The planet and the point of its surface under a pixel of the
+    /// 			framebuffer, by a ray from the camera of the last frame: the
+    /// 			meshes and the impostors only. On the thread of render(); a left
+    /// 			click logs the pick and the weather of its cell.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    PlanetPick pick(const QPoint& pixel) const;
+
+    /// <summary>	How the embedded texture was loaded. </summary>
+    const TextureLoadInfo& textureLoadInfo() const;
+
+    /// <summary>	The number of programs restored from the binary cache at startup. </summary>
+    int programsFromCache() const;
+
+    /// <summary>	The streamed texture, null unless a tile pack is set. </summary>
+    const VirtualTexture* virtualTexture() const;
+
+    /// <summary>	The mesh being drawn. </summary>
+    const SphereMesh& mesh() const;
+
+    /// <summary>	Wall time from the request to the upload of the mesh, ms. </summary>
+    double meshGenerationTime() const;
+
     public slots:
     void onGLDebugMessage(QOpenGLDebugMessage message);
 
+protected:
+    void keyPressed(int key, Qt::KeyboardModifiers modifiers) override;
+    void wheelTurned(const QPoint& angleDelta) override;
+    void mouseClicked(const QPoint& position, Qt::MouseButton button) override;
+    void checkChanges() override;
+
 private:
-    void loadShader(QOpenGLShader::ShaderType type, const std::string& name);
-    void generateSphereVertices();
+    struct Weather;
+
+    ShaderFile shaderFile(QOpenGLShader::ShaderType type, const char* name) const;
+    void uploadPendingTexture();
+    void uploadMesh();
+    void uploadWeather();
+    void seekReplay(int key);
+    void uploadImpostors();
+    void drawScene(const QSize& viewport, double rotation);
+    const std::vector<QVector4D>& planetLayout(float aspect);
+    void bindPlanetTextures(QOpenGLShaderProgram& program, int textureUniform);
+    void drawMesh();
+    void drawMeshes(const QMatrix4x4& projection, const QMatrix4x4& spin);
+    void drawImpostors(const QMatrix4x4& projection, const QMatrix4x4& spin);
+    void drawBodies(const QSize& viewport, double time);
+    void drawTerrain(const QSize& viewport, const QMatrix4x4& spin);
 
     GLuint m_matrixUniform = 0;
     GLuint m_textureUniform = 0;
+    GLuint m_radiusUniform = 0;
 
-    const GLuint m_numLatLines = 40;
-    const GLuint m_numLongLines = 40;
     const GLfloat m_radius = 0.7f;
 
     /// <summary>   The frame count. </summary>
     int	m_frame = 0;
 
-    std::vector<GLuint> m_indexes;
-    std::vector<QVector3D> m_vertices;
-    std::vector<QVector2D> m_texCoords;
+    /// <summary>   The frames still to render after the last change. </summary>
+    int m_settleFrames = 0;
+
+    double m_simulationRate = 30.0;
+    double m_startRotation = 0.0;       ///< of the world, restored from a checkpoint
+    std::shared_ptr<Weather> m_weather;
+    std::unique_ptr<FixedStepScheduler<PlanetState>> m_world;
+    std::unique_ptr<FieldTexture> m_weatherTexture;
+
+    int m_particleCount = 0;
+    std::unique_ptr<WindParticles> m_windParticles;
+    double m_particleTime = -1.0;       ///< the world time of the last update, negative before it
+
+    SphereIndex m_cellIndex{ 10 };
+    bool m_pickable = false;            ///< whether the last frame drew the planets of the layout
+    QMatrix4x4 m_pickCamera;            ///< of the last frame, without the jitter
+    QMatrix4x4 m_pickSpin;
 
-    QOpenGLBuffer m_positionBuffer;
+    SphereMeshParams m_meshParams;
+    SphereMesh m_mesh;
+    std::future<SphereMesh> m_pendingMesh;
+    std::chrono::steady_clock::time_point m_meshRequested;
+    double m_meshGenerationTime = 0.0;
+
+    QOpenGLBuffer m_vertexBuffer;
     QOpenGLBuffer m_indexBuffer;
-    QOpenGLBuffer m_colorBuffer;
 
     std::unique_ptr<QOpenGLVertexArrayObject> m_vao;
     std::unique_ptr<QOpenGLShaderProgram> m_program;
     std::unique_ptr<QOpenGLDebugLogger> m_glLogger;
     std::unique_ptr<QOpenGLTexture> m_texture;
+    bool m_textureCacheEnabled = true;
+    std::future<PreparedTexture> m_pendingTexture;
+    TextureLoadInfo m_textureLoadInfo;
+    int m_programsFromCache = 0;
+
+    QString m_tilePackPath;
+    std::unique_ptr<VirtualTexture> m_virtualTexture;
+    std::unique_ptr<QOpenGLShaderProgram> m_feedbackProgram;
+
+    std::unique_ptr<PostProcess> m_postProcess;
+    std::unique_ptr<DynamicResolution> m_dynamicResolution;
+    QSize m_renderSize;
+
+    PlanetRenderMode m_renderMode = PlanetRenderMode::Mesh;
+    int m_planetCount = 1;
+    std::vector<QVector4D> m_planets;   ///< view-space center and radius
+    float m_layoutAspect = 0.0f;
+
+    std::unique_ptr<QOpenGLShaderProgram> m_impostorProgram;
+    std::unique_ptr<QOpenGLVertexArrayObject> m_impostorVao;
+    QOpenGLBuffer m_impostorVertices;
+    QOpenGLBuffer m_impostorIndices;
+    bool m_impostorsDirty = true;
+
+    std::unique_ptr<PlanetarySystem> m_system;
+    std::unique_ptr<BodyRenderer> m_bodyRenderer;
+    std::vector<BodyInstance> m_visibleBodies;
+
+    float m_terrainAltitude;
+    std::unique_ptr<Terrain> m_terrain;
+    std::unique_ptr<TerrainRenderer> m_terrainRenderer;
+    std::vector<const TerrainPatch*> m_terrainPatches;
 };
 } // namespace Lis
@@ -0,0 +1,176 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/PlanetarySystem.cpp
+///
+/// summary:    Implements the bodies of a planetary system and their
+///             culling against the view
+//////////////////////////////////////////////////////////////////////////
+
+#include "PlanetarySystem.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace Lis
+{
+const uint32_t Body::NoParent;
+
+//////////////////////////////////////////////////////////////////////////
+Frustum::Frustum(const float* m)
+{
+    // Gribb & Hartmann: the planes are the sums and differences of the
+    // last row with the others; m[column * 4 + row]
+    for (int plane = 0; plane < 6; ++plane)
+    {
+        const int row = plane / 2;
+        const float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+        float length = 0.0f;
+        for (int column = 0; column < 4; ++column)
+        {
+            m_planes[plane][column] = m[column * 4 + 3] + sign * m[column * 4 + row];
+            if (column < 3)
+                length += m_planes[plane][column] * m_planes[plane][column];
+        }
+
+        length = std::sqrt(length);
+        for (float& coefficient : m_planes[plane])
+            coefficient /= length;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool Frustum::Intersects(const float* center, float radius) const
+{
+    for (const float* plane : m_planes)
+    {
+        if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius)
+            return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+PlanetarySystem PlanetarySystem::Generate(size_t bodies, uint32_t layers, uint32_t seed)
+{
+    if (bodies == 0)
+        throw std::invalid_argument("a planetary system needs at least its star");
+    if (layers == 0)
+        throw std::invalid_argument("the bodies need at least one texture layer");
+
+    std::mt19937 random(seed);
+    auto uniform = [&random](float low, float high) {
+        return std::uniform_real_distribution<float>(low, high)(random);
+    };
+
+    // The last layer is the star's, the others are shared by the planets and the moons
+    const uint32_t bodyLayers = std::max(layers - 1, 1u);
+    auto layer = [&random, bodyLayers]() {
+        return std::uniform_int_distribution<uint32_t>(0, bodyLayers - 1)(random);
+    };
+
+    const size_t planets = bodies == 1 ? 0 : std::min(bodies - 1,
+        std::max<size_t>(1, static_cast<size_t>(std::lround(std::sqrt(static_cast<double>(bodies - 1))))));
+    const size_t moons = bodies - 1 - planets;
+
+    PlanetarySystem system;
+    system.m_bodies.reserve(bodies);
+    system.m_bodies.push_back(Body{ Body::NoParent, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.05f, layers - 1 });
+    system.m_levels.push_back(0);
+
+    // Kepler's third law keeps the outer orbits slow
+    float extent = 1.0f;
+    std::vector<float> planetReach(planets, 0.0f);
+    system.m_levels.push_back(system.m_bodies.size());
+    for (size_t k = 0; k < planets; ++k)
+    {
+        const float orbit = 3.0f + 2.0f * k + uniform(0.0f, 1.0f);
+        const float radius = uniform(0.15f, 0.45f);
+        system.m_bodies.push_back(Body{ 0, orbit, 0.5f * std::pow(orbit / 3.0f, -1.5f), uniform(0.0f, 6.2831853f),
+            uniform(-0.05f, 0.05f), radius, uniform(0.2f, 1.0f), layer() });
+        planetReach[k] = radius;
+    }
+
+    // The moons go round robin to the planets, each farther out than the previous one
+    system.m_levels.push_back(system.m_bodies.size());
+    for (size_t j = 0; j < moons; ++j)
+    {
+        const uint32_t parent = static_cast<uint32_t>(1 + j % planets);
+        const Body& planet = system.m_bodies[parent];
+        const float ring = static_cast<float>(j / planets);
+        const float orbit = planet.radius * (2.5f + 0.25f * ring + uniform(0.0f, 0.2f));
+        const float radius = planet.radius * uniform(0.07f, 0.3f);
+        system.m_bodies.push_back(Body{ parent, orbit, 1.5f * std::pow(orbit / planet.radius, -1.5f),
+            uniform(0.0f, 6.2831853f), uniform(-0.3f, 0.3f), radius, uniform(0.1f, 0.5f), layer() });
+        planetReach[parent - 1] = std::max(planetReach[parent - 1], orbit + radius);
+    }
+    system.m_levels.push_back(system.m_bodies.size());
+
+    for (size_t k = 0; k < planets; ++k)
+        extent = std::max(extent, system.m_bodies[1 + k].orbitRadius + planetReach[k]);
+    system.m_extent = extent;
+
+    system.m_positions.assign(bodies * 3, 0.0f);
+    system.m_spins.assign(bodies, 0.0f);
+    return system;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void PlanetarySystem::Update(double time, ThreadPool& pool)
+{
+    LIS_TRACE_ZONE("PlanetarySystem::Update");
+
+    // A level at a time: the parents are placed before their satellites
+    for (size_t level = 0; level + 1 < m_levels.size(); ++level)
+    {
+        pool.ParallelFor(m_levels[level], m_levels[level + 1], 1024, [this, time](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+            {
+                const Body& body = m_bodies[i];
+                m_spins[i] = static_cast<float>(std::fmod(body.spinSpeed * time, 6.283185307179586));
+
+                float* position = &m_positions[i * 3];
+                if (body.parent == Body::NoParent)
+                {
+                    position[0] = position[1] = position[2] = 0.0f;
+                    continue;
+                }
+
+                const float angle = static_cast<float>(std::fmod(body.orbitPhase + body.orbitSpeed * time, 6.283185307179586));
+                const float* parent = &m_positions[body.parent * 3];
+                const float along = body.orbitRadius * std::sin(angle);
+                position[0] = parent[0] + body.orbitRadius * std::cos(angle);
+                position[1] = parent[1] + along * std::sin(body.inclination);
+                position[2] = parent[2] - along * std::cos(body.inclination);
+            }
+        });
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void PlanetarySystem::Cull(const float* viewProjection, float pixelScale, float minPixels,
+    std::vector<BodyInstance>& visible) const
+{
+    LIS_TRACE_ZONE("PlanetarySystem::Cull");
+
+    const Frustum frustum(viewProjection);
+    visible.clear();
+    for (size_t i = 0; i < m_bodies.size(); ++i)
+    {
+        const float* center = Position(i);
+        const float radius = m_bodies[i].radius;
+        if (!frustum.Intersects(center, radius))
+            continue;
+
+        // The clip w is the distance along the view axis; a body around the eye is always drawn
+        const float w = viewProjection[3] * center[0] + viewProjection[7] * center[1]
+            + viewProjection[11] * center[2] + viewProjection[15];
+        if (w > radius && radius * pixelScale < minPixels * w)
+            continue;
+
+        visible.push_back(BodyInstance{ { center[0], center[1], center[2] }, radius, std::cos(m_spins[i]),
+            std::sin(m_spins[i]), static_cast<float>(m_bodies[i].layer), 0.0f });
+    }
+}
+} // namespace Lis
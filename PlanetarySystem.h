@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/PlanetarySystem.h
+///
+/// summary:    Declares the bodies of a planetary system and their
+///             culling against the view
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   A body on a circular orbit about its parent, spinning about its
+///   polar axis. The root (the star) has no parent and stays at the
+///   origin.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct Body
+{
+    static const uint32_t NoParent = 0xFFFFFFFF;
+
+    uint32_t parent;
+    float orbitRadius;
+    float orbitSpeed;       ///< rad/s
+    float orbitPhase;       ///< rad at time 0
+    float inclination;      ///< rad, the tilt of the orbit about X
+    float radius;
+    float spinSpeed;        ///< rad/s
+    uint32_t layer;         ///< of the texture array
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The per-instance data of a visible body, as the instanced draw reads
+///   it (body-vertex.shader): 32 bytes.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct BodyInstance
+{
+    float center[3];        ///< world space
+    float radius;
+    float cosSpin;
+    float sinSpin;
+    float layer;
+    float padding;
+};
+
+static_assert(sizeof(BodyInstance) == 32, "BodyInstance must match the instance attributes");
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The six planes of the view volume of a view-projection matrix
+///   (column-major, as OpenGL), normalized so a sphere is tested with
+///   six dot products.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class Frustum
+{
+public:
+    explicit Frustum(const float* viewProjection);
+
+    /// False only if the sphere is entirely outside one of the planes
+    bool Intersects(const float* center, float radius) const;
+
+private:
+    float m_planes[6][4];
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The bodies of a system and their positions at a time. The bodies
+///   are stored by level (the star, the planets, the moons), so Update()
+///   places a whole level in parallel once its parents are placed.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class PlanetarySystem
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   A star, about sqrt(bodies) planets and the rest as their moons,
+    ///   with the textures picked among the layers. Reproducible for a
+    ///   seed.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    static PlanetarySystem Generate(size_t bodies, uint32_t layers, uint32_t seed = 1);
+
+    size_t BodyCount() const { return m_bodies.size(); }
+    const std::vector<Body>& Bodies() const { return m_bodies; }
+
+    /// The radius of the sphere about the origin holding every orbit
+    float Extent() const { return m_extent; }
+
+    /// Place the bodies at the time, s
+    void Update(double time, ThreadPool& pool = ThreadPool::GetShared());
+
+    const float* Position(size_t body) const { return &m_positions[body * 3]; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Collect the bodies inside the frustum whose radius covers at least
+    ///   minPixels on the screen.
+    /// </summary>
+    ///
+    /// <param name="viewProjection"> Column-major </param>
+    /// <param name="pixelScale"> Pixels per unit of radius at distance 1:
+    ///   the [1][1] element of the projection times half the viewport
+    ///   height </param>
+    //////////////////////////////////////////////////////////////////////////
+    void Cull(const float* viewProjection, float pixelScale, float minPixels,
+        std::vector<BodyInstance>& visible) const;
+
+private:
+    PlanetarySystem() = default;
+
+    std::vector<Body> m_bodies;
+    std::vector<size_t> m_levels;       ///< the first body of each level, and the count
+    std::vector<float> m_positions;     ///< xyz per body
+    std::vector<float> m_spins;         ///< rad per body
+    float m_extent = 0.0f;
+};
+} // namespace Lis
@@ -0,0 +1,422 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/PostProcess.cpp
+//
+// summary:	Implements the offscreen scene target and its anti-aliasing passes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "PostProcess.h"
+#include "Logger.h"
+#include "Tracer.h"
+
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QOpenGLVertexArrayObject>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+/// <summary>	The jitter repeats after that many frames. </summary>
+const uint32_t JitterFrames = 8;
+
+/// <summary>	The weight of a new frame in the history of TAA. </summary>
+const float TaaBlend = 0.1f;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The radical inverse of the index in the base: the Halton sequence, evenly
+/// 			spread over [0, 1) for any count of its first terms.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+float halton(uint32_t index, uint32_t base)
+{
+    float result = 0.0f;
+    float fraction = 1.0f / base;
+    for (; index > 0; index /= base, fraction /= base)
+        result += fraction * (index % base);
+    return result;
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+AntiAliasing parseAntiAliasing(const QString& name)
+{
+    if (name == "off")
+        return AntiAliasing::Off;
+    if (name == "msaa2")
+        return AntiAliasing::Msaa2;
+    if (name == "msaa4")
+        return AntiAliasing::Msaa4;
+    if (name == "msaa8")
+        return AntiAliasing::Msaa8;
+    if (name == "fxaa")
+        return AntiAliasing::Fxaa;
+    if (name == "taa")
+        return AntiAliasing::Taa;
+    throw std::invalid_argument("unknown anti-aliasing: " + name.toStdString());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QString antiAliasingName(AntiAliasing mode)
+{
+    switch (mode)
+    {
+    case AntiAliasing::Msaa2:
+        return "msaa2";
+    case AntiAliasing::Msaa4:
+        return "msaa4";
+    case AntiAliasing::Msaa8:
+        return "msaa8";
+    case AntiAliasing::Fxaa:
+        return "fxaa";
+    case AntiAliasing::Taa:
+        return "taa";
+    default:
+        return "off";
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int antiAliasingSamples(AntiAliasing mode)
+{
+    switch (mode)
+    {
+    case AntiAliasing::Msaa2:
+        return 2;
+    case AntiAliasing::Msaa4:
+        return 4;
+    case AntiAliasing::Msaa8:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PostProcess::PostProcess()
+    : m_mode(AntiAliasing::Off)
+    , m_targetMode(AntiAliasing::Off)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PostProcess::~PostProcess()
+{
+    if (isInitialized())
+        releaseTargets();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::initialize(const ShaderFile& vertex, const ShaderFile& fxaa, const ShaderFile& taa)
+{
+    initializeOpenGLFunctions();
+
+    ProgramCache programCache;
+    m_fxaaProgram = std::make_unique<QOpenGLShaderProgram>();
+    programCache.build(*m_fxaaProgram, { vertex, fxaa });
+    m_taaProgram = std::make_unique<QOpenGLShaderProgram>();
+    programCache.build(*m_taaProgram, { vertex, taa });
+
+    // The fullscreen triangle is made of gl_VertexID alone, but a core profile draws nothing without a VAO
+    m_vao = std::make_unique<QOpenGLVertexArrayObject>();
+    m_vao->create();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool PostProcess::isInitialized() const
+{
+    return static_cast<bool>(m_vao);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::setAntiAliasing(AntiAliasing mode)
+{
+    m_mode = mode;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+AntiAliasing PostProcess::antiAliasing() const
+{
+    return m_mode;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::begin(const QSize& size)
+{
+    LIS_TRACE_ZONE("PostProcess::begin");
+
+    if (!m_sceneFramebuffer || size != m_size || m_mode != m_targetMode)
+        createTargets(size);
+
+    // A Halton (2, 3) point in the pixel about its center, to the NDC of the target
+    m_jitter.setToIdentity();
+    m_jitterOffset = QVector2D();
+    if (m_mode == AntiAliasing::Taa)
+    {
+        const uint32_t index = m_frame % JitterFrames + 1;
+        m_jitterOffset = QVector2D((halton(index, 2) - 0.5f) * 2.0f / size.width(),
+            (halton(index, 3) - 0.5f) * 2.0f / size.height());
+        m_jitter.translate(m_jitterOffset.x(), m_jitterOffset.y(), 0.0f);
+    }
+    m_viewProjection.setToIdentity();
+    ++m_frame;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFramebuffer);
+    glViewport(0, 0, size.width(), size.height());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const QMatrix4x4& PostProcess::jitter() const
+{
+    return m_jitter;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::setViewProjection(const QMatrix4x4& viewProjection)
+{
+    m_viewProjection = viewProjection;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::end(GLuint framebuffer, const QSize& size)
+{
+    LIS_TRACE_ZONE("PostProcess::end");
+
+    // At the size of the output the passes write it directly, otherwise an intermediate
+    // at the size of the scene is stretched over it
+    const bool scaled = size != m_size;
+    switch (m_mode)
+    {
+    case AntiAliasing::Fxaa:
+    {
+        const GLuint target = scaled ? resolveFramebuffer() : framebuffer;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_sceneColor);
+        m_fxaaProgram->bind();
+        m_fxaaProgram->setUniformValue("scene", 0);
+        m_fxaaProgram->setUniformValue("texelSize", QVector2D(1.0f / m_size.width(), 1.0f / m_size.height()));
+        drawFullscreen(*m_fxaaProgram, target);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (scaled)
+            blit(target, framebuffer, size);
+        break;
+    }
+    case AntiAliasing::Taa:
+    {
+        // From this frame to the previous one, in clip space
+        const QMatrix4x4 reprojection = m_previousViewProjection * m_viewProjection.inverted();
+        const int previous = m_historyIndex;
+        const int next = 1 - m_historyIndex;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_sceneColor);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_sceneDepth);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, m_history[previous]);
+        m_taaProgram->bind();
+        m_taaProgram->setUniformValue("scene", 0);
+        m_taaProgram->setUniformValue("depth", 1);
+        m_taaProgram->setUniformValue("history", 2);
+        m_taaProgram->setUniformValue("reprojection", reprojection);
+        m_taaProgram->setUniformValue("jitter", m_jitterOffset);
+        m_taaProgram->setUniformValue("blend", m_historyValid ? TaaBlend : 1.0f);
+        drawFullscreen(*m_taaProgram, m_historyFramebuffers[next]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // The new history is the frame
+        blit(m_historyFramebuffers[next], framebuffer, size);
+        m_historyIndex = next;
+        m_historyValid = true;
+        break;
+    }
+    default:
+        // Off, or the resolve of the samples, which cannot be scaled at once
+        if (scaled && antiAliasingSamples(m_mode) > 0)
+        {
+            blit(m_sceneFramebuffer, resolveFramebuffer(), m_size);
+            blit(m_resolveFramebuffer, framebuffer, size);
+        }
+        else
+        {
+            blit(m_sceneFramebuffer, framebuffer, size);
+        }
+        break;
+    }
+
+    m_previousViewProjection = m_viewProjection;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t PostProcess::gpuMemory() const
+{
+    return m_gpuMemory;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::createTargets(const QSize& size)
+{
+    releaseTargets();
+    m_size = size;
+    m_targetMode = m_mode;
+
+    const size_t pixels = static_cast<size_t>(size.width()) * size.height();
+    glGenFramebuffers(1, &m_sceneFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFramebuffer);
+
+    int samples = antiAliasingSamples(m_mode);
+    if (samples > 0)
+    {
+        GLint maxSamples = 0;
+        glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+        if (samples > maxSamples)
+        {
+            Logger::GetInstance().Info() << antiAliasingName(m_mode).toStdString() << ": the driver allows "
+                << maxSamples << " samples at most";
+            samples = maxSamples;
+        }
+
+        glGenRenderbuffers(1, &m_sceneColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_sceneColor);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, size.width(), size.height());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_sceneColor);
+
+        glGenRenderbuffers(1, &m_sceneDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_sceneDepth);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, size.width(), size.height());
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_sceneDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        m_gpuMemory = pixels * 8 * std::max(samples, 1);
+    }
+    else
+    {
+        // Textures, for the passes to read the colors and, for TAA, the depth
+        m_sceneColor = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_LINEAR);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_sceneColor, 0);
+        m_sceneDepth = createTexture(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_sceneDepth, 0);
+        m_gpuMemory = pixels * 8;
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("failed to create the scene target for " + antiAliasingName(m_mode).toStdString());
+
+    if (m_mode == AntiAliasing::Taa)
+    {
+        // Half floats: the history is blended a tenth at a time, 8 bits would band
+        for (int i = 0; i < 2; ++i)
+        {
+            m_history[i] = createTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, GL_LINEAR);
+            glGenFramebuffers(1, &m_historyFramebuffers[i]);
+            glBindFramebuffer(GL_FRAMEBUFFER, m_historyFramebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_history[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                throw std::runtime_error("failed to create the history of taa");
+        }
+        m_gpuMemory += pixels * 16;
+    }
+    m_historyValid = false;
+
+    Logger::GetInstance().Info() << "anti-aliasing: " << antiAliasingName(m_mode).toStdString() << ", "
+        << size.width() << "x" << size.height() << ", " << m_gpuMemory / (1024 * 1024) << " MB";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::releaseTargets()
+{
+    if (antiAliasingSamples(m_targetMode) > 0)
+    {
+        glDeleteRenderbuffers(1, &m_sceneColor);
+        glDeleteRenderbuffers(1, &m_sceneDepth);
+    }
+    else
+    {
+        glDeleteTextures(1, &m_sceneColor);
+        glDeleteTextures(1, &m_sceneDepth);
+    }
+    glDeleteFramebuffers(1, &m_sceneFramebuffer);
+    glDeleteTextures(1, &m_resolveColor);
+    glDeleteFramebuffers(1, &m_resolveFramebuffer);
+    glDeleteTextures(2, m_history);
+    glDeleteFramebuffers(2, m_historyFramebuffers);
+
+    // Names of 0 are ignored by the deletes: releasing twice is harmless
+    m_sceneFramebuffer = m_sceneColor = m_sceneDepth = 0;
+    m_resolveFramebuffer = m_resolveColor = 0;
+    m_history[0] = m_history[1] = 0;
+    m_historyFramebuffers[0] = m_historyFramebuffers[1] = 0;
+    m_gpuMemory = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+GLuint PostProcess::createTexture(GLenum internalFormat, GLenum format, GLenum type, GLenum filter)
+{
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, m_size.width(), m_size.height(), 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+GLuint PostProcess::resolveFramebuffer()
+{
+    if (!m_resolveFramebuffer)
+    {
+        m_resolveColor = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_LINEAR);
+        glGenFramebuffers(1, &m_resolveFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_resolveColor, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("failed to create the resolve target");
+        m_gpuMemory += static_cast<size_t>(m_size.width()) * m_size.height() * 4;
+    }
+    return m_resolveFramebuffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::blit(GLuint from, GLuint to, const QSize& size)
+{
+    // Bilinear when stretched; a multisampled source is only ever copied at its size
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, from);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, to);
+    glBlitFramebuffer(0, 0, m_size.width(), m_size.height(), 0, 0, size.width(), size.height(),
+        GL_COLOR_BUFFER_BIT, size == m_size ? GL_NEAREST : GL_LINEAR);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void PostProcess::drawFullscreen(QOpenGLShaderProgram& program, GLuint framebuffer)
+{
+    // Every pixel is written once: no depth, no culling, no blending
+    const GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, m_size.width(), m_size.height());
+    m_vao->bind();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    m_vao->release();
+    program.release();
+
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+    if (cullFace)
+        glEnable(GL_CULL_FACE);
+    if (blend)
+        glEnable(GL_BLEND);
+}
+} // namespace Lis
@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/PostProcess.h
+//
+// summary:	Declares the offscreen scene target and its anti-aliasing passes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ProgramCache.h"
+
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QOpenGLExtraFunctions>
+#include <QtGui/QVector2D>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class QOpenGLShaderProgram;
+class QOpenGLVertexArrayObject;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	How the edges of the scene are smoothed. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+enum class AntiAliasing
+{
+    Off,
+    Msaa2,      ///< a multisampled scene target, resolved by a blit
+    Msaa4,
+    Msaa8,
+    Fxaa,       ///< a pass over the resolved colors along their luma edges
+    Taa         ///< a jittered frame blended into the reprojected history
+};
+
+/// <summary>	"off", "msaa2", "msaa4", "msaa8", "fxaa" or "taa"; throws std::invalid_argument otherwise. </summary>
+AntiAliasing parseAntiAliasing(const QString& name);
+QString antiAliasingName(AntiAliasing mode);
+
+/// <summary>	The samples per pixel of the scene target, 0 if it is not multisampled. </summary>
+int antiAliasingSamples(AntiAliasing mode);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The scene is drawn into a target of its own rather than the window, then
+/// 			resolved into the window by the pass of the anti-aliasing mode: a blit for
+/// 			none and for MSAA, a fullscreen pass for FXAA and TAA. The window itself has
+/// 			a single sample, whatever the mode.
+///
+/// 			The scene target may be smaller than the output, for the dynamic
+/// 			resolution: the anti-aliased scene is then stretched over the output by
+/// 			a bilinear blit.
+///
+/// 			TAA offsets the projection by a sub-pixel every frame (jitter()) and blends
+/// 			the frame with the history: the pixel is moved back to where it was the
+/// 			frame before by its depth and the motion the renderer tells with
+/// 			setViewProjection(), and the history is clamped to the colors around the
+/// 			pixel, so whatever moves otherwise does not ghost.
+///
+/// 			Per frame: begin(), the scene, end(). The mode changes at any time; the
+/// 			targets are made again by the next begin().
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class PostProcess : protected QOpenGLExtraFunctions
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	No OpenGL calls are made until initialize(). </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    PostProcess();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Must be destroyed with the context of initialize() current. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    ~PostProcess();
+
+    PostProcess(const PostProcess&) = delete;
+    PostProcess& operator=(const PostProcess&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <param name="vertex">	The fullscreen triangle both passes share. </param>
+    /// <param name="fxaa">  	The fragment shader of the FXAA pass. </param>
+    /// <param name="taa">   	The fragment shader of the TAA pass. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    void initialize(const ShaderFile& vertex, const ShaderFile& fxaa, const ShaderFile& taa);
+    bool isInitialized() const;
+
+    void setAntiAliasing(AntiAliasing mode);
+    AntiAliasing antiAliasing() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Bind the scene target of that size, made if the size or the mode
+    /// 			changed, and set the viewport to it.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void begin(const QSize& size);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	To premultiply the projections of the frame with: the sub-pixel
+    /// 			offset of the frame under TAA, the identity otherwise.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    const QMatrix4x4& jitter() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	The matrix, without the jitter, of the surface the motion of the
+    /// 			frame follows: TAA finds the pixels of the previous frame by it.
+    /// 			Whatever moves otherwise is left to the clamp of the history. The
+    /// 			identity, a still scene, unless set during the frame.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void setViewProjection(const QMatrix4x4& viewProjection);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Resolve the scene into the framebuffer, scaled to its size, and
+    /// 			leave it bound.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void end(GLuint framebuffer, const QSize& size);
+
+    /// <summary>	The bytes of the targets. </summary>
+    size_t gpuMemory() const;
+
+private:
+    void createTargets(const QSize& size);
+    void releaseTargets();
+    GLuint createTexture(GLenum internalFormat, GLenum format, GLenum type, GLenum filter);
+    GLuint resolveFramebuffer();
+    void drawFullscreen(QOpenGLShaderProgram& program, GLuint framebuffer);
+    void blit(GLuint from, GLuint to, const QSize& size);
+
+    AntiAliasing m_mode;
+    AntiAliasing m_targetMode;
+    QSize m_size;
+
+    GLuint m_sceneFramebuffer = 0;
+    GLuint m_sceneColor = 0;            ///< a renderbuffer if multisampled, a texture otherwise
+    GLuint m_sceneDepth = 0;
+    GLuint m_resolveFramebuffer = 0;    ///< the anti-aliased scene, when it is smaller than the output
+    GLuint m_resolveColor = 0;
+    GLuint m_historyFramebuffers[2] = {};
+    GLuint m_history[2] = {};
+    int m_historyIndex = 0;
+    bool m_historyValid = false;
+    size_t m_gpuMemory = 0;
+
+    uint32_t m_frame = 0;
+    QMatrix4x4 m_jitter;
+    QVector2D m_jitterOffset;           ///< of this frame, NDC
+    QMatrix4x4 m_viewProjection;
+    QMatrix4x4 m_previousViewProjection;
+
+    std::unique_ptr<QOpenGLShaderProgram> m_fxaaProgram;
+    std::unique_ptr<QOpenGLShaderProgram> m_taaProgram;
+    std::unique_ptr<QOpenGLVertexArrayObject> m_vao;
+};
+} // namespace Lis
@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/ProgramCache.cpp
+//
+// summary:	Implements the on-disk cache of linked shader program binaries
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "ProgramCache.h"
+#include "Hash.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLShaderProgram>
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace Lis
+{
+namespace
+{
+const char ProgramMagic[8] = { 'L', 'I', 'S', 'P', 'R', 'O', 'G', '\0' };
+const quint32 ProgramVersion = 1;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The file layout: the header, then the binary as the driver returned it. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ProgramHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 binaryFormat;
+    quint64 key;
+    quint32 size;
+    quint32 reserved;
+};
+
+static_assert(sizeof(ProgramHeader) == 32, "the program cache header must stay 32 bytes");
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QByteArray readShader(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error("failed to read the shader " + path.toStdString());
+    return file.readAll();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+quint64 hashString(const char* text, quint64 seed)
+{
+    return text ? HashBytes(text, std::strlen(text), seed) : seed;
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+ProgramCache::ProgramCache(const QString& directory)
+    : m_directory(directory)
+{
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (!context)
+        throw std::logic_error("the program cache needs a current OpenGL context");
+    initializeOpenGLFunctions();
+
+    if (m_directory.isEmpty())
+        m_directory = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/Lis/programs";
+
+    const QSurfaceFormat format = context->format();
+    const bool supported = context->isOpenGLES()
+        ? format.majorVersion() >= 3
+        : format.version() >= qMakePair(4, 1) || context->hasExtension(QByteArrayLiteral("GL_ARB_get_program_binary"));
+    GLint formats = 0;
+    if (supported)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    m_enabled = formats > 0;
+
+    // A binary is only valid for the driver that produced it
+    m_driverKey = hashString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)), m_driverKey);
+    m_driverKey = hashString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), m_driverKey);
+    m_driverKey = hashString(reinterpret_cast<const char*>(glGetString(GL_VERSION)), m_driverKey);
+
+    if (!m_enabled)
+        Logger::GetInstance().Info() << "program binaries are not supported: shaders are compiled at every start";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ProgramCache::build(QOpenGLShaderProgram& program, const std::vector<ShaderFile>& shaders)
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    std::vector<QByteArray> sources;
+    quint64 key = m_driverKey;
+    QString names;
+    for (const ShaderFile& shader : shaders)
+    {
+        sources.push_back(readShader(shader.path));
+        const quint64 type = static_cast<quint64>(shader.type);
+        key = HashBytes(sources.back().constData(), sources.back().size(), HashBytes(&type, sizeof(type), key));
+        names += (names.isEmpty() ? "" : "+") + QFileInfo(shader.path).fileName();
+    }
+    const QString path = m_directory + "/" + QString::fromStdString(HashToHex(key)) + ".bin";
+
+    bool cached = m_enabled && restore(program, path, key);
+    if (cached)
+    {
+        ++m_hits;
+    }
+    else
+    {
+        ++m_misses;
+        if (!program.create())
+            throw std::runtime_error("failed to create a shader program");
+        if (m_enabled)
+            glProgramParameteri(program.programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+        for (size_t i = 0; i < shaders.size(); ++i)
+        {
+            if (!program.addShaderFromSourceCode(shaders[i].type, sources[i]))
+                throw std::runtime_error("failed to compile the shader " + shaders[i].path.toStdString()
+                    + ": " + program.log().toStdString());
+        }
+        if (!program.link())
+            throw std::runtime_error("failed to link shader program: " + program.log().toStdString());
+
+        if (m_enabled)
+            store(program, path, key);
+    }
+
+    Logger::GetInstance().Info() << "program " << names.toStdString() << (cached ? ": binary loaded in " : ": compiled in ")
+        << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms";
+    return cached;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ProgramCache::restore(QOpenGLShaderProgram& program, const QString& path, quint64 key)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray data = file.readAll();
+
+    ProgramHeader header;
+    if (data.size() < static_cast<int>(sizeof(header)))
+        return false;
+    std::memcpy(&header, data.constData(), sizeof(header));
+    if (std::memcmp(header.magic, ProgramMagic, sizeof(ProgramMagic)) != 0 || header.version != ProgramVersion
+        || header.key != key || header.size != data.size() - sizeof(header))
+    {
+        Logger::GetInstance().Info() << "ignoring the invalid program binary " << path.toStdString();
+        return false;
+    }
+
+    if (!program.create())
+        return false;
+    glProgramBinary(program.programId(), header.binaryFormat, data.constData() + sizeof(header),
+        static_cast<GLsizei>(header.size));
+
+    // With no shaders attached QOpenGLShaderProgram::link() takes the link status
+    // of the binary; the driver rejects binaries of another build
+    if (program.link())
+        return true;
+
+    Logger::GetInstance().Info() << "the driver rejected the program binary " << path.toStdString()
+        << ": " << program.log().toStdString();
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ProgramCache::store(QOpenGLShaderProgram& program, const QString& path, quint64 key)
+{
+    GLint length = 0;
+    glGetProgramiv(program.programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    QByteArray data(static_cast<int>(sizeof(ProgramHeader)) + length, Qt::Uninitialized);
+    GLsizei written = 0;
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program.programId(), length, &written, &binaryFormat, data.data() + sizeof(ProgramHeader));
+    if (written <= 0)
+        return;
+
+    ProgramHeader header;
+    std::memcpy(header.magic, ProgramMagic, sizeof(ProgramMagic));
+    header.version = ProgramVersion;
+    header.binaryFormat = binaryFormat;
+    header.key = key;
+    header.size = static_cast<quint32>(written);
+    header.reserved = 0;
+    std::memcpy(data.data(), &header, sizeof(header));
+    data.truncate(static_cast<int>(sizeof(header)) + written);
+
+    // The file is written off the render thread; QSaveFile renames it into place
+    ThreadPool::GetShared().Submit([path, data] {
+        QSaveFile file(path);
+        if (!QDir().mkpath(QFileInfo(path).absolutePath()) || !file.open(QIODevice::WriteOnly)
+            || file.write(data) != data.size() || !file.commit())
+        {
+            Logger::GetInstance().Error() << "failed to write the program binary " << path.toStdString();
+        }
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool ProgramCache::isEnabled() const
+{
+    return m_enabled;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int ProgramCache::hits() const
+{
+    return m_hits;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int ProgramCache::misses() const
+{
+    return m_misses;
+}
+} // namespace Lis
@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/ProgramCache.h
+//
+// summary:	Declares the on-disk cache of linked shader program binaries
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <QtCore/QString>
+#include <QtGui/QOpenGLExtraFunctions>
+#include <QtGui/QOpenGLShader>
+
+#include <vector>
+
+class QOpenGLShaderProgram;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct ShaderFile
+{
+    QOpenGLShader::ShaderType type;
+    QString path;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Linked programs saved with glGetProgramBinary and restored with glProgramBinary,
+/// 			so a warm start skips the compiler entirely. A binary is keyed by the hash of
+/// 			the driver (GL_VENDOR, GL_RENDERER, GL_VERSION) and of the shader sources:
+/// 			a driver update or a shader edit is a miss, never a stale program. A binary
+/// 			the driver rejects is compiled and replaced.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ProgramCache : protected QOpenGLExtraFunctions
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Needs a current context. Without program binary support (GL 4.1,
+    /// 			ARB_get_program_binary or GLES 3) every program is compiled.
+    /// </summary>
+    ///
+    /// <param name="directory">	The cache directory, the per-user cache if empty. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    explicit ProgramCache(const QString& directory = QString());
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Link the program from the shader files, from the cache if possible. A
+    /// 			compiled program is written to the cache on the thread pool.
+    /// </summary>
+    ///
+    /// <returns>	true if the program came from the cache. </returns>
+    /// <exception cref="std::runtime_error"> A shader cannot be read or compiled, or the
+    /// 			program cannot be linked </exception>
+    ////////////////////////////////////////////////////////////////////////////////
+    bool build(QOpenGLShaderProgram& program, const std::vector<ShaderFile>& shaders);
+
+    bool isEnabled() const;
+    int hits() const;
+    int misses() const;
+
+private:
+    bool restore(QOpenGLShaderProgram& program, const QString& path, quint64 key);
+    void store(QOpenGLShaderProgram& program, const QString& path, quint64 key);
+
+    QString m_directory;
+    quint64 m_driverKey = 0;
+    bool m_enabled = false;
+    int m_hits = 0;
+    int m_misses = 0;
+};
+} // namespace Lis
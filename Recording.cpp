@@ -0,0 +1,806 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Recording.cpp
+///
+/// summary:    Implements the recording writer, reader and prefetcher
+//////////////////////////////////////////////////////////////////////////
+
+#include "Recording.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+const char RecordingMagic[8] = { 'L', 'I', 'S', 'R', 'E', 'C', '\0', '\0' };
+const uint32_t RecordingVersion = 1;
+
+/// Every block starts on a page of the usual size
+const uint32_t BlockAlignment = 4096;
+
+/// In the chunk table of a coded block: the chunk is stored as it is
+const uint32_t StoredChunk = 0x80000000u;
+
+const uint64_t NoFrame = ~uint64_t(0);
+
+//////////////////////////////////////////////////////////////////////////
+/// The file layout, little-endian: the header, the fields, the metadata,
+/// the blocks of the frames, the times of the frames and the blocks
+//////////////////////////////////////////////////////////////////////////
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint32_t fieldCount;
+    uint32_t chunkBytes;
+    uint64_t frameCount;
+    uint64_t indexOffset;
+    uint64_t metadataBytes;
+    uint8_t reserved[16];
+};
+
+struct FieldEntry
+{
+    char name[20];
+    uint32_t width;
+    uint32_t height;
+    uint32_t elementBytes;
+};
+
+struct BlockEntry
+{
+    uint64_t offset;
+    uint64_t size;              ///< 0 for a field absent from the frame
+    uint32_t codec;
+    uint32_t reserved;
+};
+
+/// Ahead of the chunks of a coded block, then a uint32_t size per chunk
+struct ChunkTableHeader
+{
+    uint32_t chunkCount;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(RecordingHeader) == 64, "the recording header must stay 64 bytes");
+static_assert(sizeof(FieldEntry) == 32, "the recording field entry must stay 32 bytes");
+static_assert(sizeof(BlockEntry) == 24, "the recording block entry must stay 24 bytes");
+
+//////////////////////////////////////////////////////////////////////////
+/// Recordings of long runs are well over 2 GB
+//////////////////////////////////////////////////////////////////////////
+void Seek(std::FILE* file, uint64_t offset)
+{
+#ifdef _MSC_VER
+    const int result = _fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+    const int result = fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    if (result != 0)
+        throw std::runtime_error("failed to seek in the recording");
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Write(std::FILE* file, const void* data, size_t size)
+{
+    if (size && std::fwrite(data, size, 1, file) != 1)
+        throw std::runtime_error("failed to write the recording");
+}
+
+/// The bytes of a field coded on their own: whole elements
+size_t ChunkBytes(const RecordedField& field, uint32_t chunkBytes)
+{
+    return std::max<size_t>(chunkBytes / field.elementBytes, 1) * field.elementBytes;
+}
+
+size_t ChunkCount(const RecordedField& field, uint32_t chunkBytes)
+{
+    const size_t chunk = ChunkBytes(field, chunkBytes);
+    return (field.Bytes() + chunk - 1) / chunk;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Runs of 3 to 130 equal bytes as a control byte of 128 + length - 3
+///   and the byte, the others as a control byte of count - 1 and up to
+///   128 literal bytes.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void EncodeRuns(const uint8_t* in, size_t size, std::vector<uint8_t>& out)
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = 1;
+        while (i + run < size && run < 130 && in[i + run] == in[i])
+            ++run;
+        if (run >= 3)
+        {
+            out.push_back(static_cast<uint8_t>(128 + run - 3));
+            out.push_back(in[i]);
+            i += run;
+            continue;
+        }
+
+        const size_t start = i;
+        while (i < size && i - start < 128 && !(i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2]))
+            ++i;
+        out.push_back(static_cast<uint8_t>(i - start - 1));
+        out.insert(out.end(), in + start, in + i);
+    }
+}
+
+/// Whether the runs decoded to exactly size bytes
+bool DecodeRuns(const uint8_t* in, size_t inSize, uint8_t* out, size_t size)
+{
+    const uint8_t* end = in + inSize;
+    size_t written = 0;
+    while (in < end)
+    {
+        const uint8_t control = *in++;
+        if (control >= 128)
+        {
+            const size_t run = control - 125u;
+            if (in == end || written + run > size)
+                return false;
+            std::memset(out + written, *in++, run);
+            written += run;
+        }
+        else
+        {
+            const size_t count = control + 1u;
+            if (static_cast<size_t>(end - in) < count || written + count > size)
+                return false;
+            std::memcpy(out + written, in, count);
+            in += count;
+            written += count;
+        }
+    }
+    return written == size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The ShuffleRle coding of a chunk of whole elements: the planes of
+///   the bytes of the elements, each as the differences of neighbours,
+///   then run length coded.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void EncodeChunk(const uint8_t* in, size_t size, uint32_t elementBytes, std::vector<uint8_t>& out)
+{
+    thread_local std::vector<uint8_t> planes;
+    planes.resize(size);
+    const size_t count = size / elementBytes;
+    for (uint32_t p = 0; p < elementBytes; ++p)
+    {
+        uint8_t* plane = planes.data() + p * count;
+        uint8_t previous = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint8_t byte = in[i * elementBytes + p];
+            plane[i] = static_cast<uint8_t>(byte - previous);
+            previous = byte;
+        }
+    }
+    out.clear();
+    EncodeRuns(planes.data(), size, out);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void DecodeChunk(const uint8_t* in, size_t inSize, uint32_t elementBytes, uint8_t* out, size_t size)
+{
+    thread_local std::vector<uint8_t> planes;
+    planes.resize(size);
+    if (!DecodeRuns(in, inSize, planes.data(), size))
+        throw std::runtime_error("damaged block in the recording");
+
+    const size_t count = size / elementBytes;
+    for (uint32_t p = 0; p < elementBytes; ++p)
+    {
+        const uint8_t* plane = planes.data() + p * count;
+        uint8_t byte = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            byte = static_cast<uint8_t>(byte + plane[i]);
+            out[i * elementBytes + p] = byte;
+        }
+    }
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+RecordingCodec ParseRecordingCodec(const std::string& name)
+{
+    if (name == "raw")
+        return RecordingCodec::Raw;
+    if (name == "rle")
+        return RecordingCodec::ShuffleRle;
+    throw std::invalid_argument("unknown recording codec: " + name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+const char* RecordingCodecName(RecordingCodec codec)
+{
+    return codec == RecordingCodec::ShuffleRle ? "rle" : "raw";
+}
+
+//////////////////////////////////////////////////////////////////////////
+struct RecordingWriter::Block
+{
+    uint64_t offset;
+    uint64_t size;
+    RecordingCodec codec;
+};
+
+//////////////////////////////////////////////////////////////////////////
+RecordingWriter::RecordingWriter(const std::string& path, const std::vector<RecordedField>& fields,
+    const RecordingOptions& options, const std::string& metadata)
+    : m_file(nullptr)
+    , m_fields(fields)
+    , m_options(options)
+    , m_metadataBytes(metadata.size())
+    , m_end(0)
+    , m_staging(fields.size())
+{
+    if (fields.empty())
+        throw std::invalid_argument("a recording needs a field");
+    for (const RecordedField& field : fields)
+    {
+        if (field.name.empty() || field.name.size() >= sizeof(FieldEntry::name) || field.Bytes() == 0)
+            throw std::invalid_argument("invalid recorded field: " + field.name);
+    }
+    if (options.chunkBytes == 0)
+        throw std::invalid_argument("the recording chunks must not be empty");
+
+    m_file = std::fopen(path.c_str(), "w+b");
+    if (!m_file)
+        throw std::runtime_error("failed to create the recording " + path);
+
+    // The header is rewritten by Finish(), an interrupted run leaves no magic
+    const RecordingHeader placeholder = {};
+    Write(m_file, &placeholder, sizeof(placeholder));
+    for (const RecordedField& field : fields)
+    {
+        FieldEntry entry = {};
+        std::memcpy(entry.name, field.name.data(), field.name.size());
+        entry.width = field.width;
+        entry.height = field.height;
+        entry.elementBytes = field.elementBytes;
+        Write(m_file, &entry, sizeof(entry));
+    }
+    Write(m_file, metadata.data(), metadata.size());
+    m_end = sizeof(RecordingHeader) + fields.size() * sizeof(FieldEntry) + metadata.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+RecordingWriter::~RecordingWriter()
+{
+    if (m_file)
+        std::fclose(m_file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RecordingWriter::WriteFrame(double time, const void* const* fields, const size_t* rowStrides, ThreadPool& pool)
+{
+    LIS_TRACE_ZONE("RecordingWriter::WriteFrame");
+    if (!m_file)
+        throw std::runtime_error("the recording is finished");
+    if (!m_times.empty() && time < m_times.back())
+        throw std::invalid_argument("the recorded frames must not go back in time");
+
+    // The fields with rows apart are packed first
+    std::vector<const uint8_t*> packed(m_fields.size(), nullptr);
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        if (!fields[i])
+            continue;
+        const RecordedField& field = m_fields[i];
+        const size_t rowBytes = static_cast<size_t>(field.width) * field.elementBytes;
+        const size_t stride = rowStrides ? rowStrides[i] : 0;
+        packed[i] = static_cast<const uint8_t*>(fields[i]);
+        if (stride != 0 && stride != rowBytes)
+        {
+            m_staging[i].resize(field.Bytes());
+            for (uint32_t y = 0; y < field.height; ++y)
+                std::memcpy(m_staging[i].data() + y * rowBytes, packed[i] + y * stride, rowBytes);
+            packed[i] = m_staging[i].data();
+        }
+    }
+
+    // The chunks of every field are coded at once
+    std::vector<size_t> firstChunk(m_fields.size() + 1, 0);
+    std::vector<uint32_t> chunkField;
+    if (m_options.codec == RecordingCodec::ShuffleRle)
+    {
+        for (size_t i = 0; i < m_fields.size(); ++i)
+        {
+            firstChunk[i] = chunkField.size();
+            if (packed[i])
+                chunkField.resize(chunkField.size() + ChunkCount(m_fields[i], m_options.chunkBytes), static_cast<uint32_t>(i));
+        }
+        firstChunk[m_fields.size()] = chunkField.size();
+        if (m_chunks.size() < chunkField.size())
+            m_chunks.resize(chunkField.size());
+
+        pool.ParallelFor(0, chunkField.size(), 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c)
+            {
+                const RecordedField& field = m_fields[chunkField[c]];
+                const size_t chunk = ChunkBytes(field, m_options.chunkBytes);
+                const size_t offset = (c - firstChunk[chunkField[c]]) * chunk;
+                const size_t size = std::min(chunk, field.Bytes() - offset);
+                EncodeChunk(packed[chunkField[c]] + offset, size, field.elementBytes, m_chunks[c]);
+            }
+        });
+    }
+
+    Seek(m_file, m_end);
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        const RecordedField& field = m_fields[i];
+        if (!packed[i])
+        {
+            m_blocks.push_back(Block{ 0, 0, RecordingCodec::Raw });
+            continue;
+        }
+
+        Pad();
+        Block block{ m_end, 0, m_options.codec };
+        if (m_options.codec == RecordingCodec::Raw)
+        {
+            Write(m_file, packed[i], field.Bytes());
+            block.size = field.Bytes();
+        }
+        else
+        {
+            // A chunk the coding does not shrink is stored as it is
+            const size_t chunk = ChunkBytes(field, m_options.chunkBytes);
+            const ChunkTableHeader table = { static_cast<uint32_t>(firstChunk[i + 1] - firstChunk[i]), 0 };
+            std::vector<uint32_t> sizes(table.chunkCount);
+            for (uint32_t c = 0; c < table.chunkCount; ++c)
+            {
+                const size_t size = std::min(chunk, field.Bytes() - c * chunk);
+                const size_t coded = m_chunks[firstChunk[i] + c].size();
+                sizes[c] = coded < size ? static_cast<uint32_t>(coded) : static_cast<uint32_t>(size) | StoredChunk;
+            }
+            Write(m_file, &table, sizeof(table));
+            Write(m_file, sizes.data(), sizes.size() * sizeof(uint32_t));
+            block.size = sizeof(table) + sizes.size() * sizeof(uint32_t);
+            for (uint32_t c = 0; c < table.chunkCount; ++c)
+            {
+                const size_t size = sizes[c] & ~StoredChunk;
+                Write(m_file, (sizes[c] & StoredChunk) ? packed[i] + c * chunk : m_chunks[firstChunk[i] + c].data(), size);
+                block.size += size;
+            }
+        }
+        m_end += block.size;
+        m_blocks.push_back(block);
+    }
+    m_times.push_back(time);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RecordingWriter::Pad()
+{
+    static const uint8_t Zeros[BlockAlignment] = {};
+    const uint64_t padding = (BlockAlignment - m_end % BlockAlignment) % BlockAlignment;
+    Write(m_file, Zeros, static_cast<size_t>(padding));
+    m_end += padding;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RecordingWriter::Finish()
+{
+    if (!m_file)
+        throw std::runtime_error("the recording is finished");
+
+    Seek(m_file, m_end);
+    Pad();
+    const uint64_t indexOffset = m_end;
+    Write(m_file, m_times.data(), m_times.size() * sizeof(double));
+    std::vector<BlockEntry> entries(m_blocks.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+        entries[i] = BlockEntry{ m_blocks[i].offset, m_blocks[i].size, static_cast<uint32_t>(m_blocks[i].codec), 0 };
+    Write(m_file, entries.data(), entries.size() * sizeof(BlockEntry));
+
+    RecordingHeader header = {};
+    std::memcpy(header.magic, RecordingMagic, sizeof(RecordingMagic));
+    header.version = RecordingVersion;
+    header.alignment = BlockAlignment;
+    header.fieldCount = static_cast<uint32_t>(m_fields.size());
+    header.chunkBytes = m_options.chunkBytes;
+    header.frameCount = m_times.size();
+    header.indexOffset = indexOffset;
+    header.metadataBytes = m_metadataBytes;
+    Seek(m_file, 0);
+    Write(m_file, &header, sizeof(header));
+
+    std::FILE* file = m_file;
+    m_file = nullptr;
+    if (std::fclose(file) != 0)
+        throw std::runtime_error("failed to write the recording");
+}
+
+//////////////////////////////////////////////////////////////////////////
+RecordingReader::RecordingReader(const std::string& path)
+    : m_file(path)
+    , m_chunkBytes(0)
+{
+    RecordingHeader header = {};
+    if (m_file.Size() < sizeof(header))
+        throw std::runtime_error("not a recording: " + path);
+    std::memcpy(&header, m_file.Data(), sizeof(header));
+    if (std::memcmp(header.magic, RecordingMagic, sizeof(RecordingMagic)) != 0)
+        throw std::runtime_error("not a finished recording: " + path);
+    if (header.version != RecordingVersion)
+        throw std::runtime_error("unsupported recording version " + std::to_string(header.version) + ": " + path);
+
+    const uint64_t size = m_file.Size();
+    const uint64_t fieldsEnd = sizeof(header) + static_cast<uint64_t>(header.fieldCount) * sizeof(FieldEntry);
+    if (header.fieldCount == 0 || header.chunkBytes == 0 || fieldsEnd + header.metadataBytes > size
+        || header.indexOffset > size
+        || header.frameCount > (size - header.indexOffset) / (sizeof(double) + header.fieldCount * sizeof(BlockEntry)))
+        throw std::runtime_error("damaged recording: " + path);
+    m_chunkBytes = header.chunkBytes;
+
+    m_fields.resize(header.fieldCount);
+    for (uint32_t i = 0; i < header.fieldCount; ++i)
+    {
+        FieldEntry entry;
+        std::memcpy(&entry, m_file.Data() + sizeof(header) + i * sizeof(FieldEntry), sizeof(entry));
+        RecordedField& field = m_fields[i];
+        field.name.assign(entry.name, strnlen(entry.name, sizeof(entry.name)));
+        field.width = entry.width;
+        field.height = entry.height;
+        field.elementBytes = entry.elementBytes;
+        if (field.Bytes() == 0)
+            throw std::runtime_error("damaged recording: " + path);
+    }
+    m_metadata.assign(reinterpret_cast<const char*>(m_file.Data() + fieldsEnd), static_cast<size_t>(header.metadataBytes));
+
+    m_times.resize(header.frameCount);
+    std::memcpy(m_times.data(), m_file.Data() + header.indexOffset, m_times.size() * sizeof(double));
+    m_blocks.resize(header.frameCount * header.fieldCount);
+    const uint8_t* entries = m_file.Data() + header.indexOffset + m_times.size() * sizeof(double);
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+    {
+        BlockEntry entry;
+        std::memcpy(&entry, entries + i * sizeof(BlockEntry), sizeof(entry));
+        const RecordedField& field = m_fields[i % header.fieldCount];
+        if (entry.codec > static_cast<uint32_t>(RecordingCodec::ShuffleRle) || entry.offset > header.indexOffset
+            || entry.size > header.indexOffset - entry.offset
+            || (entry.codec == static_cast<uint32_t>(RecordingCodec::Raw) && entry.size != 0 && entry.size != field.Bytes()))
+            throw std::runtime_error("damaged recording: " + path);
+        m_blocks[i] = Block{ entry.offset, entry.size, static_cast<RecordingCodec>(entry.codec) };
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+int RecordingReader::FieldIndex(const std::string& name) const
+{
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        if (m_fields[i].name == name)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint64_t RecordingReader::FindFrame(double time) const
+{
+    const auto next = std::upper_bound(m_times.begin(), m_times.end(), time);
+    return next == m_times.begin() ? 0 : static_cast<uint64_t>(next - m_times.begin() - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+const RecordingReader::Block& RecordingReader::BlockOf(uint64_t frame, uint32_t field) const
+{
+    if (frame >= m_times.size() || field >= m_fields.size())
+        throw std::out_of_range("the block is outside of the recording");
+    return m_blocks[frame * m_fields.size() + field];
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool RecordingReader::Has(uint64_t frame, uint32_t field) const
+{
+    return BlockOf(frame, field).size != 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+RecordingCodec RecordingReader::Codec(uint64_t frame, uint32_t field) const
+{
+    return BlockOf(frame, field).codec;
+}
+
+//////////////////////////////////////////////////////////////////////////
+const void* RecordingReader::View(uint64_t frame, uint32_t field) const
+{
+    const Block& block = BlockOf(frame, field);
+    return block.size != 0 && block.codec == RecordingCodec::Raw ? m_file.Data() + block.offset : nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RecordingReader::Read(uint64_t frame, uint32_t field, void* out, size_t rowStride, ThreadPool& pool) const
+{
+    LIS_TRACE_ZONE("RecordingReader::Read");
+    const Block& block = BlockOf(frame, field);
+    const RecordedField& info = m_fields[field];
+    if (block.size == 0)
+        throw std::runtime_error("the field " + info.name + " is absent from frame " + std::to_string(frame));
+
+    const size_t rowBytes = static_cast<size_t>(info.width) * info.elementBytes;
+    const bool packed = rowStride == 0 || rowStride == rowBytes;
+    const uint8_t* data = m_file.Data() + block.offset;
+
+    std::vector<uint8_t> staging;
+    uint8_t* target = static_cast<uint8_t*>(out);
+    if (block.codec == RecordingCodec::Raw)
+    {
+        target = const_cast<uint8_t*>(data);
+    }
+    else
+    {
+        if (!packed)
+        {
+            staging.resize(info.Bytes());
+            target = staging.data();
+        }
+
+        ChunkTableHeader table;
+        if (block.size < sizeof(table))
+            throw std::runtime_error("damaged block in the recording");
+        std::memcpy(&table, data, sizeof(table));
+        const size_t chunk = ChunkBytes(info, m_chunkBytes);
+        if (table.chunkCount != ChunkCount(info, m_chunkBytes)
+            || block.size < sizeof(table) + static_cast<uint64_t>(table.chunkCount) * sizeof(uint32_t))
+            throw std::runtime_error("damaged block in the recording");
+
+        std::vector<uint32_t> sizes(table.chunkCount);
+        std::memcpy(sizes.data(), data + sizeof(table), sizes.size() * sizeof(uint32_t));
+        std::vector<uint64_t> offsets(table.chunkCount + 1, sizeof(table) + sizes.size() * sizeof(uint32_t));
+        for (uint32_t c = 0; c < table.chunkCount; ++c)
+            offsets[c + 1] = offsets[c] + (sizes[c] & ~StoredChunk);
+        if (offsets.back() != block.size)
+            throw std::runtime_error("damaged block in the recording");
+
+        pool.ParallelFor(0, table.chunkCount, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c)
+            {
+                const size_t size = std::min(chunk, info.Bytes() - c * chunk);
+                if (sizes[c] & StoredChunk)
+                {
+                    if ((sizes[c] & ~StoredChunk) != size)
+                        throw std::runtime_error("damaged block in the recording");
+                    std::memcpy(target + c * chunk, data + offsets[c], size);
+                }
+                else
+                {
+                    DecodeChunk(data + offsets[c], sizes[c], info.elementBytes, target + c * chunk, size);
+                }
+            }
+        });
+        if (packed)
+            return;
+    }
+
+    if (packed)
+    {
+        std::memcpy(out, target, info.Bytes());
+        return;
+    }
+    for (uint32_t y = 0; y < info.height; ++y)
+        std::memcpy(static_cast<uint8_t*>(out) + y * rowStride, target + y * rowBytes, rowBytes);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RecordingReader::Prefetch(uint64_t frame) const
+{
+    for (uint32_t field = 0; field < m_fields.size(); ++field)
+    {
+        const Block& block = BlockOf(frame, field);
+        if (block.size != 0)
+            m_file.Prefetch(static_cast<size_t>(block.offset), static_cast<size_t>(block.size));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RecordingReader::Release(uint64_t frame) const
+{
+    for (uint32_t field = 0; field < m_fields.size(); ++field)
+    {
+        const Block& block = BlockOf(frame, field);
+        if (block.size != 0)
+            m_file.Release(static_cast<size_t>(block.offset), static_cast<size_t>(block.size));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+ReplayPrefetcher::ReplayPrefetcher(const RecordingReader& reader, uint32_t ahead)
+    : m_reader(reader)
+    , m_ahead(std::max(ahead, 1u))
+    , m_coded(false)
+    , m_frame(reader.Fields().size(), nullptr)
+{
+    for (uint64_t frame = 0; frame < reader.FrameCount() && !m_coded; ++frame)
+    {
+        for (uint32_t field = 0; field < reader.Fields().size(); ++field)
+            m_coded = m_coded || (reader.Has(frame, field) && reader.Codec(frame, field) != RecordingCodec::Raw);
+    }
+    if (m_coded)
+    {
+        m_slots.resize(m_ahead + 1);
+        for (Slot& slot : m_slots)
+            slot.frame = NoFrame;
+    }
+    m_thread = std::thread(&ReplayPrefetcher::Run, this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+ReplayPrefetcher::~ReplayPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+const std::vector<const void*>& ReplayPrefetcher::Frame(uint64_t frame)
+{
+    LIS_TRACE_ZONE("ReplayPrefetcher::Frame");
+    if (frame >= m_reader.FrameCount())
+        throw std::out_of_range("the frame is outside of the recording");
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    const bool started = m_started;
+    const uint64_t previous = m_cursor;
+    m_cursor = frame;
+    m_started = true;
+
+    Slot* slot = nullptr;
+    if (m_coded)
+    {
+        slot = &m_slots[frame % m_slots.size()];
+        m_decoded.wait(lock, [slot] { return slot->state != SlotState::Decoding; });
+        if (slot->frame == frame && slot->state == SlotState::Ready)
+        {
+            ++m_hits;
+        }
+        else
+        {
+            // Not read ahead, e.g. after a seek: this one is needed now
+            ++m_misses;
+            slot->frame = frame;
+            slot->state = SlotState::Decoding;
+            lock.unlock();
+            m_wake.notify_one();
+            try
+            {
+                Decode(*slot, frame);
+            }
+            catch (...)
+            {
+                lock.lock();
+                slot->state = SlotState::Empty;
+                m_decoded.notify_all();
+                throw;
+            }
+            lock.lock();
+            slot->state = SlotState::Ready;
+            m_decoded.notify_all();
+        }
+    }
+    else if (started && frame > previous && frame <= previous + m_ahead)
+    {
+        ++m_hits;
+    }
+    else
+    {
+        ++m_misses;
+    }
+    lock.unlock();
+    m_wake.notify_one();
+
+    // The pages of the frame left are not needed until the replay comes back
+    if (started && previous != frame)
+        m_reader.Release(previous);
+
+    for (uint32_t field = 0; field < m_frame.size(); ++field)
+    {
+        if (!m_reader.Has(frame, field))
+            m_frame[field] = nullptr;
+        else if (m_reader.Codec(frame, field) == RecordingCodec::Raw)
+            m_frame[field] = m_reader.View(frame, field);
+        else
+            m_frame[field] = slot->fields[field].data();
+    }
+    return m_frame;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ReplayPrefetcher::Decode(Slot& slot, uint64_t frame)
+{
+    slot.fields.resize(m_reader.Fields().size());
+    for (uint32_t field = 0; field < slot.fields.size(); ++field)
+    {
+        if (m_reader.Has(frame, field) && m_reader.Codec(frame, field) != RecordingCodec::Raw)
+        {
+            slot.fields[field].resize(m_reader.Fields()[field].Bytes());
+            m_reader.Read(frame, field, slot.fields[field].data());
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ReplayPrefetcher::Run()
+{
+    uint64_t served = NoFrame;      // the cursor the frames ahead are ready for
+    uint64_t prefetchedFirst = 1;   // the frames handed to the OS, none yet
+    uint64_t prefetchedLast = 0;
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (true)
+    {
+        m_wake.wait(lock, [this, served] { return m_stop || (m_started && m_cursor != served); });
+        if (m_stop)
+            return;
+
+        const uint64_t cursor = m_cursor;
+        const uint64_t last = std::min(cursor + m_ahead, m_reader.FrameCount() - 1);
+
+        // The OS reads the pages of the new frames ahead
+        const uint64_t oldFirst = prefetchedFirst;
+        const uint64_t oldLast = prefetchedLast;
+        prefetchedFirst = cursor + 1;
+        prefetchedLast = last;
+        lock.unlock();
+        for (uint64_t frame = cursor + 1; frame <= last; ++frame)
+        {
+            if (frame < oldFirst || frame > oldLast)
+                m_reader.Prefetch(frame);
+        }
+        lock.lock();
+
+        // Then the coded ones are decoded, the nearest first; a new cursor restarts the scan.
+        // The cursor may have moved while the lock was released: Frame() has handed out the
+        // slot of the new one, which must not be claimed for a frame ahead of the old one.
+        bool moved = m_cursor != cursor;
+        for (uint64_t frame = cursor + 1; m_coded && frame <= last && !moved && !m_stop; ++frame)
+        {
+            Slot& slot = m_slots[frame % m_slots.size()];
+            if (slot.frame == frame || slot.state == SlotState::Decoding
+                || frame % m_slots.size() == m_cursor % m_slots.size())
+            {
+                continue;
+            }
+
+            slot.frame = frame;
+            slot.state = SlotState::Decoding;
+            lock.unlock();
+            bool decoded = true;
+            try
+            {
+                Decode(slot, frame);
+            }
+            catch (const std::exception&)
+            {
+                // Frame() decodes it again and reports the error
+                decoded = false;
+            }
+            lock.lock();
+            slot.state = decoded ? SlotState::Ready : SlotState::Empty;
+            m_decoded.notify_all();
+            moved = m_cursor != cursor;
+        }
+        if (!moved)
+            served = cursor;
+    }
+}
+} // namespace Lis
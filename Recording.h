@@ -0,0 +1,270 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Recording.h
+///
+/// summary:    Declares the recording: the frames of a run, field by
+///             field, stored in one file for checkpoints and replay
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   How a block is stored. Raw blocks are read in place from the
+///   mapping; the others are decoded. ShuffleRle is lossless: the bytes
+///   of the elements split into planes, each plane delta coded and run
+///   length coded, which shrinks the sign and exponent bytes of smooth
+///   float fields to little and leaves the noisy mantissas as they are.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+enum class RecordingCodec : uint32_t
+{
+    Raw = 0,
+    ShuffleRle = 1
+};
+
+/// "raw" or "rle"; throws std::invalid_argument otherwise
+RecordingCodec ParseRecordingCodec(const std::string& name);
+const char* RecordingCodecName(RecordingCodec codec);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   A field of every frame: width x height elements of elementBytes,
+///   row by row, e.g. a GridField or a blob of 1 x n bytes.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct RecordedField
+{
+    std::string name;           ///< up to 19 characters
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t elementBytes = 0;
+
+    size_t Bytes() const { return static_cast<size_t>(width) * height * elementBytes; }
+};
+
+//////////////////////////////////////////////////////////////////////////
+struct RecordingOptions
+{
+    RecordingCodec codec = RecordingCodec::Raw;
+    uint32_t chunkBytes = 1u << 20;     ///< of a field coded on its own, so in parallel
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Write a recording: a fixed header, the fields and the metadata, the
+///   frames, then the index of the frames and of their blocks at the
+///   end. Every block starts on a page, so a raw one is a page-aligned
+///   array in the mapping of the reader. The file is not valid until
+///   Finish() is called.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class RecordingWriter
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <exception cref="std::invalid_argument"> No field, or one that is
+    ///   empty or badly named </exception>
+    /// <exception cref="std::runtime_error"> The file cannot be created </exception>
+    //////////////////////////////////////////////////////////////////////////
+    RecordingWriter(const std::string& path, const std::vector<RecordedField>& fields,
+        const RecordingOptions& options = RecordingOptions(), const std::string& metadata = std::string());
+    ~RecordingWriter();
+
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+
+    const std::vector<RecordedField>& Fields() const { return m_fields; }
+    uint64_t FrameCount() const { return m_times.size(); }
+
+    /// The bytes written so far
+    uint64_t Bytes() const { return m_end; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Append a frame: a pointer per field in the order of Fields(), a
+    ///   null one for a field absent from the frame. The rows of field i
+    ///   are rowStrides[i] bytes apart, packed if the strides are null
+    ///   or the stride is 0. The times must not decrease.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void WriteFrame(double time, const void* const* fields, const size_t* rowStrides = nullptr,
+        ThreadPool& pool = ThreadPool::GetShared());
+
+    void Finish();
+
+private:
+    struct Block;
+
+    void Pad();
+
+    std::FILE* m_file;
+    std::vector<RecordedField> m_fields;
+    RecordingOptions m_options;
+    uint64_t m_metadataBytes;
+    uint64_t m_end;
+    std::vector<double> m_times;
+    std::vector<Block> m_blocks;
+
+    // Reused from frame to frame
+    std::vector<std::vector<uint8_t>> m_staging;
+    std::vector<std::vector<uint8_t>> m_chunks;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   A recording mapped read-only: finding a frame is a lookup in the
+///   index, a raw block is a pointer into the mapping and only the pages
+///   touched are read, so any frame of a recording of many GB is at hand
+///   in the time of reading that frame. The methods may be called from
+///   several threads at once.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class RecordingReader
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <exception cref="std::runtime_error"> The file cannot be mapped,
+    ///   is not a finished recording or is damaged </exception>
+    //////////////////////////////////////////////////////////////////////////
+    explicit RecordingReader(const std::string& path);
+
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+
+    const std::vector<RecordedField>& Fields() const { return m_fields; }
+
+    /// The field of the name, -1 if there is none
+    int FieldIndex(const std::string& name) const;
+
+    const std::string& Metadata() const { return m_metadata; }
+    uint64_t FrameCount() const { return m_times.size(); }
+    double FrameTime(uint64_t frame) const { return m_times.at(frame); }
+    uint64_t Bytes() const { return m_file.Size(); }
+
+    /// The last frame at or before the time, the first one before it
+    uint64_t FindFrame(double time) const;
+
+    bool Has(uint64_t frame, uint32_t field) const;
+    RecordingCodec Codec(uint64_t frame, uint32_t field) const;
+
+    /// The packed field in the mapping if its block is raw, else null
+    const void* View(uint64_t frame, uint32_t field) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Copy or decode the field, the rows rowStride bytes apart, packed
+    ///   if 0. The chunks of a coded block are decoded on the pool.
+    /// </summary>
+    /// <exception cref="std::runtime_error"> The field is absent from the
+    ///   frame or its block is damaged </exception>
+    //////////////////////////////////////////////////////////////////////////
+    void Read(uint64_t frame, uint32_t field, void* out, size_t rowStride = 0,
+        ThreadPool& pool = ThreadPool::GetShared()) const;
+
+    /// Have the OS read the blocks of the frame ahead
+    void Prefetch(uint64_t frame) const;
+
+    /// Drop the pages of the frame from the process, they stay cached
+    void Release(uint64_t frame) const;
+
+private:
+    struct Block
+    {
+        uint64_t offset;
+        uint64_t size;
+        RecordingCodec codec;
+    };
+
+    const Block& BlockOf(uint64_t frame, uint32_t field) const;
+
+    MappedFile m_file;
+    uint32_t m_chunkBytes;
+    std::vector<RecordedField> m_fields;
+    std::string m_metadata;
+    std::vector<double> m_times;
+    std::vector<Block> m_blocks;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Feeds a replay from a thread of its own: the frames after the one
+///   last asked for are read ahead and their coded blocks decoded, so the
+///   consumer, e.g. the upload of the fields to the GPU, finds them ready.
+///   A seek costs the one frame asked for; the thread catches up behind.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class ReplayPrefetcher
+{
+public:
+    /// <param name="ahead"> The frames read ahead of the last one asked for </param>
+    explicit ReplayPrefetcher(const RecordingReader& reader, uint32_t ahead = 8);
+    ~ReplayPrefetcher();
+
+    ReplayPrefetcher(const ReplayPrefetcher&) = delete;
+    ReplayPrefetcher& operator=(const ReplayPrefetcher&) = delete;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The packed fields of a frame, null where absent: the raw ones in
+    ///   the mapping, the others decoded. Valid until the next call, which
+    ///   must come from the same thread.
+    /// </summary>
+    /// <exception cref="std::runtime_error"> A block is damaged </exception>
+    //////////////////////////////////////////////////////////////////////////
+    const std::vector<const void*>& Frame(uint64_t frame);
+
+    /// The frames the thread had ready, and the ones decoded by Frame()
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+
+private:
+    enum class SlotState
+    {
+        Empty,
+        Decoding,
+        Ready
+    };
+
+    // Frame f is decoded into slot f % slots, so the frames ahead never
+    // evict the one being used
+    struct Slot
+    {
+        uint64_t frame = 0;
+        SlotState state = SlotState::Empty;
+        std::vector<std::vector<uint8_t>> fields;
+    };
+
+    void Run();
+    void Decode(Slot& slot, uint64_t frame);
+
+    const RecordingReader& m_reader;
+    uint32_t m_ahead;
+    bool m_coded;               ///< whether any block needs decoding
+    std::vector<Slot> m_slots;
+    std::vector<const void*> m_frame;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_decoded;
+    uint64_t m_cursor = 0;
+    bool m_started = false;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+} // namespace Lis
@@ -0,0 +1,174 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ReplayBench.cpp
+///
+/// summary:    Throughput of the recordings of the model and the latency
+///             of their seeks
+//////////////////////////////////////////////////////////////////////////
+
+#include "ModelRecording.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double Percentile(std::vector<double> values, double fraction)
+{
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(fraction * (values.size() - 1))];
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_replay_bench [grid] [frames] [codec,...]
+///
+/// For every codec, the model is stepped and recorded for the frames,
+/// then the recording is opened, replayed frame by frame through the
+/// prefetcher, sought at random and the model restored from its last
+/// frame. The report is printed as JSON with the MB/s written and read,
+/// the seek times in ms and the size against the raw fields. The
+/// recordings are removed at the end.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const Lis::ShallowWaterParams params = Lis::ParseGridSpec(argc > 1 ? argv[1] : "720x360");
+    const long frames = argc > 2 ? std::atol(argv[2]) : 200;
+    const std::vector<std::string> codecs = SplitList(argc > 3 ? argv[3] : "raw,rle");
+    if (frames <= 0 || codecs.empty())
+        throw std::invalid_argument("need at least one frame and one codec");
+
+    std::cout << "{\n  \"grid\": \"" << params.longitudes << "x" << params.latitudes << "\",\n  \"frames\": " << frames
+        << ",\n  \"results\": [\n";
+    for (size_t c = 0; c < codecs.size(); ++c)
+    {
+        const std::string path = "lis_replay_bench." + codecs[c];
+        Lis::RecordingOptions options;
+        options.codec = Lis::ParseRecordingCodec(codecs[c]);
+
+        // The model steps are not timed, only the frames written
+        Lis::ShallowWaterModel model(params);
+        double writeSeconds = 0.0;
+        uint64_t rawBytes = 0;
+        {
+            Lis::RecordingWriter writer(path, Lis::ModelRecordingFields(params), options, Lis::ModelRecordingMetadata(params));
+            std::vector<const void*> fields(writer.Fields().size());
+            std::vector<size_t> strides(writer.Fields().size());
+            Lis::ModelClock clock;
+            for (long frame = 0; frame < frames; ++frame)
+            {
+                model.Step();
+                Lis::ModelFrame(model, clock, fields.data(), strides.data());
+                const Clock::time_point start = Clock::now();
+                writer.WriteFrame(model.Time(), fields.data(), strides.data());
+                writeSeconds += Seconds(start);
+            }
+            const Clock::time_point start = Clock::now();
+            writer.Finish();
+            writeSeconds += Seconds(start);
+            for (const Lis::RecordedField& field : writer.Fields())
+                rawBytes += field.Bytes() * frames;
+        }
+
+        Clock::time_point start = Clock::now();
+        const Lis::RecordingReader reader(path);
+        const double openMs = Seconds(start) * 1e3;
+
+        // Sequential, each frame touched as an upload would
+        double checksum = 0.0;
+        double replaySeconds = 0.0;
+        uint64_t hits = 0;
+        {
+            Lis::ReplayPrefetcher prefetcher(reader);
+            start = Clock::now();
+            for (long frame = 0; frame < frames; ++frame)
+            {
+                const std::vector<const void*>& fields = prefetcher.Frame(frame);
+                const float* t = static_cast<const float*>(fields[Lis::STATE_TEMPERATURE]);
+                for (size_t i = 0; i < model.CellCount(); i += 1024)
+                    checksum += t[i];
+            }
+            replaySeconds = Seconds(start);
+            hits = prefetcher.Hits();
+        }
+
+        // Random seeks, each the first access to the frame since the replay
+        std::mt19937 random(1);
+        std::uniform_int_distribution<long> pick(0, frames - 1);
+        std::vector<double> seekMs;
+        {
+            Lis::ReplayPrefetcher prefetcher(reader);
+            for (int seek = 0; seek < 64; ++seek)
+            {
+                const uint64_t frame = reader.FindFrame(reader.FrameTime(pick(random)));
+                start = Clock::now();
+                const std::vector<const void*>& fields = prefetcher.Frame(frame);
+                const float* t = static_cast<const float*>(fields[Lis::STATE_TEMPERATURE]);
+                for (size_t i = 0; i < model.CellCount(); i += 1024)
+                    checksum += t[i];
+                seekMs.push_back(Seconds(start) * 1e3);
+            }
+        }
+
+        start = Clock::now();
+        Lis::ShallowWaterModel restored(Lis::ModelRecordingParams(reader));
+        Lis::RestoreModel(reader, reader.FrameCount() - 1, restored);
+        const double restoreMs = Seconds(start) * 1e3;
+        const bool exact = restored.Steps() == model.Steps()
+            && std::equal(model.Temperature().Row(0), model.Temperature().Row(0) + model.Temperature().Pitch() * params.latitudes,
+                restored.Temperature().Row(0));
+
+        std::cout << "    {\"codec\": \"" << Lis::RecordingCodecName(options.codec)
+            << "\", \"mb\": " << reader.Bytes() / 1048576.0
+            << ", \"ratio\": " << static_cast<double>(reader.Bytes()) / rawBytes
+            << ", \"write_mb_per_sec\": " << rawBytes / writeSeconds / 1048576.0
+            << ", \"open_ms\": " << openMs
+            << ", \"replay_fps\": " << frames / replaySeconds
+            << ", \"replay_mb_per_sec\": " << rawBytes / replaySeconds / 1048576.0
+            << ", \"prefetch_hits\": " << hits
+            << ", \"seek_ms_p50\": " << Percentile(seekMs, 0.5)
+            << ", \"seek_ms_max\": " << Percentile(seekMs, 1.0)
+            << ", \"restore_ms\": " << restoreMs
+            << ", \"restored_exact\": " << (exact ? "true" : "false")
+            << ", \"checksum\": " << static_cast<long>(checksum) % 1000
+            << "}" << (c + 1 == codecs.size() ? "\n" : ",\n");
+        std::remove(path.c_str());
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
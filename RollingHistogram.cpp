@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/RollingHistogram.cpp
+///
+/// summary:    Implements the distribution of the last samples of a timing
+//////////////////////////////////////////////////////////////////////////
+
+#include "RollingHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Lis
+{
+const size_t HistogramSummary::BucketCount;
+
+//////////////////////////////////////////////////////////////////////////
+double HistogramSummary::BucketLimit(size_t bucket)
+{
+    return std::ldexp(1.0, static_cast<int>(bucket) - 4);
+}
+
+//////////////////////////////////////////////////////////////////////////
+RollingHistogram::RollingHistogram(size_t window)
+    : m_samples(window)
+    , m_next(0)
+    , m_count(0)
+    , m_total(0)
+{
+    if (window == 0)
+        throw std::invalid_argument("the histogram window must hold at least one sample");
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RollingHistogram::Add(double value)
+{
+    m_samples[m_next] = value;
+    m_next = m_next + 1 == m_samples.size() ? 0 : m_next + 1;
+    m_count = std::min(m_count + 1, m_samples.size());
+    ++m_total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RollingHistogram::Clear()
+{
+    m_next = 0;
+    m_count = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+HistogramSummary RollingHistogram::Summary() const
+{
+    HistogramSummary summary;
+    summary.count = m_count;
+    if (m_count == 0)
+        return summary;
+
+    // Until the ring wraps the samples are at its start
+    std::vector<double> sorted(m_samples.begin(), m_samples.begin() + m_count);
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest-rank percentiles, as the frame statistics of lis_bench
+    auto percentile = [&sorted](double p) {
+        return sorted[std::min(static_cast<size_t>(p * (sorted.size() - 1) + 0.5), sorted.size() - 1)];
+    };
+
+    double sum = 0;
+    size_t bucket = 0;
+    for (double value : sorted)
+    {
+        sum += value;
+        while (bucket + 1 < HistogramSummary::BucketCount && value > HistogramSummary::BucketLimit(bucket))
+            ++bucket;
+        ++summary.buckets[bucket];
+    }
+
+    summary.mean = sum / sorted.size();
+    summary.min = sorted.front();
+    summary.max = sorted.back();
+    summary.p50 = percentile(0.5);
+    summary.p90 = percentile(0.9);
+    summary.p99 = percentile(0.99);
+    return summary;
+}
+} // namespace Lis
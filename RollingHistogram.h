@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/RollingHistogram.h
+///
+/// summary:    Declares the distribution of the last samples of a timing
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The distribution of the samples in the window, ms. The buckets are
+///   powers of two: bucket i counts the samples up to BucketLimit(i), the
+///   last one everything above.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct HistogramSummary
+{
+    static const size_t BucketCount = 16;
+
+    /// The upper bound of the bucket: 1/16 ms for the first, 1024 ms for the
+    /// one before last
+    static double BucketLimit(size_t bucket);
+
+    size_t count = 0;
+    double mean = 0;
+    double min = 0;
+    double max = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    std::array<uint32_t, BucketCount> buckets = {};
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Keeps the last samples of a timing in a ring, so the statistics
+///   follow the recent frames rather than the whole run. Adding is O(1)
+///   and never allocates; the percentiles are computed by Summary() only.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class RollingHistogram
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <param name="window"> The number of samples kept, at least 1 </param>
+    //////////////////////////////////////////////////////////////////////////
+    explicit RollingHistogram(size_t window = 600);
+
+    void Add(double value);
+    void Clear();
+
+    /// The samples in the window
+    size_t Count() const { return m_count; }
+
+    /// All samples ever added
+    uint64_t Total() const { return m_total; }
+
+    HistogramSummary Summary() const;
+
+private:
+    std::vector<double> m_samples;
+    size_t m_next;
+    size_t m_count;
+    uint64_t m_total;
+};
+} // namespace Lis
@@ -0,0 +1,636 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ShallowWater.cpp
+///
+/// summary:    Implements the shallow-water atmosphere on a lat-lon grid
+//////////////////////////////////////////////////////////////////////////
+
+#include "ShallowWater.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace Lis
+{
+namespace
+{
+const double Pi = 3.14159265358979323846;
+
+// Moist thermodynamics
+const float LatentHeat = 2.5e6f;        ///< J/kg
+const float HeatCapacity = 1004.0f;     ///< of the dry air at constant pressure, J/(kg K)
+const float VaporConstant = 461.5f;     ///< J/(kg K)
+
+// The initial jet and the bump on it
+const double JetSpeed = 20.0;           ///< m/s at the equator
+const double BumpHeight = 120.0;        ///< m
+const double BumpLatitude = Pi / 6.0;
+const double BumpLongitude = Pi / 2.0;
+
+//////////////////////////////////////////////////////////////////////////
+/// The bilinear weights of a point in cell coordinates; the longitudes
+/// wrap, the latitudes are clamped to the rows next to the poles
+//////////////////////////////////////////////////////////////////////////
+struct Stencil
+{
+    uint32_t x0, x1;
+    uint32_t y0, y1;
+    float fx, fy;
+
+    Stencil(float x, float y, uint32_t width, uint32_t height)
+    {
+        x0 = std::min(static_cast<uint32_t>(x), width - 1);
+        x1 = x0 + 1 == width ? 0 : x0 + 1;
+        fx = x - static_cast<float>(x0);
+
+        y0 = std::min(static_cast<uint32_t>(y), height - 2);
+        y1 = y0 + 1;
+        fy = y - static_cast<float>(y0);
+    }
+
+    float Sample(const GridField& field) const
+    {
+        const float* south = field.Row(y0);
+        const float* north = field.Row(y1);
+        const float a = south[x0] + fx * (south[x1] - south[x0]);
+        const float b = north[x0] + fx * (north[x1] - north[x0]);
+        return a + fy * (b - a);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// The departure points of a row from the displacement in cells; the
+/// loop has no branches left for the vectorizer to give up on
+//////////////////////////////////////////////////////////////////////////
+void DeparturePoints(uint32_t width, uint32_t height, uint32_t row, const float* dx, const float* dy,
+    float* x, float* y)
+{
+    const float wrap = static_cast<float>(width);
+    const float maxShift = 0.5f * wrap - 1.0f;
+    const float top = static_cast<float>(height - 1);
+    const float y0 = static_cast<float>(row);
+    for (uint32_t i = 0; i < width; ++i)
+    {
+        float px = static_cast<float>(i) - std::min(std::max(dx[i], -maxShift), maxShift);
+        px += px < 0.0f ? wrap : 0.0f;
+        px -= px >= wrap ? wrap : 0.0f;
+        x[i] = px;
+        y[i] = std::min(std::max(y0 - dy[i], 0.0f), top);
+    }
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+ShallowWaterParams ParseGridSpec(const std::string& spec)
+{
+    const size_t cross = spec.find('x');
+    ShallowWaterParams params;
+    try
+    {
+        size_t lonParsed = 0, latParsed = 0;
+        const std::string lon = spec.substr(0, cross);
+        const std::string lat = cross == std::string::npos ? std::string() : spec.substr(cross + 1);
+        const unsigned long longitudes = std::stoul(lon, &lonParsed);
+        const unsigned long latitudes = std::stoul(lat, &latParsed);
+        if (lonParsed != lon.size() || latParsed != lat.size()
+            || longitudes > std::numeric_limits<uint16_t>::max() || latitudes > std::numeric_limits<uint16_t>::max())
+        {
+            throw std::invalid_argument(spec);
+        }
+        params.longitudes = static_cast<uint32_t>(longitudes);
+        params.latitudes = static_cast<uint32_t>(latitudes);
+    }
+    catch (const std::exception&)
+    {
+        throw std::invalid_argument("invalid grid specification: " + spec);
+    }
+    return params;
+}
+
+//////////////////////////////////////////////////////////////////////////
+ShallowWaterModel::ShallowWaterModel(const ShallowWaterParams& params, ThreadPool& pool)
+    : m_params(params)
+    , m_pool(pool)
+    , m_timeStep(params.timeStep)
+    , m_time(0.0)
+    , m_steps(0)
+{
+    if (params.longitudes < 8 || params.latitudes < 4)
+        throw std::invalid_argument("the simulation grid must be at least 8x4");
+    if (!(params.radius > 0.0) || !(params.gravity > 0.0) || !(params.meanDepth > 0.0))
+        throw std::invalid_argument("the planet needs a positive radius, gravity and depth");
+    if (params.timeStep < 0.0 || (params.timeStep == 0.0 && !(params.courantNumber > 0.0)))
+        throw std::invalid_argument("invalid simulation time step");
+    if (!(params.radiativeTimescale > 0.0) || !(params.evaporationTimescale > 0.0))
+        throw std::invalid_argument("the relaxation timescales must be positive");
+    if (params.spectralTruncation > 0
+        && (params.spectralInterval == 0 || params.spectralOrder == 0 || !(params.spectralTimescale > 0.0)))
+    {
+        throw std::invalid_argument("the spectral filter needs an interval, an order and a timescale");
+    }
+
+    const uint32_t width = params.longitudes;
+    const uint32_t height = params.latitudes;
+    const double dLatitude = Pi / height;
+    if (m_timeStep == 0.0)
+        m_timeStep = params.courantNumber * params.radius * dLatitude / std::sqrt(params.gravity * params.meanDepth);
+
+    GridField* fields[] = { &m_u, &m_v, &m_h, &m_q, &m_t, &m_nextU, &m_nextV, &m_nextH, &m_nextQ, &m_nextT, &m_rain };
+    for (GridField* field : fields)
+        *field = GridField(width, height);
+
+    const double dLongitude = 2.0 * Pi / width;
+    m_zonalScale.resize(height);
+    m_cosLatitude.resize(height);
+    m_tanLatitude.resize(height);
+    m_coriolis.resize(height);
+    m_equilibrium.resize(height);
+    for (uint32_t j = 0; j < height; ++j)
+    {
+        const double latitude = Latitude(j);
+        const double sine = std::sin(latitude);
+        m_zonalScale[j] = static_cast<float>(1.0 / (params.radius * std::cos(latitude) * dLongitude));
+        m_cosLatitude[j] = static_cast<float>(std::cos(latitude));
+        m_tanLatitude[j] = static_cast<float>(std::tan(latitude));
+        m_coriolis[j] = static_cast<float>(2.0 * params.rotationRate * sine);
+        m_equilibrium[j] = static_cast<float>(params.poleTemperature
+            + (params.equatorTemperature - params.poleTemperature) * (1.0 - sine * sine));
+    }
+
+    PrepareZonalSolver();
+    if (params.spectralTruncation > 0)
+    {
+        // The coefficient that takes the truncation degree down by 1/e over the timescale
+        const uint32_t truncation = params.spectralTruncation;
+        m_spectral = std::make_unique<SphericalHarmonics>(truncation, width, height, m_pool);
+        const double eigenvalue = static_cast<double>(truncation) * (truncation + 1) / (params.radius * params.radius);
+        const double coefficient = 1.0 / (params.spectralTimescale * std::pow(eigenvalue, params.spectralOrder));
+        m_spectralFactors = DiffusionFactors(truncation, coefficient, params.spectralInterval * m_timeStep,
+            params.radius, params.spectralOrder);
+    }
+    Initialize();
+}
+
+//////////////////////////////////////////////////////////////////////////
+double ShallowWaterModel::Latitude(uint32_t row) const
+{
+    return -0.5 * Pi + (row + 0.5) * Pi / m_params.latitudes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Initialize()
+{
+    const uint32_t width = m_params.longitudes;
+    const uint32_t height = m_params.latitudes;
+    const double a = m_params.radius;
+    const double bumpRadius = a / 8.0;
+
+    for (uint32_t j = 0; j < height; ++j)
+    {
+        const double latitude = Latitude(j);
+        const double sine = std::sin(latitude);
+
+        // Balanced by the Coriolis and the metric terms; zero area mean
+        const double jet = -(a * m_params.rotationRate * JetSpeed + 0.5 * JetSpeed * JetSpeed)
+            * (sine * sine - 1.0 / 3.0) / m_params.gravity;
+
+        float* u = m_u.Row(j);
+        float* h = m_h.Row(j);
+        float* q = m_q.Row(j);
+        float* t = m_t.Row(j);
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const double longitude = (i + 0.5) * 2.0 * Pi / width;
+            const double cosDistance = std::sin(BumpLatitude) * sine
+                + std::cos(BumpLatitude) * std::cos(latitude) * std::cos(longitude - BumpLongitude);
+            const double distance = a * std::acos(std::min(std::max(cosDistance, -1.0), 1.0)) / bumpRadius;
+
+            u[i] = static_cast<float>(JetSpeed * std::cos(latitude));
+            h[i] = static_cast<float>(jet + BumpHeight * std::exp(-distance * distance));
+            t[i] = m_equilibrium[j];
+            q[i] = static_cast<float>(m_params.surfaceHumidity) * SaturationHumidity(t[i]);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// The zonal system of a row is (1 + 2 alpha) h_i - alpha (h_i-1 + h_i+1)
+/// = r_i with periodic ends. Sherman-Morrison turns it into two
+/// tridiagonal solves sharing the pivots; the one against the
+/// correction vector does not depend on r, so it is done here once.
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::PrepareZonalSolver()
+{
+    const uint32_t width = m_params.longitudes;
+    const uint32_t height = m_params.latitudes;
+    const double gH = m_params.gravity * m_params.meanDepth;
+
+    m_zonalAlpha.resize(height);
+    m_zonalCorrection.resize(height);
+    m_zonalInverse.resize(static_cast<size_t>(width) * height);
+    m_zonalZ.resize(static_cast<size_t>(width) * height);
+
+    for (uint32_t j = 0; j < height; ++j)
+    {
+        const double scale = 1.0 / (m_params.radius * std::cos(Latitude(j)) * 2.0 * Pi / width);
+        const double alpha = m_timeStep * m_timeStep * gH * scale * scale;
+        const double diagonal = 1.0 + 2.0 * alpha;
+        m_zonalAlpha[j] = alpha;
+
+        // The corners folded into the first and the last pivots
+        double* inverse = &m_zonalInverse[static_cast<size_t>(j) * width];
+        double* z = &m_zonalZ[static_cast<size_t>(j) * width];
+        inverse[0] = 1.0 / (2.0 * diagonal);
+        for (uint32_t i = 1; i < width; ++i)
+        {
+            const double pivot = (i + 1 == width ? diagonal + alpha * alpha / diagonal : diagonal)
+                + alpha * (-alpha * inverse[i - 1]);
+            inverse[i] = 1.0 / pivot;
+        }
+
+        // Solve against u = (-diagonal, 0, ..., -alpha)
+        z[0] = -diagonal * inverse[0];
+        for (uint32_t i = 1; i < width; ++i)
+            z[i] = ((i + 1 == width ? -alpha : 0.0) + alpha * z[i - 1]) * inverse[i];
+        for (uint32_t i = width - 1; i-- > 0;)
+            z[i] += alpha * inverse[i] * z[i + 1];
+
+        m_zonalCorrection[j] = 1.0 / (1.0 + z[0] + alpha / diagonal * z[width - 1]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Step()
+{
+    LIS_TRACE_ZONE("ShallowWaterModel::Step");
+    const size_t rows = m_params.latitudes;
+    m_pool.ParallelFor(0, rows, 1, [this](size_t first, size_t last) {
+        Advect(static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+    });
+    m_pool.ParallelFor(0, rows, 1, [this](size_t first, size_t last) {
+        Rotate(static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+    });
+    m_pool.ParallelFor(0, rows, 1, [this](size_t first, size_t last) {
+        Adjust(static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+    });
+
+    std::swap(m_u, m_nextU);
+    std::swap(m_v, m_nextV);
+    std::swap(m_h, m_nextH);
+    std::swap(m_q, m_nextQ);
+    std::swap(m_t, m_nextT);
+    m_time += m_timeStep;
+    ++m_steps;
+
+    if (m_spectral && m_steps % m_params.spectralInterval == 0)
+        SmoothScalars(*m_spectral, m_spectralFactors);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Run(uint64_t steps)
+{
+    for (uint64_t step = 0; step < steps; ++step)
+        Step();
+}
+
+//////////////////////////////////////////////////////////////////////////
+const char* ShallowWaterModel::StateFieldName(uint32_t field)
+{
+    switch (field)
+    {
+    case STATE_ZONAL_WIND:
+        return "u";
+    case STATE_MERIDIONAL_WIND:
+        return "v";
+    case STATE_HEIGHT:
+        return "h";
+    case STATE_HUMIDITY:
+        return "q";
+    case STATE_TEMPERATURE:
+        return "t";
+    case STATE_PRECIPITATION:
+        return "rain";
+    default:
+        throw std::out_of_range("no such state field");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+const GridField& ShallowWaterModel::StateField(uint32_t field) const
+{
+    if (field >= StateFieldCount)
+        throw std::out_of_range("no such state field");
+    GridField* fields[StateFieldCount];
+    const_cast<ShallowWaterModel*>(this)->StateFields(fields);
+    return *fields[field];
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Restore(double time, uint64_t steps, const std::function<void(uint32_t field, GridField& state)>& load)
+{
+    GridField* fields[StateFieldCount];
+    StateFields(fields);
+    for (uint32_t field = 0; field < StateFieldCount; ++field)
+        load(field, *fields[field]);
+    m_time = time;
+    m_steps = steps;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::StateFields(GridField* (&fields)[StateFieldCount])
+{
+    fields[STATE_ZONAL_WIND] = &m_u;
+    fields[STATE_MERIDIONAL_WIND] = &m_v;
+    fields[STATE_HEIGHT] = &m_h;
+    fields[STATE_HUMIDITY] = &m_q;
+    fields[STATE_TEMPERATURE] = &m_t;
+    fields[STATE_PRECIPITATION] = &m_rain;
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t ShallowWaterModel::AssimilateTemperature(const GridField& observed, float weight)
+{
+    LIS_TRACE_ZONE("ShallowWaterModel::AssimilateTemperature");
+    if (observed.Width() != m_params.longitudes || observed.Height() != m_params.latitudes)
+        throw std::invalid_argument("the observed field must be of the grid size");
+
+    std::atomic<size_t> nudged(0);
+    m_pool.ParallelFor(0, m_params.latitudes, 4, [&](size_t first, size_t last) {
+        size_t cells = 0;
+        for (size_t y = first; y < last; ++y)
+        {
+            const float* in = observed.Row(static_cast<uint32_t>(y));
+            float* t = m_t.Row(static_cast<uint32_t>(y));
+            for (uint32_t x = 0; x < m_params.longitudes; ++x)
+            {
+                if (!std::isnan(in[x]))
+                {
+                    t[x] += weight * (in[x] - t[x]);
+                    ++cells;
+                }
+            }
+        }
+        nudged += cells;
+    });
+    return nudged;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::SmoothScalars(const SphericalHarmonics& transform, const std::vector<double>& degreeFactors)
+{
+    LIS_TRACE_ZONE("ShallowWaterModel::SmoothScalars");
+    if (transform.Longitudes() != m_params.longitudes || transform.Latitudes() != m_params.latitudes)
+        throw std::invalid_argument("the transform must be of the grid size");
+
+    transform.Smooth(m_h, degreeFactors);
+    transform.Smooth(m_q, degreeFactors);
+    transform.Smooth(m_t, degreeFactors);
+    m_pool.ParallelFor(0, m_params.latitudes, 4, [this](size_t first, size_t last) {
+        for (size_t y = first; y < last; ++y)
+        {
+            float* q = m_q.Row(static_cast<uint32_t>(y));
+            for (uint32_t x = 0; x < m_params.longitudes; ++x)
+                q[x] = std::max(q[x], 0.0f);
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Every field is interpolated at the departure point of the cell:
+/// the midpoint of the trajectory is found with the wind at the start,
+/// the departure point with the wind interpolated at the midpoint.
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Advect(uint32_t first, uint32_t last)
+{
+    const uint32_t width = m_params.longitudes;
+    const uint32_t height = m_params.latitudes;
+    const float dt = static_cast<float>(m_timeStep);
+    const float meridionalScale = static_cast<float>(m_params.latitudes / (Pi * m_params.radius));
+
+    std::vector<float> dx(width), dy(width), x(width), y(width);
+    for (uint32_t j = first; j < last; ++j)
+    {
+        const float zonal = dt * m_zonalScale[j];
+        const float meridional = dt * meridionalScale;
+        const float* u = m_u.Row(j);
+        const float* v = m_v.Row(j);
+
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            dx[i] = 0.5f * zonal * u[i];
+            dy[i] = 0.5f * meridional * v[i];
+        }
+        DeparturePoints(width, height, j, dx.data(), dy.data(), x.data(), y.data());
+
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const Stencil midpoint(x[i], y[i], width, height);
+            dx[i] = zonal * midpoint.Sample(m_u);
+            dy[i] = meridional * midpoint.Sample(m_v);
+        }
+        DeparturePoints(width, height, j, dx.data(), dy.data(), x.data(), y.data());
+
+        float* nextU = m_nextU.Row(j);
+        float* nextV = m_nextV.Row(j);
+        float* nextH = m_nextH.Row(j);
+        float* nextQ = m_nextQ.Row(j);
+        float* nextT = m_nextT.Row(j);
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const Stencil departure(x[i], y[i], width, height);
+            nextU[i] = departure.Sample(m_u);
+            nextV[i] = departure.Sample(m_v);
+            nextH[i] = departure.Sample(m_h);
+            nextQ[i] = departure.Sample(m_q);
+            nextT[i] = departure.Sample(m_t);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// The Coriolis and the metric terms turn the wind without changing its
+/// speed: the Cayley transform of the angle keeps that exactly. The
+/// meridional pressure gradient, one-sided next to the poles, goes
+/// through the same Crank-Nicolson step: added after the rotation it
+/// would spin a balanced jet down by the square of the angle per step.
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Rotate(uint32_t first, uint32_t last)
+{
+    const uint32_t width = m_params.longitudes;
+    const uint32_t height = m_params.latitudes;
+    const float dt = static_cast<float>(m_timeStep);
+    const float inverseRadius = static_cast<float>(1.0 / m_params.radius);
+    const double dLatitude = Pi / height;
+
+    for (uint32_t j = first; j < last; ++j)
+    {
+        const uint32_t north = std::min(j + 1, height - 1);
+        const uint32_t south = j > 0 ? j - 1 : 0;
+        const float gradient = static_cast<float>(
+            m_timeStep * m_params.gravity / (m_params.radius * dLatitude * (north - south)));
+        const float coriolis = m_coriolis[j];
+        const float metric = m_tanLatitude[j] * inverseRadius;
+        const float* hNorth = m_nextH.Row(north);
+        const float* hSouth = m_nextH.Row(south);
+        float* u = m_nextU.Row(j);
+        float* v = m_nextV.Row(j);
+
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const float k = 0.5f * dt * (coriolis + u[i] * metric);
+            const float denominator = 1.0f / (1.0f + k * k);
+            const float c = (1.0f - k * k) * denominator;
+            const float s = 2.0f * k * denominator;
+            const float force = -gradient * (hNorth[i] - hSouth[i]) * denominator;
+            const float eastward = u[i];
+            const float northward = v[i];
+            u[i] = c * eastward + s * northward + k * force;
+            v[i] = c * northward - s * eastward + force;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// The continuity equation with the zonal gravity waves implicit, then
+/// the zonal wind from the new height, then the column physics.
+/// Reads the meridional wind of the neighbouring rows, so it runs after
+/// Rotate() is done with all of them.
+//////////////////////////////////////////////////////////////////////////
+void ShallowWaterModel::Adjust(uint32_t first, uint32_t last)
+{
+    const uint32_t width = m_params.longitudes;
+    const uint32_t height = m_params.latitudes;
+    const float dt = static_cast<float>(m_timeStep);
+    const float depth = static_cast<float>(m_params.meanDepth);
+    const float gravity = static_cast<float>(m_params.gravity);
+    const float meridionalScale = static_cast<float>(m_params.latitudes / (Pi * m_params.radius));
+    const float radiation = static_cast<float>(m_timeStep / m_params.radiativeTimescale);
+    const float evaporation = static_cast<float>(m_timeStep / m_params.evaporationTimescale);
+    const float relativeHumidity = static_cast<float>(m_params.surfaceHumidity);
+    const float latentFactor = LatentHeat * LatentHeat / (HeatCapacity * VaporConstant);
+
+    std::vector<float> rhs(width);
+    std::vector<double> solution(width);
+    for (uint32_t j = first; j < last; ++j)
+    {
+        // Meridional divergence through the faces; nothing crosses the poles
+        const float cosine = m_cosLatitude[j];
+        const float* v = m_nextV.Row(j);
+        const float* vNorth = j + 1 < height ? m_nextV.Row(j + 1) : v;
+        const float* vSouth = j > 0 ? m_nextV.Row(j - 1) : v;
+        const float cosNorth = j + 1 < height ? m_cosLatitude[j + 1] : 0.0f;
+        const float cosSouth = j > 0 ? m_cosLatitude[j - 1] : 0.0f;
+        const float northFace = j + 1 < height ? 0.5f : 0.0f;
+        const float southFace = j > 0 ? 0.5f : 0.0f;
+        const float meridional = dt * depth * meridionalScale / cosine;
+        const float zonal = 0.5f * dt * depth * m_zonalScale[j];
+
+        const float* u = m_nextU.Row(j);
+        float* h = m_nextH.Row(j);
+        rhs[0] = h[0] - zonal * (u[1] - u[width - 1]);
+        rhs[width - 1] = h[width - 1] - zonal * (u[0] - u[width - 2]);
+        for (uint32_t i = 1; i + 1 < width; ++i)
+            rhs[i] = h[i] - zonal * (u[i + 1] - u[i - 1]);
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            const float fluxNorth = northFace * (v[i] * cosine + vNorth[i] * cosNorth);
+            const float fluxSouth = southFace * (v[i] * cosine + vSouth[i] * cosSouth);
+            rhs[i] -= meridional * (fluxNorth - fluxSouth);
+        }
+
+        // Thomas sweep with the precomputed pivots, then the correction
+        const double alpha = m_zonalAlpha[j];
+        const double* inverse = &m_zonalInverse[static_cast<size_t>(j) * width];
+        const double* z = &m_zonalZ[static_cast<size_t>(j) * width];
+        solution[0] = rhs[0] * inverse[0];
+        for (uint32_t i = 1; i < width; ++i)
+            solution[i] = (rhs[i] + alpha * solution[i - 1]) * inverse[i];
+        for (uint32_t i = width - 1; i-- > 0;)
+            solution[i] += alpha * inverse[i] * solution[i + 1];
+        const double factor = (solution[0] + alpha / (1.0 + 2.0 * alpha) * solution[width - 1])
+            * m_zonalCorrection[j];
+        for (uint32_t i = 0; i < width; ++i)
+            h[i] = static_cast<float>(solution[i] - factor * z[i]);
+
+        // The zonal wind feels the new height
+        float* uNext = m_nextU.Row(j);
+        const float pressure = 0.5f * dt * gravity * m_zonalScale[j];
+        const float westEnd = uNext[0] - pressure * (h[1] - h[width - 1]);
+        const float eastEnd = uNext[width - 1] - pressure * (h[0] - h[width - 2]);
+        for (uint32_t i = 1; i + 1 < width; ++i)
+            uNext[i] -= pressure * (h[i + 1] - h[i - 1]);
+        uNext[0] = westEnd;
+        uNext[width - 1] = eastEnd;
+
+        // Column physics
+        const float equilibrium = m_equilibrium[j];
+        float* q = m_nextQ.Row(j);
+        float* t = m_nextT.Row(j);
+        float* rain = m_rain.Row(j);
+        for (uint32_t i = 0; i < width; ++i)
+        {
+            float temperature = t[i] + radiation * (equilibrium - t[i]);
+            float humidity = q[i];
+            const float saturation = SaturationHumidity(temperature);
+            humidity += evaporation * (relativeHumidity * saturation - humidity);
+
+            const float excess = std::max(humidity - saturation, 0.0f)
+                / (1.0f + latentFactor * saturation / (temperature * temperature));
+            humidity -= excess;
+            temperature += LatentHeat / HeatCapacity * excess;
+
+            q[i] = humidity;
+            t[i] = temperature;
+            rain[i] += excess;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+ShallowWaterDiagnostics ShallowWaterModel::Diagnose() const
+{
+    ShallowWaterDiagnostics result = {};
+    result.minHeight = std::numeric_limits<double>::max();
+    result.maxHeight = -std::numeric_limits<double>::max();
+
+    double area = 0.0;
+    for (uint32_t j = 0; j < m_params.latitudes; ++j)
+    {
+        const float* u = m_u.Row(j);
+        const float* v = m_v.Row(j);
+        const float* h = m_h.Row(j);
+        const float* q = m_q.Row(j);
+        const float* t = m_t.Row(j);
+        const float* rain = m_rain.Row(j);
+
+        double height = 0.0, temperature = 0.0, humidity = 0.0, precipitation = 0.0;
+        for (uint32_t i = 0; i < m_params.longitudes; ++i)
+        {
+            height += h[i];
+            temperature += t[i];
+            humidity += q[i];
+            precipitation += rain[i];
+            result.minHeight = std::min(result.minHeight, static_cast<double>(h[i]));
+            result.maxHeight = std::max(result.maxHeight, static_cast<double>(h[i]));
+            result.maxWind = std::max(result.maxWind, std::sqrt(static_cast<double>(u[i] * u[i] + v[i] * v[i])));
+        }
+
+        const double weight = m_cosLatitude[j];
+        area += weight * m_params.longitudes;
+        result.meanHeight += weight * height;
+        result.meanTemperature += weight * temperature;
+        result.meanHumidity += weight * humidity;
+        result.precipitation += weight * precipitation;
+    }
+
+    result.meanHeight /= area;
+    result.meanTemperature /= area;
+    result.meanHumidity /= area;
+    result.precipitation /= area;
+    return result;
+}
+} // namespace Lis
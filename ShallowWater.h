@@ -0,0 +1,246 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ShallowWater.h
+///
+/// summary:    Declares the shallow-water atmosphere on a lat-lon grid
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "GridField.h"
+#include "SphericalHarmonics.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The planet and the numerics. The defaults are the Earth at one
+///   degree resolution.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct ShallowWaterParams
+{
+    uint32_t longitudes = 360;
+    uint32_t latitudes = 180;
+
+    double radius = 6.371e6;            ///< m
+    double rotationRate = 7.292e-5;     ///< rad/s
+    double gravity = 9.80616;           ///< m/s^2
+    double meanDepth = 5000.0;          ///< equivalent depth of the layer, m
+
+    //////////////////////////////////////////////////////////////////////////
+    /// The step, s; 0 takes the largest one the explicit meridional
+    /// gravity waves allow at the given Courant number
+    //////////////////////////////////////////////////////////////////////////
+    double timeStep = 0.0;
+    double courantNumber = 0.8;
+
+    double radiativeTimescale = 10.0 * 86400.0;     ///< temperature relaxation, s
+    double evaporationTimescale = 2.0 * 86400.0;    ///< humidity relaxation, s
+    double surfaceHumidity = 0.8;                   ///< relative humidity the evaporation aims at
+    double equatorTemperature = 300.0;              ///< radiative equilibrium, K
+    double poleTemperature = 240.0;                 ///< radiative equilibrium, K
+
+    //////////////////////////////////////////////////////////////////////////
+    /// The spectral filter of the scalars, see SmoothScalars(): every
+    /// interval of steps, a diffusion of the order, 2 the biharmonic, that
+    /// damps the degree of the truncation by 1/e over the timescale and
+    /// drops the degrees above it. A truncation of 0 leaves them as they
+    /// are; else the rows must be even and more than twice it.
+    //////////////////////////////////////////////////////////////////////////
+    uint32_t spectralTruncation = 0;
+    uint32_t spectralInterval = 4;
+    uint32_t spectralOrder = 2;
+    double spectralTimescale = 86400.0;             ///< s
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Saturation specific humidity at the surface pressure, kg/kg, from the
+/// temperature, K (Tetens formula)
+//////////////////////////////////////////////////////////////////////////
+inline float SaturationHumidity(float temperature)
+{
+    return 3.8e-3f * std::exp(17.67f * (temperature - 273.15f) / (temperature - 29.65f));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// "LONxLAT", e.g. "360x180"
+//////////////////////////////////////////////////////////////////////////
+ShallowWaterParams ParseGridSpec(const std::string& spec);
+
+//////////////////////////////////////////////////////////////////////////
+/// The state of ShallowWaterModel in its fixed order, the indices of
+/// ShallowWaterModel::StateField() and of the fields of its recordings
+//////////////////////////////////////////////////////////////////////////
+enum StateFieldIndex
+{
+    STATE_ZONAL_WIND = 0,       ///< "u"
+    STATE_MERIDIONAL_WIND = 1,  ///< "v"
+    STATE_HEIGHT = 2,           ///< "h"
+    STATE_HUMIDITY = 3,         ///< "q"
+    STATE_TEMPERATURE = 4,      ///< "t"
+    STATE_PRECIPITATION = 5,    ///< "rain"
+    STATE_FIELD_COUNT = 6
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Area-weighted statistics of the state, e.g. to watch a long run
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct ShallowWaterDiagnostics
+{
+    double meanHeight;          ///< m, conserved up to the interpolation error
+    double minHeight;
+    double maxHeight;
+    double maxWind;             ///< m/s
+    double meanTemperature;     ///< K
+    double meanHumidity;        ///< kg/kg
+    double precipitation;       ///< condensed humidity since the start, kg/kg averaged over the planet
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Rotating shallow-water equations on the sphere with humidity and
+///   temperature, on a regular lat-lon grid with the cell centers
+///   between the poles. No Qt, no OpenGL: it runs anywhere the thread
+///   pool does.
+///
+///   A step: semi-Lagrangian advection of every field along two-pass
+///   midpoint trajectories with bilinear interpolation; the Coriolis
+///   and metric terms as an exact rotation of the wind; the meridional
+///   pressure gradient explicitly; the zonal gravity waves implicitly,
+///   one cyclic tridiagonal system per latitude. The implicit part keeps
+///   the step independent of the converging meridians, so no polar
+///   filter is needed. Then the column physics: temperature relaxes to
+///   the radiative equilibrium, evaporation feeds the humidity and the
+///   supersaturation condenses, releasing latent heat.
+///
+///   The fields are GridField, one array per variable. Every pass runs
+///   over latitude bands on the pool, the kernels are unit-stride row
+///   loops written for the auto-vectorizer; only the interpolation
+///   gathers are scalar.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class ShallowWaterModel
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Start from a zonal jet in geostrophic balance with a height bump
+    ///   on it, the temperature at equilibrium and the humidity at the
+    ///   surface value.
+    /// </summary>
+    /// <exception cref="std::invalid_argument"> The grid is too small or
+    ///   a parameter is out of range </exception>
+    //////////////////////////////////////////////////////////////////////////
+    explicit ShallowWaterModel(const ShallowWaterParams& params, ThreadPool& pool = ThreadPool::GetShared());
+
+    void Step();
+    void Run(uint64_t steps);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Nudge the temperature toward observed values, e.g. the field of
+    ///   an ObservationGridder: by the weight, 1 replacing it, in the
+    ///   cells that are not NaN. Returns the cells nudged.
+    /// </summary>
+    /// <exception cref="std::invalid_argument"> The field is not of the
+    ///   grid size </exception>
+    //////////////////////////////////////////////////////////////////////////
+    size_t AssimilateTemperature(const GridField& observed, float weight = 1.0f);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Filter the scalar fields, the height, humidity and temperature, by
+    ///   the factors per degree of the transform, e.g. DiffusionFactors():
+    ///   the same everywhere, poles included. The degree 0, the mean, is
+    ///   the mass: a factor of 1 keeps it. The winds are components of a
+    ///   vector, not scalars, and are left; the humidity stays >= 0.
+    /// </summary>
+    /// <exception cref="std::invalid_argument"> The transform is not of
+    ///   the grid size </exception>
+    //////////////////////////////////////////////////////////////////////////
+    void SmoothScalars(const SphericalHarmonics& transform, const std::vector<double>& degreeFactors);
+
+    const ShallowWaterParams& Params() const { return m_params; }
+    double TimeStep() const { return m_timeStep; }
+    double Time() const { return m_time; }
+    uint64_t Steps() const { return m_steps; }
+    size_t CellCount() const { return static_cast<size_t>(m_params.longitudes) * m_params.latitudes; }
+
+    /// Latitude of the row, radians, south to north
+    double Latitude(uint32_t row) const;
+
+    const GridField& ZonalWind() const { return m_u; }         ///< m/s, eastward
+    const GridField& MeridionalWind() const { return m_v; }    ///< m/s, northward
+    const GridField& Height() const { return m_h; }           ///< m, deviation from the mean depth
+    const GridField& Humidity() const { return m_q; }         ///< kg/kg
+    const GridField& Temperature() const { return m_t; }      ///< K
+    const GridField& Precipitation() const { return m_rain; } ///< kg/kg since the start
+
+    ShallowWaterDiagnostics Diagnose() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The state in a fixed order, e.g. to save it: indexed by
+    ///   StateFieldIndex, STATE_ZONAL_WIND to STATE_PRECIPITATION.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    static const uint32_t StateFieldCount = STATE_FIELD_COUNT;
+    static const char* StateFieldName(uint32_t field);
+    const GridField& StateField(uint32_t field) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Replace the state by a saved one: load fills each field of the
+    ///   order of StateField(), then the clock is set.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Restore(double time, uint64_t steps, const std::function<void(uint32_t field, GridField& state)>& load);
+
+private:
+    void Initialize();
+    void PrepareZonalSolver();
+    void Advect(uint32_t first, uint32_t last);
+    void Rotate(uint32_t first, uint32_t last);
+    void Adjust(uint32_t first, uint32_t last);
+    void StateFields(GridField* (&fields)[StateFieldCount]);
+
+    ShallowWaterParams m_params;
+    ThreadPool& m_pool;
+    double m_timeStep;
+    double m_time;
+    uint64_t m_steps;
+
+    // Per row
+    std::vector<float> m_zonalScale;        ///< 1 / (a cos(lat) dlon): m -> zonal cells
+    std::vector<float> m_cosLatitude;
+    std::vector<float> m_tanLatitude;
+    std::vector<float> m_coriolis;
+    std::vector<float> m_equilibrium;       ///< radiative equilibrium temperature
+
+    // The state and the next one
+    GridField m_u, m_v, m_h, m_q, m_t;
+    GridField m_nextU, m_nextV, m_nextH, m_nextQ, m_nextT;
+    GridField m_rain;
+
+    std::unique_ptr<SphericalHarmonics> m_spectral;     ///< of the filter, if any
+    std::vector<double> m_spectralFactors;              ///< per degree, over an interval
+
+    // The factorization of the zonal systems, in double: the polar ones
+    // are poorly conditioned. A row of longitudes per latitude.
+    std::vector<double> m_zonalAlpha;       ///< the coupling of the neighbours
+    std::vector<double> m_zonalCorrection;  ///< the Sherman-Morrison denominator
+    std::vector<double> m_zonalInverse;     ///< the inverse pivots of the Thomas sweep
+    std::vector<double> m_zonalZ;           ///< the Sherman-Morrison vector
+};
+} // namespace Lis
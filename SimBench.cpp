@@ -0,0 +1,108 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SimBench.cpp
+///
+/// summary:    Throughput of the shallow-water model per thread count
+//////////////////////////////////////////////////////////////////////////
+
+#include "ShallowWater.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// 1,2,4,... up to the hardware threads
+//////////////////////////////////////////////////////////////////////////
+std::string DefaultThreadCounts()
+{
+    const unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string counts;
+    for (unsigned threads = 1; threads < hardware; threads *= 2)
+        counts += std::to_string(threads) + ",";
+    return counts + std::to_string(hardware);
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_sim_bench [grid,...] [threads,...] [steps]
+///
+/// Every grid is stepped steps times on a pool of every thread count,
+/// after a warm-up step. The report is printed as JSON with the cells
+/// updated per second in total and per thread, and the diagnostics at
+/// the end of the run to tell a fast blow-up from a fast model.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const std::vector<std::string> grids = SplitList(argc > 1 ? argv[1] : "360x180,720x360,1440x720");
+    const std::vector<std::string> threadCounts = SplitList(argc > 2 ? argv[2] : DefaultThreadCounts());
+    const int steps = argc > 3 ? std::atoi(argv[3]) : 50;
+    if (grids.empty() || threadCounts.empty() || steps <= 0)
+        throw std::invalid_argument("need at least one grid, one thread count and one step");
+
+    std::cout << "{\n  \"results\": [\n";
+    for (size_t g = 0; g < grids.size(); ++g)
+    {
+        const Lis::ShallowWaterParams params = Lis::ParseGridSpec(grids[g]);
+        for (size_t t = 0; t < threadCounts.size(); ++t)
+        {
+            const int threads = std::atoi(threadCounts[t].c_str());
+            if (threads <= 0)
+                throw std::invalid_argument("invalid thread count: " + threadCounts[t]);
+
+            // ParallelFor lets the caller work too: step from a pool thread to use exactly that many
+            Lis::ThreadPool pool(static_cast<size_t>(threads));
+            Lis::ShallowWaterModel model(params, pool);
+            const double seconds = pool.Submit([&model, steps] {
+                model.Step();
+                const Clock::time_point start = Clock::now();
+                model.Run(static_cast<uint64_t>(steps));
+                return std::chrono::duration<double>(Clock::now() - start).count();
+            }).get();
+
+            const Lis::ShallowWaterDiagnostics state = model.Diagnose();
+            const double cellsPerSecond = static_cast<double>(model.CellCount()) * steps / seconds;
+            std::cout << "    {\"grid\": \"" << params.longitudes << "x" << params.latitudes << "\""
+                << ", \"threads\": " << threads
+                << ", \"steps\": " << steps
+                << ", \"time_step_s\": " << model.TimeStep()
+                << ", \"ms_per_step\": " << seconds * 1e3 / steps
+                << ", \"mcells_per_sec\": " << cellsPerSecond / 1e6
+                << ", \"mcells_per_sec_per_thread\": " << cellsPerSecond / 1e6 / threads
+                << ", \"max_wind\": " << state.maxWind
+                << ", \"height_range\": [" << state.minHeight << ", " << state.maxHeight << "]"
+                << "}" << (g + 1 == grids.size() && t + 1 == threadCounts.size() ? "\n" : ",\n");
+        }
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
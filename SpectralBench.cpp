@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SpectralBench.cpp
+///
+/// summary:    Timings of the spherical harmonic transforms from T85 to
+///             T639
+//////////////////////////////////////////////////////////////////////////
+
+#include "SphericalHarmonics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double Median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+/// The first length from it made of only the factors 2, 3 and 5
+uint32_t FastLength(uint32_t length)
+{
+    for (;; ++length)
+    {
+        uint32_t rest = length;
+        for (const uint32_t factor : { 2u, 3u, 5u })
+        {
+            while (rest % factor == 0)
+                rest /= factor;
+        }
+        if (rest == 1)
+            return length;
+    }
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+/// Usage: lis_spectral_bench [truncation,...] [runs]
+///
+/// For every truncation, on the grid where the transforms are exact,
+/// 2T + 2 rows and about twice the columns: a random spectrum is
+/// synthesized and analyzed back for the runs. The report is printed as
+/// JSON with the median ms of the forward and inverse transforms, the
+/// worst error of the round trip against the largest coefficient, the
+/// MB of the tables and the time to build them.
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    const std::vector<std::string> truncations = SplitList(argc > 1 ? argv[1] : "85,170,319,639");
+    const long runs = argc > 2 ? std::atol(argv[2]) : 5;
+    if (truncations.empty() || runs <= 0)
+        throw std::invalid_argument("need at least one truncation and one run");
+
+    std::cout << "{\n  \"threads\": " << Lis::ThreadPool::GetShared().ThreadCount() << ",\n  \"runs\": " << runs
+        << ",\n  \"results\": [\n";
+    for (size_t t = 0; t < truncations.size(); ++t)
+    {
+        const long truncation = std::atol(truncations[t].c_str());
+        if (truncation <= 0)
+            throw std::invalid_argument("bad truncation: " + truncations[t]);
+        const uint32_t latitudes = 2 * static_cast<uint32_t>(truncation) + 2;
+        const uint32_t longitudes = FastLength(2 * latitudes);
+
+        Clock::time_point start = Clock::now();
+        const Lis::SphericalHarmonics transform(static_cast<uint32_t>(truncation), longitudes, latitudes);
+        const double setupMs = Seconds(start) * 1e3;
+
+        // Red, as the fields of the weather: the amplitude falls with the degree
+        std::mt19937 random(1);
+        std::normal_distribution<double> normal;
+        Lis::Spectrum spectrum(transform.CoefficientCount());
+        for (uint32_t m = 0; m <= transform.Truncation(); ++m)
+        {
+            for (uint32_t l = m; l <= transform.Truncation(); ++l)
+            {
+                const double amplitude = 1.0 / (1.0 + l);
+                spectrum[transform.Index(l, m)] = amplitude * std::complex<double>(normal(random), m == 0 ? 0.0 : normal(random));
+            }
+        }
+
+        Lis::GridField field(longitudes, latitudes);
+        Lis::Spectrum analyzed;
+        std::vector<double> inverseMs, forwardMs;
+        for (long run = 0; run < runs; ++run)
+        {
+            start = Clock::now();
+            transform.Inverse(spectrum, field);
+            inverseMs.push_back(Seconds(start) * 1e3);
+            start = Clock::now();
+            transform.Forward(field, analyzed);
+            forwardMs.push_back(Seconds(start) * 1e3);
+        }
+
+        double error = 0.0, largest = 0.0;
+        for (size_t i = 0; i < spectrum.size(); ++i)
+        {
+            error = std::max(error, std::abs(analyzed[i] - spectrum[i]));
+            largest = std::max(largest, std::abs(spectrum[i]));
+        }
+
+        start = Clock::now();
+        transform.Smooth(field, Lis::LowPassFactors(transform.Truncation(), transform.Truncation() / 2));
+        const double smoothMs = Seconds(start) * 1e3;
+
+        std::cout << "    {\"truncation\": " << truncation
+            << ", \"grid\": \"" << longitudes << "x" << latitudes
+            << "\", \"coefficients\": " << transform.CoefficientCount()
+            << ", \"table_mb\": " << transform.TableBytes() / 1048576.0
+            << ", \"setup_ms\": " << setupMs
+            << ", \"inverse_ms\": " << Median(inverseMs)
+            << ", \"forward_ms\": " << Median(forwardMs)
+            << ", \"smooth_ms\": " << smoothMs
+            << ", \"roundtrip_error\": " << error / largest
+            << "}" << (t + 1 == truncations.size() ? "\n" : ",\n");
+    }
+
+    std::cout << "  ]\n}" << std::endl;
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << "terminated: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
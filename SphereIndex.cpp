@@ -0,0 +1,480 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SphereIndex.cpp
+///
+/// summary:    Implements the hierarchical equal-area cells of the sphere
+///             and their queries
+//////////////////////////////////////////////////////////////////////////
+
+#include "SphereIndex.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace Lis
+{
+const uint32_t SphereIndex::MaxOrder;
+const size_t SphereIndex::DefaultMaxCells;
+const CellId SphereIndex::NoCell;
+
+namespace
+{
+const double Pi = 3.14159265358979323846;
+const double HalfPi = 0.5 * Pi;
+
+/// The row of the north corner of the base cells, in side units, and their longitude, in quarter side units
+const int BaseRow[12] = { 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4 };
+const int BaseColumn[12] = { 1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7 };
+
+/// The neighbours within a base cell, in the order of Neighbours()
+const int NeighbourX[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+const int NeighbourY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+/// The base cell over an edge or a corner of each: by the side of the crossing, 3 * dy + dx + 4,
+/// and the base cell; -1 where none meets there. Then how the coordinates turn on the way:
+/// 1 flips x, 2 flips y, 4 swaps them, by the row of the base cell.
+const int NeighbourBase[9][12] = {
+    { 8, 9, 10, 11, -1, -1, -1, -1, 10, 11, 8, 9 },     // south
+    { 5, 6, 7, 4, 8, 9, 10, 11, 9, 10, 11, 8 },         // southeast
+    { -1, -1, -1, -1, 5, 6, 7, 4, -1, -1, -1, -1 },     // east
+    { 4, 5, 6, 7, 11, 8, 9, 10, 11, 8, 9, 10 },         // southwest
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 },           // the same
+    { 1, 2, 3, 0, 0, 1, 2, 3, 5, 6, 7, 4 },             // northeast
+    { -1, -1, -1, -1, 7, 4, 5, 6, -1, -1, -1, -1 },     // west
+    { 3, 0, 1, 2, 3, 0, 1, 2, 4, 5, 6, 7 },             // northwest
+    { 2, 3, 0, 1, -1, -1, -1, -1, 0, 1, 2, 3 } };       // north
+const int NeighbourSwap[9][3] = {
+    { 0, 0, 3 }, { 0, 0, 6 }, { 0, 0, 0 }, { 0, 0, 5 }, { 0, 0, 0 },
+    { 5, 0, 0 }, { 0, 0, 0 }, { 6, 0, 0 }, { 3, 0, 0 } };
+
+//////////////////////////////////////////////////////////////////////////
+/// The bits of x at the even bits of the result
+uint64_t Spread(uint64_t x)
+{
+    x &= 0xFFFFFFFFull;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    return (x | (x << 1)) & 0x5555555555555555ull;
+}
+
+/// The even bits of x
+uint64_t Compact(uint64_t x)
+{
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    return (x | (x >> 16)) & 0xFFFFFFFFull;
+}
+
+//////////////////////////////////////////////////////////////////////////
+CellId Encode(uint32_t order, int64_t x, int64_t y, int base)
+{
+    return (static_cast<CellId>(base) << (2 * order)) + Spread(static_cast<uint64_t>(x))
+        + (Spread(static_cast<uint64_t>(y)) << 1);
+}
+
+void Decode(uint32_t order, CellId cell, int64_t& x, int64_t& y, int& base)
+{
+    const CellId inBase = cell & ((CellId(1) << (2 * order)) - 1);
+    base = static_cast<int>(cell >> (2 * order));
+    x = static_cast<int64_t>(Compact(inBase));
+    y = static_cast<int64_t>(Compact(inBase >> 1));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The cell of a point: z the sine of the latitude, cosLatitude for
+///   the precision near the poles.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+CellId CellAt(uint32_t order, double z, double cosLatitude, double longitude)
+{
+    const int64_t side = int64_t(1) << order;
+    const double za = std::fabs(z);
+    double t = std::fmod(longitude / HalfPi, 4.0);     // the quarter of the longitude, 0 to 4
+    if (t < 0.0)
+        t += 4.0;
+
+    if (za <= 2.0 / 3.0)
+    {
+        // The equatorial belt: the lines of the cell edges run diagonally
+        const double ascending = side * (0.5 + t) - side * (0.75 * z);
+        const double descending = side * (0.5 + t) + side * (0.75 * z);
+        const int64_t up = static_cast<int64_t>(ascending);
+        const int64_t down = static_cast<int64_t>(descending);
+        const int64_t upBase = up >> order;
+        const int64_t downBase = down >> order;
+        const int base = static_cast<int>(upBase == downBase ? (upBase | 4) : upBase < downBase ? upBase : downBase + 8);
+        return Encode(order, down & (side - 1), side - (up & (side - 1)) - 1, base);
+    }
+
+    // The polar caps: the cells shrink in longitude toward the pole
+    const int quarter = std::min(3, static_cast<int>(t));
+    const double within = t - quarter;
+    const double distance = side * std::sqrt(3.0) * cosLatitude / std::sqrt(1.0 + za);
+    const int64_t up = std::min(side - 1, static_cast<int64_t>(within * distance));
+    const int64_t down = std::min(side - 1, static_cast<int64_t>((1.0 - within) * distance));
+    if (z >= 0.0)
+        return Encode(order, side - down - 1, side - up - 1, quarter);
+    return Encode(order, up, down, quarter + 8);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void CenterAt(uint32_t order, CellId cell, double& z, double& longitude)
+{
+    const int64_t side = int64_t(1) << order;
+    int64_t x, y;
+    int base;
+    Decode(order, cell, x, y, base);
+
+    // The ring from the north pole, 1 to 4 side - 1, and the cells along it
+    const int64_t ring = (static_cast<int64_t>(BaseRow[base]) << order) - x - y - 1;
+    const double cells = 12.0 * side * side;
+    int64_t ringCells;
+    if (ring < side)
+    {
+        ringCells = ring;
+        z = 1.0 - ringCells * ringCells * 4.0 / cells;
+    }
+    else if (ring > 3 * side)
+    {
+        ringCells = 4 * side - ring;
+        z = ringCells * ringCells * 4.0 / cells - 1.0;
+    }
+    else
+    {
+        ringCells = side;
+        z = (2 * side - ring) * 8.0 * side / cells;
+    }
+
+    int64_t column = BaseColumn[base] * ringCells + x - y;
+    if (column < 0)
+        column += 8 * ringCells;
+    longitude = 0.5 * HalfPi * column / ringCells;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Direction(double z, double longitude, double* direction)
+{
+    const double r = std::sqrt(std::max(0.0, 1.0 - z * z));
+    direction[0] = r * std::cos(longitude);
+    direction[1] = z;
+    direction[2] = -r * std::sin(longitude);
+}
+
+/// Of unit directions; exact for the tiny cells, unlike the arc cosine
+double Angle(const double* a, const double* b)
+{
+    const double cross[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    return std::atan2(std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]),
+        a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The largest distance from the center of a cell to its corners, at
+///   the north corner of the cells next to the pole (Gorski et al.).
+///   The edges bulge out a little between the corners: the margin
+///   covers them.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+double CellRadiusAt(uint32_t order)
+{
+    const double side = static_cast<double>(int64_t(1) << order);
+    double center[3], corner[3];
+    Direction(2.0 / 3.0, Pi / (4.0 * side), center);
+    const double t = (1.0 - 1.0 / side) * (1.0 - 1.0 / side);
+    Direction(1.0 - t / 3.0, 0.0, corner);
+    return 1.05 * Angle(center, corner);
+}
+
+/// The result of a region test of a cell
+enum Overlap
+{
+    OVERLAP_NONE,
+    OVERLAP_PARTIAL,
+    OVERLAP_FULL
+};
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+SphereIndex::SphereIndex(uint32_t order)
+    : m_order(order)
+    , m_side(uint64_t(1) << std::min(order, MaxOrder))
+    , m_cellRadius(CellRadiusAt(std::min(order, MaxOrder)))
+{
+    if (order > MaxOrder)
+        throw std::invalid_argument("the sphere index order must not exceed " + std::to_string(MaxOrder));
+}
+
+//////////////////////////////////////////////////////////////////////////
+double SphereIndex::CellArea() const
+{
+    return 4.0 * Pi / static_cast<double>(CellCount());
+}
+
+//////////////////////////////////////////////////////////////////////////
+CellId SphereIndex::Cell(double latitude, double longitude) const
+{
+    return CellAt(m_order, std::sin(latitude), std::cos(latitude), longitude);
+}
+
+//////////////////////////////////////////////////////////////////////////
+CellId SphereIndex::CellOf(const float* direction) const
+{
+    const double x = direction[0], y = direction[1], z = direction[2];
+    const double horizontal = std::sqrt(x * x + z * z);
+    const double length = std::sqrt(horizontal * horizontal + y * y);
+    return CellAt(m_order, y / length, horizontal / length, std::atan2(-z, x));
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphereIndex::Cells(const float* latitudes, const float* longitudes, size_t count, CellId* cells,
+    ThreadPool& pool) const
+{
+    LIS_TRACE_ZONE("SphereIndex::Cells");
+
+    const uint32_t order = m_order;
+    pool.ParallelFor(0, count, 16384, [=](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+            const double latitude = latitudes[i];
+            cells[i] = CellAt(order, std::sin(latitude), std::cos(latitude), longitudes[i]);
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphereIndex::Center(CellId cell, double& latitude, double& longitude) const
+{
+    double z;
+    CenterAt(m_order, cell, z, longitude);
+    latitude = std::asin(z);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphereIndex::CenterDirection(CellId cell, float* direction) const
+{
+    double z, longitude, center[3];
+    CenterAt(m_order, cell, z, longitude);
+    Direction(z, longitude, center);
+    for (int i = 0; i < 3; ++i)
+        direction[i] = static_cast<float>(center[i]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphereIndex::Neighbours(CellId cell, CellId* neighbours) const
+{
+    const int64_t side = static_cast<int64_t>(m_side);
+    int64_t x, y;
+    int base;
+    Decode(m_order, cell, x, y, base);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        int64_t nx = x + NeighbourX[i];
+        int64_t ny = y + NeighbourY[i];
+
+        // Over an edge of the base cell the coordinates continue in the next one, turned
+        int crossing = 4;
+        if (nx < 0)
+        {
+            nx += side;
+            crossing -= 1;
+        }
+        else if (nx >= side)
+        {
+            nx -= side;
+            crossing += 1;
+        }
+        if (ny < 0)
+        {
+            ny += side;
+            crossing -= 3;
+        }
+        else if (ny >= side)
+        {
+            ny -= side;
+            crossing += 3;
+        }
+
+        const int neighbourBase = NeighbourBase[crossing][base];
+        if (neighbourBase < 0)
+        {
+            neighbours[i] = NoCell;
+            continue;
+        }
+        const int turn = NeighbourSwap[crossing][base >> 2];
+        if (turn & 1)
+            nx = side - nx - 1;
+        if (turn & 2)
+            ny = side - ny - 1;
+        if (turn & 4)
+            std::swap(nx, ny);
+        neighbours[i] = Encode(m_order, nx, ny, neighbourBase);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Descend from the base cells an order at a time: a cell out of the
+///   region is dropped, one inside it is taken whole as the range of its
+///   descendants, and the cells across the edge are split down to the
+///   order. If their children could take the cover past the budget, they
+///   are taken whole instead and the descent stops. The ranges come out
+///   sorted and merged.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+template <class Test>
+void SphereIndex::Cover(Test test, size_t maxCells, std::vector<CellRange>& ranges) const
+{
+    LIS_TRACE_ZONE("SphereIndex::Cover");
+    ranges.clear();
+
+    std::vector<CellId> cells, edge;
+    for (CellId base = 0; base < 12; ++base)
+        cells.push_back(base);
+    for (uint32_t order = 0; !cells.empty(); ++order)
+    {
+        const uint32_t shift = 2 * (m_order - order);
+        const double radius = CellRadiusAt(order);
+        edge.clear();
+        for (const CellId cell : cells)
+        {
+            double z, longitude, center[3];
+            CenterAt(order, cell, z, longitude);
+            Direction(z, longitude, center);
+            const Overlap overlap = test(center, radius);
+            if (overlap == OVERLAP_FULL)
+                ranges.push_back(CellRange{ cell << shift, (cell + 1) << shift });
+            else if (overlap == OVERLAP_PARTIAL)
+                edge.push_back(cell);
+        }
+
+        // Four children per cell at most: split only if they all fit
+        if (order == m_order || ranges.size() + 4 * edge.size() > maxCells)
+        {
+            for (const CellId cell : edge)
+                ranges.push_back(CellRange{ cell << shift, (cell + 1) << shift });
+            break;
+        }
+
+        cells.clear();
+        for (const CellId cell : edge)
+        {
+            for (CellId child = 0; child < 4; ++child)
+                cells.push_back((cell << 2) + child);
+        }
+    }
+
+    // The whole cells of every order: sort them and merge the neighbours
+    std::sort(ranges.begin(), ranges.end(), [](const CellRange& a, const CellRange& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (merged > 0 && ranges[merged - 1].last == ranges[i].first)
+            ranges[merged - 1].last = ranges[i].last;
+        else
+            ranges[merged++] = ranges[i];
+    }
+    ranges.resize(merged);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphereIndex::CoverCap(const float* center, double radius, std::vector<CellRange>& ranges, size_t maxCells) const
+{
+    double axis[3] = { center[0], center[1], center[2] };
+    const double length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (double& coordinate : axis)
+        coordinate /= length;
+
+    Cover([&axis, radius](const double* cellCenter, double cellRadius) {
+        const double distance = Angle(axis, cellCenter);
+        if (distance > radius + cellRadius)
+            return OVERLAP_NONE;
+        return distance + cellRadius <= radius ? OVERLAP_FULL : OVERLAP_PARTIAL;
+    }, maxCells, ranges);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphereIndex::CoverPolygon(const float* vertices, size_t count, std::vector<CellRange>& ranges,
+    size_t maxCells) const
+{
+    if (count < 3)
+        throw std::invalid_argument("a spherical polygon needs at least three vertices");
+
+    // The polygon is the intersection of the hemispheres on the inner side of its edges
+    std::vector<double> normals(count * 3);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float* a = vertices + i * 3;
+        const float* b = vertices + (i + 1) % count * 3;
+        double* n = &normals[i * 3];
+        n[0] = double(a[1]) * b[2] - double(a[2]) * b[1];
+        n[1] = double(a[2]) * b[0] - double(a[0]) * b[2];
+        n[2] = double(a[0]) * b[1] - double(a[1]) * b[0];
+        const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (!(length > 0.0))
+            throw std::invalid_argument("the polygon has an edge of no length");
+        for (int k = 0; k < 3; ++k)
+            n[k] /= length;
+    }
+
+    // Either winding: the other vertices are on the same side of every edge
+    const float* third = vertices + 2 * 3;
+    const double sign = normals[0] * third[0] + normals[1] * third[1] + normals[2] * third[2] < 0.0 ? -1.0 : 1.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        double* n = &normals[i * 3];
+        for (int k = 0; k < 3; ++k)
+            n[k] *= sign;
+        for (size_t j = 0; j < count; ++j)
+        {
+            const float* v = vertices + j * 3;
+            if (n[0] * v[0] + n[1] * v[1] + n[2] * v[2] < -1e-6)
+                throw std::invalid_argument("the spherical polygon must be convex");
+        }
+    }
+
+    Cover([&normals, count](const double* cellCenter, double cellRadius) {
+        // The signed distance of the center to every edge, positive inside
+        const double edge = std::sin(cellRadius);
+        Overlap overlap = OVERLAP_FULL;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const double* n = &normals[i * 3];
+            const double distance = n[0] * cellCenter[0] + n[1] * cellCenter[1] + n[2] * cellCenter[2];
+            if (distance < -edge)
+                return OVERLAP_NONE;
+            if (distance < edge)
+                overlap = OVERLAP_PARTIAL;
+        }
+        return overlap;
+    }, maxCells, ranges);
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool SphereIndex::Contains(const std::vector<CellRange>& ranges, CellId cell)
+{
+    // The last range starting at or before the cell
+    auto after = std::upper_bound(ranges.begin(), ranges.end(), cell,
+        [](CellId id, const CellRange& range) { return id < range.first; });
+    return after != ranges.begin() && cell < (after - 1)->last;
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint64_t SphereIndex::CellCount(const std::vector<CellRange>& ranges)
+{
+    uint64_t cells = 0;
+    for (const CellRange& range : ranges)
+        cells += range.last - range.first;
+    return cells;
+}
+} // namespace Lis
@@ -0,0 +1,141 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SphereIndex.h
+///
+/// summary:    Declares the hierarchical equal-area cells of the sphere
+///             and their queries
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+/// A cell of a SphereIndex, of the nested numbering
+typedef uint64_t CellId;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The cells first to last - 1 of an order: a cell of a coarser order
+///   is the range of its descendants.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct CellRange
+{
+    CellId first;
+    CellId last;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The HEALPix tessellation of the sphere (Gorski et al. 2005) in its
+///   nested numbering: 12 base cells, each split in four per order, all
+///   of the same area. The 4^order cells of a base cell are numbered
+///   along a Z-order curve, so the parent of a cell is its id shifted
+///   right by two and the descendants of a cell are a single range.
+///
+///   Directions are unit vectors of the planet frame of SphereMesh: y
+///   to the north pole, the longitude atan2(-z, x) east from the +x
+///   meridian. Latitudes and longitudes are radians.
+///
+///   A cell is found in constant time, its neighbours too. The region
+///   queries return sorted ranges, tested with Contains() in logarithmic
+///   time; they are inclusive: every cell that touches the region, and
+///   maybe a few close to its edge that do not. A cover stops refining
+///   at maxCells cells: past it, the cells across the edge are returned
+///   whole at the coarsest order reached, as the RegionCoverer of S2.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class SphereIndex
+{
+public:
+    static const uint32_t MaxOrder = 29;
+    static const CellId NoCell = ~CellId(0);
+
+    /// The budget of a cover, in cells of any order before they merge in ranges
+    static const size_t DefaultMaxCells = 1 << 14;
+
+    /// Throws std::invalid_argument for an order above MaxOrder
+    explicit SphereIndex(uint32_t order);
+
+    uint32_t Order() const { return m_order; }
+
+    /// The cells along an edge of a base cell, 2^order
+    uint64_t Side() const { return m_side; }
+
+    uint64_t CellCount() const { return 12 * m_side * m_side; }
+
+    /// Of every cell, sr
+    double CellArea() const;
+
+    /// The largest distance from the center of a cell to its edge, rad
+    double CellRadius() const { return m_cellRadius; }
+
+    CellId Cell(double latitude, double longitude) const;
+
+    /// Of a unit direction: x, y, z
+    CellId CellOf(const float* direction) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The cells of count points, in parallel on the pool for the large
+    ///   batches.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Cells(const float* latitudes, const float* longitudes, size_t count, CellId* cells,
+        ThreadPool& pool = ThreadPool::GetShared()) const;
+
+    void Center(CellId cell, double& latitude, double& longitude) const;
+    void CenterDirection(CellId cell, float* direction) const;
+
+    /// The cell of a coarser order holding the cell
+    CellId Parent(CellId cell, uint32_t order) const { return cell >> (2 * (m_order - order)); }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The eight cells around one: southwest, west, northwest, north,
+    ///   northeast, east, southeast and south. A few cells at the corners
+    ///   of the base cells have only seven: the missing one is NoCell.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Neighbours(CellId cell, CellId* neighbours) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The cells of the cap of the angular radius about a unit direction,
+    ///   at most maxCells of them, or the base cells it touches if more.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void CoverCap(const float* center, double radius, std::vector<CellRange>& ranges,
+        size_t maxCells = DefaultMaxCells) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The cells of a convex spherical polygon, its edges the great
+    ///   circles between count unit directions in either winding. Throws
+    ///   std::invalid_argument for fewer than three vertices or a polygon
+    ///   that is not convex. At most maxCells cells, as CoverCap().
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void CoverPolygon(const float* vertices, size_t count, std::vector<CellRange>& ranges,
+        size_t maxCells = DefaultMaxCells) const;
+
+    /// Whether a cell is in the sorted ranges of a cover
+    static bool Contains(const std::vector<CellRange>& ranges, CellId cell);
+
+    /// The cells of the ranges
+    static uint64_t CellCount(const std::vector<CellRange>& ranges);
+
+private:
+    template <class Test>
+    void Cover(Test test, size_t maxCells, std::vector<CellRange>& ranges) const;
+
+    uint32_t m_order;
+    uint64_t m_side;
+    double m_cellRadius;
+};
+} // namespace Lis
@@ -0,0 +1,651 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SphereMesh.cpp
+///
+/// summary:    Implements the compact sphere mesh generator
+//////////////////////////////////////////////////////////////////////////
+
+#include "SphereMesh.h"
+#include "MeshOptimizer.h"
+#include "PackedFormats.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define LIS_MESH_SSE2
+#endif
+
+namespace Lis
+{
+namespace
+{
+const float Pi = 3.14159265358979f;
+
+//////////////////////////////////////////////////////////////////////////
+/// The mesh before packing: unit positions, float UVs and 32-bit indices
+//////////////////////////////////////////////////////////////////////////
+struct RawMesh
+{
+    std::vector<float> positions;
+    std::vector<float> texCoords;
+    std::vector<uint32_t> indices;
+
+    uint32_t AddVertex(float x, float y, float z, float u, float v)
+    {
+        const uint32_t index = static_cast<uint32_t>(positions.size() / 3);
+        positions.insert(positions.end(), { x, y, z });
+        texCoords.insert(texCoords.end(), { u, v });
+        return index;
+    }
+
+    void AddTriangle(uint32_t a, uint32_t b, uint32_t c)
+    {
+        indices.insert(indices.end(), { a, b, c });
+    }
+
+    size_t VertexCount() const
+    {
+        return positions.size() / 3;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Equirectangular coordinates of a unit direction: u grows eastward,
+/// that is counter-clockwise seen from the north pole (+Y)
+//////////////////////////////////////////////////////////////////////////
+void DirectionToTexCoord(const float* direction, float& u, float& v)
+{
+    u = std::atan2(-direction[2], direction[0]) / (2.0f * Pi);
+    if (u < 0.0f)
+        u += 1.0f;
+    if (u >= 1.0f)
+        u = 0.0f;
+    v = std::asin(std::max(-1.0f, std::min(1.0f, direction[1]))) / Pi + 0.5f;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Generated meshes assign the texture coordinates from the direction,
+///   so the triangles crossing the u = 0 meridian and the ones touching a
+///   pole need their own copies of the vertices: the first get u + 1,
+///   the second get the mean u of their other corners.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void FixTextureSeams(RawMesh& mesh)
+{
+    const float poleThreshold = 1.0f - 1e-6f;
+    std::unordered_map<uint32_t, uint32_t> wrapped;
+
+    auto isPole = [&mesh, poleThreshold](uint32_t v) {
+        return std::fabs(mesh.positions[v * 3 + 1]) > poleThreshold;
+    };
+    auto duplicate = [&mesh](uint32_t v, float u) {
+        const float* p = &mesh.positions[v * 3];
+        return mesh.AddVertex(p[0], p[1], p[2], u, mesh.texCoords[v * 2 + 1]);
+    };
+
+    const size_t triangleCount = mesh.indices.size() / 3;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        uint32_t* corners = &mesh.indices[t * 3];
+
+        float minU = 1.0f, maxU = 0.0f;
+        for (int c = 0; c < 3; ++c)
+        {
+            if (isPole(corners[c]))
+                continue;
+            minU = std::min(minU, mesh.texCoords[corners[c] * 2]);
+            maxU = std::max(maxU, mesh.texCoords[corners[c] * 2]);
+        }
+
+        if (maxU - minU > 0.5f)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                const uint32_t v = corners[c];
+                if (isPole(v) || mesh.texCoords[v * 2] >= 0.5f)
+                    continue;
+
+                auto found = wrapped.find(v);
+                if (found == wrapped.end())
+                    found = wrapped.emplace(v, duplicate(v, mesh.texCoords[v * 2] + 1.0f)).first;
+                corners[c] = found->second;
+            }
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            if (!isPole(corners[c]))
+                continue;
+
+            float sumU = 0.0f;
+            int count = 0;
+            for (int other = 0; other < 3; ++other)
+            {
+                if (other != c && !isPole(corners[other]))
+                {
+                    sumU += mesh.texCoords[corners[other] * 2];
+                    ++count;
+                }
+            }
+            corners[c] = duplicate(corners[c], count ? sumU / count : 0.0f);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Encode one latitude row of a UV sphere. The direction of column c is
+///   (cosPhi * cosTheta[c], sinPhi, -cosPhi * sinTheta[c]); the texture
+///   coordinates come as ready halves from the tables.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void EncodeRow(float cosPhi, float sinPhi, uint16_t vHalf, const float* cosTheta, const float* sinTheta,
+    const uint16_t* uHalf, size_t count, PackedVertex* out)
+{
+    size_t c = 0;
+
+#ifdef LIS_MESH_SSE2
+    // Four vertices per iteration: the octahedral encoding with the fold
+    // done by masks, then the normals and the UVs are interleaved into
+    // two pairs of PackedVertex by the unpack instructions
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minusOne = _mm_set1_ps(-1.0f);
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 ringRadius = _mm_set1_ps(cosPhi);
+    const __m128 y = _mm_set1_ps(sinPhi);
+    const __m128 absY = _mm_and_ps(y, absMask);
+    const __m128i v = _mm_set1_epi16(static_cast<short>(vHalf));
+
+    auto select = [](__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    };
+
+    for (; c + 4 <= count; c += 4)
+    {
+        const __m128 x = _mm_mul_ps(ringRadius, _mm_loadu_ps(cosTheta + c));
+        const __m128 z = _mm_sub_ps(zero, _mm_mul_ps(ringRadius, _mm_loadu_ps(sinTheta + c)));
+
+        const __m128 invL1 = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_and_ps(x, absMask), absY), _mm_and_ps(z, absMask)));
+        __m128 u = _mm_mul_ps(x, invL1);
+        __m128 w = _mm_mul_ps(y, invL1);
+
+        const __m128 signU = select(_mm_cmpge_ps(u, zero), one, minusOne);
+        const __m128 signW = select(_mm_cmpge_ps(w, zero), one, minusOne);
+        const __m128 foldedU = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(w, absMask)), signU);
+        const __m128 foldedW = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(u, absMask)), signW);
+        const __m128 lower = _mm_cmplt_ps(z, zero);
+        u = _mm_max_ps(minusOne, _mm_min_ps(one, select(lower, foldedU, u)));
+        w = _mm_max_ps(minusOne, _mm_min_ps(one, select(lower, foldedW, w)));
+
+        const __m128i normals = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(u, scale)),
+            _mm_cvtps_epi32(_mm_mul_ps(w, scale)));
+        const __m128i normalPairs = _mm_unpacklo_epi16(normals, _mm_srli_si128(normals, 8));
+        const __m128i texCoordPairs = _mm_unpacklo_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(uHalf + c)), v);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c), _mm_unpacklo_epi32(normalPairs, texCoordPairs));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c + 2), _mm_unpackhi_epi32(normalPairs, texCoordPairs));
+    }
+#endif
+
+    for (; c < count; ++c)
+    {
+        PackOctahedral(cosPhi * cosTheta[c], sinPhi, -cosPhi * sinTheta[c], out[c].normal);
+        out[c].texCoord[0] = uHalf[c];
+        out[c].texCoord[1] = vHalf;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Write the triangles of the UV sphere columns [firstColumn, lastColumn)
+///   from pole to pole. Narrow bands keep two rows of the band in the
+///   post-transform cache: 7 quads need 16 entries.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+template<class Index>
+void WriteBandIndices(uint32_t rings, uint32_t segments, uint32_t firstColumn, uint32_t lastColumn, Index* out)
+{
+    auto ring = [segments](uint32_t r, uint32_t c) {
+        return static_cast<Index>(segments + (r - 1) * (segments + 1) + c);
+    };
+    const uint32_t southPole = segments + (rings - 1) * (segments + 1);
+
+    for (uint32_t c = firstColumn; c < lastColumn; ++c)
+    {
+        *out++ = static_cast<Index>(c);
+        *out++ = ring(1, c);
+        *out++ = ring(1, c + 1);
+    }
+
+    for (uint32_t r = 1; r + 1 < rings; ++r)
+    {
+        for (uint32_t c = firstColumn; c < lastColumn; ++c)
+        {
+            *out++ = ring(r, c);
+            *out++ = ring(r + 1, c);
+            *out++ = ring(r + 1, c + 1);
+            *out++ = ring(r, c);
+            *out++ = ring(r + 1, c + 1);
+            *out++ = ring(r, c + 1);
+        }
+    }
+
+    for (uint32_t c = firstColumn; c < lastColumn; ++c)
+    {
+        *out++ = ring(rings - 1, c);
+        *out++ = static_cast<Index>(southPole + c);
+        *out++ = ring(rings - 1, c + 1);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+template<class Index>
+void WriteUvIndices(uint32_t rings, uint32_t segments, Index* out, ThreadPool& pool)
+{
+    const uint32_t bandWidth = 7;
+    const uint32_t bands = (segments + bandWidth - 1) / bandWidth;
+    const size_t indicesPerColumn = static_cast<size_t>(rings - 1) * 6;
+
+    pool.ParallelFor(0, bands, 1, [=](size_t first, size_t last) {
+        for (size_t band = first; band < last; ++band)
+        {
+            const uint32_t firstColumn = static_cast<uint32_t>(band) * bandWidth;
+            const uint32_t lastColumn = std::min(segments, firstColumn + bandWidth);
+            WriteBandIndices(rings, segments, firstColumn, lastColumn, out + firstColumn * indicesPerColumn);
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+RawMesh GenerateIcoSphere(uint32_t subdivisions)
+{
+    if (subdivisions > 10)
+        throw std::invalid_argument("icosphere subdivision level is too high");
+
+    RawMesh mesh;
+
+    // Icosahedron with vertices at the poles, so the pole fix-up applies.
+    // The rings are at latitude +-atan(1/2), the lower one turned by 36.
+    const float ringY = 1.0f / std::sqrt(5.0f);
+    const float ringRadius = 2.0f / std::sqrt(5.0f);
+    auto addPoint = [&mesh](float x, float y, float z) {
+        return mesh.AddVertex(x, y, z, 0.0f, 0.0f);
+    };
+
+    const uint32_t north = addPoint(0.0f, 1.0f, 0.0f);
+    uint32_t upper[5], lower[5];
+    for (int k = 0; k < 5; ++k)
+    {
+        const float upperTheta = k * 2.0f * Pi / 5.0f;
+        const float lowerTheta = upperTheta + Pi / 5.0f;
+        upper[k] = addPoint(ringRadius * std::cos(upperTheta), ringY, -ringRadius * std::sin(upperTheta));
+        lower[k] = addPoint(ringRadius * std::cos(lowerTheta), -ringY, -ringRadius * std::sin(lowerTheta));
+    }
+    const uint32_t south = addPoint(0.0f, -1.0f, 0.0f);
+
+    for (int k = 0; k < 5; ++k)
+    {
+        const int next = (k + 1) % 5;
+        mesh.AddTriangle(north, upper[k], upper[next]);
+        mesh.AddTriangle(upper[k], lower[k], upper[next]);
+        mesh.AddTriangle(lower[k], lower[next], upper[next]);
+        mesh.AddTriangle(lower[k], south, lower[next]);
+    }
+
+    for (uint32_t level = 0; level < subdivisions; ++level)
+    {
+        std::unordered_map<uint64_t, uint32_t> midpoints;
+        auto midpoint = [&mesh, &midpoints](uint32_t a, uint32_t b) {
+            const uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+            auto found = midpoints.find(key);
+            if (found != midpoints.end())
+                return found->second;
+
+            float p[3];
+            for (int axis = 0; axis < 3; ++axis)
+                p[axis] = mesh.positions[a * 3 + axis] + mesh.positions[b * 3 + axis];
+            const float invLength = 1.0f / std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            const uint32_t index = mesh.AddVertex(p[0] * invLength, p[1] * invLength, p[2] * invLength, 0.0f, 0.0f);
+            midpoints.emplace(key, index);
+            return index;
+        };
+
+        std::vector<uint32_t> coarse;
+        coarse.swap(mesh.indices);
+        mesh.indices.reserve(coarse.size() * 4);
+        for (size_t t = 0; t < coarse.size(); t += 3)
+        {
+            const uint32_t a = coarse[t], b = coarse[t + 1], c = coarse[t + 2];
+            const uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            mesh.AddTriangle(a, ab, ca);
+            mesh.AddTriangle(ab, b, bc);
+            mesh.AddTriangle(ca, bc, c);
+            mesh.AddTriangle(ab, bc, ca);
+        }
+    }
+
+    for (size_t v = 0; v < mesh.VertexCount(); ++v)
+        DirectionToTexCoord(&mesh.positions[v * 3], mesh.texCoords[v * 2], mesh.texCoords[v * 2 + 1]);
+    FixTextureSeams(mesh);
+    return mesh;
+}
+
+//////////////////////////////////////////////////////////////////////////
+RawMesh GenerateCubeSphere(uint32_t resolution)
+{
+    if (resolution < 1)
+        throw std::invalid_argument("cube sphere needs at least one cell per face");
+
+    // An even resolution puts a vertex exactly at the poles (face centers)
+    resolution += resolution % 2;
+
+    RawMesh mesh;
+    const size_t faceVertices = static_cast<size_t>(resolution + 1) * (resolution + 1);
+    mesh.positions.reserve(6 * faceVertices * 3);
+    mesh.texCoords.reserve(6 * faceVertices * 2);
+    mesh.indices.reserve(6 * static_cast<size_t>(resolution) * resolution * 6);
+
+    // Face normal and the tangent U; V = N x U, so U x V = N and the
+    // cells (u, v) -> (u + 1, v) -> (u + 1, v + 1) face outward
+    const float faces[6][2][3] = {
+        { { 1, 0, 0 }, { 0, 0, -1 } },
+        { { -1, 0, 0 }, { 0, 0, 1 } },
+        { { 0, 1, 0 }, { 1, 0, 0 } },
+        { { 0, -1, 0 }, { 1, 0, 0 } },
+        { { 0, 0, 1 }, { 1, 0, 0 } },
+        { { 0, 0, -1 }, { -1, 0, 0 } },
+    };
+
+    for (const auto& face : faces)
+    {
+        const float* n = face[0];
+        const float* t = face[1];
+        const float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+        const uint32_t base = static_cast<uint32_t>(mesh.VertexCount());
+
+        for (uint32_t j = 0; j <= resolution; ++j)
+        {
+            const float s = 2.0f * j / resolution - 1.0f;
+            for (uint32_t i = 0; i <= resolution; ++i)
+            {
+                const float r = 2.0f * i / resolution - 1.0f;
+                const float x = n[0] + r * t[0] + s * b[0];
+                const float y = n[1] + r * t[1] + s * b[1];
+                const float z = n[2] + r * t[2] + s * b[2];
+
+                // Spherified cube mapping: much more uniform cells than
+                // the plain normalization of the cube point
+                const float x2 = x * x, y2 = y * y, z2 = z * z;
+                const float p[3] = {
+                    x * std::sqrt(std::max(0.0f, 1.0f - y2 / 2.0f - z2 / 2.0f + y2 * z2 / 3.0f)),
+                    y * std::sqrt(std::max(0.0f, 1.0f - z2 / 2.0f - x2 / 2.0f + z2 * x2 / 3.0f)),
+                    z * std::sqrt(std::max(0.0f, 1.0f - x2 / 2.0f - y2 / 2.0f + x2 * y2 / 3.0f)),
+                };
+                float u, v;
+                DirectionToTexCoord(p, u, v);
+                mesh.AddVertex(p[0], p[1], p[2], u, v);
+            }
+        }
+
+        for (uint32_t j = 0; j < resolution; ++j)
+        {
+            for (uint32_t i = 0; i < resolution; ++i)
+            {
+                const uint32_t v00 = base + j * (resolution + 1) + i;
+                const uint32_t v10 = v00 + 1;
+                const uint32_t v01 = v00 + resolution + 1;
+                const uint32_t v11 = v01 + 1;
+                mesh.AddTriangle(v00, v10, v11);
+                mesh.AddTriangle(v00, v11, v01);
+            }
+        }
+    }
+
+    FixTextureSeams(mesh);
+    return mesh;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Optimize(RawMesh& mesh)
+{
+    OptimizeVertexCache(mesh.indices, mesh.VertexCount());
+    OptimizeOverdraw(mesh.indices, mesh.positions.data(), mesh.VertexCount());
+
+    const std::vector<uint32_t> remap = OptimizeVertexFetch(mesh.indices, mesh.VertexCount());
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    const size_t usedCount = remap.size() - std::count(remap.begin(), remap.end(), unused);
+
+    std::vector<float> positions(usedCount * 3);
+    std::vector<float> texCoords(usedCount * 2);
+    for (size_t v = 0; v < remap.size(); ++v)
+    {
+        if (remap[v] == unused)
+            continue;
+        std::copy_n(&mesh.positions[v * 3], 3, &positions[remap[v] * 3]);
+        std::copy_n(&mesh.texCoords[v * 2], 2, &texCoords[remap[v] * 2]);
+    }
+    mesh.positions.swap(positions);
+    mesh.texCoords.swap(texCoords);
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint32_t ParseDetail(const std::string& text, const std::string& spec)
+{
+    size_t parsed = 0;
+    unsigned long value = 0;
+    try
+    {
+        value = std::stoul(text, &parsed);
+    }
+    catch (const std::exception&)
+    {
+        parsed = 0;
+    }
+
+    if (parsed == 0 || parsed != text.size() || value == 0 || value > std::numeric_limits<uint16_t>::max())
+        throw std::invalid_argument("invalid sphere mesh specification: " + spec);
+    return static_cast<uint32_t>(value);
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+SphereMeshParams ParseSphereMeshSpec(const std::string& spec)
+{
+    const size_t colon = spec.find(':');
+    if (colon == std::string::npos)
+        throw std::invalid_argument("invalid sphere mesh specification: " + spec);
+
+    const std::string type = spec.substr(0, colon);
+    const std::string detail = spec.substr(colon + 1);
+
+    SphereMeshParams params;
+    if (type == "uv")
+    {
+        params.type = SPHERE_UV;
+        const size_t cross = detail.find('x');
+        params.latitudeLines = ParseDetail(detail.substr(0, cross), spec);
+        params.longitudeLines = cross == std::string::npos
+            ? params.latitudeLines : ParseDetail(detail.substr(cross + 1), spec);
+    }
+    else if (type == "ico")
+    {
+        params.type = SPHERE_ICO;
+        params.subdivisions = ParseDetail(detail, spec);
+    }
+    else if (type == "cube")
+    {
+        params.type = SPHERE_CUBE;
+        params.faceResolution = ParseDetail(detail, spec);
+    }
+    else
+    {
+        throw std::invalid_argument("unknown sphere mesh type: " + spec);
+    }
+    return params;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::string FormatSphereMeshSpec(const SphereMeshParams& params)
+{
+    switch (params.type)
+    {
+    case SPHERE_UV:
+        return "uv:" + std::to_string(params.latitudeLines) + "x" + std::to_string(params.longitudeLines);
+    case SPHERE_ICO:
+        return "ico:" + std::to_string(params.subdivisions);
+    case SPHERE_CUBE:
+        return "cube:" + std::to_string(params.faceResolution);
+    }
+    return std::string();
+}
+
+//////////////////////////////////////////////////////////////////////////
+SphereMesh SphereMesh::GenerateUv(const SphereMeshParams& params, ThreadPool& pool)
+{
+    const uint32_t rings = params.latitudeLines;
+    const uint32_t segments = params.longitudeLines;
+    if (rings < 2 || segments < 3)
+        throw std::invalid_argument("UV sphere needs at least 2 latitude and 3 longitude lines");
+
+    // Layout: one vertex per pole triangle at each pole, so the texture is
+    // not twisted there, and segments + 1 vertices on every inner ring:
+    // the seam column is duplicated with u = 0 and u = 1
+    const size_t rowLength = segments + 1;
+    const size_t vertexCount = 2 * static_cast<size_t>(segments) + (rings - 1) * rowLength;
+    const size_t indexCount = static_cast<size_t>(segments) * (rings - 1) * 6;
+    if (vertexCount > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("UV sphere is too large for 32-bit indices");
+
+    // Trigonometry is done once per row and once per column
+    std::vector<float> cosTheta(rowLength), sinTheta(rowLength);
+    std::vector<uint16_t> uHalf(rowLength), poleUHalf(segments);
+    for (uint32_t c = 0; c < rowLength; ++c)
+    {
+        const double theta = 2.0 * Pi * c / segments;
+        cosTheta[c] = c == segments ? 1.0f : static_cast<float>(std::cos(theta));
+        sinTheta[c] = c == segments ? 0.0f : static_cast<float>(std::sin(theta));
+        uHalf[c] = PackHalf(static_cast<float>(c) / segments);
+        if (c < segments)
+            poleUHalf[c] = PackHalf((c + 0.5f) / segments);
+    }
+
+    SphereMesh mesh;
+    mesh.m_vertices.resize(vertexCount);
+    PackedVertex* vertices = mesh.m_vertices.data();
+
+    const uint16_t northV = PackHalf(1.0f), southV = PackHalf(0.0f);
+    PackedVertex* southPole = vertices + segments + (rings - 1) * rowLength;
+    for (uint32_t c = 0; c < segments; ++c)
+    {
+        vertices[c] = PackedVertex{ { 0, 32767 }, { poleUHalf[c], northV } };
+        southPole[c] = PackedVertex{ { 0, -32767 }, { poleUHalf[c], southV } };
+    }
+
+    const size_t rowsPerChunk = std::max<size_t>(1, 16384 / rowLength);
+    pool.ParallelFor(1, rings, rowsPerChunk, [&](size_t first, size_t last) {
+        for (size_t r = first; r < last; ++r)
+        {
+            const float v = 1.0f - static_cast<float>(r) / rings;
+            const double phi = (v - 0.5) * Pi;
+            EncodeRow(static_cast<float>(std::cos(phi)), static_cast<float>(std::sin(phi)), PackHalf(v),
+                cosTheta.data(), sinTheta.data(), uHalf.data(), rowLength,
+                vertices + segments + (r - 1) * rowLength);
+        }
+    });
+
+    if (vertexCount <= std::numeric_limits<uint16_t>::max() + size_t(1))
+    {
+        mesh.m_indices16.resize(indexCount);
+        WriteUvIndices(rings, segments, mesh.m_indices16.data(), pool);
+    }
+    else
+    {
+        mesh.m_indices32.resize(indexCount);
+        WriteUvIndices(rings, segments, mesh.m_indices32.data(), pool);
+    }
+    return mesh;
+}
+
+//////////////////////////////////////////////////////////////////////////
+SphereMesh SphereMesh::Generate(const SphereMeshParams& params, ThreadPool& pool)
+{
+    LIS_TRACE_ZONE("SphereMesh::Generate");
+    RawMesh raw;
+    switch (params.type)
+    {
+    case SPHERE_UV:
+        return GenerateUv(params, pool);
+    case SPHERE_ICO:
+        raw = GenerateIcoSphere(params.subdivisions);
+        break;
+    case SPHERE_CUBE:
+        raw = GenerateCubeSphere(params.faceResolution);
+        break;
+    default:
+        throw std::invalid_argument("unknown sphere mesh type");
+    }
+
+    if (params.optimize)
+        Optimize(raw);
+
+    SphereMesh mesh;
+    const size_t vertexCount = raw.VertexCount();
+    mesh.m_vertices.resize(vertexCount);
+    pool.ParallelFor(0, vertexCount, 4096, [&raw, &mesh](size_t first, size_t last) {
+        for (size_t v = first; v < last; ++v)
+        {
+            PackedVertex& packed = mesh.m_vertices[v];
+            const float* p = &raw.positions[v * 3];
+            PackOctahedral(p[0], p[1], p[2], packed.normal);
+            packed.texCoord[0] = PackHalf(raw.texCoords[v * 2]);
+            packed.texCoord[1] = PackHalf(raw.texCoords[v * 2 + 1]);
+        }
+    });
+
+    if (vertexCount <= std::numeric_limits<uint16_t>::max() + size_t(1))
+        mesh.m_indices16.assign(raw.indices.begin(), raw.indices.end());
+    else
+        mesh.m_indices32.assign(raw.indices.begin(), raw.indices.end());
+
+    return mesh;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::future<SphereMesh> SphereMesh::GenerateAsync(const SphereMeshParams& params, ThreadPool& pool)
+{
+    return pool.Submit([params, &pool] {
+        return Generate(params, pool);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+double SphereMesh::Acmr() const
+{
+    if (HasShortIndices())
+        return ComputeAcmr(m_indices16.data(), m_indices16.size(), m_vertices.size());
+    return ComputeAcmr(m_indices32.data(), m_indices32.size(), m_vertices.size());
+}
+
+//////////////////////////////////////////////////////////////////////////
+const void* SphereMesh::IndexData() const
+{
+    if (HasShortIndices())
+        return m_indices16.data();
+    return m_indices32.data();
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t SphereMesh::IndexCount() const
+{
+    return HasShortIndices() ? m_indices16.size() : m_indices32.size();
+}
+} // namespace Lis
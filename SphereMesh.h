@@ -0,0 +1,164 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SphereMesh.h
+///
+/// summary:    Declares the compact sphere mesh generator
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+enum SphereMeshType
+{
+    SPHERE_UV,          ///< latitude/longitude grid
+    SPHERE_ICO,         ///< subdivided icosahedron
+    SPHERE_CUBE         ///< spherified cube
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Tessellation of the sphere. Only the fields of the selected type
+///   are used.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct SphereMeshParams
+{
+    SphereMeshType type = SPHERE_UV;
+    uint32_t latitudeLines = 40;    ///< UV: number of rows between the poles
+    uint32_t longitudeLines = 40;   ///< UV: number of columns around the equator
+    uint32_t subdivisions = 4;      ///< ICO: every level splits a triangle into four
+    uint32_t faceResolution = 32;   ///< CUBE: cells along a face edge, rounded up to even
+    bool optimize = true;           ///< ICO, CUBE: reorder for the vertex cache and overdraw
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Parse the mesh description: "uv:40", "uv:40x80" (latitude x longitude
+///   lines), "ico:5" or "cube:64".
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+SphereMeshParams ParseSphereMeshSpec(const std::string& spec);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Describe the parameters in the ParseSphereMeshSpec() format
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+std::string FormatSphereMeshSpec(const SphereMeshParams& params);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   8 bytes per vertex. The position of a unit sphere vertex is its own
+///   normal, so only the octahedral-encoded direction (2 x GL_SHORT,
+///   normalized) and the half-float texture coordinates are stored; the
+///   shader scales the direction by the radius.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct PackedVertex
+{
+    int16_t normal[2];
+    uint16_t texCoord[2];
+};
+
+static_assert(sizeof(PackedVertex) == 8, "PackedVertex must stay tightly packed");
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Allocator leaving the trivial elements uninitialized on resize(), so
+///   the mesh buffers are not zeroed by one thread before the workers
+///   overwrite them (and take the page faults in parallel)
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+template<class T>
+class DefaultInitAllocator : public std::allocator<T>
+{
+public:
+    template<class U>
+    struct rebind
+    {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    DefaultInitAllocator() = default;
+    template<class U>
+    DefaultInitAllocator(const DefaultInitAllocator<U>&) {}
+
+    template<class U>
+    void construct(U* pointer)
+    {
+        ::new (static_cast<void*>(pointer)) U;
+    }
+
+    template<class U, class... Args>
+    void construct(U* pointer, Args&&... args)
+    {
+        ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+    }
+};
+
+template<class T>
+using MeshBuffer = std::vector<T, DefaultInitAllocator<T>>;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Indexed triangle list of a unit sphere in one interleaved vertex
+///   buffer. Triangles are counter-clockwise seen from the outside, the
+///   texture coordinates are equirectangular with v = 1 at the north pole
+///   and u growing eastward. Vertices on the texture seam and the poles
+///   are duplicated, so no triangle wraps around the texture.
+///
+///   UV spheres are written straight into the final buffers: the rows
+///   are encoded by vectorized kernels on the pool, and the triangles are
+///   emitted in narrow column bands, which keeps the vertex cache warm
+///   without the generic optimizer.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class SphereMesh
+{
+public:
+    static SphereMesh Generate(const SphereMeshParams& params, ThreadPool& pool = ThreadPool::GetShared());
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Generate on the pool, e.g. while the window is already showing
+    //////////////////////////////////////////////////////////////////////////
+    static std::future<SphereMesh> GenerateAsync(const SphereMeshParams& params,
+        ThreadPool& pool = ThreadPool::GetShared());
+
+    const MeshBuffer<PackedVertex>& Vertices() const { return m_vertices; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// 16-bit indices are used whenever the vertex count allows
+    //////////////////////////////////////////////////////////////////////////
+    bool HasShortIndices() const { return m_indices32.empty(); }
+    const void* IndexData() const;
+    size_t IndexCount() const;
+    size_t IndexSize() const { return HasShortIndices() ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+    size_t TriangleCount() const { return IndexCount() / 3; }
+    size_t VertexBytes() const { return m_vertices.size() * sizeof(PackedVertex); }
+    size_t IndexBytes() const { return IndexCount() * IndexSize(); }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Average cache miss ratio of the index order for a 16-entry FIFO
+    /// cache. Computed on every call: it walks the whole index buffer.
+    //////////////////////////////////////////////////////////////////////////
+    double Acmr() const;
+
+private:
+    static SphereMesh GenerateUv(const SphereMeshParams& params, ThreadPool& pool);
+
+    MeshBuffer<PackedVertex> m_vertices;
+    MeshBuffer<uint16_t> m_indices16;
+    MeshBuffer<uint32_t> m_indices32;
+};
+} // namespace Lis
@@ -0,0 +1,487 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SphericalHarmonics.cpp
+///
+/// summary:    Implements the spherical harmonic transforms of the fields
+///             of the lat-lon grid and the spectral filters
+//////////////////////////////////////////////////////////////////////////
+
+#include "SphericalHarmonics.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+typedef std::complex<double> Complex;
+
+const double Pi = 3.14159265358979323846;
+
+/// Below it a seed of the recurrence is taken as 0, clear of the denormals
+const double NegligibleSeed = 1e-280;
+
+/// The pairs of rows the recurrence runs over at once: the values and the
+/// Fourier coefficients of a block stay in the L1 cache for all degrees
+const uint32_t PairBlock = 64;
+
+//////////////////////////////////////////////////////////////////////////
+/// The radices of the stages of the FFT: 4 first, the largest butterfly
+/// written out, then the prime factors
+//////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> Radices(uint32_t length)
+{
+    std::vector<uint32_t> radices;
+    while (length % 4 == 0)
+    {
+        radices.push_back(4);
+        length /= 4;
+    }
+    for (uint32_t factor = 2; length > 1; ++factor)
+    {
+        while (length % factor == 0)
+        {
+            radices.push_back(factor);
+            length /= factor;
+        }
+    }
+    return radices;
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+SphericalHarmonics::SphericalHarmonics(uint32_t truncation, uint32_t longitudes, uint32_t latitudes, ThreadPool& pool)
+    : m_truncation(truncation)
+    , m_longitudes(longitudes)
+    , m_latitudes(latitudes)
+    , m_pairs(latitudes / 2)
+    , m_pool(pool)
+{
+    if (longitudes <= 2 * truncation)
+        throw std::invalid_argument("the columns must be more than twice the truncation");
+    if (latitudes <= 2 * truncation || latitudes % 2 != 0)
+        throw std::invalid_argument("the rows must be even and more than twice the truncation");
+
+    const uint32_t orders = truncation + 1;
+    m_offsets.resize(orders + 1, 0);
+    for (uint32_t m = 0; m < orders; ++m)
+        m_offsets[m + 1] = m_offsets[m] + (orders - m);
+
+    // The FFT: every twiddle is a power of the root of the length
+    m_radices = Radices(longitudes);
+    m_twiddles.resize(longitudes);
+    for (uint32_t k = 0; k < longitudes; ++k)
+        m_twiddles[k] = std::polar(1.0, -2.0 * Pi * k / longitudes);
+    m_phases.resize(orders);
+    for (uint32_t m = 0; m < orders; ++m)
+        m_phases[m] = std::polar(1.0 / longitudes, m * (Pi - Pi / longitudes));
+
+    // The pairs from the equator, the weights of Fejer's first rule for the
+    // nodes cos((k + 1/2) pi / n): the same on both sides of the equator
+    m_sines.resize(m_pairs);
+    m_weights.resize(m_pairs);
+    for (uint32_t i = 0; i < m_pairs; ++i)
+    {
+        const double colatitude = 0.5 * Pi - (i + 0.5) * Pi / latitudes;
+        double sum = 0.0;
+        for (uint32_t j = 1; j <= latitudes / 2; ++j)
+            sum += std::cos(2.0 * j * colatitude) / (4.0 * j * j - 1.0);
+        m_sines[i] = std::cos(colatitude);
+        m_weights[i] = 2.0 / latitudes * (1.0 - 2.0 * sum);
+    }
+
+    // P(m, m) = sqrt((2m + 1) / 2m) cos(lat) P(m - 1, m - 1), P(0, 0) = sqrt(1/2);
+    // decreasing to the poles, so the pairs kept are the first ones
+    m_seeds.resize(static_cast<size_t>(orders) * m_pairs);
+    m_activePairs.resize(orders);
+    for (uint32_t i = 0; i < m_pairs; ++i)
+    {
+        const double cosine = std::sqrt(1.0 - m_sines[i] * m_sines[i]);
+        double seed = std::sqrt(0.5);
+        for (uint32_t m = 0; m < orders; ++m)
+        {
+            if (m > 0)
+                seed *= std::sqrt((2.0 * m + 1.0) / (2.0 * m)) * cosine;
+            if (seed < NegligibleSeed)
+                seed = 0.0;
+            m_seeds[static_cast<size_t>(m) * m_pairs + i] = seed;
+        }
+    }
+    for (uint32_t m = 0; m < orders; ++m)
+    {
+        const double* seeds = &m_seeds[static_cast<size_t>(m) * m_pairs];
+        m_activePairs[m] = static_cast<uint32_t>(std::find(seeds, seeds + m_pairs, 0.0) - seeds);
+    }
+
+    m_recurrenceA.resize(CoefficientCount(), 0.0);
+    m_recurrenceB.resize(CoefficientCount(), 0.0);
+    for (uint32_t m = 0; m < orders; ++m)
+    {
+        for (uint32_t l = m + 1; l <= truncation; ++l)
+        {
+            const double ll = static_cast<double>(l) * l;
+            const double mm = static_cast<double>(m) * m;
+            const double previous = static_cast<double>(l - 1) * (l - 1);
+            m_recurrenceA[Index(l, m)] = std::sqrt((4.0 * ll - 1.0) / (ll - mm));
+            m_recurrenceB[Index(l, m)] = std::sqrt((previous - mm) / (4.0 * previous - 1.0));
+        }
+    }
+
+    const size_t coefficients = static_cast<size_t>(orders) * m_pairs;
+    m_evenReal.resize(coefficients);
+    m_evenImag.resize(coefficients);
+    m_oddReal.resize(coefficients);
+    m_oddImag.resize(coefficients);
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t SphericalHarmonics::TableBytes() const
+{
+    return m_twiddles.size() * sizeof(Complex) + m_phases.size() * sizeof(Complex)
+        + (m_sines.size() + m_weights.size() + m_seeds.size() + m_recurrenceA.size() + m_recurrenceB.size()) * sizeof(double)
+        + 4 * m_evenReal.size() * sizeof(double);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stockham's FFT, no bit reversal: before a stage of radix p, the data
+/// holds the DFTs of length L of the n / L decimated sequences, the one of
+/// frequency k of the sequence j at k n / L + j; the stage merges p of
+/// them into DFTs of length L p. The result is in data, work is scratch
+/// of the length.
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::Fft(Complex* data, Complex* work) const
+{
+    const uint32_t n = m_longitudes;
+    Complex* in = data;
+    Complex* out = work;
+    uint32_t length = 1;
+    Complex butterfly[16];
+    std::vector<Complex> wide;
+    for (const uint32_t radix : m_radices)
+    {
+        const uint32_t sequences = n / length;
+        const uint32_t stride = sequences / radix;
+        for (uint32_t k = 0; k < length; ++k)
+        {
+            // The twiddle of the element r of the frequency k is w(L p)^(k r)
+            const Complex* x = in + static_cast<size_t>(k) * sequences;
+            Complex* y = out + static_cast<size_t>(k) * stride;
+            const size_t step = static_cast<size_t>(length) * stride;
+            if (radix == 4)
+            {
+                const Complex w1 = m_twiddles[k * stride];
+                const Complex w2 = m_twiddles[2 * k * stride];
+                const Complex w3 = m_twiddles[3 * k * stride];
+                for (uint32_t j = 0; j < stride; ++j)
+                {
+                    const Complex t0 = x[j];
+                    const Complex t1 = w1 * x[j + stride];
+                    const Complex t2 = w2 * x[j + 2 * stride];
+                    const Complex t3 = w3 * x[j + 3 * stride];
+                    const Complex sum02 = t0 + t2, difference02 = t0 - t2;
+                    const Complex sum13 = t1 + t3;
+                    const Complex rotated13(t1.imag() - t3.imag(), t3.real() - t1.real());   // -i (t1 - t3)
+                    y[j] = sum02 + sum13;
+                    y[j + step] = difference02 + rotated13;
+                    y[j + 2 * step] = sum02 - sum13;
+                    y[j + 3 * step] = difference02 - rotated13;
+                }
+            }
+            else if (radix == 2)
+            {
+                const Complex w1 = m_twiddles[k * stride];
+                for (uint32_t j = 0; j < stride; ++j)
+                {
+                    const Complex t0 = x[j];
+                    const Complex t1 = w1 * x[j + stride];
+                    y[j] = t0 + t1;
+                    y[j + step] = t0 - t1;
+                }
+            }
+            else
+            {
+                // A DFT of the radix, its roots w(p)^q = w(n)^(q n / p)
+                Complex* t = butterfly;
+                if (radix > 16)
+                {
+                    wide.resize(radix);
+                    t = wide.data();
+                }
+                const size_t rootStep = n / radix;
+                for (uint32_t j = 0; j < stride; ++j)
+                {
+                    for (uint32_t r = 0; r < radix; ++r)
+                        t[r] = m_twiddles[(static_cast<size_t>(k) * r * stride) % n] * x[j + r * stride];
+                    for (uint32_t s = 0; s < radix; ++s)
+                    {
+                        Complex sum = t[0];
+                        for (uint32_t r = 1; r < radix; ++r)
+                            sum += m_twiddles[(s * r) % radix * rootStep] * t[r];
+                        y[j + s * step] = sum;
+                    }
+                }
+            }
+        }
+        std::swap(in, out);
+        length *= radix;
+    }
+    if (in != data)
+        std::copy(in, in + n, data);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// The rows of a pair are the real and imaginary parts of one FFT; the
+/// coefficients of the orders are split by the symmetry of the Legendre
+/// functions, even and odd about the equator, and weighted
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::FourierAnalysis(const GridField& field) const
+{
+    const uint32_t n = m_longitudes;
+    m_pool.ParallelFor(0, m_pairs, 4, [&](size_t first, size_t last) {
+        std::vector<Complex> z(n), work(n);
+        for (size_t i = first; i < last; ++i)
+        {
+            const float* north = field.Row(static_cast<uint32_t>(m_pairs + i));
+            const float* south = field.Row(static_cast<uint32_t>(m_pairs - 1 - i));
+            for (uint32_t x = 0; x < n; ++x)
+                z[x] = Complex(north[x], south[x]);
+            Fft(z.data(), work.data());
+
+            for (uint32_t m = 0; m <= m_truncation; ++m)
+            {
+                const Complex zm = z[m];
+                const Complex mirror = std::conj(z[(n - m) % n]);
+                const Complex northCoefficient = 0.5 * (zm + mirror) * m_phases[m];
+                const Complex southCoefficient = Complex(0.0, -0.5) * (zm - mirror) * m_phases[m];
+                const Complex even = m_weights[i] * (northCoefficient + southCoefficient);
+                const Complex odd = m_weights[i] * (northCoefficient - southCoefficient);
+                const size_t at = static_cast<size_t>(m) * m_pairs + i;
+                m_evenReal[at] = even.real();
+                m_evenImag[at] = even.imag();
+                m_oddReal[at] = odd.real();
+                m_oddImag[at] = odd.imag();
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// From the parts even and odd of the orders of the pairs back to the
+/// rows: the negative orders are the conjugates, the ones above the
+/// truncation 0
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::FourierSynthesis(GridField& field) const
+{
+    const uint32_t n = m_longitudes;
+    m_pool.ParallelFor(0, m_pairs, 4, [&](size_t first, size_t last) {
+        std::vector<Complex> z(n), work(n);
+        for (size_t i = first; i < last; ++i)
+        {
+            std::fill(z.begin(), z.end(), Complex());
+            for (uint32_t m = 0; m <= m_truncation; ++m)
+            {
+                const size_t at = static_cast<size_t>(m) * m_pairs + i;
+                const Complex even(m_evenReal[at], m_evenImag[at]);
+                const Complex odd(m_oddReal[at], m_oddImag[at]);
+                const Complex phase = std::conj(m_phases[m]) * static_cast<double>(n);
+                const Complex northCoefficient = (even + odd) * phase;
+                const Complex southCoefficient = (even - odd) * phase;
+                if (m == 0)
+                {
+                    z[0] = Complex(northCoefficient.real(), southCoefficient.real());
+                    continue;
+                }
+                // conj(z) after the transform of the conjugate is the inverse
+                z[m] += std::conj(northCoefficient + Complex(0.0, 1.0) * southCoefficient);
+                z[n - m] += std::conj(std::conj(northCoefficient) + Complex(0.0, 1.0) * std::conj(southCoefficient));
+            }
+            z[0] = std::conj(z[0]);
+            Fft(z.data(), work.data());
+
+            float* north = field.Row(static_cast<uint32_t>(m_pairs + i));
+            float* south = field.Row(static_cast<uint32_t>(m_pairs - 1 - i));
+            for (uint32_t x = 0; x < n; ++x)
+            {
+                north[x] = static_cast<float>(z[x].real());
+                south[x] = static_cast<float>(-z[x].imag());
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Per order, the degrees are accumulated a block of pairs at a time, the
+/// functions of the block advanced by the recurrence from the seeds
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::Forward(const GridField& field, Spectrum& spectrum) const
+{
+    LIS_TRACE_ZONE("SphericalHarmonics::Forward");
+    if (field.Width() != m_longitudes || field.Height() != m_latitudes)
+        throw std::invalid_argument("the field must be of the grid size of the transform");
+
+    FourierAnalysis(field);
+    spectrum.assign(CoefficientCount(), Complex());
+    m_pool.ParallelFor(0, m_truncation + 1, 1, [&](size_t first, size_t last) {
+        double previous[PairBlock], current[PairBlock];
+        for (size_t order = first; order < last; ++order)
+        {
+            const uint32_t m = static_cast<uint32_t>(order);
+            const size_t base = static_cast<size_t>(m) * m_pairs;
+            Complex* out = &spectrum[Index(m, m)];
+            for (uint32_t block = 0; block < m_activePairs[m]; block += PairBlock)
+            {
+                const uint32_t count = std::min(PairBlock, m_activePairs[m] - block);
+                const double* sines = &m_sines[block];
+                const double* seeds = &m_seeds[base + block];
+                const double* evenReal = &m_evenReal[base + block];
+                const double* evenImag = &m_evenImag[base + block];
+                const double* oddReal = &m_oddReal[base + block];
+                const double* oddImag = &m_oddImag[base + block];
+
+                double real = 0.0, imag = 0.0;
+                for (uint32_t b = 0; b < count; ++b)
+                {
+                    previous[b] = 0.0;
+                    current[b] = seeds[b];
+                    real += current[b] * evenReal[b];
+                    imag += current[b] * evenImag[b];
+                }
+                out[0] += Complex(real, imag);
+
+                for (uint32_t l = m + 1; l <= m_truncation; ++l)
+                {
+                    const double a = m_recurrenceA[Index(l, m)];
+                    const double ab = a * m_recurrenceB[Index(l, m)];
+                    const bool odd = ((l - m) & 1) != 0;
+                    const double* partReal = odd ? oddReal : evenReal;
+                    const double* partImag = odd ? oddImag : evenImag;
+                    real = 0.0;
+                    imag = 0.0;
+                    for (uint32_t b = 0; b < count; ++b)
+                    {
+                        const double next = a * sines[b] * current[b] - ab * previous[b];
+                        previous[b] = current[b];
+                        current[b] = next;
+                        real += next * partReal[b];
+                        imag += next * partImag[b];
+                    }
+                    out[l - m] += Complex(real, imag);
+                }
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::Inverse(const Spectrum& spectrum, GridField& field) const
+{
+    LIS_TRACE_ZONE("SphericalHarmonics::Inverse");
+    if (field.Width() != m_longitudes || field.Height() != m_latitudes)
+        throw std::invalid_argument("the field must be of the grid size of the transform");
+    if (spectrum.size() != CoefficientCount())
+        throw std::invalid_argument("the spectrum is not of the truncation of the transform");
+
+    m_pool.ParallelFor(0, m_truncation + 1, 1, [&](size_t first, size_t last) {
+        double previous[PairBlock], current[PairBlock];
+        for (size_t order = first; order < last; ++order)
+        {
+            const uint32_t m = static_cast<uint32_t>(order);
+            const size_t base = static_cast<size_t>(m) * m_pairs;
+            const Complex* in = &spectrum[Index(m, m)];
+            for (uint32_t block = 0; block < m_pairs; block += PairBlock)
+            {
+                const uint32_t count = std::min(PairBlock, m_pairs - block);
+                double* evenReal = &m_evenReal[base + block];
+                double* evenImag = &m_evenImag[base + block];
+                double* oddReal = &m_oddReal[base + block];
+                double* oddImag = &m_oddImag[base + block];
+                std::fill(evenReal, evenReal + count, 0.0);
+                std::fill(evenImag, evenImag + count, 0.0);
+                std::fill(oddReal, oddReal + count, 0.0);
+                std::fill(oddImag, oddImag + count, 0.0);
+                if (block >= m_activePairs[m])
+                    continue;
+
+                const uint32_t active = std::min(count, m_activePairs[m] - block);
+                const double* sines = &m_sines[block];
+                const double* seeds = &m_seeds[base + block];
+                for (uint32_t b = 0; b < active; ++b)
+                {
+                    previous[b] = 0.0;
+                    current[b] = seeds[b];
+                    evenReal[b] = current[b] * in[0].real();
+                    evenImag[b] = current[b] * in[0].imag();
+                }
+                for (uint32_t l = m + 1; l <= m_truncation; ++l)
+                {
+                    const double a = m_recurrenceA[Index(l, m)];
+                    const double ab = a * m_recurrenceB[Index(l, m)];
+                    const bool odd = ((l - m) & 1) != 0;
+                    double* partReal = odd ? oddReal : evenReal;
+                    double* partImag = odd ? oddImag : evenImag;
+                    const double real = in[l - m].real();
+                    const double imag = in[l - m].imag();
+                    for (uint32_t b = 0; b < active; ++b)
+                    {
+                        const double next = a * sines[b] * current[b] - ab * previous[b];
+                        previous[b] = current[b];
+                        current[b] = next;
+                        partReal[b] += next * real;
+                        partImag[b] += next * imag;
+                    }
+                }
+            }
+        }
+    });
+    FourierSynthesis(field);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::Filter(Spectrum& spectrum, const std::vector<double>& degreeFactors) const
+{
+    if (spectrum.size() != CoefficientCount() || degreeFactors.size() != m_truncation + 1)
+        throw std::invalid_argument("the spectrum and the factors must be of the truncation of the transform");
+    for (uint32_t m = 0; m <= m_truncation; ++m)
+    {
+        for (uint32_t l = m; l <= m_truncation; ++l)
+            spectrum[Index(l, m)] *= degreeFactors[l];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SphericalHarmonics::Smooth(GridField& field, const std::vector<double>& degreeFactors) const
+{
+    Spectrum spectrum;
+    Forward(field, spectrum);
+    Filter(spectrum, degreeFactors);
+    Inverse(spectrum, field);
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<double> DiffusionFactors(uint32_t truncation, double coefficient, double seconds, double radius, uint32_t order)
+{
+    if (!(coefficient >= 0.0) || !(seconds >= 0.0) || !(radius > 0.0) || order == 0)
+        throw std::invalid_argument("the diffusion needs a coefficient and a time >= 0, a radius > 0 and an order >= 1");
+    std::vector<double> factors(truncation + 1);
+    for (uint32_t l = 0; l <= truncation; ++l)
+    {
+        const double eigenvalue = static_cast<double>(l) * (l + 1) / (radius * radius);
+        factors[l] = std::exp(-coefficient * std::pow(eigenvalue, order) * seconds);
+    }
+    return factors;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<double> LowPassFactors(uint32_t truncation, uint32_t cutoff, uint32_t order)
+{
+    if (cutoff == 0 || order == 0)
+        throw std::invalid_argument("the low-pass filter needs a cutoff and an order >= 1");
+    std::vector<double> factors(truncation + 1);
+    const double scale = static_cast<double>(cutoff) * (cutoff + 1);
+    for (uint32_t l = 0; l <= truncation; ++l)
+        factors[l] = std::exp(-std::pow(l * (l + 1.0) / scale, order));
+    return factors;
+}
+} // namespace Lis
@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/SphericalHarmonics.h
+///
+/// summary:    Declares the spherical harmonic transforms of the fields
+///             of the lat-lon grid and the spectral filters
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "GridField.h"
+#include "ThreadPool.h"
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The coefficients of a field of triangular truncation T: degree l
+///   0 to T, order m 0 to l, the negative orders being the conjugates of
+///   a real field. Order-major: see SphericalHarmonics::Index().
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+typedef std::vector<std::complex<double>> Spectrum;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Transforms between a field of the grid of ShallowWaterModel (cell
+///   centers, row 0 at the south pole, column 0 from 180 degrees west)
+///   and its spherical harmonic coefficients:
+///
+///     f(lon, lat) = sum over l, m of a(l, m) P(l, m)(sin lat) e^(i m lon)
+///
+///   with P the associated Legendre functions normalized to 1 over
+///   [-1, 1], the negative m the conjugates.
+///
+///   A transform is an FFT along each row, two rows mirrored about the
+///   equator at once, then a Legendre transform per order m over the
+///   pairs of rows, by the symmetry of P about the equator. The orders
+///   are spread over the pool. The rows of the centers are the Chebyshev
+///   nodes, so the quadrature is Fejer's first rule: Forward() inverts
+///   Inverse() exactly when the rows are more than 2T, the columns more
+///   than 2T too.
+///
+///   A table of P would take (T + 1)^2 / 2 values per row, a GB at T639:
+///   only the three-term recurrence coefficients and the P(m, m) seeding
+///   it are kept, and the recurrence runs over a block of rows at once in
+///   the cache. The rows where the seed underflows, near the poles at
+///   high orders, are skipped: the functions are below 1e-280 there.
+///
+///   The transforms share the scratch of the object: one at a time.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class SphericalHarmonics
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <exception cref="std::invalid_argument"> The grid does not resolve
+    ///   the truncation: the columns must be more than 2T and the rows
+    ///   even and more than 2T, else the quadrature is not exact and the
+    ///   analysis aliases </exception>
+    //////////////////////////////////////////////////////////////////////////
+    SphericalHarmonics(uint32_t truncation, uint32_t longitudes, uint32_t latitudes,
+        ThreadPool& pool = ThreadPool::GetShared());
+
+    uint32_t Truncation() const { return m_truncation; }
+    uint32_t Longitudes() const { return m_longitudes; }
+    uint32_t Latitudes() const { return m_latitudes; }
+
+    size_t CoefficientCount() const { return m_offsets.back(); }
+
+    /// Of degree l, order m <= l
+    size_t Index(uint32_t degree, uint32_t order) const { return m_offsets[order] + (degree - order); }
+
+    /// The bytes of the precomputed tables
+    size_t TableBytes() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <exception cref="std::invalid_argument"> The field is not of the
+    ///   grid size </exception>
+    //////////////////////////////////////////////////////////////////////////
+    void Forward(const GridField& field, Spectrum& spectrum) const;
+    void Inverse(const Spectrum& spectrum, GridField& field) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Scale the coefficients by a factor per degree, 0 to T: isotropic,
+    ///   so the same at every point of the sphere, poles included.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Filter(Spectrum& spectrum, const std::vector<double>& degreeFactors) const;
+
+    /// Forward(), Filter() and Inverse() in place
+    void Smooth(GridField& field, const std::vector<double>& degreeFactors) const;
+
+private:
+    void Fft(std::complex<double>* data, std::complex<double>* work) const;
+    void FourierAnalysis(const GridField& field) const;
+    void FourierSynthesis(GridField& field) const;
+
+    uint32_t m_truncation;
+    uint32_t m_longitudes;
+    uint32_t m_latitudes;
+    uint32_t m_pairs;
+    ThreadPool& m_pool;
+
+    std::vector<size_t> m_offsets;          ///< of the orders in a spectrum, and the count
+
+    // The FFT along the rows: the radices and the twiddles of each stage
+    std::vector<uint32_t> m_radices;
+    std::vector<std::complex<double>> m_twiddles;
+    std::vector<std::complex<double>> m_phases;     ///< e^(-i m lon) of column 0
+
+    // Per pair of rows, from the equator to the poles
+    std::vector<double> m_sines;            ///< of the northern latitude
+    std::vector<double> m_weights;          ///< of the quadrature
+    std::vector<double> m_seeds;            ///< P(m, m), order-major
+    std::vector<uint32_t> m_activePairs;    ///< per order, the pairs where the seed is not negligible
+
+    // The recurrence P(l, m) = a (x P(l - 1, m) - b P(l - 2, m)), spectrum layout
+    std::vector<double> m_recurrenceA;
+    std::vector<double> m_recurrenceB;
+
+    // The Fourier coefficients of the rows, order-major, split in the parts
+    // even and odd about the equator; reused by every transform
+    mutable std::vector<double> m_evenReal, m_evenImag, m_oddReal, m_oddImag;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The factors of an implicit diffusion of the order, 1 for the
+///   Laplacian, 2 for the biharmonic and so on, over a time: the exact
+///   decay exp(-coefficient (l (l + 1) / radius^2)^order seconds), stable
+///   for any time, so no pole limits it.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+std::vector<double> DiffusionFactors(uint32_t truncation, double coefficient, double seconds, double radius,
+    uint32_t order = 1);
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Smoothing to a degree: exp(-(l (l + 1) / (cutoff (cutoff + 1)))^order),
+///   about 1/e at the cutoff degree; a large order nears a sharp cut.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+std::vector<double> LowPassFactors(uint32_t truncation, uint32_t cutoff, uint32_t order = 4);
+} // namespace Lis
@@ -0,0 +1,488 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Terrain.cpp
+///
+/// summary:    Implements the level of detail terrain of the globe on a
+///             cube-sphere quadtree
+//////////////////////////////////////////////////////////////////////////
+
+#include "Terrain.h"
+#include "PackedFormats.h"
+#include "PlanetarySystem.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace Lis
+{
+namespace
+{
+//////////////////////////////////////////////////////////////////////////
+/// The faces as SphereMesh's cube: the normal and the tangent U; V = N x U,
+/// so the cells (u, v) -> (u + 1, v) -> (u + 1, v + 1) face outward
+//////////////////////////////////////////////////////////////////////////
+const float Faces[6][2][3] = {
+    { { 1, 0, 0 }, { 0, 0, -1 } },
+    { { -1, 0, 0 }, { 0, 0, 1 } },
+    { { 0, 1, 0 }, { 1, 0, 0 } },
+    { { 0, -1, 0 }, { 1, 0, 0 } },
+    { { 0, 0, 1 }, { 1, 0, 0 } },
+    { { 0, 0, -1 }, { -1, 0, 0 } },
+};
+
+/// The frequency of the first octave: continents of about a radius
+const double BaseFrequency = 2.0;
+
+//////////////////////////////////////////////////////////////////////////
+/// The spherified cube mapping of SphereMesh, normalized since the
+/// samples around a patch reach past the edges of its face
+//////////////////////////////////////////////////////////////////////////
+void CubeToSphere(uint32_t face, double r, double s, float* direction)
+{
+    const float* n = Faces[face][0];
+    const float* t = Faces[face][1];
+    const double b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+    const double x = n[0] + r * t[0] + s * b[0];
+    const double y = n[1] + r * t[1] + s * b[1];
+    const double z = n[2] + r * t[2] + s * b[2];
+    const double x2 = x * x, y2 = y * y, z2 = z * z;
+    const double p[3] = {
+        x * std::sqrt(std::max(0.0, 1.0 - y2 / 2.0 - z2 / 2.0 + y2 * z2 / 3.0)),
+        y * std::sqrt(std::max(0.0, 1.0 - z2 / 2.0 - x2 / 2.0 + z2 * x2 / 3.0)),
+        z * std::sqrt(std::max(0.0, 1.0 - x2 / 2.0 - y2 / 2.0 + x2 * y2 / 3.0)),
+    };
+    const double length = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+    for (int i = 0; i < 3; ++i)
+        direction[i] = static_cast<float>(p[i] / length);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// A value in [-1, 1] per lattice point
+//////////////////////////////////////////////////////////////////////////
+double LatticeValue(int64_t x, int64_t y, int64_t z, uint32_t seed)
+{
+    uint64_t h = static_cast<uint64_t>(x) * 0x9E3779B97F4A7C15ull ^ static_cast<uint64_t>(y) * 0xC2B2AE3D27D4EB4Full
+        ^ static_cast<uint64_t>(z) * 0x165667B19E3779F9ull ^ seed;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return static_cast<double>(h >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Value noise: the lattice values blended with the quintic fade, so the
+/// gradients (the normals) are continuous too
+//////////////////////////////////////////////////////////////////////////
+double ValueNoise(double x, double y, double z, uint32_t seed)
+{
+    const double fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    const int64_t ix = static_cast<int64_t>(fx), iy = static_cast<int64_t>(fy), iz = static_cast<int64_t>(fz);
+    auto fade = [](double t) { return t * t * t * (t * (t * 6.0 - 15.0) + 10.0); };
+    const double u = fade(x - fx), v = fade(y - fy), w = fade(z - fz);
+
+    double corners[2][2];
+    for (int dz = 0; dz < 2; ++dz)
+    {
+        for (int dy = 0; dy < 2; ++dy)
+        {
+            const double a = LatticeValue(ix, iy + dy, iz + dz, seed);
+            const double b = LatticeValue(ix + 1, iy + dy, iz + dz, seed);
+            corners[dz][dy] = a + u * (b - a);
+        }
+    }
+    const double front = corners[0][0] + v * (corners[0][1] - corners[0][0]);
+    const double back = corners[1][0] + v * (corners[1][1] - corners[1][0]);
+    return front + w * (back - front);
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+HeightFunction FractalHeight(float peak, uint32_t octaves, uint32_t seed)
+{
+    if (!(peak >= 0.0f))
+        throw std::invalid_argument("the peak elevation must not be negative");
+    if (octaves == 0 || octaves > 40)
+        throw std::invalid_argument("the fractal height needs 1 to 40 octaves");
+
+    return [peak, octaves, seed](const float* direction) {
+        double sum = 0.0;
+        double amplitude = 1.0;
+        double total = 0.0;
+        double frequency = BaseFrequency;
+        for (uint32_t octave = 0; octave < octaves; ++octave)
+        {
+            sum += amplitude * ValueNoise(direction[0] * frequency, direction[1] * frequency,
+                direction[2] * frequency, seed + octave);
+            total += amplitude;
+            amplitude *= 0.5;
+            frequency *= 2.0;
+        }
+
+        // The sums of value noise rarely reach the bounds: stretch them so the peaks do
+        const double land = 2.0 * sum / total;
+        return static_cast<float>(peak * std::min(1.0, std::max(0.0, land)));
+    };
+}
+
+//////////////////////////////////////////////////////////////////////////
+Terrain::Terrain(const TerrainParams& params, HeightFunction height, ThreadPool& pool)
+    : m_params(params)
+    , m_height(std::move(height))
+    , m_pool(pool)
+{
+    const uint32_t n = params.patchResolution;
+    if (n == 0 || n > 128)
+        throw std::invalid_argument("a terrain patch needs 1 to 128 cells along an edge");
+    if (params.maxLevel > 24)
+        throw std::invalid_argument("the terrain quadtree is limited to 24 levels");
+    if (!(params.maxPixelError > 0.0f))
+        throw std::invalid_argument("the terrain pixel error must be positive");
+    if (params.maxResidentPatches < 6 || params.maxPendingPatches == 0)
+        throw std::invalid_argument("the terrain needs room for its faces and its requests");
+
+    // The octaves reach down to the cells of the finest level
+    if (!m_height)
+    {
+        const double finestCell = 1.5707963 / (static_cast<double>(n) * std::ldexp(1.0, static_cast<int>(params.maxLevel)));
+        const uint32_t octaves = static_cast<uint32_t>(std::ceil(std::log2(1.0 / (finestCell * BaseFrequency)))) + 1;
+        m_height = FractalHeight(params.peak, std::max(octaves, 1u), params.seed);
+    }
+
+    // The grid, then the skirts in the order Generate() appends them:
+    // the edges v = 0, u = N, v = N and u = 0, each N + 1 vertices long
+    const uint32_t row = n + 1;
+    m_indices.reserve(6 * n * n + 24 * n);
+    for (uint32_t j = 0; j < n; ++j)
+    {
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            const uint16_t v00 = static_cast<uint16_t>(j * row + i);
+            const uint16_t v10 = static_cast<uint16_t>(v00 + 1);
+            const uint16_t v01 = static_cast<uint16_t>(v00 + row);
+            const uint16_t v11 = static_cast<uint16_t>(v01 + 1);
+            m_indices.insert(m_indices.end(), { v00, v10, v11, v00, v11, v01 });
+        }
+    }
+
+    const uint32_t edges[4][2] = { { 0, 1 }, { n, row }, { n * row, 1 }, { 0, row } };
+    for (uint32_t edge = 0; edge < 4; ++edge)
+    {
+        const uint32_t skirt = row * row + edge * row;
+        // The skirts face away from the patch: the edges v = 0 and u = N run
+        // with the patch on their left, the other two on their right
+        const bool outward = edge < 2;
+        for (uint32_t k = 0; k < n; ++k)
+        {
+            const uint16_t a = static_cast<uint16_t>(edges[edge][0] + k * edges[edge][1]);
+            const uint16_t b = static_cast<uint16_t>(a + edges[edge][1]);
+            const uint16_t lowA = static_cast<uint16_t>(skirt + k);
+            const uint16_t lowB = static_cast<uint16_t>(lowA + 1);
+            if (outward)
+                m_indices.insert(m_indices.end(), { a, lowB, b, a, lowA, lowB });
+            else
+                m_indices.insert(m_indices.end(), { a, b, lowB, a, lowB, lowA });
+        }
+    }
+
+    // The faces are always resident: the coarsest view needs nothing else
+    std::vector<std::future<std::shared_ptr<TerrainPatch>>> faces;
+    for (uint32_t face = 0; face < 6; ++face)
+    {
+        const PatchKey key{ face, 0, 0, 0 };
+        const TerrainParams patchParams = m_params;
+        const HeightFunction patchHeight = m_height;
+        faces.push_back(m_pool.Submit([key, patchParams, patchHeight] { return Generate(key, patchParams, patchHeight); }));
+    }
+    for (std::future<std::shared_ptr<TerrainPatch>>& face : faces)
+    {
+        std::shared_ptr<TerrainPatch> patch = face.get();
+        const uint64_t id = patch->key.Id();
+        m_resident[id] = Resident{ std::move(patch), 0 };
+        ++m_stats.generatedPatches;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+Terrain::~Terrain()
+{
+    // The pending patches own copies of everything they use: they finish
+    // on the pool and are dropped with their futures
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t Terrain::PatchVertexCount() const
+{
+    const size_t row = m_params.patchResolution + 1;
+    return row * row + 4 * row;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::shared_ptr<TerrainPatch> Terrain::Generate(const PatchKey& key, const TerrainParams& params,
+    const HeightFunction& height)
+{
+    LIS_TRACE_ZONE("Terrain::Generate");
+
+    const uint32_t n = params.patchResolution;
+    const int row = static_cast<int>(n) + 1;
+
+    // The samples cover the grid and a ring around it for the normals. The
+    // face coordinates come from the integer position on the finest grid
+    // of the level, so the shared edges of the levels match exactly
+    const int ring = row + 2;
+    const double cells = static_cast<double>(n) * std::ldexp(1.0, static_cast<int>(key.level));
+    std::vector<float> samples(static_cast<size_t>(ring) * ring * 3);
+    std::vector<float> directions(static_cast<size_t>(row) * row * 3);
+    for (int j = -1; j <= row; ++j)
+    {
+        for (int i = -1; i <= row; ++i)
+        {
+            const double r = -1.0 + 2.0 * (static_cast<double>(key.x) * n + i) / cells;
+            const double s = -1.0 + 2.0 * (static_cast<double>(key.y) * n + j) / cells;
+            float direction[3];
+            CubeToSphere(key.face, r, s, direction);
+            const float radius = 1.0f + height(direction);
+
+            float* sample = &samples[((j + 1) * ring + i + 1) * 3];
+            for (int c = 0; c < 3; ++c)
+                sample[c] = direction[c] * radius;
+            if (i >= 0 && i < row && j >= 0 && j < row)
+                std::copy(direction, direction + 3, &directions[(j * row + i) * 3]);
+        }
+    }
+
+    auto patch = std::make_shared<TerrainPatch>();
+    patch->key = key;
+    patch->vertices.resize(static_cast<size_t>(row) * row + 4 * row);
+
+    float low[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float high[3] = { -low[0], -low[1], -low[2] };
+    patch->maxRadius = 0.0f;
+    patch->cellSize = 0.0f;
+    for (int j = 0; j < row; ++j)
+    {
+        for (int i = 0; i < row; ++i)
+        {
+            auto at = [&samples, ring](int x, int y) { return &samples[((y + 1) * ring + x + 1) * 3]; };
+            const float* p = at(i, j);
+            const float* east = at(i + 1, j);
+            const float* west = at(i - 1, j);
+            const float* north = at(i, j + 1);
+            const float* south = at(i, j - 1);
+
+            // Central differences; U x V points outward
+            const float du[3] = { east[0] - west[0], east[1] - west[1], east[2] - west[2] };
+            const float dv[3] = { north[0] - south[0], north[1] - south[1], north[2] - south[2] };
+            const float normal[3] = { du[1] * dv[2] - du[2] * dv[1], du[2] * dv[0] - du[0] * dv[2], du[0] * dv[1] - du[1] * dv[0] };
+
+            TerrainVertex& vertex = patch->vertices[j * row + i];
+            std::copy(p, p + 3, vertex.position);
+            PackOctahedral(normal[0], normal[1], normal[2], vertex.normal);
+
+            for (int c = 0; c < 3; ++c)
+            {
+                low[c] = std::min(low[c], p[c]);
+                high[c] = std::max(high[c], p[c]);
+            }
+            patch->maxRadius = std::max(patch->maxRadius, std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]));
+            if (i + 1 < row)
+                patch->cellSize = std::max(patch->cellSize, std::sqrt(du[0] * du[0] + du[1] * du[1] + du[2] * du[2]) * 0.5f);
+            if (j + 1 < row)
+                patch->cellSize = std::max(patch->cellSize, std::sqrt(dv[0] * dv[0] + dv[1] * dv[1] + dv[2] * dv[2]) * 0.5f);
+        }
+    }
+
+    // The skirts hang below the edges by more than any crack between a
+    // cell and the cells of the next levels
+    const float depth = 2.0f * patch->cellSize;
+    const int edges[4][2] = { { 0, 1 }, { static_cast<int>(n), row }, { static_cast<int>(n) * row, 1 }, { 0, row } };
+    for (int edge = 0; edge < 4; ++edge)
+    {
+        for (int k = 0; k < row; ++k)
+        {
+            const int top = edges[edge][0] + k * edges[edge][1];
+            TerrainVertex& skirt = patch->vertices[row * row + edge * row + k];
+            skirt = patch->vertices[top];
+            const float* direction = &directions[top * 3];
+            for (int c = 0; c < 3; ++c)
+            {
+                skirt.position[c] -= direction[c] * depth;
+                low[c] = std::min(low[c], skirt.position[c]);
+            }
+        }
+    }
+
+    // The bounding sphere of the vertices holds their triangles
+    float boundRadius = 0.0f;
+    for (int c = 0; c < 3; ++c)
+        patch->center[c] = 0.5f * (low[c] + high[c]);
+    for (const TerrainVertex& vertex : patch->vertices)
+    {
+        const float d[3] = { vertex.position[0] - patch->center[0], vertex.position[1] - patch->center[1],
+            vertex.position[2] - patch->center[2] };
+        boundRadius = std::max(boundRadius, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    }
+    patch->boundRadius = std::sqrt(boundRadius);
+
+    // The cone of the directions, for the horizon
+    const double half = (static_cast<double>(key.x) * n + n * 0.5) / cells;
+    const double halfV = (static_cast<double>(key.y) * n + n * 0.5) / cells;
+    CubeToSphere(key.face, -1.0 + 2.0 * half, -1.0 + 2.0 * halfV, patch->axis);
+    float minCos = 1.0f;
+    for (int v = 0; v < row * row; ++v)
+    {
+        const float* d = &directions[v * 3];
+        minCos = std::min(minCos, d[0] * patch->axis[0] + d[1] * patch->axis[1] + d[2] * patch->axis[2]);
+    }
+    patch->coneAngle = std::acos(std::max(-1.0f, std::min(1.0f, minCos)));
+    return patch;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Terrain::Select(const TerrainView& view, std::vector<const TerrainPatch*>& selected)
+{
+    LIS_TRACE_ZONE("Terrain::Select");
+
+    ++m_frame;
+    Collect(false);
+
+    const Frustum frustum(view.viewProjection);
+    selected.clear();
+    m_stats.culledPatches = 0;
+    for (uint32_t face = 0; face < 6; ++face)
+        Visit(PatchKey{ face, 0, 0, 0 }, view, frustum, selected);
+    Evict();
+
+    const size_t trianglesPerPatch = m_indices.size() / 3;
+    m_stats.selectedPatches = selected.size();
+    m_stats.triangles = selected.size() * trianglesPerPatch;
+    m_stats.residentPatches = m_resident.size();
+    m_stats.pendingPatches = m_pending.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Terrain::Finish()
+{
+    Collect(true);
+    m_stats.residentPatches = m_resident.size();
+    m_stats.pendingPatches = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Terrain::Visit(const PatchKey& key, const TerrainView& view, const Frustum& frustum,
+    std::vector<const TerrainPatch*>& selected)
+{
+    // Only resident nodes are visited; marked used even if culled, so the
+    // siblings of a visible child are not dropped from under their parent
+    Resident& resident = m_resident.at(key.Id());
+    resident.lastUsed = m_frame;
+    const TerrainPatch& patch = *resident.patch;
+    if (!IsVisible(patch, view, frustum))
+    {
+        ++m_stats.culledPatches;
+        return;
+    }
+
+    if (key.level < m_params.maxLevel)
+    {
+        const float d[3] = { view.eye[0] - patch.center[0], view.eye[1] - patch.center[1], view.eye[2] - patch.center[2] };
+        const float distance = std::max(std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) - patch.boundRadius, 1e-6f);
+        if (patch.cellSize * view.pixelScale > m_params.maxPixelError * distance)
+        {
+            // Until the four children are there the parent stands in for them
+            bool ready = true;
+            for (uint32_t quadrant = 0; quadrant < 4; ++quadrant)
+            {
+                const PatchKey child = key.Child(quadrant);
+                if (m_resident.find(child.Id()) == m_resident.end())
+                {
+                    ready = false;
+                    Request(child);
+                }
+            }
+            if (ready)
+            {
+                for (uint32_t quadrant = 0; quadrant < 4; ++quadrant)
+                    Visit(key.Child(quadrant), view, frustum, selected);
+                return;
+            }
+        }
+    }
+    selected.push_back(&patch);
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool Terrain::IsVisible(const TerrainPatch& patch, const TerrainView& view, const Frustum& frustum) const
+{
+    if (!frustum.Intersects(patch.center, patch.boundRadius))
+        return false;
+
+    // Below the horizon: seen from the eye the unit sea hides the points
+    // of a radius r farther than acos(1 / eye) + acos(1 / r) from the
+    // nadir. The patch is hidden if its whole cone is
+    const float* e = view.eye;
+    const float eyeDistance = std::sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+    if (eyeDistance <= 1.0f)
+        return true;
+
+    const float cosAngle = (e[0] * patch.axis[0] + e[1] * patch.axis[1] + e[2] * patch.axis[2]) / eyeDistance;
+    const float angle = std::acos(std::max(-1.0f, std::min(1.0f, cosAngle)));
+    const float horizon = std::acos(1.0f / eyeDistance) + std::acos(1.0f / std::max(patch.maxRadius, 1.0f));
+    return angle - patch.coneAngle <= horizon;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Terrain::Request(const PatchKey& key)
+{
+    const uint64_t id = key.Id();
+    if (m_pending.size() >= m_params.maxPendingPatches || m_pending.find(id) != m_pending.end())
+        return;
+
+    const TerrainParams params = m_params;
+    const HeightFunction height = m_height;
+    m_pending.emplace(id, m_pool.Submit([key, params, height] { return Generate(key, params, height); }));
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Terrain::Collect(bool wait)
+{
+    for (auto pending = m_pending.begin(); pending != m_pending.end();)
+    {
+        if (!wait && pending->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++pending;
+            continue;
+        }
+
+        // Dropped from the requests first: a failed patch is asked for again
+        std::future<std::shared_ptr<TerrainPatch>> patch = std::move(pending->second);
+        const uint64_t id = pending->first;
+        pending = m_pending.erase(pending);
+        m_resident[id] = Resident{ patch.get(), m_frame };
+        ++m_stats.generatedPatches;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Terrain::Evict()
+{
+    if (m_resident.size() <= m_params.maxResidentPatches)
+        return;
+
+    // The least recently used first; the faces and this frame's patches stay
+    std::vector<std::pair<uint64_t, uint64_t>> candidates;
+    for (const auto& resident : m_resident)
+    {
+        if (resident.second.patch->key.level > 0 && resident.second.lastUsed < m_frame)
+            candidates.emplace_back(resident.second.lastUsed, resident.first);
+    }
+
+    const size_t excess = std::min(candidates.size(), m_resident.size() - m_params.maxResidentPatches);
+    std::nth_element(candidates.begin(), candidates.begin() + excess, candidates.end());
+    for (size_t i = 0; i < excess; ++i)
+        m_resident.erase(candidates[i].second);
+}
+} // namespace Lis
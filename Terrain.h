@@ -0,0 +1,218 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Terrain.h
+///
+/// summary:    Declares the level of detail terrain of the globe on a
+///             cube-sphere quadtree
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Lis
+{
+class Frustum;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The elevation above the sea level of a unit direction, in planet
+///   radii, never negative: the sea is the occluder of the horizon.
+///   Called from the worker threads concurrently.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+typedef std::function<float(const float* direction)> HeightFunction;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Procedural heightmap: fractal value noise over the sphere, the
+///   negative half flattened into the sea. The octaves go down to the
+///   cells of the finest patches, so a close-up still has relief.
+/// </summary>
+///
+/// <param name="peak"> The highest elevation, in planet radii </param>
+//////////////////////////////////////////////////////////////////////////
+HeightFunction FractalHeight(float peak, uint32_t octaves, uint32_t seed = 1);
+
+//////////////////////////////////////////////////////////////////////////
+struct TerrainParams
+{
+    float peak = 0.01f;                 ///< the highest elevation, planet radii
+    uint32_t patchResolution = 16;      ///< cells along a patch edge
+    uint32_t maxLevel = 14;             ///< of the quadtree, the faces are 0
+    float maxPixelError = 4.0f;         ///< the largest cell on the screen, px
+    size_t maxResidentPatches = 4096;   ///< generated patches kept in memory
+    size_t maxPendingPatches = 32;      ///< generated at once on the pool
+    uint32_t seed = 1;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   16 bytes: the displaced position about the planet center (radius
+///   1) and the octahedral normal (2 x GL_SHORT, normalized). The texture
+///   coordinates are derived from the position per pixel, so the patches
+///   have no seam to split at the meridian or the poles.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct TerrainVertex
+{
+    float position[3];
+    int16_t normal[2];
+};
+
+static_assert(sizeof(TerrainVertex) == 16, "TerrainVertex must stay tightly packed");
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   A node of the quadtree: face 0-5 of the cube, the level and the
+///   cell of the level, x and y below 2^level.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct PatchKey
+{
+    uint32_t face;
+    uint32_t level;
+    uint32_t x;
+    uint32_t y;
+
+    uint64_t Id() const
+    {
+        return (static_cast<uint64_t>(face) << 61) | (static_cast<uint64_t>(level) << 56)
+            | (static_cast<uint64_t>(x) << 28) | y;
+    }
+
+    PatchKey Child(uint32_t quadrant) const
+    {
+        return PatchKey{ face, level + 1, x * 2 + (quadrant & 1), y * 2 + (quadrant >> 1) };
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The geometry of a node: the grid, then a skirt hanging below each
+///   edge. The skirts hide the cracks between the patches of different
+///   levels, so any neighbours stitch without knowing each other.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct TerrainPatch
+{
+    PatchKey key;
+    std::vector<TerrainVertex> vertices;
+    float center[3];        ///< of the bounding sphere
+    float boundRadius;
+    float axis[3];          ///< unit direction of the patch center
+    float coneAngle;        ///< rad, from the axis to the farthest vertex
+    float maxRadius;        ///< of the highest vertex from the planet center
+    float cellSize;         ///< the longest cell edge, planet radii
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The point of view of a selection, in the planet frame (radius 1).
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct TerrainView
+{
+    const float* viewProjection;    ///< column-major, from the planet frame
+    float eye[3];
+    float pixelScale;               ///< as for PlanetarySystem::Cull
+};
+
+//////////////////////////////////////////////////////////////////////////
+struct TerrainStats
+{
+    size_t selectedPatches = 0;
+    size_t culledPatches = 0;       ///< nodes rejected by the frustum or the horizon
+    size_t residentPatches = 0;
+    size_t pendingPatches = 0;
+    size_t triangles = 0;           ///< of the selected patches, skirts included
+    uint64_t generatedPatches = 0;  ///< since the construction
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Chunked level of detail over the six faces of a cube-sphere. Every
+///   frame Select() walks the quadtree from the faces and splits a node
+///   whose cells would cover more than maxPixelError pixels, skipping
+///   the nodes outside the frustum or below the horizon. The triangle
+///   count follows the screen resolution, not the planet detail.
+///
+///   The patches are generated on the thread pool: a node is split only
+///   once its four children are ready, until then it is drawn itself, so
+///   the view never has holes and never waits. The six faces are built
+///   by the constructor. The least recently drawn patches are dropped
+///   past maxResidentPatches.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class Terrain
+{
+public:
+    explicit Terrain(const TerrainParams& params, HeightFunction height = HeightFunction(),
+        ThreadPool& pool = ThreadPool::GetShared());
+    ~Terrain();
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    const TerrainParams& Params() const { return m_params; }
+
+    /// The elevation of the heightmap under the unit direction, planet radii
+    float Elevation(const float* direction) const { return m_height(direction); }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Take the patches generated since the last call, select the ones
+    ///   to draw from the view and request the missing detail. The
+    ///   pointers stay valid until the next call. Rethrows the errors of
+    ///   the generation.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Select(const TerrainView& view, std::vector<const TerrainPatch*>& selected);
+
+    /// Wait for the requested patches, e.g. to measure a settled view
+    void Finish();
+
+    const TerrainStats& Stats() const { return m_stats; }
+
+    /// The vertices of every patch
+    size_t PatchVertexCount() const;
+
+    /// The triangles of every patch, 16-bit indices into its vertices
+    const std::vector<uint16_t>& PatchIndices() const { return m_indices; }
+
+    /// Build the geometry of a node, on any thread
+    static std::shared_ptr<TerrainPatch> Generate(const PatchKey& key, const TerrainParams& params,
+        const HeightFunction& height);
+
+private:
+    struct Resident
+    {
+        std::shared_ptr<TerrainPatch> patch;
+        uint64_t lastUsed;
+    };
+
+    void Visit(const PatchKey& key, const TerrainView& view, const Frustum& frustum,
+        std::vector<const TerrainPatch*>& selected);
+    bool IsVisible(const TerrainPatch& patch, const TerrainView& view, const Frustum& frustum) const;
+    void Request(const PatchKey& key);
+    void Collect(bool wait);
+    void Evict();
+
+    TerrainParams m_params;
+    HeightFunction m_height;
+    ThreadPool& m_pool;
+    std::vector<uint16_t> m_indices;
+
+    std::unordered_map<uint64_t, Resident> m_resident;
+    std::unordered_map<uint64_t, std::future<std::shared_ptr<TerrainPatch>>> m_pending;
+    uint64_t m_frame = 0;
+    TerrainStats m_stats;
+};
+} // namespace Lis
@@ -0,0 +1,198 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/TerrainRenderer.cpp
+//
+// summary:	Implements the drawing of the terrain patches
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "TerrainRenderer.h"
+#include "Tracer.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QOpenGLVertexArrayObject>
+
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TerrainRenderer::TerrainRenderer(const Terrain& terrain, int slots)
+    : m_patchVertices(terrain.PatchVertexCount())
+    , m_patchIndices(static_cast<GLsizei>(terrain.PatchIndices().size()))
+    , m_indexData(terrain.PatchIndices())
+    , m_slotCount(slots)
+    , m_vertices(QOpenGLBuffer::VertexBuffer)
+    , m_indices(QOpenGLBuffer::IndexBuffer)
+{
+    if (slots <= 0)
+        throw std::invalid_argument("the terrain buffer needs at least one slot");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TerrainRenderer::~TerrainRenderer()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void TerrainRenderer::initialize(const std::vector<ShaderFile>& shaders)
+{
+    initializeOpenGLFunctions();
+
+    m_program = std::make_unique<QOpenGLShaderProgram>();
+    ProgramCache().build(*m_program, shaders);
+
+    // Without the base vertex (GL 3.2) the attributes are pointed at each slot instead
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (context->isOpenGLES() ? context->format().version() >= qMakePair(3, 2)
+        : context->format().version() >= qMakePair(3, 2) || context->hasExtension(QByteArrayLiteral("GL_ARB_draw_elements_base_vertex")))
+    {
+        m_drawElementsBaseVertex = reinterpret_cast<DrawElementsBaseVertex>(context->getProcAddress("glDrawElementsBaseVertex"));
+    }
+
+    m_vao = std::make_unique<QOpenGLVertexArrayObject>();
+    m_vao->create();
+    m_vao->bind();
+
+    m_vertices.create();
+    m_vertices.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    m_vertices.bind();
+    const size_t bytes = static_cast<size_t>(m_slotCount) * m_patchVertices * sizeof(TerrainVertex);
+    if (bytes > static_cast<size_t>(std::numeric_limits<int>::max()))
+        throw std::invalid_argument("the terrain buffer is too large");
+    m_vertices.allocate(static_cast<int>(bytes));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    setAttributes(0);
+
+    m_indices.create();
+    m_indices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_indices.bind();
+    m_indices.allocate(m_indexData.data(), static_cast<int>(m_indexData.size() * sizeof(uint16_t)));
+
+    m_vao->release();
+    m_vertices.release();
+
+    m_slots.assign(m_slotCount, Slot{ 0, 0 });
+    m_freeSlots.clear();
+    for (int slot = m_slotCount - 1; slot >= 0; --slot)
+        m_freeSlots.push_back(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool TerrainRenderer::isInitialized() const
+{
+    return static_cast<bool>(m_vao);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QOpenGLShaderProgram& TerrainRenderer::program()
+{
+    return *m_program;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void TerrainRenderer::draw(const std::vector<const TerrainPatch*>& patches)
+{
+    LIS_TRACE_ZONE("TerrainRenderer::draw");
+
+    ++m_frame;
+    m_uploads = 0;
+    m_skipped = 0;
+
+    m_vao->bind();
+    m_vertices.bind();
+    const int patchBytes = static_cast<int>(m_patchVertices * sizeof(TerrainVertex));
+    for (const TerrainPatch* patch : patches)
+    {
+        const uint64_t id = patch->key.Id();
+        auto found = m_slotOf.find(id);
+        int slot = found != m_slotOf.end() ? found->second : -1;
+        if (slot < 0)
+        {
+            slot = acquireSlot(id);
+            if (slot < 0)
+            {
+                ++m_skipped;
+                continue;
+            }
+            m_vertices.write(slot * patchBytes, patch->vertices.data(), patchBytes);
+            ++m_uploads;
+        }
+        m_slots[slot].lastUsed = m_frame;
+
+        const size_t firstVertex = static_cast<size_t>(slot) * m_patchVertices;
+        if (m_drawElementsBaseVertex)
+        {
+            m_drawElementsBaseVertex(GL_TRIANGLES, m_patchIndices, GL_UNSIGNED_SHORT, nullptr, static_cast<GLint>(firstVertex));
+        }
+        else
+        {
+            setAttributes(firstVertex);
+            glDrawElements(GL_TRIANGLES, m_patchIndices, GL_UNSIGNED_SHORT, nullptr);
+        }
+    }
+    m_vertices.release();
+    m_vao->release();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int TerrainRenderer::uploads() const
+{
+    return m_uploads;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int TerrainRenderer::skipped() const
+{
+    return m_skipped;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t TerrainRenderer::gpuMemory() const
+{
+    return static_cast<size_t>(m_slotCount) * m_patchVertices * sizeof(TerrainVertex) + m_indexData.size() * sizeof(uint16_t);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int TerrainRenderer::acquireSlot(uint64_t id)
+{
+    int slot = -1;
+    if (!m_freeSlots.empty())
+    {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    else
+    {
+        // The least recently drawn; none if every slot is drawn this frame
+        uint64_t oldest = m_frame;
+        for (int candidate = 0; candidate < m_slotCount; ++candidate)
+        {
+            if (m_slots[candidate].lastUsed < oldest)
+            {
+                oldest = m_slots[candidate].lastUsed;
+                slot = candidate;
+            }
+        }
+        if (slot < 0)
+            return -1;
+        m_slotOf.erase(m_slots[slot].id);
+    }
+
+    m_slots[slot].id = id;
+    m_slotOf[id] = slot;
+    return slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void TerrainRenderer::setAttributes(size_t firstVertex)
+{
+    // The layout of terrain-vertex.shader
+    const GLsizei stride = static_cast<GLsizei>(sizeof(TerrainVertex));
+    const size_t base = firstVertex * sizeof(TerrainVertex);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(base + offsetof(TerrainVertex, position)));
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, reinterpret_cast<const void*>(base + offsetof(TerrainVertex, normal)));
+}
+} // namespace Lis
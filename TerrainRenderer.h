@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/TerrainRenderer.h
+//
+// summary:	Declares the drawing of the terrain patches
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ProgramCache.h"
+#include "Terrain.h"
+
+#include <QtGui/QOpenGLBuffer>
+#include <QtGui/QOpenGLExtraFunctions>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class QOpenGLShaderProgram;
+class QOpenGLVertexArrayObject;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Keeps the patches selected by a Terrain in the slots of one vertex buffer, all of a
+/// 			size since every patch has the same vertex count, and draws them with the one
+/// 			index buffer they share: a patch costs a draw call and no state change. A patch
+/// 			is uploaded the first frame it is selected; the least recently drawn slot is
+/// 			reused when the buffer is full.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class TerrainRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <param name="slots">	The patches the buffer holds, more than a frame selects. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    explicit TerrainRenderer(const Terrain& terrain, int slots = 2048);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Must be destroyed with the context of initialize() current. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    ~TerrainRenderer();
+
+    TerrainRenderer(const TerrainRenderer&) = delete;
+    TerrainRenderer& operator=(const TerrainRenderer&) = delete;
+
+    void initialize(const std::vector<ShaderFile>& shaders);
+    bool isInitialized() const;
+
+    /// <summary>	For the caller to bind and set the uniforms of before draw(). </summary>
+    QOpenGLShaderProgram& program();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Upload the new patches and draw all of them with the bound program.
+    /// 			The patches past the slots of the buffer are skipped.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void draw(const std::vector<const TerrainPatch*>& patches);
+
+    /// <summary>	The patches uploaded by the last draw. </summary>
+    int uploads() const;
+
+    /// <summary>	The patches the last draw had no slot for. </summary>
+    int skipped() const;
+
+    /// <summary>	The bytes of the vertex and index buffers. </summary>
+    size_t gpuMemory() const;
+
+private:
+    typedef void (QOPENGLF_APIENTRYP DrawElementsBaseVertex)(GLenum mode, GLsizei count, GLenum type,
+        const void* indices, GLint baseVertex);
+
+    struct Slot
+    {
+        uint64_t id;
+        uint64_t lastUsed;
+    };
+
+    int acquireSlot(uint64_t id);
+    void setAttributes(size_t firstVertex);
+
+    const size_t m_patchVertices;
+    const GLsizei m_patchIndices;
+    const std::vector<uint16_t> m_indexData;
+    const int m_slotCount;
+
+    std::unique_ptr<QOpenGLShaderProgram> m_program;
+    std::unique_ptr<QOpenGLVertexArrayObject> m_vao;
+    QOpenGLBuffer m_vertices;
+    QOpenGLBuffer m_indices;
+    DrawElementsBaseVertex m_drawElementsBaseVertex = nullptr;
+
+    std::vector<Slot> m_slots;
+    std::vector<int> m_freeSlots;
+    std::unordered_map<uint64_t, int> m_slotOf;
+    uint64_t m_frame = 0;
+    int m_uploads = 0;
+    int m_skipped = 0;
+};
+} // namespace Lis
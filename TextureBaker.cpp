@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/TextureBaker.cpp
+//
+// summary:	offline compressor of images into the texture cache
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <stdexcept>
+
+// Qt part
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtGui/QImage>
+
+#include "Logger.h"
+#include "TextureCache.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Usage: lis_texture_baker directory source...
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+try
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compress images into BC1 textures with mipmaps, named by their cache keys");
+    parser.addHelpOption();
+    const QCommandLineOption forceOption("force", "Bake even if the cached texture is there.");
+    parser.addOption(forceOption);
+    parser.addPositionalArgument("directory", "The cache directory, e.g. 'textures' next to the executable.");
+    parser.addPositionalArgument("source", "The images to bake.", "source...");
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.size() < 2)
+        parser.showHelp(EXIT_FAILURE);
+
+    for (int i = 1; i < arguments.size(); ++i)
+    {
+        const QString& source = arguments[i];
+        QFile file(source);
+        if (!file.open(QIODevice::ReadOnly))
+            throw std::runtime_error("failed to open " + source.toStdString());
+        const QByteArray data = file.readAll();
+
+        // The key changes with the content, so an existing file is up to date
+        const QString key = Lis::textureCacheKey(data);
+        const QString path = arguments[0] + "/" + key + ".ktx";
+        if (QFileInfo::exists(path) && !parser.isSet(forceOption))
+        {
+            Lis::Logger::GetInstance().Info() << path.toStdString() << " is up to date";
+            continue;
+        }
+
+        QImage image;
+        if (!image.loadFromData(data))
+            throw std::runtime_error("failed to decode " + source.toStdString());
+        Lis::bakeTexture(image, key, path);
+        Lis::Logger::GetInstance().Info() << "baked " << source.toStdString() << " into " << path.toStdString();
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    Lis::Logger::GetInstance().Error() << "terminated: " << e.what();
+    return EXIT_FAILURE;
+}
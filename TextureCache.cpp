@@ -0,0 +1,248 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/TextureCache.cpp
+//
+// summary:	Implements the cache of block-compressed textures
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "TextureCache.h"
+#include "BlockCompression.h"
+#include "Hash.h"
+#include "KtxFile.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStandardPaths>
+#include <QtGui/QImage>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLTexture>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+/// <summary>	The key-value entry of the KTX file holding the cache key. </summary>
+const char SourceKeyName[] = "Lis.sourceKey";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool supportsS3tc()
+{
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    return context && context->hasExtension(QByteArrayLiteral("GL_EXT_texture_compression_s3tc"));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The memory of an uncompressed RGBA8 texture with the full mip chain. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t rgbaMipChainBytes(int width, int height)
+{
+    size_t bytes = 0;
+    for (;;)
+    {
+        bytes += static_cast<size_t>(width) * height * 4;
+        if (width == 1 && height == 1)
+            return bytes;
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Upload the levels straight from the mapping: the driver reads the pages in. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::unique_ptr<QOpenGLTexture> uploadCompressed(const KtxTexture& ktx)
+{
+    std::unique_ptr<QOpenGLTexture> texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    texture->setFormat(QOpenGLTexture::RGB_DXT1);
+    texture->setSize(static_cast<int>(ktx.Width()), static_cast<int>(ktx.Height()));
+    texture->setMipLevels(static_cast<int>(ktx.Levels()));
+    texture->allocateStorage();
+    if (!texture->isStorageAllocated())
+        throw std::runtime_error("failed to allocate a compressed texture");
+
+    for (uint32_t level = 0; level < ktx.Levels(); ++level)
+    {
+        size_t size = 0;
+        const uint8_t* data = ktx.LevelData(level, size);
+        texture->setCompressedData(static_cast<int>(level), static_cast<int>(size), data);
+    }
+    return texture;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The cached copy of the source from the first directory that has a valid one. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::unique_ptr<KtxTexture> findCached(const QString& key, TextureLoadInfo& info)
+{
+    for (const QString& directory : textureCacheDirectories())
+    {
+        const QString path = directory + "/" + key + ".ktx";
+        if (!QFileInfo::exists(path))
+            continue;
+
+        try
+        {
+            std::unique_ptr<KtxTexture> ktx = std::make_unique<KtxTexture>(QFile::encodeName(path).toStdString());
+            if (ktx->InternalFormat() != KTX_COMPRESSED_RGB_S3TC_DXT1 || ktx->Value(SourceKeyName) != key.toStdString())
+            {
+                Logger::GetInstance().Info() << "ignoring " << path.toStdString() << ": made for another source";
+                continue;
+            }
+            info.cachePath = path;
+            return ktx;
+        }
+        catch (const std::exception& e)
+        {
+            Logger::GetInstance().Error() << "ignoring the cached texture: " << e.what();
+        }
+    }
+    return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void decode(PreparedTexture& prepared)
+{
+    if (!prepared.image.loadFromData(prepared.data))
+        throw std::runtime_error("failed to decode " + prepared.source.toStdString());
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QString textureCacheKey(const QByteArray& source)
+{
+    return QString::fromStdString(HashToHex(HashBytes(source.constData(), source.size(), Bc1EncoderVersion)));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QStringList textureCacheDirectories()
+{
+    return QStringList()
+        << QCoreApplication::applicationDirPath() + "/textures"
+        << QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/Lis/textures";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void bakeTexture(const QImage& image, const QString& key, const QString& path)
+{
+    const QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+    if (rgba.isNull())
+        throw std::runtime_error("failed to convert the image to bake " + path.toStdString());
+
+    const std::vector<CompressedLevel> levels = BuildBc1MipChain(rgba.constBits(),
+        static_cast<uint32_t>(rgba.width()), static_cast<uint32_t>(rgba.height()), rgba.bytesPerLine());
+
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        throw std::runtime_error("failed to create the directory of " + path.toStdString());
+    WriteKtx(QFile::encodeName(path).toStdString(), KTX_COMPRESSED_RGB_S3TC_DXT1, KTX_RGB, levels,
+        { { SourceKeyName, key.toStdString() } });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedTexture::PreparedTexture() = default;
+PreparedTexture::PreparedTexture(PreparedTexture&&) = default;
+PreparedTexture& PreparedTexture::operator=(PreparedTexture&&) = default;
+PreparedTexture::~PreparedTexture() = default;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedTexture prepareTexture(const QString& source, bool useCache)
+{
+    LIS_TRACE_ZONE("prepareTexture");
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    // The key needs the encoded bytes only: a few hundred KB instead of the decoded MB
+    PreparedTexture prepared;
+    prepared.source = source;
+    QFile file(source);
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error("failed to open " + source.toStdString());
+    prepared.data = file.readAll();
+    prepared.key = textureCacheKey(prepared.data);
+
+    if (useCache)
+        prepared.cached = findCached(prepared.key, prepared.info);
+
+    if (!prepared.cached)
+    {
+        decode(prepared);
+        if (useCache)
+        {
+            // The next start finds it; a failure costs nothing but the time
+            const QImage image = prepared.image;
+            const QString key = prepared.key;
+            const QString path = textureCacheDirectories().back() + "/" + key + ".ktx";
+            prepared.info.cachePath = path;
+            ThreadPool::GetShared().Submit([image, key, path] {
+                try
+                {
+                    bakeTexture(image, key, path);
+                    Logger::GetInstance().Info() << "baked " << path.toStdString();
+                }
+                catch (const std::exception& e)
+                {
+                    Logger::GetInstance().Error() << "failed to bake the texture cache: " << e.what();
+                }
+            });
+        }
+    }
+
+    prepared.info.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return prepared;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::unique_ptr<QOpenGLTexture> uploadTexture(PreparedTexture& prepared, TextureLoadInfo* info)
+{
+    LIS_TRACE_ZONE("uploadTexture");
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    TextureLoadInfo result = prepared.info;
+    std::unique_ptr<QOpenGLTexture> texture;
+    if (prepared.cached && supportsS3tc())
+    {
+        try
+        {
+            texture = uploadCompressed(*prepared.cached);
+            result.fromCache = true;
+            result.gpuBytes = prepared.cached->DataSize();
+        }
+        catch (const std::exception& e)
+        {
+            Logger::GetInstance().Error() << "failed to upload the cached texture: " << e.what();
+        }
+    }
+
+    if (!texture)
+    {
+        // Decoded here only if the context cannot use the cached copy
+        if (prepared.image.isNull())
+            decode(prepared);
+        texture = std::make_unique<QOpenGLTexture>(prepared.image);
+        result.fromCache = false;
+        result.gpuBytes = rgbaMipChainBytes(prepared.image.width(), prepared.image.height());
+    }
+    texture->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+
+    // The levels are in the driver now
+    prepared.cached.reset();
+    prepared.image = QImage();
+
+    result.milliseconds += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    Logger::GetInstance().Info() << "texture " << prepared.source.toStdString() << ": " << texture->width() << "x"
+        << texture->height() << (result.fromCache ? ", BC1 from " + result.cachePath.toStdString() : ", decoded")
+        << ", " << result.gpuBytes / 1024 << " KB, loaded in " << result.milliseconds << " ms";
+
+    if (info)
+        *info = result;
+    return texture;
+}
+} // namespace Lis
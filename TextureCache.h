@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/TextureCache.h
+//
+// summary:	Declares the cache of block-compressed textures
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtGui/QImage>
+
+#include <cstddef>
+#include <memory>
+
+class QOpenGLTexture;
+
+namespace Lis
+{
+class KtxTexture;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct TextureLoadInfo
+{
+    bool fromCache = false;     ///< false if the source image was decoded
+    double milliseconds = 0;    ///< the work of prepareTexture() and uploadTexture()
+    size_t gpuBytes = 0;        ///< the texture memory, mip chain included
+    QString cachePath;          ///< the file loaded, or being baked after a miss
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The cache key of an image: the hash of the encoded source bytes and of the
+/// 			encoder version. It names the cached file, "<key>.ktx".
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QString textureCacheKey(const QByteArray& source);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The directories searched for the cached textures: "textures" next to the
+/// 			executable, filled at build time by lis_texture_baker, then the per-user
+/// 			cache, filled at runtime. The last one is writable.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QStringList textureCacheDirectories();
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Compress the image into BC1 with the full mip chain and write it as a KTX file
+/// 			at the path, tagged with the key. Safe to call on any thread.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void bakeTexture(const QImage& image, const QString& key, const QString& path);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The CPU half of a texture load: the mapped cached copy or the decoded image. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct PreparedTexture
+{
+    PreparedTexture();
+    PreparedTexture(PreparedTexture&&);
+    PreparedTexture& operator=(PreparedTexture&&);
+    ~PreparedTexture();
+
+    QString source;
+    QString key;
+    QByteArray data;                        ///< the encoded source
+    std::unique_ptr<KtxTexture> cached;     ///< null on a cache miss
+    QImage image;                           ///< null unless decoded
+    TextureLoadInfo info;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Read the image at the path (a file or a resource) and map its cached BC1 copy,
+/// 			or decode it on a miss and bake the copy on the thread pool for the next
+/// 			start. No OpenGL calls: meant to run on a worker while the context is set up.
+/// </summary>
+/// <exception cref="std::runtime_error"> The source cannot be read or decoded </exception>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedTexture prepareTexture(const QString& source, bool useCache = true);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Upload the prepared texture with its mip chain: the cached copy as is if the
+/// 			context supports S3TC, the decoded image otherwise. Needs a current context.
+/// </summary>
+/// <exception cref="std::runtime_error"> The source cannot be decoded </exception>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::unique_ptr<QOpenGLTexture> uploadTexture(PreparedTexture& prepared, TextureLoadInfo* info = nullptr);
+} // namespace Lis
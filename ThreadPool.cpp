@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ThreadPool.cpp
+///
+/// summary:    Implements the worker thread pool
+//////////////////////////////////////////////////////////////////////////
+
+#include "ThreadPool.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <string>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(size_t threads)
+    : m_stop(false)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    m_workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        m_workers.emplace_back(&ThreadPool::Run, this, i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+ThreadPool::~ThreadPool()
+{
+    // The queued tasks are still executed before the workers leave
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wakeUp.notify_all();
+
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+ThreadPool& ThreadPool::GetShared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_tasks.push_back(std::move(task));
+    }
+    m_wakeUp.notify_one();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::Run(size_t index)
+{
+    Tracer::GetInstance().SetThreadName("worker " + std::to_string(index));
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wakeUp.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain,
+    const std::function<void(size_t, size_t)>& body)
+{
+    if (begin >= end)
+        return;
+
+    // A few chunks per thread balance the uneven ones
+    grain = std::max<size_t>(grain, 1);
+    const size_t count = end - begin;
+    const size_t chunkSize = std::max(grain, count / (ThreadCount() * 4 + 1) + 1);
+    const size_t chunks = (count + chunkSize - 1) / chunkSize;
+    if (chunks == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    // The state is shared with the helpers: the ones that start after
+    // every chunk is taken must still find it alive
+    struct State
+    {
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> done{ 0 };
+        std::mutex lock;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+
+    auto work = [state, begin, end, chunkSize, chunks, &body] {
+        for (;;)
+        {
+            const size_t chunk = state->next.fetch_add(1);
+            if (chunk >= chunks)
+                return;
+
+            try
+            {
+                const size_t chunkBegin = begin + chunk * chunkSize;
+                body(chunkBegin, std::min(end, chunkBegin + chunkSize));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(state->lock);
+                if (!state->error)
+                    state->error = std::current_exception();
+            }
+
+            if (state->done.fetch_add(1) + 1 == chunks)
+            {
+                std::lock_guard<std::mutex> lock(state->lock);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    // The body reference stays valid: helpers touch it only while holding
+    // a chunk, and the caller waits for every chunk below
+    const size_t helpers = std::min(ThreadCount(), chunks - 1);
+    for (size_t i = 0; i < helpers; ++i)
+        Enqueue(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(state->lock);
+    state->finished.wait(lock, [&state, chunks] { return state->done.load() == chunks; });
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+} // namespace Lis
@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/ThreadPool.h
+///
+/// summary:    Declares the worker thread pool
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Fixed set of worker threads executing submitted tasks in FIFO order.
+///   ParallelFor() lets the calling thread take part in the work, so it is
+///   safe to call from a task running on the same pool.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class ThreadPool
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <param name="threads"> The number of workers, 0 - one per core </param>
+    //////////////////////////////////////////////////////////////////////////
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Get the process-wide pool with one worker per core
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    static ThreadPool& GetShared();
+
+    size_t ThreadCount() const { return m_workers.size(); }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Run the function on a worker. Exceptions are delivered through
+    ///   the returned future.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    template<class F>
+    std::future<typename std::result_of<F()>::type> Submit(F&& function)
+    {
+        using Result = typename std::result_of<F()>::type;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+        std::future<Result> result = task->get_future();
+        Enqueue([task] { (*task)(); });
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Split [begin, end) into chunks of at least grain items and call
+    ///   body(chunkBegin, chunkEnd) for each of them on the workers and the
+    ///   calling thread. Returns when every chunk is done; the first
+    ///   exception thrown by the body is rethrown.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void ParallelFor(size_t begin, size_t end, size_t grain,
+        const std::function<void(size_t, size_t)>& body);
+
+private:
+    void Enqueue(std::function<void()> task);
+    void Run(size_t index);
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    bool m_stop;
+};
+} // namespace Lis
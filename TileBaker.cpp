@@ -0,0 +1,265 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/TileBaker.cpp
+//
+// summary:	offline cutter of big equirectangular images into virtual texture tile packs
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Qt part
+#include <QtCore/QBuffer>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtGui/QImage>
+#include <QtGui/QImageReader>
+
+#include "Logger.h"
+#include "ThreadPool.h"
+#include "TilePack.h"
+
+namespace
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct BakeOptions
+{
+    int tileSize;
+    Lis::TileEncoding encoding;
+    int quality;
+    qint64 bandBytes;           ///< the budget of the decoded source rows
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Repeat the last valid column and row over the rest of the image: the padding of
+/// 			the tiles crossing the right and bottom edges of the source.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void ExtendEdges(QImage& image, int validWidth, int validHeight)
+{
+    const int width = image.width();
+    for (int y = 0; y < validHeight && validWidth < width; ++y)
+    {
+        uint32_t* line = reinterpret_cast<uint32_t*>(image.scanLine(y));
+        std::fill(line + validWidth, line + width, line[validWidth - 1]);
+    }
+    for (int y = validHeight; y < image.height(); ++y)
+        std::memcpy(image.scanLine(y), image.constScanLine(validHeight - 1), width * 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QByteArray EncodeTile(const QImage& tile, const BakeOptions& options)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    const bool jpeg = options.encoding == Lis::TILE_JPEG;
+    if (!tile.save(&buffer, jpeg ? "JPG" : "PNG", jpeg ? options.quality : -1))
+        throw std::runtime_error("failed to encode a tile");
+    return data;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QImage DecodeTile(const std::vector<uint8_t>& data)
+{
+    const QImage image = QImage::fromData(data.data(), static_cast<int>(data.size()));
+    if (image.isNull())
+        throw std::runtime_error("failed to decode a tile written before");
+    return image.convertToFormat(QImage::Format_RGBA8888);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Read the rows [firstRow, firstRow + rowCount) of the source. Formats with clip
+/// 			support (JPEG, PNG, TIFF...) decode only up to the last row, so the whole image
+/// 			is never in memory; the others are read once and kept.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+QImage ReadRows(const QString& path, int firstRow, int rowCount, QImage& whole)
+{
+    QImageReader reader(path);
+    if (whole.isNull() && reader.supportsOption(QImageIOHandler::ClipRect))
+    {
+        reader.setClipRect(QRect(0, firstRow, reader.size().width(), rowCount));
+        const QImage rows = reader.read();
+        if (rows.isNull())
+            throw std::runtime_error("failed to read " + path.toStdString() + ": " + reader.errorString().toStdString());
+        return rows.convertToFormat(QImage::Format_RGBA8888);
+    }
+
+    if (whole.isNull())
+    {
+        Lis::Logger::GetInstance().Info() << "the format of " << path.toStdString()
+            << " cannot be read in parts: decoding the whole image";
+        whole = reader.read().convertToFormat(QImage::Format_RGBA8888);
+        if (whole.isNull())
+            throw std::runtime_error("failed to read " + path.toStdString() + ": " + reader.errorString().toStdString());
+    }
+    return whole.copy(0, firstRow, whole.width(), rowCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Cut level 0 in bands of tile rows, as tall as the memory budget allows. </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void BakeBaseLevel(const QString& source, const Lis::TileLayout& layout, const BakeOptions& options,
+    Lis::TilePackWriter& writer)
+{
+    const int tileSize = options.tileSize;
+    const uint32_t tilesX = layout.TilesX(0);
+    const uint32_t tilesY = layout.TilesY(0);
+    const qint64 tileRowBytes = qint64(layout.width) * tileSize * 4;
+    const uint32_t bandRows = static_cast<uint32_t>(std::max<qint64>(1, options.bandBytes / tileRowBytes));
+
+    QImage whole;
+    for (uint32_t firstTileRow = 0; firstTileRow < tilesY; firstTileRow += bandRows)
+    {
+        const uint32_t rows = std::min(bandRows, tilesY - firstTileRow);
+        const int firstPixelRow = static_cast<int>(firstTileRow) * tileSize;
+        const int pixelRows = std::min(static_cast<int>(rows) * tileSize, static_cast<int>(layout.height) - firstPixelRow);
+        const QImage band = ReadRows(source, firstPixelRow, pixelRows, whole);
+
+        // Cut and encode in parallel, write in order
+        std::vector<QByteArray> encoded(static_cast<size_t>(rows) * tilesX);
+        Lis::ThreadPool::GetShared().ParallelFor(0, encoded.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+            {
+                const int x = static_cast<int>(i % tilesX) * tileSize;
+                const int y = static_cast<int>(i / tilesX) * tileSize;
+                QImage tile = band.copy(x, y, tileSize, tileSize);
+                ExtendEdges(tile, std::min(tileSize, band.width() - x), std::min(tileSize, band.height() - y));
+                encoded[i] = EncodeTile(tile, options);
+            }
+        });
+
+        for (size_t i = 0; i < encoded.size(); ++i)
+        {
+            writer.WriteTile(0, static_cast<uint32_t>(i % tilesX), firstTileRow + static_cast<uint32_t>(i / tilesX),
+                encoded[i].constData(), encoded[i].size());
+        }
+
+        Lis::Logger::GetInstance().Info() << "level 0: " << firstTileRow + rows << " of " << tilesY << " tile rows";
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Build the level from the tiles of the previous one, read back from the pack: a
+/// 			row of parents needs two rows of children in memory at most.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void BakeLevel(uint32_t level, const Lis::TileLayout& layout, const BakeOptions& options, Lis::TilePackWriter& writer)
+{
+    const int tileSize = options.tileSize;
+    const uint32_t tilesX = layout.TilesX(level);
+    const uint32_t childTilesX = layout.TilesX(level - 1);
+    const uint32_t childTilesY = layout.TilesY(level - 1);
+
+    for (uint32_t y = 0; y < layout.TilesY(level); ++y)
+    {
+        // Missing children beyond the edges stay empty
+        std::vector<std::vector<uint8_t>> children(static_cast<size_t>(tilesX) * 4);
+        for (uint32_t x = 0; x < tilesX; ++x)
+        {
+            for (uint32_t child = 0; child < 4; ++child)
+            {
+                const uint32_t childX = x * 2 + child % 2;
+                const uint32_t childY = y * 2 + child / 2;
+                if (childX < childTilesX && childY < childTilesY)
+                    writer.ReadTile(level - 1, childX, childY, children[x * 4 + child]);
+            }
+        }
+
+        std::vector<QByteArray> encoded(tilesX);
+        Lis::ThreadPool::GetShared().ParallelFor(0, tilesX, 1, [&](size_t first, size_t last) {
+            for (size_t x = first; x < last; ++x)
+            {
+                QImage canvas(tileSize * 2, tileSize * 2, QImage::Format_RGBA8888);
+                int validWidth = 0, validHeight = 0;
+                for (int child = 0; child < 4; ++child)
+                {
+                    const std::vector<uint8_t>& data = children[x * 4 + child];
+                    if (data.empty())
+                        continue;
+
+                    const QImage image = DecodeTile(data);
+                    const int left = (child % 2) * tileSize;
+                    const int top = (child / 2) * tileSize;
+                    for (int row = 0; row < tileSize; ++row)
+                        std::memcpy(canvas.scanLine(top + row) + left * 4, image.constScanLine(row), tileSize * 4);
+                    validWidth = std::max(validWidth, left + tileSize);
+                    validHeight = std::max(validHeight, top + tileSize);
+                }
+                ExtendEdges(canvas, validWidth, validHeight);
+
+                encoded[x] = EncodeTile(canvas.scaled(tileSize, tileSize, Qt::IgnoreAspectRatio,
+                    Qt::SmoothTransformation), options);
+            }
+        });
+
+        for (uint32_t x = 0; x < tilesX; ++x)
+            writer.WriteTile(level, x, y, encoded[x].constData(), encoded[x].size());
+    }
+
+    Lis::Logger::GetInstance().Info() << "level " << level << ": " << tilesX << "x" << layout.TilesY(level) << " tiles";
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Usage: lis_tile_baker [--tile-size 256] [--format jpg|png] [--quality 90] source output
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+try
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Cut an equirectangular image into the tile pack of a virtual texture");
+    parser.addHelpOption();
+    const QCommandLineOption tileSizeOption("tile-size", "Tile size in pixels, a power of two.", "pixels", "256");
+    const QCommandLineOption formatOption("format", "Tile encoding: jpg or png.", "format", "jpg");
+    const QCommandLineOption qualityOption("quality", "JPEG quality, 0-100.", "quality", "90");
+    const QCommandLineOption memoryOption("memory", "Budget of the decoded source rows, MB.", "MB", "512");
+    parser.addOptions({ tileSizeOption, formatOption, qualityOption, memoryOption });
+    parser.addPositionalArgument("source", "The source image, equirectangular, north at the top.");
+    parser.addPositionalArgument("output", "The tile pack to write.");
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.size() != 2)
+        parser.showHelp(EXIT_FAILURE);
+
+    BakeOptions options;
+    options.tileSize = parser.value(tileSizeOption).toInt();
+    options.quality = parser.value(qualityOption).toInt();
+    options.bandBytes = parser.value(memoryOption).toLongLong() * 1024 * 1024;
+    if (options.tileSize < 16 || (options.tileSize & (options.tileSize - 1)) != 0)
+        throw std::invalid_argument("the tile size must be a power of two of at least 16");
+    if (parser.value(formatOption) == "jpg")
+        options.encoding = Lis::TILE_JPEG;
+    else if (parser.value(formatOption) == "png")
+        options.encoding = Lis::TILE_PNG;
+    else
+        throw std::invalid_argument("unknown tile format: " + parser.value(formatOption).toStdString());
+
+    const QString source = arguments[0];
+    const QSize size = QImageReader(source).size();
+    if (!size.isValid())
+        throw std::runtime_error("failed to read the size of " + source.toStdString());
+
+    const Lis::TileLayout layout = Lis::TileLayout::ForImage(size.width(), size.height(), options.tileSize);
+    Lis::Logger::GetInstance().Info() << "baking " << size.width() << "x" << size.height() << " into "
+        << layout.levels << " levels, " << layout.TileCount() << " tiles";
+
+    Lis::TilePackWriter writer(arguments[1].toStdString(), layout, options.encoding);
+    BakeBaseLevel(source, layout, options, writer);
+    for (uint32_t level = 1; level < layout.levels; ++level)
+        BakeLevel(level, layout, options, writer);
+    writer.Finish();
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    Lis::Logger::GetInstance().Error() << "terminated: " << e.what();
+    return EXIT_FAILURE;
+}
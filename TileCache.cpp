@@ -0,0 +1,301 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/TileCache.cpp
+///
+/// summary:    Implements the residency of the virtual texture tiles
+//////////////////////////////////////////////////////////////////////////
+
+#include "TileCache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Lis
+{
+const uint32_t TileCache::NoSlot;
+
+//////////////////////////////////////////////////////////////////////////
+TileCache::TileCache(const TileLayout& layout, uint32_t slotsX, uint32_t slotsY)
+    : m_layout(layout)
+    , m_slotsX(slotsX)
+    , m_lruHead(NoSlot)
+    , m_lruTail(NoSlot)
+    , m_loadingCount(0)
+    , m_frame(0)
+{
+    if (slotsX == 0 || slotsY == 0 || slotsX > 256 || slotsY > 256)
+        throw std::invalid_argument("the tile cache must have 1 to 256 slots per side");
+    if (layout.levels == 0 || layout.levels > 256)
+        throw std::invalid_argument("invalid tile pyramid");
+
+    for (uint32_t level = 0; level <= layout.levels; ++level)
+        m_levelOffsets.push_back(layout.LevelOffset(level));
+    m_tileState.assign(m_levelOffsets.back(), TILE_ABSENT);
+    m_tileSlot.assign(m_levelOffsets.back(), NoSlot);
+
+    m_slots.resize(static_cast<size_t>(slotsX) * slotsY);
+    for (uint32_t slot = static_cast<uint32_t>(m_slots.size()); slot-- > 0;)
+        m_freeSlots.push_back(slot);
+
+    m_pageTable.resize(layout.levels);
+    for (uint32_t level = 0; level < layout.levels; ++level)
+        m_pageTable[level].assign(static_cast<size_t>(layout.TilesX(level)) * layout.TilesY(level), PageEntry{});
+    m_dirtyFirstRow.assign(layout.levels, UINT32_MAX);
+    m_dirtyLastRow.assign(layout.levels, 0);
+
+    // The fallback of every texel
+    Request(TileId{ layout.levels - 1, 0, 0 });
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t TileCache::Index(const TileId& tile) const
+{
+    return m_levelOffsets[tile.level] + static_cast<size_t>(tile.y) * m_layout.TilesX(tile.level) + tile.x;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TileCache::BeginFrame()
+{
+    ++m_frame;
+    for (const TileId& tile : m_requests)
+    {
+        uint8_t& state = m_tileState[Index(tile)];
+        if (state == TILE_REQUESTED)
+            state = TILE_ABSENT;
+    }
+    m_requests.clear();
+
+    // Keep asking for the fallback until it arrives
+    const TileId root{ m_layout.levels - 1, 0, 0 };
+    if (m_tileState[Index(root)] == TILE_ABSENT)
+        Request(root);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TileCache::Request(const TileId& tile)
+{
+    if (tile.level >= m_layout.levels || tile.x >= m_layout.TilesX(tile.level) ||
+        tile.y >= m_layout.TilesY(tile.level))
+        return;
+
+    // Walk up until a tile already seen in this frame: its ancestors have
+    // been handled too, so the feedback costs about one step per texel.
+    // A loading tile is passed through, its fallback must stay resident.
+    TileId current = tile;
+    for (;;)
+    {
+        const size_t index = Index(current);
+        uint8_t& state = m_tileState[index];
+        if (state == TILE_RESIDENT)
+        {
+            Slot& slot = m_slots[m_tileSlot[index]];
+            if (slot.lastUsed == m_frame)
+                return;
+            Touch(m_tileSlot[index]);
+        }
+        else if (state == TILE_ABSENT)
+        {
+            state = TILE_REQUESTED;
+            m_requests.push_back(current);
+        }
+        else if (state == TILE_REQUESTED)
+        {
+            return;
+        }
+
+        if (current.level + 1 >= m_layout.levels)
+            return;
+        current = TileId{ current.level + 1, current.x / 2, current.y / 2 };
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool TileCache::CanFreeSlot() const
+{
+    return !m_freeSlots.empty() || (m_lruTail != NoSlot && m_slots[m_lruTail].lastUsed < m_frame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<TileId> TileCache::TakeRequests(size_t maxCount)
+{
+    std::vector<TileId> taken;
+    if (!CanFreeSlot())
+        return taken;
+
+    // The coarse tiles first: they cover the most texels and are the
+    // fallback of the fine ones
+    std::stable_sort(m_requests.begin(), m_requests.end(), [](const TileId& a, const TileId& b) {
+        return a.level > b.level;
+    });
+
+    const size_t count = std::min(maxCount, m_requests.size());
+    taken.assign(m_requests.begin(), m_requests.begin() + count);
+    m_requests.erase(m_requests.begin(), m_requests.begin() + count);
+
+    for (const TileId& tile : taken)
+        m_tileState[Index(tile)] = TILE_LOADING;
+    m_loadingCount += taken.size();
+    return taken;
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool TileCache::Insert(const TileId& tile, uint32_t& slotX, uint32_t& slotY)
+{
+    const size_t index = Index(tile);
+    if (m_tileState[index] == TILE_LOADING)
+        --m_loadingCount;
+    else if (m_tileState[index] == TILE_RESIDENT)
+        throw std::logic_error("the tile is already resident");
+
+    if (!CanFreeSlot())
+    {
+        m_tileState[index] = TILE_ABSENT;
+        return false;
+    }
+
+    uint32_t slot;
+    if (!m_freeSlots.empty())
+    {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    else
+    {
+        slot = m_lruTail;
+        Unlink(slot);
+
+        const TileId evicted = m_slots[slot].tile;
+        const size_t evictedIndex = Index(evicted);
+        m_tileState[evictedIndex] = TILE_ABSENT;
+        m_tileSlot[evictedIndex] = NoSlot;
+        UpdatePageTable(evicted);
+    }
+
+    Slot& entry = m_slots[slot];
+    entry.tile = tile;
+    entry.lastUsed = m_frame;
+    entry.pinned = tile.level + 1 == m_layout.levels;
+    if (!entry.pinned)
+        PushFront(slot);
+
+    m_tileState[index] = TILE_RESIDENT;
+    m_tileSlot[index] = slot;
+    UpdatePageTable(tile);
+
+    slotX = slot % m_slotsX;
+    slotY = slot / m_slotsX;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TileCache::Cancel(const TileId& tile)
+{
+    uint8_t& state = m_tileState[Index(tile)];
+    if (state == TILE_LOADING)
+    {
+        state = TILE_ABSENT;
+        --m_loadingCount;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool TileCache::TakeDirtyRows(uint32_t level, uint32_t& firstRow, uint32_t& lastRow)
+{
+    if (m_dirtyFirstRow[level] > m_dirtyLastRow[level])
+        return false;
+
+    firstRow = m_dirtyFirstRow[level];
+    lastRow = m_dirtyLastRow[level];
+    m_dirtyFirstRow[level] = UINT32_MAX;
+    m_dirtyLastRow[level] = 0;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TileCache::Touch(uint32_t slot)
+{
+    m_slots[slot].lastUsed = m_frame;
+    if (!m_slots[slot].pinned && slot != m_lruHead)
+    {
+        Unlink(slot);
+        PushFront(slot);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TileCache::Unlink(uint32_t slot)
+{
+    Slot& entry = m_slots[slot];
+    if (entry.prev != NoSlot)
+        m_slots[entry.prev].next = entry.next;
+    else
+        m_lruHead = entry.next;
+
+    if (entry.next != NoSlot)
+        m_slots[entry.next].prev = entry.prev;
+    else
+        m_lruTail = entry.prev;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TileCache::PushFront(uint32_t slot)
+{
+    Slot& entry = m_slots[slot];
+    entry.prev = NoSlot;
+    entry.next = m_lruHead;
+    if (m_lruHead != NoSlot)
+        m_slots[m_lruHead].prev = slot;
+    m_lruHead = slot;
+    if (m_lruTail == NoSlot)
+        m_lruTail = slot;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Recompute the texels covered by the tile, from its level down to
+///   level 0: each one points to its own tile if resident, otherwise it
+///   inherits the texel of the parent level. The parent level is always
+///   up to date, so one pass from coarse to fine is enough.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+void TileCache::UpdatePageTable(const TileId& tile)
+{
+    for (uint32_t level = tile.level + 1; level-- > 0;)
+    {
+        const uint32_t shift = tile.level - level;
+        const uint32_t tilesX = m_layout.TilesX(level);
+        const uint32_t tilesY = m_layout.TilesY(level);
+        const uint32_t firstX = std::min(tile.x << shift, tilesX);
+        const uint32_t firstY = std::min(tile.y << shift, tilesY);
+        const uint32_t lastX = std::min((tile.x + 1) << shift, tilesX);
+        const uint32_t lastY = std::min((tile.y + 1) << shift, tilesY);
+        if (firstX >= lastX || firstY >= lastY)
+            break;
+
+        std::vector<PageEntry>& table = m_pageTable[level];
+        for (uint32_t y = firstY; y < lastY; ++y)
+        {
+            for (uint32_t x = firstX; x < lastX; ++x)
+            {
+                const uint32_t slot = m_tileSlot[m_levelOffsets[level] + static_cast<size_t>(y) * tilesX + x];
+                PageEntry& entry = table[static_cast<size_t>(y) * tilesX + x];
+                if (slot != NoSlot)
+                {
+                    entry = PageEntry{ static_cast<uint8_t>(slot % m_slotsX), static_cast<uint8_t>(slot / m_slotsX),
+                        static_cast<uint8_t>(level), 255 };
+                }
+                else if (level + 1 < m_layout.levels)
+                {
+                    entry = m_pageTable[level + 1][static_cast<size_t>(y / 2) * m_layout.TilesX(level + 1) + x / 2];
+                }
+                else
+                {
+                    entry = PageEntry{};
+                }
+            }
+        }
+
+        m_dirtyFirstRow[level] = std::min(m_dirtyFirstRow[level], firstY);
+        m_dirtyLastRow[level] = std::max(m_dirtyLastRow[level], lastY - 1);
+    }
+}
+} // namespace Lis
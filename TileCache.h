@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/TileCache.h
+///
+/// summary:    Declares the residency of the virtual texture tiles in
+///             the fixed set of physical cache slots
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "TilePack.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+struct TileId
+{
+    uint32_t level;
+    uint32_t x;
+    uint32_t y;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Texel of the page table (RGBA8): the physical slot holding the tile
+///   or its nearest resident ancestor, and the level of that tile.
+///   resident is 0 while nothing covers the texel yet.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct PageEntry
+{
+    uint8_t slotX;
+    uint8_t slotY;
+    uint8_t level;
+    uint8_t resident;
+};
+
+static_assert(sizeof(PageEntry) == 4, "PageEntry must match the RGBA8 page table texel");
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Bookkeeping of the virtual texture, without any GPU or IO work:
+///   which tiles are wanted (from the feedback), which are loading, which
+///   slot each resident one occupies and the CPU copy of the page table.
+///
+///   Slots are recycled in the least recently used order, but never for a
+///   tile seen in the current frame, so the memory stays bounded by the
+///   slot count whatever the size of the pyramid. The single tile of the
+///   last level is pinned: every texel has a fallback once it is loaded.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class TileCache
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    /// <param name="layout"> The pyramid </param>
+    /// <param name="slotsX"> Slots across the physical cache, up to 256 </param>
+    /// <param name="slotsY"> Slots down the physical cache, up to 256 </param>
+    //////////////////////////////////////////////////////////////////////////
+    TileCache(const TileLayout& layout, uint32_t slotsX, uint32_t slotsY);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Start a new feedback round: the requests of the previous one that
+    ///   were not taken are forgotten.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void BeginFrame();
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   The tile is visible: keep it and its ancestors resident, or ask
+    ///   for the missing ones.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Request(const TileId& tile);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Get up to maxCount tiles to load, coarse levels first, and mark
+    ///   them loading. Nothing is returned while every slot is in use by
+    ///   the visible tiles.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    std::vector<TileId> TakeRequests(size_t maxCount);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Give a slot to a loaded tile, evicting the least recently used one
+    ///   if needed, and update the page table.
+    /// </summary>
+    ///
+    /// <returns> false if no slot can be freed now: the tile is dropped
+    ///           and will be requested again </returns>
+    //////////////////////////////////////////////////////////////////////////
+    bool Insert(const TileId& tile, uint32_t& slotX, uint32_t& slotY);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// The tile failed to load: it may be requested again
+    //////////////////////////////////////////////////////////////////////////
+    void Cancel(const TileId& tile);
+
+    const TileLayout& Layout() const { return m_layout; }
+    const std::vector<PageEntry>& PageTable(uint32_t level) const { return m_pageTable[level]; }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Get the rows of the page table level changed since the last call
+    /// </summary>
+    ///
+    /// <returns> false if the level is unchanged </returns>
+    //////////////////////////////////////////////////////////////////////////
+    bool TakeDirtyRows(uint32_t level, uint32_t& firstRow, uint32_t& lastRow);
+
+    size_t SlotCount() const { return m_slots.size(); }
+    size_t ResidentCount() const { return m_slots.size() - m_freeSlots.size(); }
+    size_t LoadingCount() const { return m_loadingCount; }
+
+private:
+    enum TileState : uint8_t
+    {
+        TILE_ABSENT,
+        TILE_REQUESTED,
+        TILE_LOADING,
+        TILE_RESIDENT
+    };
+
+    struct Slot
+    {
+        TileId tile;
+        uint32_t prev;
+        uint32_t next;
+        uint64_t lastUsed;
+        bool pinned;
+    };
+
+    size_t Index(const TileId& tile) const;
+    bool CanFreeSlot() const;
+    void Touch(uint32_t slot);
+    void Unlink(uint32_t slot);
+    void PushFront(uint32_t slot);
+    void UpdatePageTable(const TileId& tile);
+
+    static const uint32_t NoSlot = UINT32_MAX;
+
+    TileLayout m_layout;
+    uint32_t m_slotsX;
+    std::vector<size_t> m_levelOffsets;
+    std::vector<uint8_t> m_tileState;
+    std::vector<uint32_t> m_tileSlot;
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    uint32_t m_lruHead;         ///< the most recently used slot
+    uint32_t m_lruTail;         ///< the eviction candidate
+
+    std::vector<TileId> m_requests;
+    size_t m_loadingCount;
+    uint64_t m_frame;
+
+    std::vector<std::vector<PageEntry>> m_pageTable;
+    std::vector<uint32_t> m_dirtyFirstRow;
+    std::vector<uint32_t> m_dirtyLastRow;
+};
+} // namespace Lis
@@ -0,0 +1,267 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/TilePack.cpp
+///
+/// summary:    Implements the tile pack reader and writer
+//////////////////////////////////////////////////////////////////////////
+
+#include "TilePack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+const char PackMagic[8] = { 'L', 'I', 'S', 'T', 'I', 'L', 'E', '\0' };
+const uint32_t PackVersion = 1;
+
+//////////////////////////////////////////////////////////////////////////
+/// The file layout, little-endian: the header, the tiles, the index
+//////////////////////////////////////////////////////////////////////////
+struct PackHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t tileSize;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t encoding;
+    uint64_t indexOffset;
+    uint64_t tileCount;
+    uint8_t reserved[16];
+};
+
+struct PackIndexEntry
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(PackHeader) == 64, "the tile pack header must stay 64 bytes");
+static_assert(sizeof(PackIndexEntry) == 16, "the tile pack index entry must stay 16 bytes");
+
+//////////////////////////////////////////////////////////////////////////
+/// Tile packs of big images are well over 2 GB
+//////////////////////////////////////////////////////////////////////////
+void Seek(std::FILE* file, uint64_t offset)
+{
+#ifdef _MSC_VER
+    const int result = _fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+    const int result = fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    if (result != 0)
+        throw std::runtime_error("failed to seek in the tile pack");
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Read(std::FILE* file, void* data, size_t size)
+{
+    if (size && std::fread(data, size, 1, file) != 1)
+        throw std::runtime_error("failed to read the tile pack: unexpected end of file");
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Write(std::FILE* file, const void* data, size_t size)
+{
+    if (size && std::fwrite(data, size, 1, file) != 1)
+        throw std::runtime_error("failed to write the tile pack");
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ReadIndexed(std::FILE* file, uint64_t offset, uint32_t size, std::vector<uint8_t>& data)
+{
+    if (size == 0)
+        throw std::runtime_error("the tile is missing from the pack");
+    data.resize(size);
+    Seek(file, offset);
+    Read(file, data.data(), size);
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////
+TileLayout TileLayout::ForImage(uint32_t width, uint32_t height, uint32_t tileSize)
+{
+    if (width == 0 || height == 0 || tileSize == 0)
+        throw std::invalid_argument("the tiled image must not be empty");
+
+    TileLayout layout;
+    layout.tileSize = tileSize;
+    layout.width = width;
+    layout.height = height;
+    layout.levels = 1;
+    while (layout.TilesX(layout.levels - 1) > 1 || layout.TilesY(layout.levels - 1) > 1)
+        ++layout.levels;
+    return layout;
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint32_t TileLayout::TilesX(uint32_t level) const
+{
+    const uint64_t span = static_cast<uint64_t>(tileSize) << level;
+    return static_cast<uint32_t>((width + span - 1) / span);
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint32_t TileLayout::TilesY(uint32_t level) const
+{
+    const uint64_t span = static_cast<uint64_t>(tileSize) << level;
+    return static_cast<uint32_t>((height + span - 1) / span);
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t TileLayout::LevelOffset(uint32_t level) const
+{
+    size_t offset = 0;
+    for (uint32_t l = 0; l < level; ++l)
+        offset += static_cast<size_t>(TilesX(l)) * TilesY(l);
+    return offset;
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t TileLayout::TileIndex(uint32_t level, uint32_t x, uint32_t y) const
+{
+    if (level >= levels || x >= TilesX(level) || y >= TilesY(level))
+        throw std::out_of_range("tile is outside of the pyramid");
+    return LevelOffset(level) + static_cast<size_t>(y) * TilesX(level) + x;
+}
+
+//////////////////////////////////////////////////////////////////////////
+TilePackWriter::TilePackWriter(const std::string& path, const TileLayout& layout, TileEncoding encoding)
+    : m_file(std::fopen(path.c_str(), "w+b"))
+    , m_layout(layout)
+    , m_encoding(encoding)
+    , m_offsets(layout.TileCount(), 0)
+    , m_sizes(layout.TileCount(), 0)
+    , m_end(sizeof(PackHeader))
+{
+    if (!m_file)
+        throw std::runtime_error("failed to create the tile pack " + path);
+
+    // The header is rewritten by Finish(), a crashed bake leaves no magic
+    const PackHeader placeholder = {};
+    Write(m_file, &placeholder, sizeof(placeholder));
+}
+
+//////////////////////////////////////////////////////////////////////////
+TilePackWriter::~TilePackWriter()
+{
+    if (m_file)
+        std::fclose(m_file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TilePackWriter::WriteTile(uint32_t level, uint32_t x, uint32_t y, const void* data, size_t size)
+{
+    if (size == 0 || size > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("invalid encoded tile size");
+
+    const size_t index = m_layout.TileIndex(level, x, y);
+    Seek(m_file, m_end);
+    Write(m_file, data, size);
+
+    m_offsets[index] = m_end;
+    m_sizes[index] = static_cast<uint32_t>(size);
+    m_end += size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TilePackWriter::ReadTile(uint32_t level, uint32_t x, uint32_t y, std::vector<uint8_t>& data)
+{
+    const size_t index = m_layout.TileIndex(level, x, y);
+    ReadIndexed(m_file, m_offsets[index], m_sizes[index], data);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TilePackWriter::Finish()
+{
+    if (std::find(m_sizes.begin(), m_sizes.end(), 0u) != m_sizes.end())
+        throw std::runtime_error("the tile pack is incomplete");
+
+    std::vector<PackIndexEntry> index(m_offsets.size());
+    for (size_t i = 0; i < index.size(); ++i)
+        index[i] = PackIndexEntry{ m_offsets[i], m_sizes[i], 0 };
+
+    Seek(m_file, m_end);
+    Write(m_file, index.data(), index.size() * sizeof(PackIndexEntry));
+
+    PackHeader header = {};
+    std::memcpy(header.magic, PackMagic, sizeof(PackMagic));
+    header.version = PackVersion;
+    header.tileSize = m_layout.tileSize;
+    header.width = m_layout.width;
+    header.height = m_layout.height;
+    header.levels = m_layout.levels;
+    header.encoding = m_encoding;
+    header.indexOffset = m_end;
+    header.tileCount = index.size();
+
+    Seek(m_file, 0);
+    Write(m_file, &header, sizeof(header));
+
+    const int closed = std::fclose(m_file);
+    m_file = nullptr;
+    if (closed != 0)
+        throw std::runtime_error("failed to write the tile pack");
+}
+
+//////////////////////////////////////////////////////////////////////////
+TilePackReader::TilePackReader(const std::string& path)
+    : m_file(std::fopen(path.c_str(), "rb"))
+{
+    if (!m_file)
+        throw std::runtime_error("failed to open the tile pack " + path);
+
+    try
+    {
+        PackHeader header;
+        Read(m_file, &header, sizeof(header));
+        if (std::memcmp(header.magic, PackMagic, sizeof(PackMagic)) != 0)
+            throw std::runtime_error("not a tile pack: " + path);
+        if (header.version != PackVersion)
+            throw std::runtime_error("unsupported tile pack version " + std::to_string(header.version));
+
+        m_layout = TileLayout::ForImage(header.width, header.height, header.tileSize);
+        if (m_layout.levels != header.levels || m_layout.TileCount() != header.tileCount)
+            throw std::runtime_error("corrupted tile pack header: " + path);
+        m_encoding = static_cast<TileEncoding>(header.encoding);
+
+        std::vector<PackIndexEntry> index(header.tileCount);
+        Seek(m_file, header.indexOffset);
+        Read(m_file, index.data(), index.size() * sizeof(PackIndexEntry));
+
+        m_offsets.reserve(index.size());
+        m_sizes.reserve(index.size());
+        for (const PackIndexEntry& entry : index)
+        {
+            m_offsets.push_back(entry.offset);
+            m_sizes.push_back(entry.size);
+        }
+    }
+    catch (...)
+    {
+        std::fclose(m_file);
+        throw;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+TilePackReader::~TilePackReader()
+{
+    std::fclose(m_file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void TilePackReader::ReadTile(uint32_t level, uint32_t x, uint32_t y, std::vector<uint8_t>& data)
+{
+    const size_t index = m_layout.TileIndex(level, x, y);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    ReadIndexed(m_file, m_offsets[index], m_sizes[index], data);
+}
+} // namespace Lis
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/TilePack.h
+///
+/// summary:    Declares the tile pack: the mip pyramid of an image cut
+///             into square tiles, stored in one file
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Geometry of the pyramid. Level 0 has the source resolution, every
+///   next level halves it, the last one is a single tile. Tile (x, y) of
+///   level L covers the source pixels [x, x + 1) * tileSize * 2^L; the
+///   tiles crossing the right and bottom edges are padded by repeating
+///   the edge pixels.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+struct TileLayout
+{
+    uint32_t tileSize = 0;
+    uint32_t width = 0;         ///< source image width, pixels
+    uint32_t height = 0;        ///< source image height, pixels
+    uint32_t levels = 0;
+
+    static TileLayout ForImage(uint32_t width, uint32_t height, uint32_t tileSize);
+
+    uint32_t TilesX(uint32_t level) const;
+    uint32_t TilesY(uint32_t level) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Index of the tile in the level-major order of the whole pyramid
+    //////////////////////////////////////////////////////////////////////////
+    size_t TileIndex(uint32_t level, uint32_t x, uint32_t y) const;
+    size_t LevelOffset(uint32_t level) const;
+    size_t TileCount() const { return LevelOffset(levels); }
+};
+
+//////////////////////////////////////////////////////////////////////////
+enum TileEncoding
+{
+    TILE_JPEG = 1,
+    TILE_PNG = 2
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Write the pack: a fixed header, the encoded tiles in any order and
+///   the index of the tile offsets at the end. The file is not valid
+///   until Finish() is called.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class TilePackWriter
+{
+public:
+    TilePackWriter(const std::string& path, const TileLayout& layout, TileEncoding encoding);
+    ~TilePackWriter();
+
+    TilePackWriter(const TilePackWriter&) = delete;
+    TilePackWriter& operator=(const TilePackWriter&) = delete;
+
+    void WriteTile(uint32_t level, uint32_t x, uint32_t y, const void* data, size_t size);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Read back a tile written before, e.g. to build the next level
+    //////////////////////////////////////////////////////////////////////////
+    void ReadTile(uint32_t level, uint32_t x, uint32_t y, std::vector<uint8_t>& data);
+
+    void Finish();
+
+private:
+    std::FILE* m_file;
+    TileLayout m_layout;
+    TileEncoding m_encoding;
+    std::vector<uint64_t> m_offsets;
+    std::vector<uint32_t> m_sizes;
+    uint64_t m_end;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Random access to the tiles of a pack. ReadTile() may be called from
+///   several threads at once.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class TilePackReader
+{
+public:
+    explicit TilePackReader(const std::string& path);
+    ~TilePackReader();
+
+    TilePackReader(const TilePackReader&) = delete;
+    TilePackReader& operator=(const TilePackReader&) = delete;
+
+    const TileLayout& Layout() const { return m_layout; }
+    TileEncoding Encoding() const { return m_encoding; }
+
+    void ReadTile(uint32_t level, uint32_t x, uint32_t y, std::vector<uint8_t>& data);
+
+private:
+    std::FILE* m_file;
+    std::mutex m_lock;
+    TileLayout m_layout;
+    TileEncoding m_encoding;
+    std::vector<uint64_t> m_offsets;
+    std::vector<uint32_t> m_sizes;
+};
+} // namespace Lis
@@ -0,0 +1,350 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Tracer.cpp
+///
+/// summary:    Implements the timeline tracer of the scoped zones
+//////////////////////////////////////////////////////////////////////////
+
+#include "Tracer.h"
+#include "Logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+namespace Lis
+{
+namespace
+{
+//////////////////////////////////////////////////////////////////////////
+/// The names are literals from the code, but a thread name may be
+/// anything: escape what JSON requires
+//////////////////////////////////////////////////////////////////////////
+void WriteJsonString(std::ostream& out, const char* text)
+{
+    out << '"';
+    for (; *text; ++text)
+    {
+        const unsigned char c = static_cast<unsigned char>(*text);
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << *text;
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        }
+        else
+        {
+            out << *text;
+        }
+    }
+    out << '"';
+}
+} // namespace
+
+const size_t Tracer::MaxEventsPerThread;
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   The events of one thread. Only that thread appends; the count is
+///   published with release semantics after the event and, at a chunk
+///   boundary, the link to the new chunk are written, so a reader that
+///   loads the count with acquire may walk that many events.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class Tracer::ThreadBuffer
+{
+public:
+    ThreadBuffer()
+        : exited(false)
+        , collected(false)
+        , m_id(0)
+        , m_head(new Chunk())
+        , m_tail(m_head.get())
+        , m_count(0)
+        , m_dropped(0)
+    {
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Hand the buffer to a new thread: the chunks are kept for it, under
+    /// the lock of the tracer and with no other thread appending
+    //////////////////////////////////////////////////////////////////////////
+    void Reset(uint32_t id)
+    {
+        m_id = id;
+        m_tail = m_head.get();
+        m_count.store(0, std::memory_order_relaxed);
+        m_dropped.store(0, std::memory_order_relaxed);
+        name.clear();
+        exited = false;
+        collected = false;
+    }
+
+    void Append(const Event& event)
+    {
+        const size_t count = m_count.load(std::memory_order_relaxed);
+        if (count >= MaxEventsPerThread)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (count > 0 && count % ChunkSize == 0)
+        {
+            if (!m_tail->next)
+                m_tail->next.reset(new Chunk());
+            m_tail = m_tail->next.get();
+        }
+        m_tail->events[count % ChunkSize] = event;
+        m_count.store(count + 1, std::memory_order_release);
+    }
+
+    template<class F>
+    void ForEach(F function) const
+    {
+        const size_t count = m_count.load(std::memory_order_acquire);
+        const Chunk* chunk = m_head.get();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i > 0 && i % ChunkSize == 0)
+                chunk = chunk->next.get();
+            function(chunk->events[i % ChunkSize]);
+        }
+    }
+
+    uint32_t Id() const { return m_id; }
+    uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    // Guarded by the lock of the tracer
+    std::string name;
+    bool exited;            ///< the thread is gone, no more events
+    bool collected;         ///< written since the thread exited
+
+private:
+    static const size_t ChunkSize = 4096;
+
+    struct Chunk
+    {
+        Event events[ChunkSize];
+        std::unique_ptr<Chunk> next;
+    };
+
+    uint32_t m_id;
+    const std::unique_ptr<Chunk> m_head;
+    Chunk* m_tail;
+    std::atomic<size_t> m_count;
+    std::atomic<uint64_t> m_dropped;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// The tracer state of a thread: its name from SetThreadName() and the
+/// buffer of its events, taken on the first one and retired at the exit
+//////////////////////////////////////////////////////////////////////////
+class Tracer::ThreadSlot
+{
+public:
+    ~ThreadSlot()
+    {
+        if (buffer)
+            GetInstance().RetireBuffer(buffer);
+    }
+
+    ThreadBuffer* buffer = nullptr;
+    std::string name;
+};
+
+//////////////////////////////////////////////////////////////////////////
+Tracer& Tracer::GetInstance()
+{
+    static Tracer* tracer = new Tracer();
+    return *tracer;
+}
+
+//////////////////////////////////////////////////////////////////////////
+Tracer::Tracer()
+    : m_epoch(Clock::now())
+    , m_recording(false)
+    , m_threadCount(0)
+    , m_recycledDropped(0)
+    , m_exitHandlerSet(false)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+Tracer::~Tracer()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::Start()
+{
+    m_recording.store(true, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::Stop()
+{
+    m_recording.store(false, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::Record(const char* name, Clock::time_point start, Clock::time_point end)
+{
+    ThreadSlot& slot = LocalSlot();
+    if (!slot.buffer)
+        slot.buffer = AcquireBuffer(slot.name);
+    slot.buffer->Append(Event{ name, std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_epoch).count(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() });
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::SetThreadName(const std::string& name)
+{
+    ThreadSlot& slot = LocalSlot();
+    slot.name = name;
+    if (slot.buffer)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        slot.buffer->name = name;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+uint64_t Tracer::DroppedCount() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    uint64_t dropped = m_recycledDropped;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : m_buffers)
+        dropped += buffer->Dropped();
+    return dropped;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::Write(const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("failed to create the trace " + path);
+
+    // Complete events ("X") with the timestamps in microseconds; the
+    // metadata events name the threads
+    size_t events = 0;
+    uint64_t dropped = 0;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"lis\"}}";
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (const std::unique_ptr<ThreadBuffer>& buffer : m_buffers)
+        {
+            const uint32_t tid = buffer->Id();
+            if (!buffer->name.empty())
+            {
+                out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":";
+                WriteJsonString(out, buffer->name.c_str());
+                out << "}}";
+            }
+
+            buffer->ForEach([&out, &events, tid](const Event& event) {
+                char times[64];
+                std::snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", event.start / 1e3, event.duration / 1e3);
+                out << ",\n{\"name\":";
+                WriteJsonString(out, event.name);
+                out << ",\"cat\":\"lis\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ',' << times << '}';
+                ++events;
+            });
+            dropped += buffer->Dropped();
+
+            if (buffer->exited && !buffer->collected)
+            {
+                buffer->collected = true;
+                m_freeBuffers.push_back(buffer.get());
+            }
+        }
+    }
+    out << "\n]}\n";
+
+    out.flush();
+    if (!out)
+        throw std::runtime_error("failed to write the trace " + path);
+
+    Logger::GetInstance().Info() << "trace: " << events << " events written to " << path
+        << (dropped ? ", " : "") << (dropped ? std::to_string(dropped) + " dropped" : std::string());
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::WriteAtExit(const std::string& path)
+{
+    // The logger must outlive the handler: construct it first
+    Logger::GetInstance();
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_exitPath = path;
+    if (!m_exitHandlerSet)
+    {
+        std::atexit(&Tracer::WriteAtExitHandler);
+        m_exitHandlerSet = true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::WriteAtExitHandler()
+{
+    Tracer& tracer = GetInstance();
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(tracer.m_lock);
+        path = tracer.m_exitPath;
+    }
+    if (path.empty())
+        return;
+
+    try
+    {
+        tracer.Write(path);
+    }
+    catch (const std::exception& e)
+    {
+        Logger::GetInstance().Error() << e.what();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+Tracer::ThreadSlot& Tracer::LocalSlot()
+{
+    thread_local ThreadSlot slot;
+    return slot;
+}
+
+//////////////////////////////////////////////////////////////////////////
+Tracer::ThreadBuffer* Tracer::AcquireBuffer(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    ThreadBuffer* buffer = nullptr;
+    if (!m_freeBuffers.empty())
+    {
+        buffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+        m_recycledDropped += buffer->Dropped();
+    }
+    else
+    {
+        m_buffers.emplace_back(new ThreadBuffer());
+        buffer = m_buffers.back().get();
+    }
+    buffer->Reset(++m_threadCount);
+    buffer->name = name;
+    return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Tracer::RetireBuffer(ThreadBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    buffer->exited = true;
+}
+
+} // namespace Lis
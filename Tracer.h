@@ -0,0 +1,178 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/Tracer.h
+///
+/// summary:    Declares the timeline tracer of the scoped zones
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+/// Set to 0 to compile the zones out entirely (see the CMake option)
+//////////////////////////////////////////////////////////////////////////
+#ifndef LIS_TRACE
+# define LIS_TRACE 1
+#endif
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Records the zones of every thread on a common timeline and writes
+///   them as Chrome trace events, to open in chrome://tracing or Perfetto
+///   and see where the threads wait for each other.
+///
+///   Each thread appends to its own buffer, a list of fixed chunks it
+///   alone writes: a zone takes two clock reads and a release store, no
+///   lock, and allocates once per chunk only. Write() reads the events
+///   published so far while the threads go on recording. A thread stops
+///   recording at MaxEventsPerThread; the rest is counted as dropped.
+///
+///   A thread gets its buffer with its first event, so the threads that
+///   never record while tracing allocate nothing. The buffer of a thread
+///   that has exited is kept until a Write() has collected it, then it
+///   is reused by the next thread that needs one.
+///
+///   Stopped (the default), a zone costs one relaxed atomic load.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class Tracer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const size_t MaxEventsPerThread = 1 << 20;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Get the tracer instance. It is never destroyed: the zones of the
+    ///   pool threads may end after the static destructors.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    static Tracer& GetInstance();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void Start();
+    void Stop();
+    bool IsRecording() const { return m_recording.load(std::memory_order_relaxed); }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Write the events recorded so far as trace-event JSON. Throws
+    ///   std::runtime_error if the file cannot be written. The buffers of
+    ///   the exited threads written here may be reused afterwards: their
+    ///   events are in the later traces until then only.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Write(const std::string& path);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Write the trace when the process exits normally, errors go to the
+    ///   log. An empty path cancels.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void WriteAtExit(const std::string& path);
+
+    //////////////////////////////////////////////////////////////////////////
+    /// Name the calling thread in the trace, e.g. "world" or "worker 3":
+    /// metadata only, allocates no buffer
+    //////////////////////////////////////////////////////////////////////////
+    void SetThreadName(const std::string& name);
+
+    /// The events not recorded because a thread buffer was full
+    uint64_t DroppedCount() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Record a complete zone of the calling thread. The name must
+    ///   outlive the tracer: a string literal.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    void Record(const char* name, Clock::time_point start, Clock::time_point end);
+
+private:
+    struct Event
+    {
+        const char* name;
+        int64_t start;      ///< ns since the epoch of the tracer
+        int64_t duration;   ///< ns
+    };
+
+    class ThreadBuffer;
+    class ThreadSlot;
+
+    Tracer();
+    ~Tracer();
+
+    static ThreadSlot& LocalSlot();
+    ThreadBuffer* AcquireBuffer(const std::string& name);
+    void RetireBuffer(ThreadBuffer* buffer);
+    static void WriteAtExitHandler();
+
+    const Clock::time_point m_epoch;
+    std::atomic<bool> m_recording;
+
+    mutable std::mutex m_lock;      ///< the buffers, the thread names, the exit path
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+    std::vector<ThreadBuffer*> m_freeBuffers;   ///< of exited threads, collected
+    uint32_t m_threadCount;
+    uint64_t m_recycledDropped;     ///< by the threads of the reused buffers
+    std::string m_exitPath;
+    bool m_exitHandlerSet;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Records the enclosing scope as a zone of the calling thread. Use
+///   LIS_TRACE_ZONE, which compiles to nothing with LIS_TRACE=0.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+class TraceZone
+{
+public:
+    explicit TraceZone(const char* name)
+        : m_name(Tracer::GetInstance().IsRecording() ? name : nullptr)
+    {
+        if (m_name)
+            m_start = Tracer::Clock::now();
+    }
+
+    ~TraceZone()
+    {
+        if (m_name)
+            Tracer::GetInstance().Record(m_name, m_start, Tracer::Clock::now());
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+    const char* m_name;
+    Tracer::Clock::time_point m_start;
+};
+} // namespace Lis
+
+//////////////////////////////////////////////////////////////////////////
+/// Trace the rest of the enclosing scope:
+///
+///     LIS_TRACE_ZONE("PlanetWindow::render");
+//////////////////////////////////////////////////////////////////////////
+#define LIS_TRACE_CONCAT_IMPL(a, b) a##b
+#define LIS_TRACE_CONCAT(a, b) LIS_TRACE_CONCAT_IMPL(a, b)
+
+#if LIS_TRACE
+# define LIS_TRACE_ZONE(name) ::Lis::TraceZone LIS_TRACE_CONCAT(lisTraceZone, __LINE__)(name)
+#else
+# define LIS_TRACE_ZONE(name) do {} while (false)
+#endif
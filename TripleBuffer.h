@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////
+/// file:       Lis/TripleBuffer.h
+///
+/// summary:    Declares the lock-free single-writer single-reader handoff
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Lis
+{
+//////////////////////////////////////////////////////////////////////////
+/// <summary>
+///   Hands the latest value from one writer thread to one reader thread,
+///   neither of them ever waits. The writer fills its own buffer and
+///   swaps it with the middle one; the reader swaps its buffer with the
+///   middle one only when the middle holds something new. Values the
+///   reader is too slow to see are overwritten, the reader always gets
+///   the newest one.
+///
+///   The index of the middle buffer and the "fresh" flag share one
+///   atomic byte, so each side needs a single exchange.
+/// </summary>
+//////////////////////////////////////////////////////////////////////////
+template<class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : m_write(0)
+        , m_middle(1)
+        , m_read(2)
+    {
+    }
+
+    explicit TripleBuffer(const T& value)
+        : TripleBuffer()
+    {
+        for (T& buffer : m_buffers)
+            buffer = value;
+    }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    //////////////////////////////////////////////////////////////////////////
+    /// The writer's buffer; holds whatever the reader returned, not the
+    /// last published value
+    //////////////////////////////////////////////////////////////////////////
+    T& WriteBuffer() { return m_buffers[m_write]; }
+
+    /// Make the write buffer the newest value
+    void Publish()
+    {
+        const uint8_t previous = m_middle.exchange(static_cast<uint8_t>(m_write | Fresh), std::memory_order_acq_rel);
+        m_write = previous & IndexMask;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    /// <summary>
+    ///   Take the newest published value if there is one. Returns false and
+    ///   keeps the read buffer otherwise.
+    /// </summary>
+    //////////////////////////////////////////////////////////////////////////
+    bool Update()
+    {
+        if (!(m_middle.load(std::memory_order_acquire) & Fresh))
+            return false;
+
+        const uint8_t previous = m_middle.exchange(m_read, std::memory_order_acq_rel);
+        m_read = previous & IndexMask;
+        return true;
+    }
+
+    const T& ReadBuffer() const { return m_buffers[m_read]; }
+
+    /// Whether a value was published since the last Update(); reader side
+    bool HasNew() const { return (m_middle.load(std::memory_order_acquire) & Fresh) != 0; }
+
+private:
+    static const uint8_t IndexMask = 3;
+    static const uint8_t Fresh = 4;
+
+    // The two sides only share the middle index; keep their own indices
+    // off its cache line. Padding instead of alignas, as in BoundedQueue.
+    static const size_t CacheLineSize = 64;
+
+    T m_buffers[3];
+    char m_padding0[CacheLineSize];
+    uint8_t m_write;
+    char m_padding1[CacheLineSize - sizeof(uint8_t)];
+    std::atomic<uint8_t> m_middle;
+    char m_padding2[CacheLineSize - sizeof(std::atomic<uint8_t>)];
+    uint8_t m_read;
+};
+} // namespace Lis
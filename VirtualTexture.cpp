@@ -0,0 +1,343 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/VirtualTexture.cpp
+//
+// summary:	Implements the streaming virtual texture
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "VirtualTexture.h"
+#include "BoundedQueue.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+
+#include <QtGui/QImage>
+#include <QtGui/QOpenGLFramebufferObject>
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QOpenGLTexture>
+#include <QtGui/QVector2D>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace Lis
+{
+namespace
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int NextPowerOfTwo(int value)
+{
+    int result = 1;
+    while (result < value)
+        result *= 2;
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct DecodedTile
+{
+    TileId tile;
+    QImage image;       ///< null if the tile failed to load
+};
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	The part of the virtual texture the loading tasks work with. It is shared, so
+/// 			the tasks still running when the texture is destroyed finish harmlessly.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct VirtualTexture::Loader
+{
+    Loader(const QString& path, size_t capacity)
+        : reader(path.toStdString())
+        , decoded(capacity)
+    {
+    }
+
+    TilePackReader reader;
+
+    /// <summary>	At most VirtualTextureSettings::maxLoading tiles are loading, so a push never fails. </summary>
+    BoundedQueue<DecodedTile> decoded;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+VirtualTexture::VirtualTexture(const QString& packPath, const VirtualTextureSettings& settings)
+    : m_settings(settings)
+    , m_loader(std::make_shared<Loader>(packPath, NextPowerOfTwo(std::max(settings.maxLoading, 2))))
+{
+    const TileLayout& layout = m_loader->reader.Layout();
+    if (layout.TilesX(0) > 4096 || layout.TilesY(0) > 4096)
+        throw std::runtime_error("the tile pack has more than 4096 tiles per side: " + packPath.toStdString());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+VirtualTexture::~VirtualTexture()
+{
+    m_feedbackBuffers[0].destroy();
+    m_feedbackBuffers[1].destroy();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::initialize()
+{
+    initializeOpenGLFunctions();
+    const TileLayout& layout = m_loader->reader.Layout();
+    const int tileSize = static_cast<int>(layout.tileSize);
+
+    // The cache is bounded by the texture size limit too
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    const int slots = std::min(std::min(m_settings.cacheSlots, 256), maxTextureSize / tileSize);
+    if (slots < 1)
+        throw std::runtime_error("the tiles are larger than the maximal texture size");
+    m_cache = std::make_unique<TileCache>(layout, slots, slots);
+
+    m_physicalCache = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    m_physicalCache->setSize(slots * tileSize, slots * tileSize);
+    m_physicalCache->setMipLevels(1);
+    m_physicalCache->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    m_physicalCache->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+    m_physicalCache->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    m_physicalCache->setWrapMode(QOpenGLTexture::ClampToEdge);
+
+    // Level L of the page table holds the tiles of level L. The power of two size
+    // makes the mip chain at least as big as the tile grids, which round up.
+    m_pageTable = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    m_pageTable->setSize(NextPowerOfTwo(layout.TilesX(0)), NextPowerOfTwo(layout.TilesY(0)));
+    m_pageTable->setMipLevels(static_cast<int>(layout.levels));
+    m_pageTable->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    m_pageTable->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+    m_pageTable->setMinMagFilters(QOpenGLTexture::NearestMipMapNearest, QOpenGLTexture::Nearest);
+    m_pageTable->setWrapMode(QOpenGLTexture::ClampToEdge);
+    for (uint32_t level = 0; level < layout.levels; ++level)
+    {
+        // The storage is undefined: nothing is resident yet
+        const int width = std::max(m_pageTable->width() >> level, 1);
+        const int height = std::max(m_pageTable->height() >> level, 1);
+        const std::vector<PageEntry> empty(static_cast<size_t>(width) * height, PageEntry{});
+        m_pageTable->bind();
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, empty.data());
+    }
+    m_pageTable->release();
+
+    for (QOpenGLBuffer& buffer : m_feedbackBuffers)
+    {
+        buffer = QOpenGLBuffer(QOpenGLBuffer::PixelPackBuffer);
+        buffer.setUsagePattern(QOpenGLBuffer::StreamRead);
+        buffer.create();
+    }
+
+    Logger::GetInstance().Info() << "virtual texture " << layout.width << "x" << layout.height << ", "
+        << layout.levels << " levels of " << tileSize << " px tiles, " << m_cache->SlotCount()
+        << " cache slots, " << gpuMemory() / (1024 * 1024) << " MB of GPU memory";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::update()
+{
+    LIS_TRACE_ZONE("VirtualTexture::update");
+    const int tileSize = static_cast<int>(m_cache->Layout().tileSize);
+
+    DecodedTile decoded;
+    for (int uploads = 0; uploads < m_settings.uploadsPerFrame && m_loader->decoded.TryPop(decoded); )
+    {
+        if (decoded.image.isNull())
+        {
+            m_cache->Cancel(decoded.tile);
+            continue;
+        }
+
+        uint32_t slotX, slotY;
+        if (!m_cache->Insert(decoded.tile, slotX, slotY))
+            continue;
+
+        m_physicalCache->bind();
+        glTexSubImage2D(GL_TEXTURE_2D, 0, slotX * tileSize, slotY * tileSize, tileSize, tileSize,
+            GL_RGBA, GL_UNSIGNED_BYTE, decoded.image.constBits());
+        ++uploads;
+    }
+    m_physicalCache->release();
+    decoded.image = QImage();
+
+    uploadPageTable();
+
+    const size_t loading = m_cache->LoadingCount();
+    const size_t maxLoading = static_cast<size_t>(m_settings.maxLoading);
+    if (loading >= maxLoading)
+        return;
+
+    for (const TileId& tile : m_cache->TakeRequests(maxLoading - loading))
+    {
+        std::shared_ptr<Loader> loader = m_loader;
+        ThreadPool::GetShared().Submit([loader, tile, tileSize] {
+            LIS_TRACE_ZONE("VirtualTexture tile load");
+            DecodedTile result{ tile, QImage() };
+            try
+            {
+                std::vector<uint8_t> data;
+                loader->reader.ReadTile(tile.level, tile.x, tile.y, data);
+                result.image = QImage::fromData(data.data(), static_cast<int>(data.size()))
+                    .convertToFormat(QImage::Format_RGBA8888);
+                if (result.image.width() != tileSize || result.image.height() != tileSize)
+                    throw std::runtime_error("failed to decode the tile");
+            }
+            catch (const std::exception& e)
+            {
+                Logger::GetInstance().Error() << "virtual texture tile " << tile.level << "/" << tile.x << "/"
+                    << tile.y << ": " << e.what();
+                result.image = QImage();
+            }
+            loader->decoded.TryPush(std::move(result));
+        });
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::uploadPageTable()
+{
+    const TileLayout& layout = m_cache->Layout();
+    for (uint32_t level = 0; level < layout.levels; ++level)
+    {
+        uint32_t firstRow, lastRow;
+        if (!m_cache->TakeDirtyRows(level, firstRow, lastRow))
+            continue;
+
+        const uint32_t tilesX = layout.TilesX(level);
+        m_pageTable->bind();
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, firstRow, tilesX, lastRow - firstRow + 1, GL_RGBA,
+            GL_UNSIGNED_BYTE, m_cache->PageTable(level).data() + static_cast<size_t>(firstRow) * tilesX);
+    }
+    m_pageTable->release();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::beginFeedback(const QSize& viewport)
+{
+    const QSize size(std::max(viewport.width() / m_settings.feedbackDivisor, 1),
+        std::max(viewport.height() / m_settings.feedbackDivisor, 1));
+    if (!m_feedbackFbo || m_feedbackFbo->size() != size)
+        m_feedbackFbo = std::make_unique<QOpenGLFramebufferObject>(size, QOpenGLFramebufferObject::Depth);
+
+    // The main target may be the headless framebuffer: restore exactly what was bound
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, m_previousClearColor);
+
+    m_feedbackFbo->bind();
+    glViewport(0, 0, size.width(), size.height());
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::setFeedbackUniforms(QOpenGLShaderProgram& program)
+{
+    const TileLayout& layout = m_cache->Layout();
+    program.setUniformValue("virtualSize", QVector2D(layout.width, layout.height));
+    program.setUniformValue("tileSize", static_cast<GLfloat>(layout.tileSize));
+    program.setUniformValue("maxLevel", static_cast<GLfloat>(layout.levels - 1));
+    program.setUniformValue("feedbackBias", std::log2(static_cast<GLfloat>(m_settings.feedbackDivisor)));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::endFeedback()
+{
+    // Read this frame into one buffer and process the other one, filled a frame ago:
+    // the copy has completed by now and mapping it does not stall the pipeline
+    const QSize size = m_feedbackFbo->size();
+    QOpenGLBuffer& current = m_feedbackBuffers[m_feedbackIndex];
+    current.bind();
+    if (m_feedbackSizes[m_feedbackIndex] != size)
+        current.allocate(size.width() * size.height() * 4);
+    glReadPixels(0, 0, size.width(), size.height(), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    current.release();
+    m_feedbackSizes[m_feedbackIndex] = size;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_previousFramebuffer);
+    glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+    glClearColor(m_previousClearColor[0], m_previousClearColor[1], m_previousClearColor[2], m_previousClearColor[3]);
+
+    m_feedbackIndex ^= 1;
+    QOpenGLBuffer& previous = m_feedbackBuffers[m_feedbackIndex];
+    const QSize previousSize = m_feedbackSizes[m_feedbackIndex];
+    if (previousSize.isEmpty())
+        return;
+
+    const int bytes = previousSize.width() * previousSize.height() * 4;
+    previous.bind();
+    if (const void* pixels = previous.mapRange(0, bytes, QOpenGLBuffer::RangeRead))
+    {
+        processFeedback(static_cast<const uchar*>(pixels), previousSize.width() * previousSize.height());
+        previous.unmap();
+    }
+    previous.release();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::processFeedback(const uchar* pixels, int count)
+{
+    // See vt-feedback.shader for the encoding. The neighbors mostly need the
+    // same tile, the cache skips the repeats anyway.
+    m_cache->BeginFrame();
+    uint32_t previous = 0;
+    for (int i = 0; i < count; ++i, pixels += 4)
+    {
+        uint32_t packed;
+        std::memcpy(&packed, pixels, sizeof(packed));
+        if (pixels[3] == 0 || packed == previous)
+            continue;
+        previous = packed;
+
+        const uint32_t x = pixels[0] | (pixels[2] & 0x0f) << 8;
+        const uint32_t y = pixels[1] | (pixels[2] & 0xf0) << 4;
+        m_cache->Request(TileId{ pixels[3] - 1u, x, y });
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void VirtualTexture::bind(QOpenGLShaderProgram& program, int firstUnit)
+{
+    const TileLayout& layout = m_cache->Layout();
+    m_pageTable->bind(firstUnit);
+    m_physicalCache->bind(firstUnit + 1);
+
+    program.setUniformValue("pageTable", firstUnit);
+    program.setUniformValue("physicalCache", firstUnit + 1);
+    program.setUniformValue("virtualSize", QVector2D(layout.width, layout.height));
+    program.setUniformValue("tileSize", static_cast<GLfloat>(layout.tileSize));
+    program.setUniformValue("cacheSize", QVector2D(m_physicalCache->width(), m_physicalCache->height()));
+    program.setUniformValue("maxLevel", static_cast<GLfloat>(layout.levels - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const TileLayout& VirtualTexture::layout() const
+{
+    return m_loader->reader.Layout();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t VirtualTexture::residentTiles() const
+{
+    return m_cache ? m_cache->ResidentCount() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t VirtualTexture::loadingTiles() const
+{
+    return m_cache ? m_cache->LoadingCount() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+qint64 VirtualTexture::gpuMemory() const
+{
+    if (!m_physicalCache)
+        return 0;
+
+    // A full mip chain adds a third
+    const qint64 pageTable = qint64(m_pageTable->width()) * m_pageTable->height() * 4 * 4 / 3;
+    const qint64 cache = qint64(m_physicalCache->width()) * m_physicalCache->height() * 4;
+    return pageTable + cache;
+}
+} // namespace Lis
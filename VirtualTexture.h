@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/VirtualTexture.h
+//
+// summary:	Declares the streaming virtual texture
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "TileCache.h"
+
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtGui/QOpenGLBuffer>
+#include <QtGui/QOpenGLExtraFunctions>
+
+#include <memory>
+
+class QOpenGLFramebufferObject;
+class QOpenGLShaderProgram;
+class QOpenGLTexture;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct VirtualTextureSettings
+{
+    int cacheSlots = 16;        ///< slots per side of the physical cache
+    int maxLoading = 32;        ///< tiles read and decoded at once
+    int uploadsPerFrame = 8;    ///< tiles uploaded to the cache per frame
+    int feedbackDivisor = 8;    ///< the feedback framebuffer is this much smaller
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Image of any size streamed from a tile pack (see lis_tile_baker). The GPU holds
+/// 			a page table with one texel per tile of every level and a physical cache
+/// 			texture of a fixed number of tile slots, so the memory does not depend on the
+/// 			source size. A feedback pass renders the tile each pixel needs into a small
+/// 			framebuffer; its readback, one frame late, drives the requests. The tiles
+/// 			are read and decoded on the thread pool and uploaded a few per frame.
+///
+/// 			Per frame: update(), then the feedback pass between beginFeedback() and
+/// 			endFeedback(), then the pass sampling through bind(). The programs use
+/// 			vt-feedback.shader and vt-fragment.shader.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class VirtualTexture : protected QOpenGLExtraFunctions
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Open the tile pack. No OpenGL calls are made until initialize(). </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    explicit VirtualTexture(const QString& packPath, const VirtualTextureSettings& settings = VirtualTextureSettings());
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Must be destroyed with the context of initialize() current. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    void initialize();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Upload the decoded tiles and the page table changes, start the
+    /// 			loading of the requested tiles.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void update();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Redirect the rendering into the feedback framebuffer. The program
+    /// 			drawn until endFeedback() needs setFeedbackUniforms().
+    /// </summary>
+    ///
+    /// <param name="viewport">	The size of the main render target. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    void beginFeedback(const QSize& viewport);
+    void setFeedbackUniforms(QOpenGLShaderProgram& program);
+    void endFeedback();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Bind the page table and the cache to the texture units firstUnit
+    /// 			and firstUnit + 1 and set the uniforms of the sampling program.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    void bind(QOpenGLShaderProgram& program, int firstUnit);
+
+    const TileLayout& layout() const;
+    size_t residentTiles() const;
+    size_t loadingTiles() const;
+    qint64 gpuMemory() const;
+
+private:
+    struct Loader;
+
+    void uploadPageTable();
+    void processFeedback(const uchar* pixels, int count);
+
+    VirtualTextureSettings m_settings;
+    std::shared_ptr<Loader> m_loader;
+    std::unique_ptr<TileCache> m_cache;
+
+    std::unique_ptr<QOpenGLTexture> m_pageTable;
+    std::unique_ptr<QOpenGLTexture> m_physicalCache;
+
+    std::unique_ptr<QOpenGLFramebufferObject> m_feedbackFbo;
+    QOpenGLBuffer m_feedbackBuffers[2];
+    QSize m_feedbackSizes[2];
+    int m_feedbackIndex = 0;
+    GLint m_previousFramebuffer = 0;
+    GLint m_previousViewport[4] = {};
+    GLfloat m_previousClearColor[4] = {};
+};
+} // namespace Lis
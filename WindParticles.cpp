@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/WindParticles.cpp
+//
+// summary:	Implements the wind tracers advected and drawn on the GPU
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "WindParticles.h"
+#include "Tracer.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QOpenGLVertexArrayObject>
+
+#include <stdexcept>
+#include <string>
+
+namespace Lis
+{
+namespace
+{
+/// <summary>	The local size of particle-compute.shader. </summary>
+const int WorkGroupSize = 256;
+
+/// <summary>	The work groups a dispatch is sure to allow, each way. </summary>
+const int MaxWorkGroups = 65535;
+
+/// <summary>	The particle of particle-compute.shader: the position and its age, the
+/// 			velocity and its speed.
+/// </summary>
+const size_t ParticleBytes = 8 * sizeof(float);
+
+/// <summary>	The streaks float above the surface by that much of the radius, clear of
+/// 			the flat triangles of the coarsest meshes.
+/// </summary>
+const float Lift = 1.01f;
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+WindParticles::WindParticles(const WindParticleParams& params)
+    : m_params(params)
+{
+    if (params.count <= 0 || params.count > MaxWorkGroups * WorkGroupSize)
+        throw std::invalid_argument("the wind particles must be between 1 and " + std::to_string(MaxWorkGroups * WorkGroupSize));
+    if (!(params.lifetime > 0.0f) || !(params.trail >= 0.0f) || !(params.maxSpeed > 0.0f))
+        throw std::invalid_argument("invalid wind particle params");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+WindParticles::~WindParticles()
+{
+    if (m_buffer)
+        glDeleteBuffers(1, &m_buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void WindParticles::initialize(const ShaderFile& compute, const std::vector<ShaderFile>& shaders)
+{
+    initializeOpenGLFunctions();
+
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (context->format().version() < (context->isOpenGLES() ? qMakePair(3, 1) : qMakePair(4, 3)))
+        throw std::runtime_error("the wind particles need compute shaders: OpenGL 4.3 or OpenGL ES 3.1");
+
+    ProgramCache programCache;
+    m_computeProgram = std::make_unique<QOpenGLShaderProgram>();
+    programCache.build(*m_computeProgram, { compute });
+    m_drawProgram = std::make_unique<QOpenGLShaderProgram>();
+    programCache.build(*m_drawProgram, shaders);
+
+    // Scattered by the first update, on the GPU as well
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(gpuMemory()), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // The streaks are made of gl_VertexID alone, but a core profile draws nothing without a VAO
+    m_vao = std::make_unique<QOpenGLVertexArrayObject>();
+    m_vao->create();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool WindParticles::isInitialized() const
+{
+    return static_cast<bool>(m_vao);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const WindParticleParams& WindParticles::params() const
+{
+    return m_params;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void WindParticles::update(int weatherUnit, float seconds, float modelRate, float radius)
+{
+    LIS_TRACE_ZONE("WindParticles::update");
+
+    if (!m_computeProgram->bind())
+        throw std::runtime_error("failed to bind the particle compute program to active GL context");
+    m_computeProgram->setUniformValue("weather", weatherUnit);
+    m_computeProgram->setUniformValue("count", static_cast<GLuint>(m_params.count));
+    m_computeProgram->setUniformValue("dt", seconds);
+    m_computeProgram->setUniformValue("modelRate", modelRate);
+    m_computeProgram->setUniformValue("radius", radius);
+    m_computeProgram->setUniformValue("lifetime", m_params.lifetime);
+    m_computeProgram->setUniformValue("seed", static_cast<GLuint>(++m_seed));
+    m_computeProgram->setUniformValue("scatter", static_cast<GLint>(!m_scattered));
+    m_scattered = true;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_buffer);
+    glDispatchCompute((m_params.count + WorkGroupSize - 1) / WorkGroupSize, 1, 1);
+    m_computeProgram->release();
+
+    // The streaks read what the dispatch wrote
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void WindParticles::draw(const QMatrix4x4& matrix, float radius)
+{
+    LIS_TRACE_ZONE("WindParticles::draw");
+
+    if (!m_drawProgram->bind())
+        throw std::runtime_error("failed to bind the particle program to active GL context");
+    m_drawProgram->setUniformValue("matrix", matrix);
+    m_drawProgram->setUniformValue("radius", radius * Lift);
+    m_drawProgram->setUniformValue("trail", m_params.trail);
+    m_drawProgram->setUniformValue("maxSpeed", m_params.maxSpeed);
+
+    // Faint streaks add up where they are dense; the globe hides the ones behind it
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glDepthMask(GL_FALSE);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_buffer);
+    m_vao->bind();
+    glDrawArrays(GL_LINES, 0, m_params.count * 2);
+    m_vao->release();
+
+    glDepthMask(GL_TRUE);
+    glBlendFunc(GL_ONE, GL_ZERO);
+    if (!blend)
+        glDisable(GL_BLEND);
+    m_drawProgram->release();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int WindParticles::count() const
+{
+    return m_params.count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t WindParticles::gpuMemory() const
+{
+    return static_cast<size_t>(m_params.count) * ParticleBytes;
+}
+} // namespace Lis
@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// file:	Lis/WindParticles.h
+//
+// summary:	Declares the wind tracers advected and drawn on the GPU
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "ProgramCache.h"
+
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QOpenGLExtraFunctions>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class QOpenGLShaderProgram;
+class QOpenGLVertexArrayObject;
+
+namespace Lis
+{
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct WindParticleParams
+{
+    int count = 1 << 20;            ///< the particles over the globe
+    float lifetime = 4.0f;          ///< mean, s of the world: a particle lives half to one and a half of it
+    float trail = 0.5f;             ///< the streak behind a particle, s of its motion
+    float maxSpeed = 40.0f;         ///< the wind of the brightest streaks, m/s
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// <summary>	Tracers of the wind over the globe, millions of them, that never leave the GPU.
+/// 			The particles live in a shader storage buffer: a compute shader moves each one
+/// 			along the wind it samples from the weather texture and respawns it at random
+/// 			when it expires, then the same buffer is drawn as streaks, two vertices a
+/// 			particle fetched by their index. Nothing is uploaded after the creation and
+/// 			nothing is read back.
+///
+/// 			The particles are on the unit sphere of the planet frame, in the texture
+/// 			coordinates of SphereMesh. Needs compute shaders: OpenGL 4.3 or ES 3.1.
+///
+/// 			Per frame: update() with the weather texture bound, then draw() per planet.
+/// </summary>
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class WindParticles : protected QOpenGLExtraFunctions
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	No OpenGL calls are made until initialize(). Throws
+    /// 			std::invalid_argument for a count a dispatch cannot cover.
+    /// </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    explicit WindParticles(const WindParticleParams& params = WindParticleParams());
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Must be destroyed with the context of initialize() current. </summary>
+    ////////////////////////////////////////////////////////////////////////////////
+    ~WindParticles();
+
+    WindParticles(const WindParticles&) = delete;
+    WindParticles& operator=(const WindParticles&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Build the programs and the buffer; the first update() scatters the
+    /// 			particles. Throws std::runtime_error without compute shaders.
+    /// </summary>
+    ///
+    /// <param name="compute">	The advection. </param>
+    /// <param name="shaders">	The streaks: a vertex and a fragment shader. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    void initialize(const ShaderFile& compute, const std::vector<ShaderFile>& shaders);
+    bool isInitialized() const;
+
+    const WindParticleParams& params() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Advect the particles. </summary>
+    ///
+    /// <param name="weatherUnit">	The unit the weather texture is bound to: RGBA16F,
+    /// 							the wind eastward and northward in blue and alpha, m/s. </param>
+    /// <param name="seconds">	  	Of the world since the last update. </param>
+    /// <param name="modelRate">  	The seconds of the model a second of the world. </param>
+    /// <param name="radius">	  	Of the planet, m. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    void update(int weatherUnit, float seconds, float modelRate, float radius);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// <summary>	Draw the streaks blended over the frame, behind the depth of the globe. </summary>
+    ///
+    /// <param name="matrix">	From the planet frame to the clip space. </param>
+    /// <param name="radius">	Of the planet in the frame. </param>
+    ////////////////////////////////////////////////////////////////////////////////
+    void draw(const QMatrix4x4& matrix, float radius);
+
+    int count() const;
+
+    /// <summary>	The bytes of the particle buffer. </summary>
+    size_t gpuMemory() const;
+
+private:
+    WindParticleParams m_params;
+    GLuint m_buffer = 0;
+    bool m_scattered = false;
+    uint32_t m_seed = 0;
+
+    std::unique_ptr<QOpenGLShaderProgram> m_computeProgram;
+    std::unique_ptr<QOpenGLShaderProgram> m_drawProgram;
+    std::unique_ptr<QOpenGLVertexArrayObject> m_vao;
+};
+} // namespace Lis
@@ -0,0 +1,10 @@
+#version 430
+
+uniform sampler2DArray bodies;      // a layer per kind of body, see Lis::BodyRenderer
+in vec3 texc;
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = texture(bodies, texc);
+}
@@ -0,0 +1,30 @@
+#version 430
+
+// The sphere mesh, as vertex.shader
+layout(location = 0) in vec2 octNormal;
+layout(location = 1) in vec2 texCoord;
+
+// Per instance, see Lis::BodyInstance
+layout(location = 2) in vec4 body;          // center, world space; radius
+layout(location = 3) in vec3 spinLayer;     // cos and sin of the spin; texture array layer
+
+uniform highp mat4 viewProjection;
+out vec3 texc;
+
+// Mirror of Lis::PackOctahedral (PackedFormats.h)
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void main()
+{
+    // Spin about the polar axis, as QMatrix4x4::rotate(angle, 0, 1, 0)
+    vec3 n = decodeOctahedral(octNormal);
+    vec3 turned = vec3(spinLayer.x * n.x + spinLayer.y * n.z, n.y, spinLayer.x * n.z - spinLayer.y * n.x);
+    gl_Position = viewProjection * vec4(body.xyz + turned * body.w, 1.0);
+    texc = vec3(texCoord, spinLayer.z);
+}
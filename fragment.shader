@@ -3,7 +3,16 @@
 uniform sampler2D texture;
 varying vec2 texc;
 
+// The weather overlay, see Lis::PlanetWindow::setWeather
+uniform sampler2D weather;          // RGBA16F: temperature, K; relative humidity; wind, m/s
+uniform float weatherOpacity;       // 0 without the simulation
+
 void main()
 {
-    gl_FragColor = texture2D(texture, texc);
+    vec4 color = texture2D(texture, texc);
+    vec2 state = texture2D(weather, texc).rg;
+    vec3 tint = mix(vec3(0.2, 0.4, 1.0), vec3(1.0, 0.35, 0.1), clamp((state.r - 240.0) / 60.0, 0.0, 1.0));
+    color.rgb = mix(color.rgb, tint, 0.2 * weatherOpacity);
+    color.rgb = mix(color.rgb, vec3(0.95), smoothstep(0.85, 1.0, state.g) * weatherOpacity);
+    gl_FragColor = color;
 }
@@ -0,0 +1,142 @@
+// FXAA for Lis::PostProcess, after Timothy Lottes, "FXAA 3.11" (NVIDIA 2011):
+// the direction of the edge through the pixel is found from the luma of its
+// neighbours, the ends of the edge are searched along it, and the pixel is
+// sampled across the edge by how close it is to the nearer end
+
+#version 330
+
+uniform sampler2D scene;        // the resolved colors, linear filtering
+uniform vec2 texelSize;
+in vec2 uv;
+out vec4 colorOut;
+
+const float EdgeThreshold = 0.125;      // the contrast of an edge, relative to the brightest
+const float EdgeThresholdMin = 0.0312;  // the darkest edge
+const float SubpixelQuality = 0.75;     // how much of the single-pixel detail is blurred
+
+const int SearchSteps = 10;
+const float StepSizes[SearchSteps] = float[](1.0, 1.0, 1.0, 1.0, 1.0, 1.5, 2.0, 2.0, 4.0, 8.0);
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+float lumaAt(vec2 position)
+{
+    return luma(texture(scene, position).rgb);
+}
+
+void main()
+{
+    vec3 colorCenter = texture(scene, uv).rgb;
+    float lumaCenter = luma(colorCenter);
+    float lumaDown = luma(textureOffset(scene, uv, ivec2(0, -1)).rgb);
+    float lumaUp = luma(textureOffset(scene, uv, ivec2(0, 1)).rgb);
+    float lumaLeft = luma(textureOffset(scene, uv, ivec2(-1, 0)).rgb);
+    float lumaRight = luma(textureOffset(scene, uv, ivec2(1, 0)).rgb);
+
+    // Flat pixels are left alone: most of the frame ends here
+    float lumaMin = min(lumaCenter, min(min(lumaDown, lumaUp), min(lumaLeft, lumaRight)));
+    float lumaMax = max(lumaCenter, max(max(lumaDown, lumaUp), max(lumaLeft, lumaRight)));
+    float lumaRange = lumaMax - lumaMin;
+    if (lumaRange < max(EdgeThresholdMin, lumaMax * EdgeThreshold))
+    {
+        colorOut = vec4(colorCenter, 1.0);
+        return;
+    }
+
+    float lumaDownLeft = luma(textureOffset(scene, uv, ivec2(-1, -1)).rgb);
+    float lumaUpRight = luma(textureOffset(scene, uv, ivec2(1, 1)).rgb);
+    float lumaUpLeft = luma(textureOffset(scene, uv, ivec2(-1, 1)).rgb);
+    float lumaDownRight = luma(textureOffset(scene, uv, ivec2(1, -1)).rgb);
+
+    float lumaDownUp = lumaDown + lumaUp;
+    float lumaLeftRight = lumaLeft + lumaRight;
+    float lumaLeftCorners = lumaDownLeft + lumaUpLeft;
+    float lumaDownCorners = lumaDownLeft + lumaDownRight;
+    float lumaRightCorners = lumaDownRight + lumaUpRight;
+    float lumaUpCorners = lumaUpRight + lumaUpLeft;
+
+    // The edge runs along the stronger of the two second derivatives
+    float edgeHorizontal = abs(-2.0 * lumaLeft + lumaLeftCorners) + abs(-2.0 * lumaCenter + lumaDownUp) * 2.0
+        + abs(-2.0 * lumaRight + lumaRightCorners);
+    float edgeVertical = abs(-2.0 * lumaUp + lumaUpCorners) + abs(-2.0 * lumaCenter + lumaLeftRight) * 2.0
+        + abs(-2.0 * lumaDown + lumaDownCorners);
+    bool isHorizontal = edgeHorizontal >= edgeVertical;
+
+    // Which side of the pixel the edge is on
+    float luma1 = isHorizontal ? lumaDown : lumaLeft;
+    float luma2 = isHorizontal ? lumaUp : lumaRight;
+    float gradient1 = luma1 - lumaCenter;
+    float gradient2 = luma2 - lumaCenter;
+    bool is1Steepest = abs(gradient1) >= abs(gradient2);
+    float gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+
+    float stepLength = isHorizontal ? texelSize.y : texelSize.x;
+    float lumaLocalAverage;
+    if (is1Steepest)
+    {
+        stepLength = -stepLength;
+        lumaLocalAverage = 0.5 * (luma1 + lumaCenter);
+    }
+    else
+    {
+        lumaLocalAverage = 0.5 * (luma2 + lumaCenter);
+    }
+
+    // Walk both ways along the edge, half a pixel toward it, until the luma leaves the edge
+    vec2 edgeUv = uv;
+    if (isHorizontal)
+        edgeUv.y += stepLength * 0.5;
+    else
+        edgeUv.x += stepLength * 0.5;
+    vec2 offset = isHorizontal ? vec2(texelSize.x, 0.0) : vec2(0.0, texelSize.y);
+    vec2 uv1 = edgeUv - offset * StepSizes[0];
+    vec2 uv2 = edgeUv + offset * StepSizes[0];
+    float lumaEnd1 = 0.0;
+    float lumaEnd2 = 0.0;
+    bool reached1 = false;
+    bool reached2 = false;
+    for (int i = 1; i < SearchSteps && !(reached1 && reached2); ++i)
+    {
+        if (!reached1)
+        {
+            lumaEnd1 = lumaAt(uv1) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+            if (!reached1)
+                uv1 -= offset * StepSizes[i];
+        }
+        if (!reached2)
+        {
+            lumaEnd2 = lumaAt(uv2) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+            if (!reached2)
+                uv2 += offset * StepSizes[i];
+        }
+    }
+
+    float distance1 = isHorizontal ? uv.x - uv1.x : uv.y - uv1.y;
+    float distance2 = isHorizontal ? uv2.x - uv.x : uv2.y - uv.y;
+    bool isDirection1 = distance1 < distance2;
+    float distanceFinal = min(distance1, distance2);
+    float edgeLength = distance1 + distance2;
+
+    // Only the end the luma varies toward, as the center, blends
+    bool isLumaCenterSmaller = lumaCenter < lumaLocalAverage;
+    bool correctVariation = ((isDirection1 ? lumaEnd1 : lumaEnd2) < 0.0) != isLumaCenterSmaller;
+    float pixelOffset = correctVariation ? 0.5 - distanceFinal / edgeLength : 0.0;
+
+    // The detail thinner than a pixel: by the contrast of the center with its 3x3 average
+    float lumaAverage = (1.0 / 12.0) * (2.0 * (lumaDownUp + lumaLeftRight) + lumaLeftCorners + lumaRightCorners);
+    float subpixel = clamp(abs(lumaAverage - lumaCenter) / lumaRange, 0.0, 1.0);
+    subpixel = (-2.0 * subpixel + 3.0) * subpixel * subpixel;
+    pixelOffset = max(pixelOffset, subpixel * subpixel * SubpixelQuality);
+
+    vec2 finalUv = uv;
+    if (isHorizontal)
+        finalUv.y += pixelOffset * stepLength;
+    else
+        finalUv.x += pixelOffset * stepLength;
+    colorOut = vec4(texture(scene, finalUv).rgb, 1.0);
+}
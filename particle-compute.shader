@@ -0,0 +1,78 @@
+// The advection of Lis::WindParticles: every particle moves along the wind it
+// samples from the weather texture and is respawned at random when it expires
+
+#version 430
+
+layout(local_size_x = 256) in;
+
+struct Particle
+{
+    vec4 position;      // xyz: on the unit sphere; w: the age, of the lifetime
+    vec4 velocity;      // xyz: on the unit sphere a second of the world; w: the wind, m/s
+};
+
+layout(std430, binding = 0) buffer Particles
+{
+    Particle particles[];
+};
+
+uniform sampler2D weather;  // RGBA16F: temperature, humidity, eastward and northward wind, m/s
+uniform uint count;
+uniform float dt;           // s of the world since the last update
+uniform float modelRate;    // s of the model a second of the world
+uniform float radius;       // of the planet, m
+uniform float lifetime;     // mean, s of the world
+uniform uint seed;          // changes every update
+uniform bool scatter;       // place every particle, at a random age
+
+const float Pi = 3.14159265;
+
+// PCG hash, Jarzynski and Olano, "Hash Functions for GPU Rendering" (JCGT 2020)
+uint hash(uint value)
+{
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state) * (1.0 / 4294967296.0);
+}
+
+vec3 randomDirection(inout uint state)
+{
+    // Uniform over the sphere: uniform in height and longitude
+    float y = 2.0 * random(state) - 1.0;
+    float longitude = 2.0 * Pi * random(state);
+    float r = sqrt(max(1.0 - y * y, 0.0));
+    return vec3(r * cos(longitude), y, -r * sin(longitude));
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= count)
+        return;
+
+    // Each particle has a lifetime of its own, so they do not expire together
+    Particle particle = particles[id];
+    float life = lifetime * (0.5 + float(hash(id)) * (1.0 / 4294967296.0));
+    uint state = hash(id ^ hash(seed));
+    if (scatter || particle.position.w >= 1.0)
+        particle.position = vec4(randomDirection(state), scatter ? random(state) : 0.0);
+
+    // The texture coordinates of Lis::SphereMesh: u east from the +x meridian, v north from the south pole
+    vec3 p = particle.position.xyz;
+    float longitude = atan(-p.z, p.x);
+    float latitude = asin(clamp(p.y, -1.0, 1.0));
+    vec2 wind = textureLod(weather, vec2(longitude / (2.0 * Pi), latitude / Pi + 0.5), 0.0).ba;
+    vec3 east = vec3(-sin(longitude), 0.0, -cos(longitude));
+    vec3 north = vec3(-sin(latitude) * cos(longitude), cos(latitude), sin(latitude) * sin(longitude));
+    vec3 velocity = (wind.x * east + wind.y * north) * (modelRate / radius);
+
+    particle.position = vec4(normalize(p + velocity * dt), particle.position.w + dt / life);
+    particle.velocity = vec4(velocity, length(wind));
+    particles[id] = particle;
+}
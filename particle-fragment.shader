@@ -0,0 +1,13 @@
+#version 430
+
+uniform float maxSpeed;     // m/s of the brightest streaks, see Lis::WindParticleParams
+in float fade;
+in float speed;
+out vec4 fragColor;
+
+void main()
+{
+    float strength = clamp(speed / maxSpeed, 0.0, 1.0);
+    vec3 color = mix(vec3(0.55, 0.75, 1.0), vec3(1.0, 0.95, 0.7), strength);
+    fragColor = vec4(color, fade * mix(0.25, 0.9, strength));
+}
@@ -0,0 +1,35 @@
+// The streaks of Lis::WindParticles, straight from the buffer of the advection:
+// two vertices a particle, where it is and where it was the trail before
+
+#version 430
+
+struct Particle
+{
+    vec4 position;      // xyz: on the unit sphere; w: the age, of the lifetime
+    vec4 velocity;      // xyz: on the unit sphere a second of the world; w: the wind, m/s
+};
+
+layout(std430, binding = 0) readonly buffer Particles
+{
+    Particle particles[];
+};
+
+uniform highp mat4 matrix;
+uniform float radius;
+uniform float trail;        // s of the world
+out float fade;
+out float speed;
+
+const float Pi = 3.14159265;
+
+void main()
+{
+    Particle particle = particles[gl_VertexID >> 1];
+    bool tail = (gl_VertexID & 1) == 1;
+    vec3 p = tail ? normalize(particle.position.xyz - particle.velocity.xyz * trail) : particle.position.xyz;
+
+    // Fades in and out over the life, and along the streak to the tail
+    fade = tail ? 0.0 : sin(Pi * clamp(particle.position.w, 0.0, 1.0));
+    speed = particle.velocity.w;
+    gl_Position = matrix * vec4(p * radius, 1.0);
+}
@@ -0,0 +1,13 @@
+// The fullscreen triangle of Lis::PostProcess: three vertices and no buffer,
+// the corners made of gl_VertexID; the triangle covers the viewport and
+// clips to it
+
+#version 330
+
+out vec2 uv;
+
+void main()
+{
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -2,21 +2,31 @@
 // (c) Jarmo Pietiläinen 2012
 // http://z0b.kapsi.fi
 // Public domain
+//
+// Adapted for Lis::PlanetWindow: the ray through the pixel is intersected
+// with the sphere, so the silhouette and the depth are exact under
+// perspective, and the texture is addressed as Lis::SphereMesh does
 
 #version 330
 
 uniform sampler2D tex;          // sphere texture
 uniform vec4 color;             // color (usually (1, 1, 1, 1))
-in vec2 texCoord;
+in vec3 viewPos;
+flat in vec4 planet;            // center (view space) and radius
 
+uniform mat4 projection;
 uniform mat4 rotation;          // sphere rotation matrix
-uniform vec4 lightPos;          // where the light is (assume sphere is at (0, 0, 0))
+uniform vec4 lightPos;          // direction to the light, view space
 uniform float minLight;         // minimum light level
 
+// The weather overlay, see Lis::PlanetWindow::setWeather
+uniform sampler2D weather;      // RGBA16F: temperature, K; relative humidity; wind, m/s
+uniform float weatherOpacity;   // 0 without the simulation
+
 out vec4 colorOut;              // pixel output
 
 #define PIP2    1.5707963       // PI/2
-#define PI      3.1415629
+#define PI      3.1415927
 #define TWOPI   6.2831853       // 2PI
 
 /*
@@ -25,48 +35,58 @@ to be enabled first:
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-*/
-
-#define WANT_AA
 
-/*
-Anti-aliasing "distance", ie. how thick the edge is. The bigger the
-final sphere is, the lower this should be. If this is too big, the
-output will be too crisp. Too low and you get too blurry edges.
-Adjust accordingly.
+The edge is about two pixels thick whatever the size of the sphere.
 */
 
-#define AA_MIN 0.985
+#define WANT_AA
 
 void main()
 {
-    // make us round
-    float d = texCoord.x * texCoord.x + texCoord.y * texCoord.y;
-
-    if (d > 1.0)
-        discard;
-
-    // we're in, compute the exact Z
-    float z = sqrt(1.0 - d);
+    // cast the ray from the eye through the pixel; d is 0 in the middle
+    // of the disc and 1 on the silhouette
+    vec3 ray = normalize(viewPos);
+    float along = dot(ray, planet.xyz);
+    vec3 miss = ray * along - planet.xyz;
+    float d = dot(miss, miss) / (planet.w * planet.w);
+
+    // the nearest intersection; the derivatives below need every pixel of
+    // the quad, so the misses are discarded at the end
+    vec3 hit = ray * (along - planet.w * sqrt(max(1.0 - d, 0.0)));
+    vec3 normal = (hit - planet.xyz) / planet.w;
 
     // get light intensity
-    vec4 point = vec4(texCoord.xy, z, 1.0);
-
-    float l = clamp(dot(point, lightPos), minLight, 1.0);
+    float l = clamp(dot(normal, lightPos.xyz), minLight, 1.0);
 
-    // rotate
-    point *= rotation;
+    // rotate into the frame of the planet
+    vec3 point = (vec4(normal, 0.0) * rotation).xyz;
 
-    // get texture coordinates (I believe this could be replaced with a
-    // precomputed texture lookup, if you need more performance)
-    float x = (atan(point.x, point.z) + PI) / TWOPI,
-          y = (asin(point.y) + PIP2) / PI;
+    // u grows eastward from +X, v from the south pole. The derivatives of u
+    // jump at the seam and would select the smallest mip level there: use
+    // whichever of u and u shifted by a half turn is continuous in the quad
+    float u = atan(-point.z, point.x) / TWOPI;
+    float seamless = fract(u + 0.5) - 0.5;
+    u = fract(u);
+    u = fwidth(u) <= fwidth(seamless) ? u : seamless;
+    vec2 uv = vec2(u, asin(clamp(point.y, -1.0, 1.0)) / PI + 0.5);
 
     // get texel, shade, colorize and output it
-    vec4 texel = texture2D(tex, vec2(x, y)) * vec4(l, l, l, 1.0) * color;
+    vec4 texel = texture(tex, uv);
+    vec2 state = texture(weather, uv).rg;
+    vec3 tint = mix(vec3(0.2, 0.4, 1.0), vec3(1.0, 0.35, 0.1), clamp((state.r - 240.0) / 60.0, 0.0, 1.0));
+    texel.rgb = mix(texel.rgb, tint, 0.2 * weatherOpacity);
+    texel.rgb = mix(texel.rgb, vec3(0.95), smoothstep(0.85, 1.0, state.g) * weatherOpacity);
+    texel *= vec4(l, l, l, 1.0) * color;
+
+    float edge = 2.0 * fwidth(d);
+    if (d > 1.0)
+        discard;
+
+    vec4 clip = projection * vec4(hit, 1.0);
+    gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
 #ifndef WANT_AA
     colorOut = texel;
 #else
-    colorOut = texel * (1.0 - smoothstep(AA_MIN, 1.0, d));
+    colorOut = texel * (1.0 - smoothstep(1.0 - edge, 1.0, d));
 #endif
 }
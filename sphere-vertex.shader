@@ -2,15 +2,31 @@
 // (c) Jarmo Pietiläinen 2012
 // http://z0b.kapsi.fi
 // Public domain
+//
+// Adapted for Lis::PlanetWindow: the quad is a billboard facing the eye,
+// sized to cover the silhouette exactly under perspective, one per planet
 
 #version 330
 
-uniform mat4 mvp;       // modelviewproject matrix (most likely ortho)
-in vec4 vertex;         // XYST
-out vec2 texCoord;
+uniform mat4 projection;
+in vec2 corner;         // -1..1
+in vec4 sphere;         // center (view space) and radius
+out vec3 viewPos;       // the point of the quad, view space
+flat out vec4 planet;
 
 void main()
 {
-    gl_Position = mvp * vec4(vertex.xy, 0.0, 1.0);
-    texCoord = vertex.zw;
+    float distance = length(sphere.xyz);
+    vec3 forward = sphere.xyz / distance;
+    vec3 up = abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right = normalize(cross(up, forward));
+    up = cross(forward, right);
+
+    // The cone of the rays touching the sphere cuts the plane through its
+    // center in a circle of this radius
+    float size = sphere.w * distance / sqrt(max(distance * distance - sphere.w * sphere.w, 1e-6));
+
+    viewPos = sphere.xyz + (corner.x * right + corner.y * up) * size;
+    planet = sphere;
+    gl_Position = projection * vec4(viewPos, 1.0);
 }
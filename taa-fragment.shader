@@ -0,0 +1,56 @@
+// Temporal anti-aliasing for Lis::PostProcess, after Brian Karis, "High
+// Quality Temporal Supersampling" (SIGGRAPH 2014): every frame is jittered
+// by a sub-pixel and blended into the history, found again where the pixel
+// was the frame before and clamped to the colors around it
+
+#version 330
+
+uniform sampler2D scene;        // this frame, jittered
+uniform sampler2D depth;        // of this frame
+uniform sampler2D history;      // the previous output, linear filtering
+uniform mat4 reprojection;      // clip space of this frame to the previous one, without the jitter
+uniform vec2 jitter;            // the offset of this frame, NDC
+uniform float blend;            // the weight of this frame, 1 drops the history
+in vec2 uv;
+out vec4 colorOut;
+
+// The spread of the neighbourhood the history may take, in standard deviations
+const float ClampSigma = 1.25;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 last = textureSize(scene, 0) - 1;
+    vec3 current = texelFetch(scene, pixel, 0).rgb;
+
+    // The mean and the deviation of the 3x3 colors bound the history
+    vec3 mean = vec3(0.0);
+    vec3 meanSquares = vec3(0.0);
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            vec3 color = texelFetch(scene, clamp(pixel + ivec2(x, y), ivec2(0), last), 0).rgb;
+            mean += color;
+            meanSquares += color * color;
+        }
+    }
+    mean /= 9.0;
+    vec3 sigma = sqrt(max(meanSquares / 9.0 - mean * mean, 0.0));
+    vec3 low = mean - ClampSigma * sigma;
+    vec3 high = mean + ClampSigma * sigma;
+
+    // The point the pixel shows, without the jitter, then where it was
+    float z = texelFetch(depth, pixel, 0).r;
+    vec4 point = vec4(uv * 2.0 - 1.0 - jitter, z * 2.0 - 1.0, 1.0);
+    vec4 previous = reprojection * point;
+    vec2 previousUv = previous.xy / max(previous.w, 1e-6) * 0.5 + 0.5;
+
+    // Off the previous frame the history has nothing to give
+    float weight = blend;
+    if (previous.w <= 0.0 || any(lessThan(previousUv, vec2(0.0))) || any(greaterThan(previousUv, vec2(1.0))))
+        weight = 1.0;
+
+    vec3 past = clamp(texture(history, previousUv).rgb, low, high);
+    colorOut = vec4(mix(past, current, weight), 1.0);
+}
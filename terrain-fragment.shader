@@ -0,0 +1,40 @@
+#version 430
+
+uniform sampler2D tex;              // the planet imagery
+uniform vec3 light;                 // direction to the light, planet frame
+uniform float minLight;             // the ambient level
+
+// The weather overlay, see Lis::PlanetWindow::setWeather
+uniform sampler2D weather;          // RGBA16F: temperature, K; relative humidity; wind, m/s
+uniform float weatherOpacity;       // 0 without the simulation
+
+in vec3 point;
+in vec3 normal;
+out vec4 fragColor;
+
+#define PI      3.1415927
+#define TWOPI   6.2831853
+
+void main()
+{
+    // Addressed as Lis::SphereMesh per pixel, so the patches need no seam: u
+    // grows eastward from +X, v from the south pole. The derivatives of u jump
+    // at the meridian; whichever of u and u shifted by a half turn is
+    // continuous selects the mip level
+    vec3 direction = normalize(point);
+    float u = atan(-direction.z, direction.x) / TWOPI;
+    float seamless = fract(u + 0.5) - 0.5;
+    u = fract(u);
+    u = fwidth(u) <= fwidth(seamless) ? u : seamless;
+    vec2 uv = vec2(u, asin(clamp(direction.y, -1.0, 1.0)) / PI + 0.5);
+
+    vec4 color = texture(tex, uv);
+    vec2 state = texture(weather, uv).rg;
+    vec3 tint = mix(vec3(0.2, 0.4, 1.0), vec3(1.0, 0.35, 0.1), clamp((state.r - 240.0) / 60.0, 0.0, 1.0));
+    color.rgb = mix(color.rgb, tint, 0.2 * weatherOpacity);
+    color.rgb = mix(color.rgb, vec3(0.95), smoothstep(0.85, 1.0, state.g) * weatherOpacity);
+
+    // The relief shows by its shading only
+    float l = clamp(dot(normalize(normal), light), minLight, 1.0);
+    fragColor = vec4(color.rgb * l, color.a);
+}
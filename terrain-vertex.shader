@@ -0,0 +1,25 @@
+#version 430
+
+// See Lis::TerrainVertex
+layout(location = 0) in vec3 position;      // planet frame, radius 1
+layout(location = 1) in vec2 octNormal;
+
+uniform highp mat4 matrix;                  // planet frame to clip space
+out vec3 point;
+out vec3 normal;
+
+// Mirror of Lis::PackOctahedral (PackedFormats.h)
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void main()
+{
+    point = position;
+    normal = decodeOctahedral(octNormal);
+    gl_Position = matrix * vec4(position, 1.0);
+}
@@ -1,12 +1,24 @@
 #version 430
 
-layout(location = 0) in vec3 vertexPosition;
+layout(location = 0) in vec2 octNormal;
 layout(location = 1) in vec2 texCoord;
 uniform highp mat4 matrix;
+uniform float radius;
 out vec2 texc;
 
+// Mirror of Lis::PackOctahedral (PackedFormats.h)
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
 void main()
 {
-    gl_Position = matrix * vec4(vertexPosition, 1.0);
+    // The vertex of a unit sphere is its own normal
+    vec3 normal = decodeOctahedral(octNormal);
+    gl_Position = matrix * vec4(normal * radius, 1.0);
     texc = texCoord;
 }
@@ -0,0 +1,25 @@
+#version 430
+
+// Writes the tile each pixel needs, read back by Lis::VirtualTexture:
+// r, g - low 8 bits of the tile x, y; b - their high 4 bits; a - level + 1
+uniform vec2 virtualSize;           // source image size, pixels
+uniform float tileSize;             // tile size, pixels
+uniform float maxLevel;
+uniform float feedbackBias;         // log2 of how much smaller the feedback target is
+in vec2 texc;
+out vec4 fragColor;
+
+void main()
+{
+    // Same selection as vt-fragment.shader at the full resolution
+    vec2 pixel = texc * virtualSize;
+    vec2 dx = dFdx(pixel), dy = dFdy(pixel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0)) - feedbackBias;
+    int level = int(clamp(floor(lod), 0.0, maxLevel));
+    pixel = clamp(pixel, vec2(0.0), virtualSize - 0.5);
+
+    uvec2 tile = uvec2(pixel / (tileSize * exp2(float(level))));
+    uvec2 low = tile & 255u;
+    uvec2 high = (tile >> 8) & 15u;
+    fragColor = vec4(vec2(low), float(high.x | (high.y << 4)), float(level + 1)) / 255.0;
+}
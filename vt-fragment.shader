@@ -0,0 +1,46 @@
+#version 430
+
+// Sampling through the virtual texture, see Lis::VirtualTexture
+uniform sampler2D pageTable;        // RGBA8 per tile: cache slot x, y, resident level, valid
+uniform sampler2D physicalCache;    // the resident tiles
+uniform vec2 virtualSize;           // source image size, pixels
+uniform float tileSize;             // tile size, pixels
+uniform vec2 cacheSize;             // physical cache size, pixels
+uniform float maxLevel;
+in vec2 texc;
+out vec4 fragColor;
+
+// The weather overlay, see Lis::PlanetWindow::setWeather
+uniform sampler2D weather;          // RGBA16F: temperature, K; relative humidity; wind, m/s
+uniform float weatherOpacity;       // 0 without the simulation
+
+void main()
+{
+    // The level a full mip chain would sample (no anisotropy, no blending of levels)
+    vec2 pixel = texc * virtualSize;
+    vec2 dx = dFdx(pixel), dy = dFdy(pixel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+    int level = int(min(floor(lod), maxLevel));
+
+    // u = 1 and v = 1 would fall into the next tile
+    pixel = clamp(pixel, vec2(0.0), virtualSize - 0.5);
+    ivec2 tile = ivec2(pixel / (tileSize * exp2(float(level))));
+    vec4 entry = texelFetch(pageTable, tile, level) * 255.0;
+    if (entry.a == 0.0)
+    {
+        // Nothing is loaded yet, not even the coarsest level
+        fragColor = vec4(0.1, 0.1, 0.1, 1.0);
+        return;
+    }
+
+    // The entry may point to an ancestor: locate the pixel in that tile. The tiles
+    // have no border, so the filtering is clamped half a texel inside the tile.
+    vec2 inTile = fract(pixel / (tileSize * exp2(entry.b))) * tileSize;
+    inTile = clamp(inTile, vec2(0.5), vec2(tileSize - 0.5));
+    vec4 color = textureLod(physicalCache, (entry.xy * tileSize + inTile) / cacheSize, 0.0);
+    vec2 state = textureLod(weather, texc, 0.0).rg;
+    vec3 tint = mix(vec3(0.2, 0.4, 1.0), vec3(1.0, 0.35, 0.1), clamp((state.r - 240.0) / 60.0, 0.0, 1.0));
+    color.rgb = mix(color.rgb, tint, 0.2 * weatherOpacity);
+    color.rgb = mix(color.rgb, vec3(0.95), smoothstep(0.85, 1.0, state.g) * weatherOpacity);
+    fragColor = color;
+}